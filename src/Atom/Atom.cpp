@@ -4,6 +4,7 @@
 #include "Include.h"
 #include "Atom.h"
 #include "Basis/BasisGenerator.h"
+#include "Universal/Communicator.h"
 #include "Universal/ExpLattice.h"
 #include "MBPT/BruecknerDecorator.h"
 #include "HartreeFock/HartreeFocker.h"
@@ -74,7 +75,7 @@ pCore Atom::MakeBasis(pCoreConst hf_open_core_start)
     }
 
 #ifdef AMBIT_USE_MPI
-    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Barrier(ProcessGroup.Comm());
     ReadBasis();
 #endif
 
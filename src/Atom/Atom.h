@@ -8,6 +8,7 @@
 #include "Universal/PhysicalConstant.h"
 #include "Configuration/LevelMap.h"
 #include "HartreeFock/NucleusDecorator.h"
+#include "HartreeFock/ContinuumBuilder.h"
 #include "MBPT/Sigma3Calculator.h"
 
 namespace Ambit
@@ -79,9 +80,16 @@ public:
     void CheckMatrixSizes(pAngularDataLibrary angular_lib = nullptr);
 
     /** Get levels to be calculated, so the client can request one be done at a time.
+        Stored levels are read unless --clean is set (and always_read is false).
         PRE: MakeBasis() must have been run.
      */
-    pLevelStore ChooseHamiltoniansAndRead(pAngularDataLibrary angular_lib = nullptr);
+    pLevelStore ChooseHamiltoniansAndRead(pAngularDataLibrary angular_lib = nullptr, bool always_read = false);
+
+    /** Recover results of MakeMBPTIntegrals() and CalculateEnergies() that were calculated by another group of
+        processes: Brueckner orbitals (from stored sigmas) and levels are read from file.
+        PRE: MakeBasis() must have been run.
+     */
+    pLevelStore ReadResults(pAngularDataLibrary angular_lib = nullptr);
 
     /** Calculate levels for all chosen symmetries in user input.
         PRE: ChooseHamiltoniansAndRead() must have been run.
@@ -94,6 +102,27 @@ public:
     */
     LevelVector CalculateEnergies(pHamiltonianID hID);
 
+    /** Calculate levels for all keys. If CI/--parallel-symmetries is set (and not CI/--scalapack), the
+        Hamiltonians of different symmetries are generated and solved at the same time on separate groups of
+        processes (see CalculateEnergiesConcurrently()); otherwise CalculateEnergies(hID) is called for each key.
+        PRE: ChooseHamiltoniansAndRead() must have been run.
+     */
+    void CalculateEnergies(const std::vector<pHamiltonianID>& keys);
+
+    /** The steps of CalculateEnergies(hID), so that a client can generate several Hamiltonians together
+        (see HamiltonianMatrix::GenerateMatrices()):
+            PrepareCI()         get stored levels and configurations into levelvec; return true if CI is needed
+                                to find num_solutions levels,
+            MakeHamiltonian()   make (but don't generate) the Hamiltonian matrix, making integrals if required,
+            SolveHamiltonian()  solve generated matrix H and store the levels,
+            FinishLevels()      calculate g-factors and print levels.
+        PRE: ChooseHamiltoniansAndRead() must have been run.
+     */
+    bool PrepareCI(pHamiltonianID hID, LevelVector& levelvec, unsigned int& num_solutions);
+    std::unique_ptr<HamiltonianMatrix> MakeHamiltonian(pRelativisticConfigList configs);
+    void SolveHamiltonian(pHamiltonianID hID, HamiltonianMatrix& H, LevelVector& levelvec, unsigned int num_solutions);
+    void FinishLevels(pHamiltonianID hID, LevelVector& levelvec);
+
     pLevelStore GetLevels() { return levels; }
     pAngularDataLibrary GetAngularDataLibrary() { return angular_library; }
 
@@ -133,6 +162,20 @@ protected:
      */
     LevelVector SingleElectronConfigurations(pHamiltonianID sym);
 
+    /** Calculate levels for all keys with the Hamiltonians of different symmetries generated and solved at the
+        same time on separate groups of processes (CI/--parallel-symmetries). Symmetries are packed onto groups
+        largest first with cost estimated from NumCSFs (see PackTasks()); solutions are then shared so that
+        every process has all levels. Output of each group is collected and printed in order of keys.
+        PRE: ChooseHamiltoniansAndRead() must have been run.
+     */
+    void CalculateEnergiesConcurrently(const std::vector<pHamiltonianID>& keys);
+
+    /** Estimate memory and time needed to generate and solve the CI matrix of each symmetry with the current
+        processes and threads, and recommend CI/ChunkSize and numbers of processes and threads
+        (part of CheckMatrixSizes()).
+     */
+    void EstimateResources(const std::vector<Symmetry>& symmetries, const std::vector<pRelativisticConfigList>& configs);
+
     /** Attempt to read basis from file and generate HF operator.
         Return true if successful, false if file "identifier.basis" not found.
      */
@@ -143,6 +186,13 @@ protected:
      */
     void GenerateBruecknerOrbitals(bool generate_sigmas);
 
+    /** Create a ContinuumBuilder for the open-shell HF operator. If user_input(residue_key) is set,
+        the continuum is instead built in the field of that residue core configuration.
+        With DR/--cache-continuum the waves are also stored in (and read from) a file, see
+        ContinuumBuilder::SetCacheFile().
+     */
+    pContinuumBuilder MakeContinuumBuilder(const std::string& residue_key);
+
 public:
     void GenerateCowanInputFile();
     void PrintWavefunctionCowan(FILE* fp, pOrbitalConst ds);
@@ -167,6 +217,7 @@ protected:
     pHFIntegrals hf_electron;                       //!< One-body Hamiltonian operator
     pTwoElectronCoulombOperator twobody_electron;   //!< Two-body Hamiltonian operator
     pSigma3Calculator threebody_electron;           //!< Three-body Hamiltonian operator
+    unsigned int num_coulomb_integrals = 0;         //!< Number of CI Coulomb integrals (for CheckMatrixSizes())
 
     pConfigList leading_configs;
     pRelativisticConfigList allconfigs;
@@ -357,22 +357,65 @@ void Atom::Autoionization(const LevelVector& target)
         gen.GenerateProjections(ptarget_config, target_symmetry, two_m, angular_library);
     }
 
-    // Create operator for construction of continuum field
-    pHFOperator hf_continuum;
-    std::string config = user_input("DR/ContinuumResidue", "");
-    if(config == "")
-        hf_continuum = hf_open;
-    else
-    {   hf_continuum = hf_open->Clone();
-        pCore continuum_core(new Core(lattice, config));
-        for(auto& orbital: *continuum_core)
+    // Continuum waves are built in the field of the residue
+    pContinuumBuilder continuum_builder = MakeContinuumBuilder("DR/ContinuumResidue");
+
+    // Allowed continuum kappas for compound symmetry sym
+    auto get_eps_kappas = [&](const Symmetry& sym)
+    {
+        std::vector<int> eps_kappas;
+        Parity eps_parity = sym.GetParity() * target_symmetry.GetParity();
+
+        // Minimum L and Parity -> Minimum J
+        int min_eps_twoJ;
+        if(eps_parity == (min_continuum_l%2? Parity::odd: Parity::even))
+            min_eps_twoJ = mmax(2 * min_continuum_l - 1, 1);
+        else
+            min_eps_twoJ = 2 * min_continuum_l + 1;
+
+        // continuum J should not be less than (sym.J - target.J)
+        min_eps_twoJ = mmax(min_eps_twoJ, abs(sym.GetTwoJ() - target_symmetry.GetTwoJ()));
+
+        // Maximum L and Parity -> Maximum J
+        int max_eps_twoJ;
+        if(eps_parity == (max_continuum_l%2? Parity::odd: Parity::even))
+            max_eps_twoJ = 2 * max_continuum_l + 1;
+        else
+            max_eps_twoJ = 2 * max_continuum_l - 1;
+
+        // continuum J should not exceed sym.J + target.J
+        max_eps_twoJ = mmin(max_eps_twoJ, sym.GetTwoJ() + target_symmetry.GetTwoJ());
+
+        for(int eps_twoJ = min_eps_twoJ; eps_twoJ <= max_eps_twoJ; eps_twoJ += 2)
         {
-            pOrbital basis_state = orbitals->all->GetState(orbital.first);
-            continuum_core->AddState(basis_state);
+            // Kappa = (-1)^(j+1/2 + l) (j + 1/2) = (-1)^(j+1/2).P.(j+1/2)
+            int eps_kappa = (eps_twoJ + 1)/2;
+            eps_kappa = math->minus_one_to_the_power(eps_kappa) * Sign(eps_parity) * eps_kappa;
+            eps_kappas.push_back(eps_kappa);
         }
 
-        hf_continuum->SetCore(continuum_core);
+        return eps_kappas;
+    };
+
+    // All (energy, partial wave) points are independent: request them all and solve together
+    for(auto& key: levels->keys)
+    {
+        std::vector<int> eps_kappas = get_eps_kappas(key->GetSymmetry());
+        auto levelvec = levels->GetLevels(key);
+
+        for(auto& level: levelvec.levels)
+        {
+            double eps_energy = level->GetEnergy() - ionization_energy;
+            if(eps_energy <= 0.)
+                continue;
+            else if(energy_limit > 0.0 && (eps_energy > energy_limit))
+                break;
+
+            for(int eps_kappa: eps_kappas)
+                continuum_builder->Request(eps_kappa, eps_energy);
+        }
     }
+    continuum_builder->CalculatePending();
 
     *outstream << "\nAutoionization rates:"
                << "\n E(eV)   A(ns)   J   P   LevelID" << std::endl;
@@ -408,60 +451,35 @@ void Atom::Autoionization(const LevelVector& target)
                 break;
 
             double rate = 0.0;
+            std::vector<int> eps_kappas = get_eps_kappas(sym);
 
-            // Get continuum wave (eps)
-            Parity eps_parity = sym.GetParity() * target_symmetry.GetParity();
+            // Get all partial waves of the continuum (eps) at this energy
+            pOrbitalMap continuum_map(new OrbitalMap(lattice));
+            pOrbitalManager all_orbitals(new OrbitalManager(*orbitals));
+            for(int eps_kappa: eps_kappas)
+            {
+                pContinuumWave eps = continuum_builder->GetContinuumWave(eps_kappa, eps_energy);
+                continuum_map->AddState(eps);
+                all_orbitals->all->AddState(eps);
+            }
 
-            // Minimum L and Parity -> Minimum J
-            int min_eps_twoJ;
-            if(eps_parity == (min_continuum_l%2? Parity::odd: Parity::even))
-                min_eps_twoJ = mmax(2 * min_continuum_l - 1, 1);
-            else
-                min_eps_twoJ = 2 * min_continuum_l + 1;
+            // Create one- and two-body integrals for all partial waves at once
+            all_orbitals->MakeStateIndexes();
+            pHFIntegrals one_body_integrals(new HFIntegrals(all_orbitals, hf));
+            pSlaterIntegrals two_body_integrals(new SlaterIntegralsFlatHash(all_orbitals, hartreeY));
+            one_body_integrals->clear();
+            one_body_integrals->CalculateOneElectronIntegrals(continuum_map, valence);
+            two_body_integrals->clear();
+            two_body_integrals->CalculateTwoElectronIntegrals(continuum_map, target_map, valence, valence);
 
-            // continuum J should not be less than (sym.J - target.J)
-            min_eps_twoJ = mmax(min_eps_twoJ, abs(sym.GetTwoJ() - target_symmetry.GetTwoJ()));
+            // Create operator for autoionization
+            pTwoElectronCoulombOperator two_body_operator = std::make_shared<TwoElectronCoulombOperator>(two_body_integrals);
+            ManyBodyOperator<pHFIntegrals, pTwoElectronCoulombOperator> H(one_body_integrals, two_body_operator);
 
-            // Maximum L and Parity -> Maximum J
-            int max_eps_twoJ;
-            if(eps_parity == (max_continuum_l%2? Parity::odd: Parity::even))
-                max_eps_twoJ = 2 * max_continuum_l + 1;
-            else
-                max_eps_twoJ = 2 * max_continuum_l - 1;
-
-            // continuum J should not exceed sym.J + target.J
-            max_eps_twoJ = mmin(max_eps_twoJ, sym.GetTwoJ() + target_symmetry.GetTwoJ());
-
-            for(int eps_twoJ = min_eps_twoJ; eps_twoJ <= max_eps_twoJ; eps_twoJ += 2)
+            for(int eps_kappa: eps_kappas)
             {
                 double partial = 0.0;
-
-                // Kappa = (-1)^(j+1/2 + l) (j + 1/2) = (-1)^(j+1/2).P.(j+1/2)
-                int eps_kappa = (eps_twoJ + 1)/2;
-                eps_kappa = math->minus_one_to_the_power(eps_kappa) * Sign(eps_parity) * eps_kappa;
-
-                pODESolver ode_solver(new AdamsSolver(hf->GetIntegrator()));
-                HartreeFocker HF_Solver(ode_solver);
-                pContinuumWave eps(new ContinuumWave(eps_kappa, 100, eps_energy));
-                HF_Solver.CalculateContinuumWave(eps, hf_continuum);
-
-                // Create two-body integrals
-                pOrbitalMap continuum_map(new OrbitalMap(lattice));
-                continuum_map->AddState(eps);
-
-                pOrbitalManager all_orbitals(new OrbitalManager(*orbitals));
-                all_orbitals->all->AddState(eps);
-                all_orbitals->MakeStateIndexes();
-                pHFIntegrals one_body_integrals(new HFIntegrals(all_orbitals, hf));
-                pSlaterIntegrals two_body_integrals(new SlaterIntegralsFlatHash(all_orbitals, hartreeY));
-                one_body_integrals->clear();
-                one_body_integrals->CalculateOneElectronIntegrals(continuum_map, valence);
-                two_body_integrals->clear();
-                two_body_integrals->CalculateTwoElectronIntegrals(continuum_map, target_map, valence, valence);
-
-                // Create operator for autoionization
-                pTwoElectronCoulombOperator two_body_operator = std::make_shared<TwoElectronCoulombOperator>(two_body_integrals);
-                ManyBodyOperator<pHFIntegrals, pTwoElectronCoulombOperator> H(one_body_integrals, two_body_operator);
+                int eps_twoJ = 2 * abs(eps_kappa) - 1;
 
                 // Couple target and epsilon; start with maximum target M
                 auto target_config_it = target_configs.begin();
@@ -539,50 +557,45 @@ void Atom::AutoionizationEnergyGrid(const LevelVector& target)
     Symmetry target_symmetry(target.hID->GetSymmetry());
     LevelVector target_levelvector(target);
 
-    // Create operator for construction of continuum field
-    pHFOperator hf_continuum;
-    std::string config = user_input("DR/ContinuumResidue", "");
-    if(config == "")
-        hf_continuum = hf_open;
-    else
-    {   hf_continuum = hf_open->Clone();
-        pCore continuum_core(new Core(lattice, config));
-        for(auto& orbital: *continuum_core)
-        {
-            pOrbital basis_state = orbitals->all->GetState(orbital.first);
-            continuum_core->AddState(basis_state);
-        }
-
-        hf_continuum->SetCore(continuum_core);
-    }
+    // Continuum waves are built in the field of the residue
+    pContinuumBuilder continuum_builder = MakeContinuumBuilder("DR/ContinuumResidue");
 
     // Create continuum waves
     pOrbitalManager all_orbitals(new OrbitalManager(*orbitals));
     pOrbitalMap continuum_map(new OrbitalMap(lattice));
-    pODESolver ode_solver(new AdamsSolver(hf->GetIntegrator()));
-    HartreeFocker HF_Solver(ode_solver);
 
     int pqn_offset = 100;
     if(energy_limit > 0.0 && energy_limit < grid_max)
         grid_max = energy_limit;
     energy_grid.reserve((grid_max - grid_min)/grid_step + 1);
 
-    int pqn = pqn_offset;
     for(double eps_energy = grid_min; eps_energy <= grid_max; eps_energy += grid_step)
+        energy_grid.push_back(eps_energy);
+
+    // All (energy, partial wave) grid points are independent: solve them together
+    for(double eps_energy: energy_grid)
     {
         for(int eps_l = min_continuum_l; eps_l <= max_continuum_l; eps_l++)
         {
             for(int eps_kappa = -eps_l -1; eps_kappa <= eps_l; eps_kappa += 2 * mmax(eps_l, 1) + 1)
-            {
-                pContinuumWave eps(new ContinuumWave(eps_kappa, pqn, eps_energy));
-                HF_Solver.CalculateContinuumWave(eps, hf_continuum);
+                continuum_builder->Request(eps_kappa, eps_energy);
+        }
+    }
+    continuum_builder->CalculatePending();
 
+    int pqn = pqn_offset;
+    for(double eps_energy: energy_grid)
+    {
+        for(int eps_l = min_continuum_l; eps_l <= max_continuum_l; eps_l++)
+        {
+            for(int eps_kappa = -eps_l -1; eps_kappa <= eps_l; eps_kappa += 2 * mmax(eps_l, 1) + 1)
+            {
+                pContinuumWave eps = continuum_builder->GetContinuumWave(eps_kappa, eps_energy, pqn);
                 continuum_map->AddState(eps);
                 all_orbitals->all->AddState(eps);
             }
         }
 
-        energy_grid.push_back(eps_energy);
         pqn++;
     }
 
@@ -794,26 +807,9 @@ void Atom::AutoionizationConfigurationAveraged(const OccupationMap& target)
     // Add holes from compound states
     target_map->AddStates(*orbitals->hole);
 
-    // Create operator for construction of continuum field
-    pHFOperator hf_continuum;
-    std::string config = user_input("DR/ContinuumResidue", "");
-    if(config == "")
-        hf_continuum = hf_open;
-    else
-    {   hf_continuum = hf_open->Clone();
-        pCore continuum_core(new Core(lattice, config));
-        for(auto& orbital: *continuum_core)
-        {
-            pOrbital basis_state = orbitals->all->GetState(orbital.first);
-            continuum_core->AddState(basis_state);
-        }
-
-        hf_continuum->SetCore(continuum_core);
-    }
-
-    // HF solver for making continuum
-    pODESolver ode_solver(new AdamsSolver(hf->GetIntegrator()));
-    HartreeFocker HF_Solver(ode_solver);
+    // Continuum waves are built in the field of the residue. Many configurations share the
+    // same continuum energy and partial wave, so these are only calculated once.
+    pContinuumBuilder continuum_builder = MakeContinuumBuilder("DR/ContinuumResidue");
 
     // Get target including core for occupancy
     OccupationMap target_with_core;
@@ -922,8 +918,7 @@ void Atom::AutoionizationConfigurationAveraged(const OccupationMap& target)
                 eps_kappa = math->minus_one_to_the_power(eps_kappa) * Sign(eps_parity) * eps_kappa;
 
                 OrbitalInfo eps_info(100, eps_kappa);
-                pContinuumWave eps(new ContinuumWave(eps_kappa, 100, eps_energy_calculated));
-                HF_Solver.CalculateContinuumWave(eps, hf_continuum);
+                pContinuumWave eps = continuum_builder->GetContinuumWave(eps_kappa, eps_energy_calculated);
 
                 // Create two-body integrals
                 pOrbitalMap continuum_map(new OrbitalMap(lattice));
@@ -992,4 +987,30 @@ void Atom::AutoionizationConfigurationAveraged(const OccupationMap& target)
         }
     }
 }
+
+pContinuumBuilder Atom::MakeContinuumBuilder(const std::string& residue_key)
+{
+    // Create operator for construction of continuum field
+    pHFOperator hf_continuum;
+    std::string config = user_input(residue_key.c_str(), "");
+    if(config == "")
+        hf_continuum = hf_open;
+    else
+    {   hf_continuum = hf_open->Clone();
+        pCore continuum_core(new Core(lattice, config));
+        for(auto& orbital: *continuum_core)
+        {
+            pOrbital basis_state = orbitals->all->GetState(orbital.first);
+            continuum_core->AddState(basis_state);
+        }
+
+        hf_continuum->SetCore(continuum_core);
+    }
+
+    pContinuumBuilder builder = std::make_shared<ContinuumBuilder>(hf_continuum);
+    if(user_input.search("DR/--cache-continuum"))
+        builder->SetCacheFile(identifier);
+
+    return builder;
+}
 }
@@ -8,7 +8,9 @@
 
 #include "Include.h"
 #include "Atom.h"
+#include "Universal/Communicator.h"
 #include "Universal/Enums.h"
+#include "Universal/Profiler.h"
 #include "HartreeFock/NonRelInfo.h"
 #include "Configuration/ConfigGenerator.h"
 #include "Configuration/HamiltonianMatrix.h"
@@ -18,11 +20,23 @@
 #include "MBPT/BruecknerDecorator.h"
 #include "HartreeFock/HartreeFocker.h"
 #include "HamiltonianTypes.h"
+#include <numeric>
+#include <sstream>
 
 namespace Ambit
 {
+namespace
+{
+    /** Approximate storage of radial integrals: key-value pairs of about 16 bytes. */
+    double IntegralStorageMB(double num_integrals)
+    {
+        return num_integrals * 16./(1024. * 1024.);
+    }
+}
+
 void Atom::MakeMBPTIntegrals()
 {
+    ProfileTimer timer("MBPT integrals");
     bool make_new_integrals = !user_input.search(1, "--no-new-mbpt");
     bool check_sizes = user_input.search("--check-sizes");
     bool one_body_mbpt = user_input.search(3, "-s1", "-s12", "-s123");
@@ -152,13 +166,15 @@ void Atom::MakeMBPTIntegrals()
         if(include_valence)
             size += val_mbpt->GetStorageSize();
 
-        *outstream << "Num stored coulomb integrals for MBPT = " << size;
+        *outstream << "Num stored coulomb integrals for MBPT = " << size
+                   << " (" << std::setprecision(4) << IntegralStorageMB(size) << " MB per process)";
 
         size = mbpt_integrals_one->CalculateOneElectronIntegrals(valence, valence, true);
         *outstream << "\nNum one-body mbpt integrals: " << size;
 
         size = mbpt_integrals_two->CalculateTwoElectronIntegrals(valence_subset[0], valence_subset[1], valence_subset[2], valence_subset[3], true);
-        *outstream << "\nNum two-body mbpt integrals: " << size << std::endl;
+        *outstream << "\nNum two-body mbpt integrals: " << size
+                   << " (" << IntegralStorageMB(size) << " MB)" << std::endl;
     }
     else
     {
@@ -180,6 +196,7 @@ void Atom::MakeMBPTIntegrals()
 
 void Atom::MakeIntegrals()
 {
+    ProfileTimer timer("Integrals");
     ClearIntegrals();
 
     pSlaterIntegrals two_body_integrals;
@@ -198,19 +215,23 @@ void Atom::MakeIntegrals()
         threebody_electron = std::make_shared<Sigma3Calculator>(orbitals, two_body_integrals, fermi_orbitals);
         threebody_electron->IncludeCore(!user_input.search("MBPT/--no-core"));
         threebody_electron->IncludeValence(user_input.search("MBPT/--use-valence"));
+        if(user_input.VariableExists("MBPT/Sigma3CacheSize"))
+            threebody_electron->SetCacheSize(user_input("MBPT/Sigma3CacheSize", 0));
     }
 
     auto& valence = orbitals->valence;
 
     // We don't need the two body integrals if we are just checking sizes and they are not needed by ConfigGenerator.
+    // Timing matrix elements needs them though.
     if(user_input.search("--check-sizes")
+       && user_input("CheckSizes/TimingSamples", 0) == 0
        && !user_input.VariableExists("CI/ConfigurationAverageEnergyRange")
        && !user_input.VariableExists("CI/SmallSide/ConfigurationAverageEnergyRange")
        && !user_input.search(2, "CI/--print-relativistic-configurations", "CI/--print-configurations")
        && !user_input.search(2, "CI/SmallSide/--print-relativistic-configurations", "CI/SmallSide/--print-configurations"))
     {
-        unsigned int size = two_body_integrals->CalculateTwoElectronIntegrals(valence, valence, valence, valence, true);
-        *outstream << "\nNum Coulomb integrals: " << size << std::endl;
+        num_coulomb_integrals = two_body_integrals->CalculateTwoElectronIntegrals(valence, valence, valence, valence, true);
+        *outstream << "\nNum Coulomb integrals: " << num_coulomb_integrals << std::endl;
 
         if(three_body_mbpt)
             *outstream << "\nSigma3 Coulomb integrals: " << threebody_electron->GetStorageSize() << std::endl;
@@ -223,9 +244,12 @@ void Atom::MakeIntegrals()
         // Don't need two body integrals if we're not doing CI
         if(!user_input.search(2, "--no-ci", "--no-CI"))
         {
-            two_body_integrals->CalculateTwoElectronIntegrals(valence, valence, valence, valence);
+            unsigned int num_integrals = two_body_integrals->CalculateTwoElectronIntegrals(valence, valence, valence, valence);
+            if(Profiler::Instance()->Enabled())
+                Profiler::Instance()->AddCount("Coulomb integrals stored", num_integrals);
+            num_coulomb_integrals = two_body_integrals->size();
             if(user_input.search("--check-sizes"))
-                *outstream << "\nNum Coulomb integrals: " << two_body_integrals->size() << std::endl;
+                *outstream << "\nNum Coulomb integrals: " << num_coulomb_integrals << std::endl;
         }
 
         // Add stored MBPT integrals
@@ -283,14 +307,16 @@ void Atom::InitialiseAngularDataLibrary(pAngularDataLibrary trial)
             angular_directory = user_input("AngularDataDirectory", "");
 
         angular_library = std::make_shared<AngularDataLibrary>(angular_directory);
+        if(user_input.search("--sparse-angular-data"))
+            angular_library->SetSparseStorage(0.5);
     }
 }
 
-pLevelStore Atom::ChooseHamiltoniansAndRead(pAngularDataLibrary angular_lib)
+pLevelStore Atom::ChooseHamiltoniansAndRead(pAngularDataLibrary angular_lib, bool always_read)
 {
     // Read existing levels?
     bool use_read = true;
-    if(user_input.search(2, "--clean", "-c"))
+    if(user_input.search(2, "--clean", "-c") && !always_read)
         use_read = false;
 
     if(user_input.search("--configuration-average"))
@@ -361,6 +387,14 @@ pLevelStore Atom::ChooseHamiltoniansAndRead(pAngularDataLibrary angular_lib)
     return levels;
 }
 
+pLevelStore Atom::ReadResults(pAngularDataLibrary angular_lib)
+{
+    if(user_input.search("MBPT/--brueckner") && !user_input.search("--check-sizes"))
+        GenerateBruecknerOrbitals(false);
+
+    return ChooseHamiltoniansAndRead(angular_lib, true);
+}
+
 pLevelStore Atom::ChooseHamiltonians(pRelativisticConfigList rlist)
 {
     std::vector<int> even_symmetries;
@@ -508,10 +542,12 @@ void Atom::CheckMatrixSizes(pAngularDataLibrary angular_lib)
     unsigned int total_levels = 0;
 
     // Do all configs in a symmetry at once
+    std::vector<pRelativisticConfigList> symmetry_configs;
     for(auto& sym: symmetries)
     {
         // Get list of relativistic configs
         pRelativisticConfigList configs = gen.GenerateRelativisticConfigurations(allconfigs, sym);
+        symmetry_configs.push_back(configs);
 
         *outstream << "J(P) = " << sym.GetJ() << "(" << ShortName(sym.GetParity()) << "): "
                    << std::setw(6) << std::right << configs->size();
@@ -532,6 +568,8 @@ void Atom::CheckMatrixSizes(pAngularDataLibrary angular_lib)
 
     *outstream << "\nTotal number of levels (all symmetries included) = " << total_levels << std::endl;
 
+    EstimateResources(symmetries, symmetry_configs);
+
     // Get Hamiltonian sizes for single configurations
     if(user_input.search(2, "CI/--single-configuration-ci", "CI/--single-configuration-CI"))
     {
@@ -556,21 +594,367 @@ void Atom::CheckMatrixSizes(pAngularDataLibrary angular_lib)
     }
 }
 
+void Atom::EstimateResources(const std::vector<Symmetry>& symmetries, const std::vector<pRelativisticConfigList>& configs)
+{
+    // Current allocation
+    int num_threads = 1;
+#ifdef AMBIT_USE_OPENMP
+    num_threads = omp_get_max_threads();
+#endif
+    int num_cores = NumProcessors * num_threads;
+
+    int num_nodes = 1;
+    double node_memory = Profiler::PhysicalMemoryMB();
+#ifdef AMBIT_USE_MPI
+    MPI_Comm node_comm;
+    int node_rank;
+    MPI_Comm_split_type(ProcessGroup.Comm(), MPI_COMM_TYPE_SHARED, ProcessorRank, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_free(&node_comm);
+
+    num_nodes = (node_rank == 0)? 1: 0;
+    MPI_Allreduce(MPI_IN_PLACE, &num_nodes, 1, MPI_INT, MPI_SUM, ProcessGroup.Comm());
+    MPI_Allreduce(MPI_IN_PLACE, &node_memory, 1, MPI_DOUBLE, MPI_MIN, ProcessGroup.Comm());
+#endif
+    node_memory = user_input("CheckSizes/MemoryPerNode", node_memory);
+    double usable_memory = 0.9 * node_memory;
+
+    int chunk_size = user_input("CI/ChunkSize", 4);
+    int num_samples = user_input("CheckSizes/TimingSamples", 0);
+    int requested_solutions = user_input("CI/NumSolutions", 6);
+    bool out_of_core = !std::string(user_input("CI/OutOfCoreDirectory", "")).empty();
+
+    // Matrices of all runs are held at once when they are generated together
+    int runs_together = 1;
+    if(user_input.search("CI/--runs-together") && user_input("ConcurrentRuns", 1) <= 1)
+        runs_together = mmax(user_input.GetNumRuns(), 1);
+
+    // Integrals and the cache of three-body matrix elements are held by every process
+    double integral_memory = IntegralStorageMB(num_coulomb_integrals);
+    double cache_memory = 0.;
+    if(threebody_electron)
+    {   cache_memory = threebody_electron->CacheMemoryMB();
+        integral_memory += IntegralStorageMB(threebody_electron->GetStorageSize()) + cache_memory;
+    }
+
+    *outstream << "\nResource estimates for " << NumProcessors << " processes x " << num_threads << " threads on "
+               << num_nodes << " node(s) with " << std::setprecision(6) << node_memory << " MB each, CI/ChunkSize = " << chunk_size << ":" << std::endl;
+    *outstream << "CI integrals: " << std::setprecision(4) << integral_memory << " MB per process";
+    if(cache_memory)
+        *outstream << " (including " << cache_memory << " MB of Sigma3 cache)";
+    *outstream << std::endl;
+
+    std::vector<std::unique_ptr<HamiltonianMatrix>> matrices;
+    std::vector<std::vector<unsigned long long>> elements;
+    std::vector<double> solve_memory;
+    std::vector<unsigned int> refine_iterations;
+    double seconds_per_element = 0.;
+
+    for(unsigned int i = 0; i < symmetries.size(); i++)
+    {
+        *outstream << "J(P) = " << symmetries[i].GetJ() << "(" << ShortName(symmetries[i].GetParity()) << "):" << std::flush;
+
+        // Integrals are only needed for timing
+        if(threebody_electron)
+            matrices.emplace_back(new HamiltonianMatrix(hf_electron, twobody_electron, threebody_electron, leading_configs, configs[i]));
+        else
+            matrices.emplace_back(new HamiltonianMatrix(hf_electron, twobody_electron, configs[i]));
+        HamiltonianMatrix& H = *matrices.back();
+        H.SetSinglePrecision(user_input.search("CI/--single-precision-matrix"));
+
+        elements.push_back(H.CountMatrixElements());
+        double total_elements = std::accumulate(elements.back().begin(), elements.back().end(), 0.);
+
+        unsigned int N = configs[i]->NumCSFs();
+        unsigned int num_solutions = (requested_solutions? mmin(requested_solutions, N): N);
+        solve_memory.push_back(HamiltonianMatrix::SolveMemoryMB(N, num_solutions, H.IsSinglePrecision(), num_threads));
+
+        // Single-precision solutions are refined by generating the matrix again in double precision
+        refine_iterations.push_back(HamiltonianMatrix::MaxRefineIterations(N, H.IsSinglePrecision()));
+
+        HamiltonianMatrix::GenerationEstimate estimate = H.EstimateGeneration(elements.back(), chunk_size, NumProcessors, num_threads);
+        double matrix_memory = (out_of_core? 0.: runs_together * estimate.max_memory_MB);
+        *outstream << "\n    " << std::setprecision(4) << total_elements << " matrix elements in " << estimate.num_chunks << " chunks"
+                   << "\n    Memory per process: matrix " << estimate.max_memory_MB << " MB (" << estimate.total_memory_MB << " MB total"
+                   << (out_of_core? ", out-of-core": "");
+        if(runs_together > 1)
+            *outstream << "; x " << runs_together << " runs together";
+        *outstream << "), solver "
+                   << solve_memory.back() << " MB; peak " << integral_memory + matrix_memory + solve_memory.back() << " MB";
+        if(refine_iterations.back())
+            *outstream << "\n    Refinement of single-precision solutions generates the matrix up to "
+                       << refine_iterations.back() << " more times";
+
+        if(num_samples && hf_electron && twobody_electron)
+        {   double sample_time = H.TimeMatrixElements(num_samples);
+            seconds_per_element = mmax(seconds_per_element, sample_time);
+            *outstream << "\n    Estimated time to generate matrix: " << estimate.elapsed_elements * sample_time << " s";
+            if(refine_iterations.back())
+                *outstream << " (up to " << (1 + refine_iterations.back()) * estimate.elapsed_elements * sample_time
+                           << " s with refinement)";
+        }
+        *outstream << std::endl;
+    }
+
+    if(symmetries.empty())
+        return;
+
+    // Time (in matrix elements) and whether memory fits for num_processes processes and configs_per_chunk
+    auto evaluate = [&](int num_processes, unsigned int configs_per_chunk, bool& fits)
+    {
+        int processes_per_node = (num_processes + num_nodes - 1)/num_nodes;
+        double time = 0.;
+        fits = true;
+        for(unsigned int i = 0; i < matrices.size(); i++)
+        {
+            auto estimate = matrices[i]->EstimateGeneration(elements[i], configs_per_chunk, num_processes, num_cores/num_processes);
+            time += (1 + refine_iterations[i]) * estimate.elapsed_elements;
+            double memory = processes_per_node * (integral_memory + (out_of_core? 0.: runs_together * estimate.max_memory_MB)) + solve_memory[i];
+            if(node_memory > 0. && memory > usable_memory)
+                fits = false;
+        }
+        return time;
+    };
+
+    // Chunk size for the current allocation: the largest within 2% of the fastest
+    const std::vector<unsigned int> chunk_sizes = {1, 2, 4, 8, 16, 32};
+    std::vector<double> chunk_times;
+    bool fits;
+    for(unsigned int c: chunk_sizes)
+        chunk_times.push_back(evaluate(NumProcessors, c, fits));
+
+    double best_time = *std::min_element(chunk_times.begin(), chunk_times.end());
+    unsigned int best_chunk_size = chunk_sizes.front();
+    for(unsigned int j = 0; j < chunk_sizes.size(); j++)
+        if(chunk_times[j] <= 1.02 * best_time)
+            best_chunk_size = chunk_sizes[j];
+
+    // Processes x threads using the same cores: the fewest processes within 5% of the fastest that fit in memory.
+    // Processes must be spread evenly over the nodes.
+    int best_processes = 0;
+    double best_processes_time = 0.;
+#ifdef AMBIT_USE_MPI
+    std::vector<int> candidates;
+    for(int p = num_nodes; p <= num_cores; p += num_nodes)
+        if(num_cores%p == 0)
+            candidates.push_back(p);
+#else
+    std::vector<int> candidates(1, 1);
+#endif
+    std::vector<double> candidate_times(candidates.size(), 0.);
+    std::vector<bool> candidate_fits(candidates.size(), false);
+    for(unsigned int j = 0; j < candidates.size(); j++)
+    {   candidate_times[j] = evaluate(candidates[j], best_chunk_size, fits);
+        candidate_fits[j] = fits;
+        if(fits && (best_processes == 0 || candidate_times[j] < best_processes_time))
+        {   best_processes = candidates[j];
+            best_processes_time = candidate_times[j];
+        }
+    }
+    for(unsigned int j = 0; j < candidates.size() && best_processes; j++)
+    {   if(candidate_fits[j] && candidate_times[j] <= 1.05 * best_processes_time)
+        {   best_processes = candidates[j];
+            best_processes_time = candidate_times[j];
+            break;
+        }
+    }
+
+    *outstream << "\nRecommended: CI/ChunkSize = " << best_chunk_size;
+    if(best_processes)
+    {   *outstream << "; " << best_processes << " processes x " << num_cores/best_processes << " threads";
+        if(seconds_per_element)
+            *outstream << " (about " << best_processes_time * seconds_per_element << " s to generate all matrices)";
+        *outstream << std::endl;
+    }
+    else
+    {   // Smallest number of nodes with one process each that would hold the largest matrix
+        double largest_matrix = 0., largest_solve = 0.;
+        for(unsigned int i = 0; i < matrices.size(); i++)
+        {   largest_matrix = mmax(largest_matrix, runs_together * matrices[i]->EstimateGeneration(elements[i], best_chunk_size, 1, 1).total_memory_MB);
+            largest_solve = mmax(largest_solve, solve_memory[i]);
+        }
+        double space = usable_memory - integral_memory - largest_solve;
+        *outstream << "\nCI matrices do not fit in the memory of " << num_nodes << " node(s)";
+        if(space > 0. && !out_of_core)
+            *outstream << ": at least " << int(ceil(largest_matrix/space)) << " nodes are needed";
+        *outstream << "." << std::endl;
+    }
+
+    if(!num_samples)
+        *outstream << "Set CheckSizes/TimingSamples to estimate times." << std::endl;
+}
+
 pLevelStore Atom::CalculateEnergies()
 {
     ChooseHamiltoniansAndRead();
+    CalculateEnergies(std::vector<pHamiltonianID>(levels->begin(), levels->end()));
+
+    return levels;
+}
 
-    for(auto& key: *levels)
+void Atom::CalculateEnergies(const std::vector<pHamiltonianID>& keys)
+{
+    if(user_input.search("CI/--parallel-symmetries") && !user_input.search("CI/--scalapack"))
+    {   CalculateEnergiesConcurrently(keys);
+        return;
+    }
+
+    for(auto& key: keys)
         CalculateEnergies(key);
+}
 
-    return levels;
+void Atom::CalculateEnergiesConcurrently(const std::vector<pHamiltonianID>& keys)
+{
+    std::vector<LevelVector> levelvecs(keys.size());
+    std::vector<unsigned int> num_solutions(keys.size());
+
+    // Configurations and CSFs of all symmetries are made by all processes together
+    std::vector<unsigned int> jobs;
+    std::vector<double> costs;
+    for(unsigned int i = 0; i < keys.size(); i++)
+    {
+        if(PrepareCI(keys[i], levelvecs[i], num_solutions[i]))
+        {   // Generating the matrix dominates: the number of pairs of CSFs
+            double N = levelvecs[i].configs->NumCSFs();
+            jobs.push_back(i);
+            costs.push_back(N * N);
+        }
+    }
+
+    if(jobs.size())
+    {
+        if(twobody_electron == nullptr)
+            MakeIntegrals();
+
+        std::vector<int> group_start, group_size;
+        std::vector<int> job_group = PackTasks(costs, NumProcessors, group_start, group_size);
+        int my_group = std::upper_bound(group_start.begin(), group_start.end(), ProcessorRank) - group_start.begin() - 1;
+        Communicator group = ProcessGroup.Split(my_group);
+
+        *outstream << "Solving " << jobs.size() << " Hamiltonians on " << group_start.size() << " groups of processes:" << std::endl;
+        for(unsigned int j = 0; j < jobs.size(); j++)
+            *outstream << "  " << keys[jobs[j]]->Print() << ": " << levelvecs[jobs[j]].configs->NumCSFs()
+                       << " CSFs; processes " << group_start[job_group[j]] << " - "
+                       << group_start[job_group[j]] + group_size[job_group[j]] - 1 << std::endl;
+
+        // If we're using OpenMP then the chunksize should be a multiple of the number of threads
+        int default_chunksize = 4;
+        int chunksize = user_input("CI/ChunkSize", default_chunksize);
+
+        // Output of each job is buffered on the root of its group
+        std::vector<std::ostringstream> job_output(jobs.size());
+        std::ostream* stored_outstream = outstream;
+
+        for(unsigned int j = 0; j < jobs.size(); j++)
+        {
+            if(job_group[j] != my_group)
+                continue;
+
+            if(group.Rank() == 0)
+                outstream = &job_output[j];
+
+            unsigned int i = jobs[j];
+            *outstream << keys[i]->Print() << ":";
+            std::unique_ptr<HamiltonianMatrix> H = MakeHamiltonian(levelvecs[i].configs);
+            H->SetCommunicator(group);
+            H->GenerateMatrix(chunksize);
+            SolveHamiltonian(keys[i], *H, levelvecs[i], num_solutions[i]);
+
+            outstream = stored_outstream;
+        }
+
+        // Print all output from rank 0
+        for(unsigned int j = 0; j < jobs.size(); j++)
+        {
+            int root = group_start[job_group[j]];
+            if(root == 0)
+            {   if(ProcessorRank == 0)
+                    *outstream << job_output[j].str();
+            }
+        #ifdef AMBIT_USE_MPI
+            else if(ProcessorRank == 0)
+            {   int size;
+                MPI_Recv(&size, 1, MPI_INT, root, j, ProcessGroup.Comm(), MPI_STATUS_IGNORE);
+                std::string text(size, ' ');
+                MPI_Recv(&text[0], size, MPI_CHAR, root, j, ProcessGroup.Comm(), MPI_STATUS_IGNORE);
+                *outstream << text;
+            }
+            else if(ProcessorRank == root)
+            {   std::string text = job_output[j].str();
+                int size = text.size();
+                MPI_Send(&size, 1, MPI_INT, 0, j, ProcessGroup.Comm());
+                MPI_Send(text.data(), size, MPI_CHAR, 0, j, ProcessGroup.Comm());
+            }
+        #endif
+        }
+        *outstream << std::flush;
+
+    #ifdef AMBIT_USE_MPI
+        // Send levels from the root of each group to all processes: energy followed by eigenvector
+        for(unsigned int j = 0; j < jobs.size(); j++)
+        {
+            unsigned int i = jobs[j];
+            LevelVector& levelvec = levelvecs[i];
+            int root = group_start[job_group[j]];
+            unsigned int N = levelvec.configs->NumCSFs();
+
+            int num_levels = levelvec.levels.size();
+            MPI_Bcast(&num_levels, 1, MPI_INT, root, ProcessGroup.Comm());
+
+            std::vector<double> buffer(num_levels * (N + 1));
+            if(ProcessorRank == root)
+            {   auto it = buffer.begin();
+                for(const auto& level: levelvec.levels)
+                {   *it++ = level->GetEnergy();
+                    it = std::copy(level->GetEigenvector().begin(), level->GetEigenvector().end(), it);
+                }
+            }
+            MPI_Bcast(buffer.data(), buffer.size(), MPI_DOUBLE, root, ProcessGroup.Comm());
+
+            if(job_group[j] != my_group)
+            {   levelvec.hID = keys[i];
+                levelvec.levels.clear();
+                for(int k = 0; k < num_levels; k++)
+                    levelvec.levels.push_back(std::make_shared<Level>(buffer[k * (N + 1)], &buffer[k * (N + 1) + 1], keys[i], N));
+
+                levels->Store(keys[i], levelvec);
+            }
+        }
+    #endif
+    }
+
+    // Print in the usual order
+    for(unsigned int i = 0; i < keys.size(); i++)
+        FinishLevels(keys[i], levelvecs[i]);
 }
 
 LevelVector Atom::CalculateEnergies(pHamiltonianID hID)
 {
     // This function is public and can call the other CalculateEnergies variants.
-    LevelVector levelvec = levels->GetLevels(hID);
-    std::string filename = identifier + ".levels";
+    LevelVector levelvec;
+    unsigned int num_solutions;
+
+    if(PrepareCI(hID, levelvec, num_solutions))
+    {
+        std::unique_ptr<HamiltonianMatrix> H = MakeHamiltonian(levelvec.configs);
+
+        // If we're using OpenMP then the chunksize should be a multiple of the number of threads
+        int default_chunksize = 4;
+
+        H->GenerateMatrix(user_input("CI/ChunkSize", default_chunksize));
+        //H->PollMatrix();
+
+        SolveHamiltonian(hID, *H, levelvec, num_solutions);
+    }
+
+    FinishLevels(hID, levelvec);
+    return levelvec;
+}
+
+bool Atom::PrepareCI(pHamiltonianID hID, LevelVector& levelvec, unsigned int& num_solutions)
+{
+    levelvec = levels->GetLevels(hID);
+    num_solutions = 0;
 
     auto nrID = std::dynamic_pointer_cast<NonRelID>(hID);
     auto soID = std::dynamic_pointer_cast<SingleOrbitalID>(hID);
@@ -579,134 +963,136 @@ LevelVector Atom::CalculateEnergies(pHamiltonianID hID)
     {
         if(levelvec.levels.empty())
             levelvec = SingleElectronConfigurations(hID);
+        return false;
     }
-    else
-    {   // Get relativistic configurations
-        pRelativisticConfigList& configs = levelvec.configs;
 
-        if(configs == nullptr)
-        {
-            ConfigGenerator gen(orbitals, user_input);
+    // Get relativistic configurations
+    pRelativisticConfigList& configs = levelvec.configs;
 
-            if(nrID)
-            {
-                pConfigList nrconfiglist = std::make_shared<ConfigList>();
-                nrconfiglist->first.emplace_back(nrID->GetNonRelConfiguration());
-                nrconfiglist->second = 1;
-                configs = gen.GenerateRelativisticConfigurations(nrconfiglist);
-                configs = gen.GenerateRelativisticConfigurations(configs, nrID->GetSymmetry(), angular_library);
-            }
-            else
+    if(configs == nullptr)
+    {
+        ConfigGenerator gen(orbitals, user_input);
+
+        if(nrID)
+        {
+            pConfigList nrconfiglist = std::make_shared<ConfigList>();
+            nrconfiglist->first.emplace_back(nrID->GetNonRelConfiguration());
+            nrconfiglist->second = 1;
+            configs = gen.GenerateRelativisticConfigurations(nrconfiglist);
+            configs = gen.GenerateRelativisticConfigurations(configs, nrID->GetSymmetry(), angular_library);
+        }
+        else
+        {
+            if(allconfigs == nullptr)
             {
-                if(configs == nullptr)
+                if(user_input.VariableExists("CI/ConfigurationAverageEnergyRange")
+                   || user_input.VariableExists("CI/SmallSide/ConfigurationAverageEnergyRange")
+                   || user_input.search(2, "CI/--print-relativistic-configurations", "CI/--print-configurations")
+                   || user_input.search(2, "CI/SmallSide/--print-relativistic-configurations", "CI/SmallSide/--print-configurations"))
                 {
-                    if(allconfigs == nullptr)
-                    {
-                        if(user_input.VariableExists("CI/ConfigurationAverageEnergyRange")
-                           || user_input.VariableExists("CI/SmallSide/ConfigurationAverageEnergyRange")
-                           || user_input.search(2, "CI/--print-relativistic-configurations", "CI/--print-configurations")
-                           || user_input.search(2, "CI/SmallSide/--print-relativistic-configurations", "CI/SmallSide/--print-configurations"))
-                        {
-                            if(twobody_electron == nullptr)
-                                MakeIntegrals();
-
-                            allconfigs = gen.GenerateConfigurations(hf_electron, twobody_electron->GetIntegrals());
-                        }
-                        else
-                            allconfigs = gen.GenerateConfigurations();
+                    if(twobody_electron == nullptr)
+                        MakeIntegrals();
 
-                        leading_configs = gen.GetLeadingConfigs();
-                    }
+                    allconfigs = gen.GenerateConfigurations(hf_electron, twobody_electron->GetIntegrals());
                 }
-                configs = gen.GenerateRelativisticConfigurations(allconfigs, hID->GetSymmetry(), angular_library);
-            }
+                else
+                    allconfigs = gen.GenerateConfigurations();
 
-            angular_library->RemoveUnused();
+                leading_configs = gen.GetLeadingConfigs();
+            }
+            configs = gen.GenerateRelativisticConfigurations(allconfigs, hID->GetSymmetry(), angular_library);
         }
 
-        // Only continue if we don't have enough levels
-        int num_solutions = user_input("CI/NumSolutions", 6);
-        num_solutions = (num_solutions? mmin(num_solutions, configs->NumCSFs()): configs->NumCSFs());
-        bool do_CI = (levelvec.levels.size() < num_solutions);
-        if(do_CI)
-        {
-            if(twobody_electron == nullptr)
-                MakeIntegrals();
+        angular_library->RemoveUnused();
+    }
 
-            std::unique_ptr<HamiltonianMatrix> H;
-            if(threebody_electron)
-                H.reset(new HamiltonianMatrix(hf_electron, twobody_electron, threebody_electron, leading_configs, configs));
-            else
-                H.reset(new HamiltonianMatrix(hf_electron, twobody_electron, configs));
+    // Only continue if we don't have enough levels
+    int requested_solutions = user_input("CI/NumSolutions", 6);
+    num_solutions = (requested_solutions? mmin(requested_solutions, configs->NumCSFs()): configs->NumCSFs());
+    return (levelvec.levels.size() < num_solutions);
+}
 
-            // If we're using OpenMP then the chunksize should be a multiple of the number of threads
-            int default_chunksize = 4;
+std::unique_ptr<HamiltonianMatrix> Atom::MakeHamiltonian(pRelativisticConfigList configs)
+{
+    if(twobody_electron == nullptr)
+        MakeIntegrals();
 
-            H->GenerateMatrix(user_input("CI/ChunkSize", default_chunksize));
-            //H->PollMatrix();
+    std::unique_ptr<HamiltonianMatrix> H;
+    if(threebody_electron)
+        H.reset(new HamiltonianMatrix(hf_electron, twobody_electron, threebody_electron, leading_configs, configs));
+    else
+        H.reset(new HamiltonianMatrix(hf_electron, twobody_electron, configs));
 
-            if(user_input.search("CI/Output/--write-hamiltonian"))
-            {
-                std::string hamiltonian_filename = identifier + "." + hID->Name() + ".matrix";
+    // Keep matrix chunks in files (e.g. on node-local SSD) rather than memory
+    H->SetOutOfCore(user_input("CI/OutOfCoreDirectory", ""));
+    H->SetSinglePrecision(user_input.search("CI/--single-precision-matrix"), user_input("CI/SinglePrecisionResidual", 1.e-6));
 
-                // Convert spaces to underscores in filename
-                std::replace_if(hamiltonian_filename.begin(), hamiltonian_filename.end(),
-                                [](char c){ return (c =='\r' || c =='\t' || c == ' ' || c == '\n');}, '_');
-                H->Write(hamiltonian_filename);
-            }
+    return H;
+}
 
-            if(user_input.search("CI/Output/--print-hamiltonian"))
-            {
-                auto rel_it = configs->begin();
-                while(rel_it != configs->end())
-                {
-                    *outstream << rel_it->Name();
-                    if(rel_it++ != configs->end())
-                    {
-                        *outstream << ",";
-                    }
-                }
-                *outstream << std::endl;
+void Atom::SolveHamiltonian(pHamiltonianID hID, HamiltonianMatrix& H, LevelVector& levelvec, unsigned int num_solutions)
+{
+    pRelativisticConfigList configs = levelvec.configs;
 
-                *outstream << std::setprecision(12);
-                *outstream << "Matrix Before:\n" << *H << std::endl;
-            }
+    if(user_input.search("CI/Output/--write-hamiltonian"))
+    {
+        std::string hamiltonian_filename = identifier + "." + hID->Name() + ".matrix";
+
+        // Convert spaces to underscores in filename
+        std::replace_if(hamiltonian_filename.begin(), hamiltonian_filename.end(),
+                        [](char c){ return (c =='\r' || c =='\t' || c == ' ' || c == '\n');}, '_');
+        H.Write(hamiltonian_filename);
+    }
 
-            #ifdef AMBIT_USE_SCALAPACK
-            if(user_input.search("CI/--scalapack"))
+    if(user_input.search("CI/Output/--print-hamiltonian"))
+    {
+        auto rel_it = configs->begin();
+        while(rel_it != configs->end())
+        {
+            *outstream << rel_it->Name();
+            if(rel_it++ != configs->end())
             {
-                if(user_input.VariableExists("CI/MaxEnergy"))
-                {
-                    double max_energy = user_input("CI/MaxEnergy", 0.0);
-                    levelvec = H->SolveMatrixScalapack(hID, max_energy);
-                }
-                else
-                {
-                    levelvec = H->SolveMatrixScalapack(hID, num_solutions, false);
-                }
+                *outstream << ",";
             }
-            else
-            #endif
-            levelvec = H->SolveMatrix(hID, num_solutions);
-            levels->Store(hID, levelvec);
         }
+        *outstream << std::endl;
+
+        *outstream << std::setprecision(12);
+        *outstream << "Matrix Before:\n" << H << std::endl;
+    }
 
+    #ifdef AMBIT_USE_SCALAPACK
+    if(user_input.search("CI/--scalapack"))
+    {
+        if(user_input.VariableExists("CI/MaxEnergy"))
+        {
+            double max_energy = user_input("CI/MaxEnergy", 0.0);
+            levelvec = H.SolveMatrixScalapack(hID, max_energy);
+        }
+        else
+        {
+            levelvec = H.SolveMatrixScalapack(hID, num_solutions, false);
+        }
+    }
+    else
+    #endif
+    levelvec = H.SolveMatrix(hID, num_solutions);
+    levels->Store(hID, levelvec);
+}
+
+void Atom::FinishLevels(pHamiltonianID hID, LevelVector& levelvec)
+{
+    if(!std::dynamic_pointer_cast<SingleOrbitalID>(hID))
+    {
         // Check if gfactor overrides are present, otherwise decide on course of action
         bool get_gfactors = levels->GFactorsNeeded();
 
-        // Don't bother doing any checks if we've got pre-calculated g-factors stored
+        // Don't bother doing any checks if we've got pre-calculated g-factors stored.
+        // g-factors come from a single diagonal density pass, so they are cheap enough to be on by default.
         if(get_gfactors)
         {
             if(hID->GetTwoJ() == 0 || user_input.search("CI/--no-gfactors"))
                 get_gfactors = false;
-            else if(user_input.search("CI/--gfactors"))
-                get_gfactors = true;
-            else
-            {   if(nrID || num_solutions > 50)
-                    get_gfactors = false;
-                else
-                    get_gfactors = true;
-            }
         }
 
         if(get_gfactors)
@@ -769,8 +1155,6 @@ LevelVector Atom::CalculateEnergies(pHamiltonianID hID)
                 levelvec.Print(min_percent_displayed);
         }
     }
-
-    return levelvec;
 }
 
 LevelVector Atom::SingleElectronConfigurations(pHamiltonianID sym)
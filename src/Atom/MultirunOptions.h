@@ -103,7 +103,7 @@ inline
 MultirunOptions::MultirunOptions(std::istream& InputStream,
                const char* CommentStart  /* = 0x0 */, const char* CommentEnd /* = 0x0 */,
                const char* FieldSeparator/* = 0x0 */):
-    GetPot()
+    GetPot(), num_runs(1), current_run_index(0)
 {
     // if specified -> overwrite default strings
     if( CommentStart )   _comment_start = std::string(CommentStart);
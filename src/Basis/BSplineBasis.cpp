@@ -8,6 +8,10 @@
 #include <Eigen/Eigen>
 #include <gsl/gsl_bspline.h>
 
+#ifdef AMBIT_USE_OPENMP
+    #include <omp.h>
+#endif
+
 namespace Ambit
 {
 // This file contains B-spline routines from BasisGenerator as well as BSplineBasis
@@ -53,6 +57,10 @@ pOrbitalMap BasisGenerator::GenerateBSplines(const std::vector<int>& max_pqn)
     // Make splines and store
     BSplineBasis spline_maker(lattice, n, k, rmax, dr0, spline_type);
 
+    // Kappa channels are independent given the HF operator, so solve them all first
+    // (concurrently if possible) and then merge them into excited in order.
+    std::vector<int> channel_kappa;
+    std::vector<int> channel_max_pqn;
     for(int l = 0; l < max_pqn.size(); l++)
     {
         if(!max_pqn[l])
@@ -63,40 +71,70 @@ pOrbitalMap BasisGenerator::GenerateBSplines(const std::vector<int>& max_pqn)
             if(kappa == 0)
                 break;
 
-            if(debug)
-                *logstream << "kappa = " << kappa << std::endl;
+            channel_kappa.push_back(kappa);
+            channel_max_pqn.push_back(max_pqn[l]);
+        }
+    }
 
-            pOrbitalMap basis = spline_maker.GenerateBSplines(hf, kappa, max_pqn[l]);
+    std::vector<pOrbitalMap> channel_basis(channel_kappa.size());
 
-            for(auto it = basis->begin(); it != basis->end(); it++)
-            {
-                pOrbital ds = it->second;
-
-                // Check whether it is in the core
-                pOrbitalConst s = open_core->GetState(it->first);
-                if(s)
-                {   if(debug)
-                    {   double diff = fabs((s->Energy() - ds->Energy())/s->Energy());
-                        *logstream << "  " << s->Name() << " en: " << std::setprecision(8) << ds->Energy()
-                                   << "  deltaE: " << diff << std::endl;
-                    }
-
-                    if(!closed_core->GetOccupancy(it->first))
-                    {   pOrbital s_copy = s->Clone();
-                        excited->AddState(s_copy);
-                    }
-                }
-                else
-                {   if(debug)
-                    {   *logstream << "  " << ds->Name() << " en: " << std::setprecision(8) << ds->Energy()
-                                   << " norm: " << ds->Norm(integrator) - 1. << std::endl;
-                    }
+#ifdef AMBIT_USE_OPENMP
+    // The HF operator is not thread-safe, so make a separate clone for each thread
+    std::vector<pHFOperator> hf_operators;
+    for(int ii = 0; ii < omp_get_max_threads(); ++ii){
+        hf_operators.emplace_back(hf->Clone());
+    }
+    // Freeze the lattice: it must not be resized underneath the threads.
+    // Decorators of the HF operator (nuclear, mass shift) use powers of R up to R^4.
+    LatticeSnapshot frozen_lattice(lattice, 4);
+
+    #pragma omp parallel for schedule(dynamic, 1) default(none) \
+    shared(hf_operators, spline_maker, channel_kappa, channel_max_pqn, channel_basis)
+#endif
+    for(unsigned int ii = 0; ii < channel_kappa.size(); ii++)
+    {
+#ifdef AMBIT_USE_OPENMP
+        channel_basis[ii] = spline_maker.GenerateBSplines(hf_operators[omp_get_thread_num()], channel_kappa[ii], channel_max_pqn[ii]);
+#else
+        channel_basis[ii] = spline_maker.GenerateBSplines(hf, channel_kappa[ii], channel_max_pqn[ii]);
+#endif
+    }
+
+    for(unsigned int ii = 0; ii < channel_kappa.size(); ii++)
+    {
+        if(debug)
+            *logstream << "kappa = " << channel_kappa[ii] << std::endl;
 
-                    ds->ReNormalise(integrator);
+        pOrbitalMap basis = channel_basis[ii];
 
-                    excited->AddState(ds);
+        for(auto it = basis->begin(); it != basis->end(); it++)
+        {
+            pOrbital ds = it->second;
+
+            // Check whether it is in the core
+            pOrbitalConst s = open_core->GetState(it->first);
+            if(s)
+            {   if(debug)
+                {   double diff = fabs((s->Energy() - ds->Energy())/s->Energy());
+                    *logstream << "  " << s->Name() << " en: " << std::setprecision(8) << ds->Energy()
+                               << "  deltaE: " << diff << std::endl;
+                }
+
+                if(!closed_core->GetOccupancy(it->first))
+                {   pOrbital s_copy = s->Clone();
+                    excited->AddState(s_copy);
                 }
             }
+            else
+            {   if(debug)
+                {   *logstream << "  " << ds->Name() << " en: " << std::setprecision(8) << ds->Energy()
+                               << " norm: " << ds->Norm(integrator) - 1. << std::endl;
+                }
+
+                ds->ReNormalise(integrator);
+
+                excited->AddState(ds);
+            }
         }
     }
 
@@ -410,8 +448,13 @@ pOrbitalMap BSplineBasis::GenerateBSplines(pHFOperatorConst hf, int kappa, int m
         // Remove spurious states
         if(i >= N && fabs(ds->Norm(integrator) - 1.) > 1.e-2)
         {   if(debug)
+            {
+#ifdef AMBIT_USE_OPENMP
+                #pragma omp critical(LOGSTREAM)
+#endif
                 *logstream << "  Orbital removed: kappa = " << kappa << "  energy = " << ds->Energy()
                            << "  norm = " << ds->Norm(integrator) << std::endl;
+            }
         }
         else
         {   excited->AddState(ds);
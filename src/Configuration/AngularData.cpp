@@ -2,38 +2,46 @@
 #include "Include.h"
 #include "RelativisticConfiguration.h"
 #include <Eigen/Eigen>
+#include <Eigen/Sparse>
 #include "ManyBodyOperator.h"
+#include "Universal/Communicator.h"
+#include "Universal/Profiler.h"
 #include <boost/interprocess/sync/file_lock.hpp>
 #include <boost/interprocess/sync/scoped_lock.hpp>
 #include <boost/interprocess/sync/sharable_lock.hpp>
+#include <algorithm>
+#include <cstring>
 #include <numeric>
+#include <random>
 #ifdef AMBIT_USE_MPI
     #include <mpi.h>
 #endif
 
 namespace Ambit
 {
+
 AngularData::AngularData(int two_m):
-    two_m(two_m), two_j(-1), num_CSFs(0), CSFs(nullptr), have_CSFs(false)
+    two_m(two_m), two_j(-1), num_CSFs(0), CSFs(nullptr), have_CSFs(false), sparse(false)
 {}
 
 AngularData::AngularData(const RelativisticConfiguration& config, int two_m):
-    two_m(two_m), two_j(-1), num_CSFs(0), CSFs(nullptr), have_CSFs(false)
+    two_m(two_m), two_j(-1), num_CSFs(0), CSFs(nullptr), have_CSFs(false), sparse(false)
 {
     GenerateProjections(config, two_m);
 }
 
 AngularData::AngularData(const RelativisticConfiguration& config, int two_m, int two_j):
-    two_m(two_m), two_j(-1), num_CSFs(0), CSFs(nullptr), have_CSFs(false)
+    two_m(two_m), two_j(-1), num_CSFs(0), CSFs(nullptr), have_CSFs(false), sparse(false)
 {
     GenerateProjections(config, two_m);
     GenerateCSFs(config, two_j);
 }
 
 AngularData::AngularData(const AngularData& other):
-    two_m(other.two_m), two_j(other.two_j), num_CSFs(other.num_CSFs), have_CSFs(other.have_CSFs), projections(other.projections)
+    two_m(other.two_m), two_j(other.two_j), num_CSFs(other.num_CSFs), CSFs(nullptr), have_CSFs(other.have_CSFs), projections(other.projections),
+    sparse(other.sparse), sparse_CSFs(other.sparse_CSFs), sparse_CSF_index(other.sparse_CSF_index), sparse_start(other.sparse_start)
 {
-    if(have_CSFs)
+    if(have_CSFs && other.CSFs)
     {
         CSFs = new double[projection_size() * num_CSFs];
         memcpy(CSFs, other.CSFs, projection_size() * num_CSFs * sizeof(double));
@@ -41,13 +49,15 @@ AngularData::AngularData(const AngularData& other):
 }
 
 AngularData::AngularData(AngularData&& other):
-    two_m(other.two_m), two_j(other.two_j), num_CSFs(other.num_CSFs), have_CSFs(other.have_CSFs), projections(other.projections)
+    two_m(other.two_m), two_j(other.two_j), num_CSFs(other.num_CSFs), CSFs(nullptr), have_CSFs(other.have_CSFs), projections(other.projections),
+    sparse(other.sparse), sparse_CSFs(std::move(other.sparse_CSFs)), sparse_CSF_index(std::move(other.sparse_CSF_index)), sparse_start(std::move(other.sparse_start))
 {
     if(have_CSFs)
     {
         CSFs = other.CSFs;
         other.have_CSFs = false;
         other.CSFs = nullptr;
+        other.sparse = false;
     }
 }
 
@@ -57,6 +67,78 @@ AngularData::~AngularData()
         delete[] CSFs;
 }
 
+void AngularData::ClearCSFs()
+{
+    if(CSFs)
+    {   delete[] CSFs;
+        CSFs = nullptr;
+    }
+    have_CSFs = false;
+
+    sparse = false;
+    sparse_CSFs.clear();
+    sparse_CSF_index.clear();
+    sparse_start.clear();
+}
+
+bool AngularData::MakeSparse(double max_fill)
+{
+    if(sparse || !have_CSFs || !CSFs || num_CSFs == 0)
+        return sparse;
+
+    unsigned int N = projections.size();
+    unsigned int num_nonzero = 0;
+    for(unsigned int i = 0; i < N * num_CSFs; i++)
+        if(fabs(CSFs[i]) >= SparseTolerance)
+            num_nonzero++;
+
+    if(num_nonzero > max_fill * N * num_CSFs)
+        return false;
+
+    sparse_CSFs.reserve(num_nonzero);
+    sparse_CSF_index.reserve(num_nonzero);
+    sparse_start.reserve(N + 1);
+    for(unsigned int i = 0; i < N; i++)
+    {
+        sparse_start.push_back(sparse_CSFs.size());
+        for(int j = 0; j < num_CSFs; j++)
+        {
+            double coeff = CSFs[i * num_CSFs + j];
+            if(fabs(coeff) >= SparseTolerance)
+            {   sparse_CSFs.push_back(coeff);
+                sparse_CSF_index.push_back(j);
+            }
+        }
+    }
+    sparse_start.push_back(sparse_CSFs.size());
+
+    delete[] CSFs;
+    CSFs = nullptr;
+    sparse = true;
+    return true;
+}
+
+void AngularData::MakeDense()
+{
+    if(!sparse)
+        return;
+
+    unsigned int N = projections.size();
+    CSFs = new double[N * num_CSFs];
+    memset(CSFs, 0, sizeof(double) * N * num_CSFs);
+    for(unsigned int i = 0; i < N; i++)
+        for(unsigned int k = sparse_start[i]; k < sparse_start[i+1]; k++)
+            CSFs[i * num_CSFs + sparse_CSF_index[k]] = sparse_CSFs[k];
+
+    sparse = false;
+    sparse_CSFs.clear();
+    sparse_CSFs.shrink_to_fit();
+    sparse_CSF_index.clear();
+    sparse_CSF_index.shrink_to_fit();
+    sparse_start.clear();
+    sparse_start.shrink_to_fit();
+}
+
 bool AngularData::ProjectionCompare(const std::vector<int>& first, const std::vector<int>& second)
 {
     auto it_first = first.begin();
@@ -186,21 +268,20 @@ int AngularData::GenerateProjections(const RelativisticConfiguration& config, in
     return projections.size();
 }
 
-int AngularData::GenerateCSFs(const RelativisticConfiguration& config, int two_j)
+int AngularData::GenerateCSFs(const RelativisticConfiguration& config, int two_j, bool allow_sparse)
 {
     unsigned int N = projections.size();
     this->two_j = two_j;
 
     // Clear existing
-    if(CSFs)
-    {   delete[] CSFs;
-        CSFs = nullptr;
-        have_CSFs = false;
-    }
+    ClearCSFs();
 
     if(N == 0 || two_j < abs(two_m))
         return 0;
 
+    if(allow_sparse && two_j == two_m && N > SparseSizeLimit && GenerateStretchedCSFs(config))
+        return num_CSFs;
+
     // Generate the matrix
     unsigned int i, j;
     Eigen::MatrixXd M = Eigen::MatrixXd::Zero(N, N);
@@ -275,17 +356,174 @@ int AngularData::GenerateCSFs(const RelativisticConfiguration& config, int two_j
     return num_CSFs;
 }
 
+bool AngularData::GenerateStretchedCSFs(const RelativisticConfiguration& config)
+{
+    unsigned int N = projections.size();
+    int particle_number = config.ParticleNumber();
+
+    // Number of CSFs with J = M
+    int num_stretched = N - AngularData(config, two_m + 2).projection_size();
+    if(num_stretched <= 0)
+    {   num_CSFs = 0;
+        have_CSFs = true;
+        return true;
+    }
+
+    // Box (orbital) of each particle, as in GenerateProjections()
+    std::vector<unsigned int> box_end(particle_number);
+    std::vector<int> box_twoj(particle_number);
+    int count = 0;
+    for(auto& config_it: config)
+    {
+        int num_particles = abs(config_it.second);
+        for(int i = count; i < count + num_particles; i++)
+        {   box_end[i] = count + num_particles;
+            box_twoj[i] = config_it.first.TwoJ();
+        }
+        count += num_particles;
+    }
+
+    // Projections with particles in each box sorted, so that they can be found independent of order
+    auto sort_boxes = [&](std::vector<int>& proj)
+    {
+        for(int i = 0; i < particle_number; i = box_end[i])
+            std::sort(proj.begin() + i, proj.begin() + box_end[i], std::greater<int>());
+    };
+
+    std::unordered_map<std::vector<int>, unsigned int, boost::hash<std::vector<int>>> projection_index;
+    projection_index.reserve(N);
+    for(unsigned int i = 0; i < N; i++)
+    {   std::vector<int> proj(projections[i]);
+        sort_boxes(proj);
+        projection_index[proj] = i;
+    }
+
+    std::vector<Projection> real_Projection_list;
+    real_Projection_list.reserve(N);
+    for(const auto& p: projections)
+        real_Projection_list.push_back(Projection(config, p));
+
+    ManyBodyOperator<const JSquaredOperator*, const JSquaredOperator*> J_squared(&J_squared_operator, &J_squared_operator);
+
+    // Sparse J^2: diagonal plus projections with two particles' 2M changed by +/- 2
+    std::vector<Eigen::Triplet<double>> elements;
+    std::vector<unsigned int> connected;
+    for(unsigned int i = 0; i < N; i++)
+    {
+        elements.push_back(Eigen::Triplet<double>(i, i, J_squared.GetMatrixElement(real_Projection_list[i], real_Projection_list[i])));
+
+        std::vector<int> proj(projections[i]);
+        sort_boxes(proj);
+
+        connected.clear();
+        for(int a = 0; a < particle_number; a++)
+            for(int b = 0; b < particle_number; b++)
+            {
+                if(a == b)
+                    continue;
+
+                for(int change_a: {-2, 2})
+                    for(int change_b: {-2, 2})
+                    {
+                        std::vector<int> other(proj);
+                        other[a] += change_a;
+                        other[b] += change_b;
+                        if(abs(other[a]) > box_twoj[a] || abs(other[b]) > box_twoj[b])
+                            continue;
+
+                        sort_boxes(other);
+                        auto found = projection_index.find(other);
+                        if(found != projection_index.end() && found->second > i)
+                            connected.push_back(found->second);
+                    }
+            }
+
+        std::sort(connected.begin(), connected.end());
+        auto end = std::unique(connected.begin(), connected.end());
+        for(auto it = connected.begin(); it != end; it++)
+        {
+            double matrix_element = J_squared.GetMatrixElement(real_Projection_list[i], real_Projection_list[*it]);
+            if(matrix_element)
+            {   elements.push_back(Eigen::Triplet<double>(i, *it, matrix_element));
+                elements.push_back(Eigen::Triplet<double>(*it, i, matrix_element));
+            }
+        }
+    }
+
+    // A = J^2 - M(M+1) is positive semi-definite: the null space is wanted, and all other eigenvalues
+    // are between 2(M+1) and Jmax(Jmax+1) - M(M+1). A Chebyshev polynomial in A that is bounded by 1 on this
+    // interval, but very large at zero, filters the null space from a block of random vectors.
+    double JSquared = double(two_m * (two_m + 2.)) / 4.;
+
+    int max_two_m = 0;
+    for(auto& config_it: config)
+        for(int i = 0; i < abs(config_it.second); i++)
+            max_two_m += config_it.first.TwoJ() - 2 * i;
+
+    double lower = 0.9 * (two_m + 2.);  // 2(M+1), with some room
+    double upper = 1.01 * (double(max_two_m * (max_two_m + 2.)) / 4. - JSquared) + 1.;
+    double centre = (upper + lower)/2.;
+    double half_width = (upper - lower)/2.;
+
+    // Degree so that null space is enhanced by about 1.e15 relative to the rest
+    int degree = int(35./acosh(centre/half_width)) + 1;
+
+    Eigen::SparseMatrix<double> A(N, N);
+    A.setFromTriplets(elements.begin(), elements.end());
+    elements.clear();
+    for(unsigned int i = 0; i < N; i++)
+        A.coeffRef(i, i) -= JSquared;
+
+    // Fixed seed so that all processes get the same CSFs
+    std::mt19937 generator(two_m + N);
+    std::uniform_real_distribution<double> distribution(-1., 1.);
+    Eigen::MatrixXd X(N, num_stretched);
+    for(unsigned int i = 0; i < N; i++)
+        for(int j = 0; j < num_stretched; j++)
+            X(i, j) = distribution(generator);
+
+    const int max_iterations = 4;
+    bool converged = false;
+    Eigen::MatrixXd previous, next;
+    for(int iteration = 0; iteration < max_iterations && !converged; iteration++)
+    {
+        // T_k((A - centre)/half_width) X
+        previous = X;
+        X = (A * previous - centre * previous)/half_width;
+        for(int k = 1; k < degree; k++)
+        {
+            next = (A * X - centre * X) * (2./half_width) - previous;
+            previous.swap(X);
+            X.swap(next);
+        }
+
+        Eigen::HouseholderQR<Eigen::MatrixXd> qr(X);
+        X = qr.householderQ() * Eigen::MatrixXd::Identity(N, num_stretched);
+
+        Eigen::MatrixXd residual = A * X;
+        converged = (residual.cwiseAbs().maxCoeff() < 1.e-10);
+    }
+
+    if(!converged)
+        return false;
+
+    num_CSFs = num_stretched;
+    CSFs = new double[N * num_CSFs];
+    for(unsigned int i = 0; i < N; i++)
+        for(int j = 0; j < num_CSFs; j++)
+            CSFs[i * num_CSFs + j] = X(i, j);
+
+    have_CSFs = true;
+    return true;
+}
+
 void AngularData::LadderLowering(const RelativisticConfiguration& config, const AngularData& parent)
 {
     unsigned int N = projections.size();
     this->two_j = parent.two_j;
 
     // Clear existing
-    if(CSFs)
-    {   delete[] CSFs;
-        CSFs = nullptr;
-        have_CSFs = false;
-    }
+    ClearCSFs();
 
     if(N == 0 || two_j < abs(two_m))
         return;
@@ -357,9 +595,9 @@ void AngularData::LadderLowering(const RelativisticConfiguration& config, const
                     if(box_ishole[i])
                         prefactor = -prefactor;
 
-                    for(int j = 0; j < num_CSFs; j++)
+                    for(auto parent_it = parent.CSF_begin(parent_index); parent_it != parent.CSF_end(parent_index); parent_it++)
                     {
-                        CSFs[child_index * num_CSFs + j] += prefactor * parent.CSFs[parent_index * num_CSFs + j];
+                        CSFs[child_index * num_CSFs + parent_it.index()] += prefactor * (*parent_it);
                     }
                 }
                 else
@@ -380,7 +618,7 @@ void AngularData::LadderLowering(const RelativisticConfiguration& config, const
 
 
 AngularDataLibrary::AngularDataLibrary(const std::string& lib_directory):
-    directory(lib_directory)
+    directory(lib_directory), comm(ProcessGroup)
 {
     if(!directory.empty())
     {
@@ -408,21 +646,43 @@ pAngularData AngularDataLibrary::GetData(const KeyType& key)
 {
     pAngularData& ret = library[key];
     if(ret != nullptr)
+    {   num_hits++;
         return ret;
+    }
 
-    auto file_info_key = std::make_tuple(GetElectronNumber(key), key[0].first, key[0].second);
-    if(file_info[file_info_key].second.empty())
+    if(!directory.empty())
     {
-        Read(file_info_key);
+        ret = Find(GetFile(GetElectronNumber(key), key[0].first, key[0].second), key);
+        if(ret != nullptr)
+        {   if(sparse_max_fill > 0.)
+                ret->MakeSparse(sparse_max_fill);
+            num_file_reads++;
+            return ret;
+        }
     }
 
-    if(ret != nullptr)
-        return ret;
-
+    num_misses++;
     ret = std::make_shared<AngularData>(GenerateRelConfig(key), key[0].second);
     return ret;
 }
 
+void AngularDataLibrary::FlushCounts()
+{
+    Profiler* profiler = Profiler::Instance();
+    if(profiler->Enabled())
+    {   if(num_hits)
+            profiler->AddCount("AngularData library hits", num_hits);
+        if(num_file_reads)
+            profiler->AddCount("AngularData file reads", num_file_reads);
+        if(num_misses)
+            profiler->AddCount("AngularData misses", num_misses);
+    }
+
+    num_hits = 0;
+    num_file_reads = 0;
+    num_misses = 0;
+}
+
 AngularDataLibrary::KeyType AngularDataLibrary::GenerateKey(const RelativisticConfiguration& config, const Symmetry& sym, int two_m)
 {
     KeyType key;
@@ -463,6 +723,9 @@ int AngularDataLibrary::GetElectronNumber(const KeyType& key)
 
 void AngularDataLibrary::GenerateCSFs()
 {
+    ProfileTimer timer("AngularData/GenerateCSFs");
+    FlushCounts();
+
     // First, for all keys with no CSFs, generate entries in the library with higher M,
     // recursively until CSFs are found or M = J.
     for(auto& pair: library)
@@ -481,101 +744,136 @@ void AngularDataLibrary::GenerateCSFs()
         }
     }
 
-    // Get CSFs for M = J
-#ifndef AMBIT_USE_MPI
+    // Get CSFs for M = J, largest first so that they don't hold up the end of the parallel loop
+    std::vector<std::pair<KeyType, pAngularData>> jobs;
     for(auto& pair: library)
     {
         Symmetry sym(pair.first[0].first);
         int two_m = pair.first[0].second;
-        auto& pAng = pair.second;
 
-        if(pAng->CSFs_calculated() == false && sym.GetTwoJ() == two_m)
+        if(pair.second->CSFs_calculated() == false && sym.GetTwoJ() == two_m)
         {
-            RelativisticConfiguration rconfig(GenerateRelConfig(pair.first));
-            pAng->GenerateCSFs(rconfig, two_m);
+            jobs.push_back(pair);
 
             // Set write_needed to true;
-            file_info[std::make_tuple(GetElectronNumber(pair.first), sym.GetJpi(), two_m)].first = true;
+            file_info[std::make_tuple(GetElectronNumber(pair.first), sym.GetJpi(), two_m)].write_needed = true;
         }
     }
+    std::sort(jobs.begin(), jobs.end(), ProjectionSizeFirstComparator());
+
+    // Indices of jobs for this process
+    std::vector<unsigned int> my_jobs;
+
+#ifndef AMBIT_USE_MPI
+    my_jobs.resize(jobs.size());
+    std::iota(my_jobs.begin(), my_jobs.end(), 0);
 #else
-    // Distribute AngularData objects with lots of projections (large matrix) using MPI
+    // Distribute AngularData objects with lots of projections (large matrix) using MPI;
+    // smaller ones are quicker to calculate on every process than to share.
     const unsigned int SHARING_SIZE_LIM = 200;
 
-    std::set<std::pair<KeyType, pAngularData>, ProjectionSizeFirstComparator> big_library;
+    std::vector<unsigned int> big_jobs;
+    std::vector<int> big_job_root;
 
-    for(auto& pair: library)
+    int jobcount = 0;   // jobcount will run from 0 -> 2 * NumProcessors - 1
+    for(unsigned int i = 0; i < jobs.size(); i++)
     {
-        Symmetry sym(pair.first[0].first);
-        int two_m = pair.first[0].second;
-        auto& pAng = pair.second;
-
-        if(pAng->CSFs_calculated() == false && sym.GetTwoJ() == two_m)
-        {
-            RelativisticConfiguration rconfig(GenerateRelConfig(pair.first));
-
-            if(pAng->projection_size() < SHARING_SIZE_LIM)
-                pAng->GenerateCSFs(rconfig, sym.GetTwoJ());
-            else
-                big_library.insert(pair);
-
-            // Set write_needed to true;
-            file_info[std::make_tuple(GetElectronNumber(pair.first), sym.GetJpi(), two_m)].first = true;
+        if(jobs[i].second->projection_size() < SHARING_SIZE_LIM)
+            my_jobs.push_back(i);
+        else
+        {   int root = jobcount;
+            if(root >= comm.Size())
+                root = 2 * comm.Size() - 1 - root;
+
+            big_jobs.push_back(i);
+            big_job_root.push_back(root);
+            if(root == comm.Rank())
+                my_jobs.push_back(i);
+
+            jobcount++;
+            if(jobcount >= 2 * comm.Size())
+                jobcount = 0;
         }
     }
+#endif
 
-    // Find big CSFs with M = J
-    int jobcount = 0;   // jobcount will run from 0 -> 2 * NumProcessors - 1
-    int otherRank = 2 * NumProcessors - 1 - ProcessorRank;
-
-    for(auto& pair: big_library)
+#ifdef AMBIT_USE_OPENMP
+    #pragma omp parallel for default(none) shared(jobs, my_jobs, logstream) schedule(dynamic)
+#endif
+    for(unsigned int job = 0; job < my_jobs.size(); job++)
     {
+        auto& pair = jobs[my_jobs[job]];
         Symmetry sym(pair.first[0].first);
-        auto& pAng = pair.second;
+        RelativisticConfiguration rconfig(GenerateRelConfig(pair.first));
 
-        if(jobcount == ProcessorRank || jobcount == otherRank)
+#ifdef AMBIT_USE_MPI
+        if(pair.second->projection_size() >= SHARING_SIZE_LIM)
         {
-            RelativisticConfiguration rconfig(GenerateRelConfig(pair.first));
-            *logstream << "Calculating CSF: N = " << pAng->projection_size() << " " << rconfig << std::endl;
-
-            pAng->GenerateCSFs(rconfig, sym.GetTwoJ());
+    #ifdef AMBIT_USE_OPENMP
+            #pragma omp critical(ANGULAR_DATA_LOG)
+    #endif
+            *logstream << "Calculating CSF: N = " << pair.second->projection_size() << " " << rconfig << std::endl;
         }
+#endif
 
-        jobcount++;
-        if(jobcount >= 2 * NumProcessors)
-            jobcount = 0;
+        pair.second->GenerateCSFs(rconfig, sym.GetTwoJ());
     }
 
-    // Share CSFs with all processors
-    jobcount = 0;
-    int ierr = 0;
-    for(auto& pair: big_library)
+#ifdef AMBIT_USE_MPI
+    // Share CSFs of big objects with all processors in one batch:
+    // first the number of CSFs of each object, then all of the coefficients.
+    if(big_jobs.size())
     {
-        int root = jobcount;
-        if(root >= NumProcessors)
-            root = 2 * NumProcessors - 1 - root;
-
-        auto& pAng = pair.second;
-        ierr = MPI_Barrier(MPI_COMM_WORLD);
-        ierr = MPI_Bcast(&(pAng->num_CSFs), 1, MPI_INT, root, MPI_COMM_WORLD);
+        std::vector<int> num_CSFs(big_jobs.size(), 0);
+        for(unsigned int i = 0; i < big_jobs.size(); i++)
+            if(big_job_root[i] == comm.Rank())
+                num_CSFs[i] = jobs[big_jobs[i]].second->num_CSFs;
+
+        MPI_Allreduce(MPI_IN_PLACE, num_CSFs.data(), num_CSFs.size(), MPI_INT, MPI_SUM, comm.Comm());
+
+        std::vector<int> recv_counts(comm.Size(), 0);
+        std::vector<int> displacements(comm.Size(), 0);
+        for(unsigned int i = 0; i < big_jobs.size(); i++)
+            recv_counts[big_job_root[i]] += num_CSFs[i] * jobs[big_jobs[i]].second->projection_size();
+        for(int proc = 1; proc < comm.Size(); proc++)
+            displacements[proc] = displacements[proc-1] + recv_counts[proc-1];
+
+        std::vector<double> send_buffer;
+        send_buffer.reserve(recv_counts[comm.Rank()]);
+        for(unsigned int i = 0; i < big_jobs.size(); i++)
+        {
+            if(big_job_root[i] == comm.Rank())
+            {   const AngularData& ang = *jobs[big_jobs[i]].second;
+                send_buffer.insert(send_buffer.end(), ang.CSFs, ang.CSFs + ang.num_CSFs * ang.projection_size());
+            }
+        }
 
-        int buffer_size = pAng->num_CSFs * pAng->projection_size();
+        std::vector<double> buffer(displacements.back() + recv_counts.back());
+        MPI_Allgatherv(send_buffer.data(), send_buffer.size(), MPI_DOUBLE,
+                       buffer.data(), recv_counts.data(), displacements.data(), MPI_DOUBLE, comm.Comm());
 
-        // Allocate space
-        if(jobcount != ProcessorRank && jobcount != otherRank)
+        // Unpack objects calculated by other processors
+        std::vector<int> position(displacements);
+        for(unsigned int i = 0; i < big_jobs.size(); i++)
         {
-            if(pAng->CSFs)
-                delete[] pAng->CSFs;
-
-            pAng->CSFs = new double[buffer_size];
-        }
+            int root = big_job_root[i];
+            auto& pAng = jobs[big_jobs[i]].second;
+            int buffer_size = num_CSFs[i] * pAng->projection_size();
 
-        ierr = MPI_Bcast(pAng->CSFs, buffer_size, MPI_DOUBLE, root, MPI_COMM_WORLD);
-        pAng->have_CSFs = true;
+            if(root != comm.Rank())
+            {
+                if(pAng->CSFs)
+                    delete[] pAng->CSFs;
+
+                pAng->two_j = Symmetry(jobs[big_jobs[i]].first[0].first).GetTwoJ();
+                pAng->num_CSFs = num_CSFs[i];
+                pAng->CSFs = new double[buffer_size];
+                std::copy(buffer.begin() + position[root], buffer.begin() + position[root] + buffer_size, pAng->CSFs);
+                pAng->have_CSFs = true;
+            }
 
-        jobcount++;
-        if(jobcount >= 2 * NumProcessors)
-            jobcount = 0;
+            position[root] += buffer_size;
+        }
     }
 #endif
 
@@ -609,49 +907,273 @@ void AngularDataLibrary::GenerateCSFs()
                 pAng->LadderLowering(rconfig, *parent);
 
                 // Set write_needed to true;
-                file_info[std::make_tuple(GetElectronNumber(pair.first), sym.GetJpi(), two_m)].first = true;
+                file_info[std::make_tuple(GetElectronNumber(pair.first), sym.GetJpi(), two_m)].write_needed = true;
 
                 pAng = parent;
             }
         }
     }
+
+    if(sparse_max_fill > 0.)
+    {   for(auto& pair: library)
+            if(pair.second->CSFs_calculated())
+                pair.second->MakeSparse(sparse_max_fill);
+    }
 }
 
 /** Structure of *.angular files:
     (Note: number of particles and symmetry is stored in filename)
-    - (int) number of stored AngularData objects
+    - (char[8]) AngularFileMagic
+    - (uint64_t) committed length: records past this point are incomplete and ignored
     then for each AngularData object
+        - (uint64_t) KeyHash(key)
+        - (uint64_t) record size in bytes, including these two fields
         - (int) key size = number of pairs (kappa, num particles)
         - key
         - (int) number of projections = N
+        - (int) particle number
         - projections
         - (int) numCSFs
-        - CSFs: double* (numCSFs * N)
+        - if numCSFs > 0, dense CSFs: double* (numCSFs * N)
+        - if numCSFs < 0, sparse storage of -numCSFs CSFs (see AngularData::MakeSparse()):
+            - (unsigned int) number of stored coefficients = S
+            - start of each projection: unsigned int* (N + 1)
+            - CSF indices: int* (S)
+            - coefficients: double* (S)
+    Records are never changed once committed, so reading requires no lock;
+    Write() appends under an exclusive file lock and then updates the committed length.
+
+    Version 1 files ("AMBiTAD1") have dense records only; since these are also valid version 2 records,
+    Write() converts them by updating the magic.
+    Old format files have no header or record sizes and start with the number of stored AngularData objects.
  */
-void AngularDataLibrary::Read(int electron_number, const Symmetry& sym, int two_m)
+namespace
 {
-    if(directory.empty())
-        return;
+    const char AngularFileMagic[8] = {'A', 'M', 'B', 'i', 'T', 'A', 'D', '2'};
+    const char AngularFileMagicVersion1[8] = {'A', 'M', 'B', 'i', 'T', 'A', 'D', '1'};
+    const uint64_t AngularFileHeaderSize = sizeof(AngularFileMagic) + sizeof(uint64_t);
+    const uint64_t AngularRecordHeaderSize = 2 * sizeof(uint64_t);
+
+    /** Copy from mapped memory, which has no alignment guarantee. */
+    template<class T>
+    T ReadMapped(const char*& position)
+    {   T value;
+        std::memcpy(&value, position, sizeof(T));
+        position += sizeof(T);
+        return value;
+    }
+
+    template<class T>
+    void AppendBuffer(std::vector<char>& buffer, const T* values, size_t count)
+    {   const char* bytes = reinterpret_cast<const char*>(values);
+        buffer.insert(buffer.end(), bytes, bytes + count * sizeof(T));
+    }
+}
+
+uint64_t AngularDataLibrary::KeyHash(const KeyType& key)
+{
+    // FNV-1a over the bytes of all key integers
+    uint64_t hash = 14695981039346656037ULL;
+    auto add = [&hash](int value)
+    {
+        uint32_t bits = static_cast<uint32_t>(value);
+        for(int byte = 0; byte < 4; byte++)
+        {   hash ^= (bits >> (8 * byte)) & 0xFF;
+            hash *= 1099511628211ULL;
+        }
+    };
 
-    auto& filedata = file_info[std::make_tuple(electron_number, sym.GetJpi(), two_m)];
-    std::filesystem::path& filepath = filedata.second;
+    for(const auto& pair: key)
+    {   add(pair.first);
+        add(pair.second);
+    }
+    return hash;
+}
+
+AngularDataLibrary::LibraryFile& AngularDataLibrary::GetFile(int electron_number, int jpi, int two_m)
+{
+    LibraryFile& file = file_info[std::make_tuple(electron_number, jpi, two_m)];
 
-    if(filepath.empty())
+    if(file.filepath.empty())
     {
         std::string holelike = (electron_number<0)?"h":"";
-        std::string filename = itoa(abs(electron_number)) + holelike + "." + sym.GetString() + "." + itoa(two_m) + ".angular";
+        std::string filename = itoa(abs(electron_number)) + holelike + "." + Symmetry(jpi).GetString() + "." + itoa(two_m) + ".angular";
+
+        file.filepath = directory / filename;
+    }
+
+    return file;
+}
+
+void AngularDataLibrary::UpdateIndex(LibraryFile& file)
+{
+    if(file.legacy)
+        return;
+
+    std::error_code ec;
+    uint64_t file_size = std::filesystem::file_size(file.filepath, ec);
+
+    // A file smaller than the header is empty (or still being created by another job)
+    if(ec || file_size < AngularFileHeaderSize)
+        return;
+
+    try
+    {   // Map whole file if it has grown past the mapped region
+        if(file.region.get_size() < file_size)
+        {   file.mapping = boost::interprocess::file_mapping(file.filepath.c_str(), boost::interprocess::read_only);
+            file.region = boost::interprocess::mapped_region(file.mapping, boost::interprocess::read_only);
+        }
+    }
+    catch(boost::interprocess::interprocess_exception& e)
+    {   *errstream << "AngularDataLibrary: couldn't map file " << file.filepath << ": " << e.what() << std::endl;
+        return;
+    }
+
+    const char* base = static_cast<const char*>(file.region.get_address());
+    uint64_t mapped_size = file.region.get_size();
+
+    if(std::memcmp(base, AngularFileMagicVersion1, sizeof(AngularFileMagic)) == 0)
+        file.version_1 = true;
+    else if(std::memcmp(base, AngularFileMagic, sizeof(AngularFileMagic)) != 0)
+    {   file.legacy = true;
+        return;
+    }
+
+    const char* position = base + sizeof(AngularFileMagic);
+    uint64_t committed = std::min(ReadMapped<uint64_t>(position), mapped_size);
+    if(file.indexed_length < AngularFileHeaderSize)
+        file.indexed_length = AngularFileHeaderSize;
+
+    while(file.indexed_length + AngularRecordHeaderSize <= committed)
+    {
+        position = base + file.indexed_length;
+        uint64_t hash = ReadMapped<uint64_t>(position);
+        uint64_t record_size = ReadMapped<uint64_t>(position);
+        if(record_size < AngularRecordHeaderSize || file.indexed_length + record_size > committed)
+            break;
+
+        file.index.emplace(hash, file.indexed_length);
+        file.indexed_length += record_size;
+    }
+}
+
+pAngularData AngularDataLibrary::Find(LibraryFile& file, const KeyType& key)
+{
+    if(!file.legacy)
+    {
+        uint64_t hash = KeyHash(key);
+
+        // Check for records appended since the last lookup (by this or another job)
+        if(file.index.count(hash) == 0 || file.region.get_size() < file.indexed_length)
+            UpdateIndex(file);
+
+        if(!file.legacy)
+        {
+            auto range = file.index.equal_range(hash);
+            for(auto it = range.first; it != range.second; it++)
+            {
+                pAngularData ang = ReadRecord(file, it->second, key);
+                if(ang)
+                    return ang;
+            }
+
+            return nullptr;
+        }
+    }
+
+    if(!file.legacy_read)
+    {
+        ReadLegacy(file, Symmetry(key[0].first).GetTwoJ(), key[0].second);
+
+        auto found = library.find(key);
+        if(found != library.end())
+            return found->second;
+    }
+
+    return nullptr;
+}
+
+bool AngularDataLibrary::RecordHasKey(const LibraryFile& file, uint64_t offset, const KeyType& key) const
+{
+    uint64_t key_length = (1 + 2 * key.size()) * sizeof(int);
+    if(offset + AngularRecordHeaderSize + key_length > file.region.get_size())
+        return false;
+
+    const char* position = static_cast<const char*>(file.region.get_address()) + offset + AngularRecordHeaderSize;
+
+    int key_size = ReadMapped<int>(position);
+    if(key_size != int(key.size()))
+        return false;
+
+    for(const auto& key_pair: key)
+    {
+        int kappa = ReadMapped<int>(position);
+        int num_particles = ReadMapped<int>(position);
+        if(kappa != key_pair.first || num_particles != key_pair.second)
+            return false;
+    }
+
+    return true;
+}
+
+pAngularData AngularDataLibrary::ReadRecord(const LibraryFile& file, uint64_t offset, const KeyType& key) const
+{
+    if(!RecordHasKey(file, offset, key))
+        return nullptr;
+
+    // Skip key
+    const char* position = static_cast<const char*>(file.region.get_address()) + offset + AngularRecordHeaderSize
+                           + (1 + 2 * key.size()) * sizeof(int);
+
+    pAngularData ang(new AngularData(key[0].second));
+    ang->two_j = Symmetry(key[0].first).GetTwoJ();
+
+    // Projections
+    int num_projections = ReadMapped<int>(position);
+    int particle_number = ReadMapped<int>(position);
+
+    ang->projections.resize(num_projections, std::vector<int>(particle_number));
+    for(auto& projection: ang->projections)
+    {   std::memcpy(projection.data(), position, particle_number * sizeof(int));
+        position += particle_number * sizeof(int);
+    }
 
-        filepath = directory / filename;
+    // CSFs
+    ang->num_CSFs = ReadMapped<int>(position);
+    if(ang->num_CSFs > 0)
+    {   ang->CSFs = new double[num_projections * ang->num_CSFs];
+        std::memcpy(ang->CSFs, position, num_projections * ang->num_CSFs * sizeof(double));
     }
+    else if(ang->num_CSFs < 0)
+    {   ang->num_CSFs = -ang->num_CSFs;
+        ang->sparse = true;
 
-    // Only try to get a shared file lock if the file actually exists, otherwise there's no point reading
-    if(!std::filesystem::exists(filedata.second.c_str()))
+        unsigned int num_stored = ReadMapped<unsigned int>(position);
+        ang->sparse_start.resize(num_projections + 1);
+        std::memcpy(ang->sparse_start.data(), position, (num_projections + 1) * sizeof(unsigned int));
+        position += (num_projections + 1) * sizeof(unsigned int);
+
+        ang->sparse_CSF_index.resize(num_stored);
+        std::memcpy(ang->sparse_CSF_index.data(), position, num_stored * sizeof(int));
+        position += num_stored * sizeof(int);
+
+        ang->sparse_CSFs.resize(num_stored);
+        std::memcpy(ang->sparse_CSFs.data(), position, num_stored * sizeof(double));
+    }
+    ang->have_CSFs = true;
+
+    return ang;
+}
+
+void AngularDataLibrary::ReadLegacy(LibraryFile& file, int two_j, int two_m)
+{
+    if(!std::filesystem::exists(file.filepath))
         return;
 
-    boost::interprocess::file_lock f_lock(filedata.second.c_str());
+    boost::interprocess::file_lock f_lock(file.filepath.c_str());
     boost::interprocess::sharable_lock<boost::interprocess::file_lock> shlock(f_lock);
 
-    FILE* fp = file_err_handler->fopen(filepath.string().c_str(), "rb");
+    FILE* fp = file_err_handler->fopen(file.filepath.string().c_str(), "rb");
     if(!fp)
         return;
 
@@ -678,7 +1200,7 @@ void AngularDataLibrary::Read(int electron_number, const Symmetry& sym, int two_
         }
 
         pAngularData ang(new AngularData(two_m));
-        ang->two_j = sym.GetTwoJ();
+        ang->two_j = two_j;
 
         // Projections
         int num_projections = 0;
@@ -702,17 +1224,15 @@ void AngularDataLibrary::Read(int electron_number, const Symmetry& sym, int two_
         }
         ang->have_CSFs = true;
 
-        library[key] = ang;
+        // Don't replace objects that are already in use
+        pAngularData& existing = library[key];
+        if(existing == nullptr)
+            existing = ang;
         count++;
     }
 
     file_err_handler->fclose(fp);
-    filedata.first = false;
-}
-
-void AngularDataLibrary::Read(const std::tuple<int, int, int>& file_info_key)
-{
-    return Read(std::get<0>(file_info_key), Symmetry(std::get<1>(file_info_key)), std::get<2>(file_info_key));
+    file.legacy_read = true;
 }
 
 void AngularDataLibrary::Write(int electron_number, const Symmetry& sym, int two_m)
@@ -723,98 +1243,151 @@ void AngularDataLibrary::Write(int electron_number, const Symmetry& sym, int two
     auto file_info_it = file_info.find(std::make_tuple(electron_number, sym.GetJpi(), two_m));
 
     // If symmetry not found or write not needed, stop.
-    if(file_info_it == file_info.end() || file_info_it->second.first == false)
+    if(file_info_it == file_info.end() || file_info_it->second.write_needed == false)
         return;
 
 #ifdef AMBIT_USE_MPI
-    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Barrier(comm.Comm());
 #endif
 
-    if(ProcessorRank == 0)
+    LibraryFile& file = GetFile(electron_number, sym.GetJpi(), two_m);
+
+    // Open for appending, creating the file if necessary (without truncating a file created by another job)
+    FILE* fp = nullptr;
+    if(comm.Rank() == 0)
+    {   fp = file_err_handler->fopen(file.filepath.c_str(), "ab");
+        if(!fp)
+            *errstream << "AngularDataLibrary::Couldn't open file " << file.filepath << " for writing." << std::endl;
+    }
+
+    if(fp)
     {
-        // Read any extra existing AngularData objects
-        auto& filedata = file_info_it->second;
-        if(filedata.second.empty())
-            Read(electron_number, sym, two_m);
+        file_err_handler->fclose(fp);
 
-        FILE* fp = nullptr;
-        // Create the AngularData file if it doesn't already exist
-        if(!std::filesystem::exists(filedata.second.c_str()))
-        {
-            fp = file_err_handler->fopen(filedata.second.c_str(), "wb");
-            if(!fp)
-            {   *errstream << "AngularDataLibrary::Couldn't open file " << filedata.second << " for writing." << std::endl;
-                return;
-            }
+        // Wait for exclusive file lock: only writers need it
+        boost::interprocess::file_lock f_lock(file.filepath.c_str());
+        boost::interprocess::scoped_lock<boost::interprocess::file_lock> exlock(f_lock);
+
+        // Index everything committed so far, so that objects written by other jobs aren't duplicated
+        UpdateIndex(file);
+
+        bool new_file = (file.indexed_length < AngularFileHeaderSize);
+        if(file.legacy)
+        {   // Convert: keep all old objects, then start again with the new format
+            if(!file.legacy_read)
+                ReadLegacy(file, sym.GetTwoJ(), two_m);
+            new_file = true;
         }
 
-        // Wait for exclusive file lock
-        boost::interprocess::file_lock f_lock(filedata.second.c_str());
-        boost::interprocess::scoped_lock<boost::interprocess::file_lock> shylock(f_lock);
+        // Release mapping before rewriting the file
+        if(new_file)
+        {   file.region = boost::interprocess::mapped_region();
+            file.mapping = boost::interprocess::file_mapping();
+            file.index.clear();
+            file.indexed_length = AngularFileHeaderSize;
+            file.legacy = false;
+            file.legacy_read = false;
+            file.version_1 = false;
+        }
 
-        // Open file
+        fp = file_err_handler->fopen(file.filepath.c_str(), new_file? "wb": "r+b");
         if(!fp)
+        {   *errstream << "AngularDataLibrary::Couldn't open file " << file.filepath << " for writing." << std::endl;
+        }
+        else
         {
-            fp = file_err_handler->fopen(filedata.second.c_str(), "wb");
-            if(!fp)
-            {   *errstream << "AngularDataLibrary::Couldn't open file " << filedata.second << " for writing." << std::endl;
-                return;
+            uint64_t committed = file.indexed_length;
+            if(new_file)
+            {   file_err_handler->fwrite(AngularFileMagic, sizeof(char), sizeof(AngularFileMagic), fp);
+                file_err_handler->fwrite(&committed, sizeof(uint64_t), 1, fp);
+            }
+            else if(file.version_1)
+            {   // Version 1 records are unchanged in version 2
+                file_err_handler->fwrite(AngularFileMagic, sizeof(char), sizeof(AngularFileMagic), fp);
+                file.version_1 = false;
             }
-        }
 
-        // Count number of elements with same symmetry
-        int num_angular_data_objects = 0;
-        auto symmetry_pair = std::make_pair(sym.GetJpi(), two_m);
-        for(auto& pair: library)
-        {
-            if(pair.first[0] == symmetry_pair)
-                num_angular_data_objects++;
-        }
-        file_err_handler->fwrite(&num_angular_data_objects, sizeof(int), 1, fp);
+            // Anything past the committed length is an incomplete record: overwrite it
+            fseek(fp, committed, SEEK_SET);
 
-        for(const auto& pair: library)
-        {
-            if(pair.first[0] == symmetry_pair)
+            std::vector<char> buffer;
+            for(const auto& pair: library)
             {
-                // Key
-                int key_size = pair.first.size();
-                file_err_handler->fwrite(&key_size, sizeof(int), 1, fp);
+                const KeyType& key = pair.first;
+                const AngularData& ang = *pair.second;
+                if(key[0] != std::make_pair(sym.GetJpi(), two_m) || GetElectronNumber(key) != electron_number
+                   || !ang.CSFs_calculated())
+                    continue;
+
+                // Skip if already stored
+                uint64_t hash = KeyHash(key);
+                bool stored = false;
+                auto range = file.index.equal_range(hash);
+                for(auto it = range.first; it != range.second && !stored; it++)
+                    stored = RecordHasKey(file, it->second, key);
+                if(stored)
+                    continue;
 
-                for(auto& key_pair: pair.first)
-                {
-                    file_err_handler->fwrite(&key_pair.first, sizeof(int), 1, fp);
-                    file_err_handler->fwrite(&key_pair.second, sizeof(int), 1, fp);
+                // Key
+                buffer.assign(AngularRecordHeaderSize, 0);
+                int key_size = key.size();
+                AppendBuffer(buffer, &key_size, 1);
+                for(auto& key_pair: key)
+                {   AppendBuffer(buffer, &key_pair.first, 1);
+                    AppendBuffer(buffer, &key_pair.second, 1);
                 }
 
                 // Projections
-                int num_projections = pair.second->projections.size();
-                file_err_handler->fwrite(&num_projections, sizeof(int), 1, fp);
-
+                int num_projections = ang.projections.size();
                 int particle_number = 0;
                 if(num_projections)
-                    particle_number = pair.second->projections.front().size();
-                file_err_handler->fwrite(&particle_number, sizeof(int), 1, fp);
+                    particle_number = ang.projections.front().size();
+                AppendBuffer(buffer, &num_projections, 1);
+                AppendBuffer(buffer, &particle_number, 1);
+                for(const auto& projection: ang.projections)
+                    AppendBuffer(buffer, projection.data(), particle_number);
 
-                for(const auto& projection: pair.second->projections)
-                {
-                    file_err_handler->fwrite(&projection[0], sizeof(int), particle_number, fp);
+                // CSFs
+                if(ang.sparse)
+                {   int stored_num_CSFs = -ang.num_CSFs;
+                    unsigned int num_stored = ang.sparse_CSFs.size();
+                    AppendBuffer(buffer, &stored_num_CSFs, 1);
+                    AppendBuffer(buffer, &num_stored, 1);
+                    AppendBuffer(buffer, ang.sparse_start.data(), ang.sparse_start.size());
+                    AppendBuffer(buffer, ang.sparse_CSF_index.data(), num_stored);
+                    AppendBuffer(buffer, ang.sparse_CSFs.data(), num_stored);
+                }
+                else
+                {   AppendBuffer(buffer, &ang.num_CSFs, 1);
+                    if(ang.num_CSFs)
+                        AppendBuffer(buffer, ang.CSFs, ang.num_CSFs * num_projections);
                 }
 
-                // CSFs
-                file_err_handler->fwrite(&pair.second->num_CSFs, sizeof(int), 1, fp);
-                if(pair.second->num_CSFs)
-                    file_err_handler->fwrite(pair.second->CSFs, sizeof(double), pair.second->num_CSFs * num_projections, fp);
+                uint64_t record_size = buffer.size();
+                std::memcpy(buffer.data(), &hash, sizeof(uint64_t));
+                std::memcpy(buffer.data() + sizeof(uint64_t), &record_size, sizeof(uint64_t));
+                file_err_handler->fwrite(buffer.data(), sizeof(char), buffer.size(), fp);
+
+                file.index.emplace(hash, committed);
+                committed += record_size;
             }
+
+            // Commit new records only once they are all on disk
+            fflush(fp);
+            fseek(fp, sizeof(AngularFileMagic), SEEK_SET);
+            file_err_handler->fwrite(&committed, sizeof(uint64_t), 1, fp);
+            file_err_handler->fclose(fp);
+
+            file.indexed_length = committed;
         }
-        file_err_handler->fclose(fp);
     }
 
 #ifdef AMBIT_USE_MPI
-    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Barrier(comm.Comm());
 #endif
 
     // Set write_needed to false
-    file_info_it->second.first = false;
+    file.write_needed = false;
 }
 
 void AngularDataLibrary::Write()
@@ -824,7 +1397,7 @@ void AngularDataLibrary::Write()
 
     for(auto& filedata: file_info)
     {
-        if(filedata.second.first)
+        if(filedata.second.write_needed)
             Write(std::get<0>(filedata.first), Symmetry(std::get<1>(filedata.first)), std::get<2>(filedata.first));
     }
 }
@@ -837,9 +1410,9 @@ void AngularDataLibrary::RemoveUnused()
         // Remove if library holds the only pointer to the AngularData object.
         if(it->second.use_count() == 1)
         {
-            // Remove filename (force Read() next time)
+            // Old format files must be read again next time; otherwise the record is found in the index
             auto file_info_key = std::make_tuple(GetElectronNumber(it->first), it->first[0].first, it->first[0].second);
-            file_info[file_info_key].second.clear();
+            file_info[file_info_key].legacy_read = false;
             it = library.erase(it);
         }
         else
@@ -4,11 +4,15 @@
 #include "HartreeFock/OrbitalInfo.h"
 #include "Projection.h"
 #include "Symmetry.h"
+#include "Universal/Communicator.h"
 #include <list>
 #include <unordered_map>
 #include <memory>
 #include <boost/functional/hash.hpp>
 #include <boost/iterator/iterator_facade.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstdint>
 #include <filesystem>
 
 namespace Ambit
@@ -16,6 +20,37 @@ namespace Ambit
 class RelativisticConfiguration;
 class AngularDataLibrary;
 
+/** Iterator over the CSF coefficients of a projection that also gives the index of each CSF
+    (cf. indexed_iterator). If csf_index is provided only stored (non-zero) coefficients are visited,
+    and csf_index gives their CSF indices relative to start_index; otherwise all CSFs are visited in order.
+ */
+class CSFIterator: public boost::iterator_facade<CSFIterator, const double, boost::forward_traversal_tag>
+{
+public:
+    CSFIterator(): m_value(nullptr), m_csf_index(nullptr), m_index(0) {}
+    CSFIterator(const double* value, int start_index): m_value(value), m_csf_index(nullptr), m_index(start_index) {}
+    CSFIterator(const double* value, const int* csf_index, int start_index): m_value(value), m_csf_index(csf_index), m_index(start_index) {}
+
+    int index() const { return m_csf_index? m_index + *m_csf_index: m_index; }
+    const double* base() const { return m_value; }
+
+private:
+    friend class boost::iterator_core_access;
+    const double& dereference() const { return *m_value; }
+    bool equal(const CSFIterator& other) const { return m_value == other.m_value; }
+    void increment()
+    {   m_value++;
+        if(m_csf_index)
+            m_csf_index++;
+        else
+            m_index++;
+    }
+
+    const double* m_value;
+    const int* m_csf_index;
+    int m_index;
+};
+
 /** Store projections and configuration state functions (CSF) corresponding to
     the angular part of a RelativisticConfiguration.
     Access is only provided by const iterators.
@@ -24,6 +59,7 @@ class AngularData : public std::enable_shared_from_this<AngularData>
 {
 protected:
     friend class AngularDataLibrary;
+    friend class RelativisticConfiguration;
     AngularData(int two_m);
 
 public:
@@ -34,7 +70,7 @@ public:
     ~AngularData();
 
     typedef std::vector<std::vector<int>>::const_iterator const_projection_iterator;
-    typedef const double* const_CSF_iterator;
+    typedef CSFIterator const_CSF_iterator;
 
     /** Bidirectional list iterator over list of "projections", i.e. list of std::vector<int> */
     const_projection_iterator projection_begin() const { return projections.begin(); }
@@ -44,22 +80,53 @@ public:
     /** Return whether CSFs have been calculated (or read in). */
     bool CSFs_calculated() const { return have_CSFs; }
 
-    /** Random access iterator over CSFs corresponding to projection i.
+    /** Iterator over CSFs corresponding to projection i, with CSF indices starting at start_index.
+        If IsSparse(), only non-zero coefficients are visited.
         PRE: 0 <= i <= projection_size()
      */
-    const_CSF_iterator CSF_begin(int i) const { return CSFs + i * num_CSFs; }
-    const_CSF_iterator CSF_end(int i) const { return CSFs + (i+1) * num_CSFs; }
+    const_CSF_iterator CSF_begin(int i, int start_index = 0) const
+    {   if(sparse)
+            return const_CSF_iterator(sparse_CSFs.data() + sparse_start[i], sparse_CSF_index.data() + sparse_start[i], start_index);
+        else
+            return const_CSF_iterator(CSFs + i * num_CSFs, start_index);
+    }
+    const_CSF_iterator CSF_end(int i, int start_index = 0) const
+    {   if(sparse)
+            return const_CSF_iterator(sparse_CSFs.data() + sparse_start[i+1], sparse_CSF_index.data() + sparse_start[i+1], start_index);
+        else
+            return const_CSF_iterator(CSFs + (i+1) * num_CSFs, start_index + num_CSFs);
+    }
 
     int GetTwoM() const { return two_m; }
     int GetTwoJ() const { return two_j; }
     int NumCSFs() const { return num_CSFs; }
+
+    /** Dense array of CSFs[proj * num_CSFs + csf], or nullptr if IsSparse(). */
     const double* GetCSFs() const { return CSFs; }
 
+    /** Sparse storage keeps only the non-zero CSF coefficients of each projection, with their CSF indices. */
+    bool IsSparse() const { return sparse; }
+
+    /** Change to sparse storage if no more than max_fill of the CSF coefficients are non-zero
+        (coefficients smaller than SparseTolerance are dropped). Return IsSparse().
+     */
+    bool MakeSparse(double max_fill = 0.5);
+
+    /** Change to dense storage. */
+    void MakeDense();
+
+    static constexpr double SparseTolerance = 1.e-12;
+
     /** Generate CSFs by diagonalising projections over J^2.
+        For stretched states (two_j == two_m) with more than SparseSizeLimit projections, the CSFs are
+        instead found from the null space of the sparse matrix J^2 - J(J+1), unless allow_sparse is false.
         Return number of CSFs generated with correct two_j.
         PRE: projections have been formed
      */
-    int GenerateCSFs(const RelativisticConfiguration& config, int two_j);
+    int GenerateCSFs(const RelativisticConfiguration& config, int two_j, bool allow_sparse = true);
+
+    /** Below this number of projections dense diagonalisation of J^2 is quicker. */
+    static constexpr unsigned int SparseSizeLimit = 400;
 
     /** Generate CSFs by applying J- to parent AngularData.
         The RelativisticConfiguration will be equivalent for both parent and child.
@@ -69,6 +136,14 @@ public:
 
 protected:
     int GenerateProjections(const RelativisticConfiguration& config, int two_m);
+
+    /** Generate CSFs with J = M. Since all states have J >= M, these span the null space of J^2 - M(M+1),
+        which has dimension N(M) - N(M+1) where N(M) is the number of projections.
+        J^2 only connects projections that differ by swapping one unit of M between two electrons,
+        so it is built as a sparse matrix, and the null space is found by Chebyshev-filtered subspace iteration.
+        Return false if this fails to converge, in which case no CSFs are stored.
+     */
+    bool GenerateStretchedCSFs(const RelativisticConfiguration& config);
     static bool ProjectionCompare(const std::vector<int>& first, const std::vector<int>& second);
 
     /** List of "projections": in this context, vectors of two_Ms. */
@@ -83,6 +158,18 @@ protected:
     int num_CSFs;
     int two_j;
 
+    /** Sparse storage: coefficients of projection i are sparse_CSFs[sparse_start[i] ... sparse_start[i+1]-1]
+        with CSF indices sparse_CSF_index[...]. CSFs is nullptr when sparse.
+     */
+    bool sparse;
+    std::vector<double> sparse_CSFs;
+    std::vector<int> sparse_CSF_index;
+    std::vector<unsigned int> sparse_start;
+
+    /** Remove all CSFs (dense or sparse). */
+    void ClearCSFs();
+
+
 protected:
     /** J^2 = Sum_i j_i^2 + 2 Sum_(i<j) j_i . j_j
         One-body operator = j(j+1)
@@ -137,6 +224,10 @@ typedef std::shared_ptr<const AngularData> pAngularDataConst;
         <particle_number>.<two_j>.<parity>.<two_m>.angular
     As usually specified in the Makefile, the directory is
         AMBiT/AngularData/
+    Files are append-only: each AngularData object is a record tagged with a hash of its key.
+    The files are memory-mapped and indexed by key hash, so objects are only read when requested
+    by GetData(), and Write() appends new objects without rewriting the file. Files in the old
+    (unindexed) format are read completely and converted by the next Write().
  */
 class AngularDataLibrary : public std::enable_shared_from_this<AngularDataLibrary>
 {
@@ -146,7 +237,7 @@ public:
         If lib_directory does not exist already, then this is an error so that the user can check the path specification.
      */
     AngularDataLibrary(const std::string& lib_directory = "");
-    ~AngularDataLibrary() {}
+    ~AngularDataLibrary() { FlushCounts(); }
 
     /** Retrieve or create an AngularData object for the given configuration, two_m, and two_j.
         PRE: abs(two_m) <= sym.GetTwoJ()
@@ -172,6 +263,15 @@ public:
     /** Print keys, projection_sizes and numCSFs to outstream. */
     void PrintKeys() const;
 
+    /** Store CSFs of AngularData objects sparsely (see AngularData::MakeSparse()) when no more than
+        max_fill of their coefficients are non-zero. This applies to objects generated by GenerateCSFs()
+        or read from file; max_fill = 0 (the default) keeps dense storage.
+     */
+    void SetSparseStorage(double max_fill) { sparse_max_fill = max_fill; }
+
+    /** Processes that share GenerateCSFs() and write files (default ProcessGroup). */
+    void SetCommunicator(const Communicator& communicator) { comm = communicator; }
+
 protected:
     /** KeyType[0] is pair<Symmetry.Jpi, two_M>,
         rest is pair(kappa, number of electrons) for all orbitals in RelativisticConfiguration.
@@ -187,25 +287,73 @@ protected:
 
     static int GetElectronNumber(const KeyType& key);
 
+    /** Hash of key stored in files. Unlike boost::hash, this doesn't depend on platform or library version. */
+    static uint64_t KeyHash(const KeyType& key);
+
     /** Retrieve or create an AngularData object for the given key.
      */
     pAngularData GetData(const KeyType& key);
 
-    /** Read library from file. */
-    void Read(int electron_number, const Symmetry& sym, int two_m);
-    void Read(const std::tuple<int, int, int>& file_info_key);
+    /** Details of file storage for a given tuple<num_electrons, Symmetry.Jpi, two_m>. */
+    struct LibraryFile
+    {
+        bool write_needed = false;
+        bool legacy = false;            //!< File is in the old format, without index
+        bool legacy_read = false;
+        bool version_1 = false;         //!< File has AngularFileMagic version 1 (no sparse records)
+        std::filesystem::path filepath;
+
+        boost::interprocess::file_mapping mapping;
+        boost::interprocess::mapped_region region;
+
+        uint64_t indexed_length = 0;    //!< Length of file (committed records) that has been indexed
+        std::unordered_multimap<uint64_t, uint64_t> index;  //!< KeyHash -> record offset
+    };
+
+    LibraryFile& GetFile(int electron_number, int jpi, int two_m);
+
+    /** Map the file and index any records committed since the last call (e.g. by other jobs).
+        Sets file.legacy if the file is in the old format.
+     */
+    void UpdateIndex(LibraryFile& file);
+
+    /** Find key in file, reading only its record. Return nullptr if not found. */
+    pAngularData Find(LibraryFile& file, const KeyType& key);
+
+    /** Return true if the record at offset has the given key, reading only the key.
+        Records that are not (completely) mapped don't match.
+     */
+    bool RecordHasKey(const LibraryFile& file, uint64_t offset, const KeyType& key) const;
+
+    /** Read record at offset, returning nullptr if it doesn't match key. PRE: record is mapped. */
+    pAngularData ReadRecord(const LibraryFile& file, uint64_t offset, const KeyType& key) const;
+
+    /** Read whole file in old format into library (without replacing existing objects). */
+    void ReadLegacy(LibraryFile& file, int two_j, int two_m);
 
     std::unordered_map<KeyType, pAngularData, boost::hash<KeyType>> library;
 
-    /** Details of file storage: file_info maps tuple<num_electrons, Symmetry.Jpi, two_m> to pair<write_needed, file>. */
-    std::map<std::tuple<int, int, int>, std::pair<bool, std::filesystem::path>> file_info;
+    /** Details of file storage: file_info maps tuple<num_electrons, Symmetry.Jpi, two_m> to LibraryFile. */
+    std::map<std::tuple<int, int, int>, LibraryFile> file_info;
     std::filesystem::path directory;
+    double sparse_max_fill = 0.;
+    Communicator comm;
+
+    /** Counts of GetData() hits, file reads and misses since the last FlushCounts(). */
+    unsigned long long num_hits = 0;
+    unsigned long long num_file_reads = 0;
+    unsigned long long num_misses = 0;
+
+    /** Add counts to the Profiler (if enabled) and reset them. Called by GenerateCSFs() and on destruction. */
+    void FlushCounts();
 
 protected:
     class ProjectionSizeFirstComparator
     {
     public:
-        bool operator()(const std::pair<KeyType, pAngularDataConst>& a, const std::pair<KeyType, pAngularDataConst>& b) const
+        /** PairType is pair<KeyType, pAngularData> or pair<KeyType, pAngularDataConst>. */
+        template<class PairType>
+        bool operator()(const PairType& a, const PairType& b) const
         {
             if(a.second->projection_size() > b.second->projection_size())
                 return true;
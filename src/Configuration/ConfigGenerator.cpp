@@ -552,6 +552,7 @@ void ConfigGenerator::GenerateProjections(pRelativisticConfigList rlist, const S
     }
 
     angular_library->GenerateCSFs();
+    rlist->ClearOffsets();
 
     // Write even if there are no CSFs for a given J since this is not so obvious
     angular_library->Write();
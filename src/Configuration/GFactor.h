@@ -2,7 +2,9 @@
 #define G_FACTOR_H
 
 #include "ManyBodyOperator.h"
+#include "TransitionDensity.h"
 #include "HartreeFock/Integrator.h"
+#include "Universal/MathConstant.h"
 #include "Basis/OrbitalManager.h"
 
 namespace Ambit
@@ -73,6 +75,27 @@ public:
         return val;
     }
 
+    /** Reduced matrix element < a || S || b > consistent with GetMatrixElement(), which is
+        the q = 0 component of a rank one operator.
+     */
+    inline double GetReducedMatrixElement(const OrbitalInfo& a, const OrbitalInfo& b) const
+    {
+        if(a.L() != b.L())
+            return 0.;
+
+        // Use M = 1/2, which is always non-zero for rank one
+        ElectronInfo e1(a.PQN(), a.Kappa(), 1);
+        ElectronInfo e2(b.PQN(), b.Kappa(), 1);
+
+        MathConstant* math = MathConstant::Instance();
+        double angular = math->Electron3j(e2.TwoJ(), e1.TwoJ(), 1, e2.TwoM(), -e1.TwoM());
+        if(!angular)
+            return 0.;
+        angular *= math->minus_one_to_the_power((e1.TwoJ()-e1.TwoM())/2);
+
+        return GetMatrixElement(e1, e2)/angular;
+    }
+
 protected:
     inline void IntegralOrdering(unsigned int& i1, unsigned int& i2) const
     {
@@ -89,6 +112,8 @@ typedef std::shared_ptr<const SzOperator> pSzOperatorConst;
 
 /** GFactorCalculator uses the SzOperator to calculate Lande g-factors
     for all levels of a given symmetry in a LevelMap.
+    The diagonal one-body density of all levels is built in one pass and then contracted with Sz,
+    so the cost hardly grows with the number of levels.
  */
 class GFactorCalculator
 {
@@ -98,13 +123,23 @@ public:
     {}
 
     inline void CalculateGFactors(LevelVector& levels) const
+    {
+        if(levels.levels.size() == 0 || levels.hID->GetTwoJ() == 0)
+            return;
+
+        TransitionDensity density(levels, 1);
+        CalculateGFactors(levels, density);
+    }
+
+    /** Calculate g-factors using previously calculated diagonal density of rank one. */
+    inline void CalculateGFactors(LevelVector& levels, const TransitionDensity& density) const
     {
         if(levels.levels.size() == 0 || levels.hID->GetTwoJ() == 0)
             return;
 
         double J = double(levels.hID->GetTwoJ())/2.;
 
-        std::vector<double> total_Sz = Sz.GetMatrixElement(levels);
+        std::vector<double> total_Sz = density.GetMatrixElement(*Sz);
 
         auto Sz_it = total_Sz.begin();
         auto it = levels.levels.begin();
@@ -117,7 +152,7 @@ public:
     }
 
 protected:
-    ManyBodyOperator<pSzOperatorConst> Sz;
+    pSzOperatorConst Sz;
 };
 
 }
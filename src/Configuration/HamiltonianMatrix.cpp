@@ -1,9 +1,20 @@
 #include "Include.h"
 #include "HamiltonianMatrix.h"
+#include "PackedProjectionList.h"
 #include "HartreeFock/Orbital.h"
+#include "Universal/Communicator.h"
 #include "Universal/Eigensolver.h"
 #include "Universal/MathConstant.h"
+#include "Universal/Profiler.h"
 #include "Universal/ScalapackMatrix.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
 #ifdef AMBIT_USE_MPI
 #include <mpi.h>
 #endif
@@ -11,6 +22,9 @@
 #ifdef AMBIT_USE_OPENMP
 #include<omp.h>
 #endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
 
 // Don't bother with davidson method if smaller than this limit
 #define SMALL_MATRIX_LIM 200
@@ -22,7 +36,7 @@
 namespace Ambit
 {
 HamiltonianMatrix::HamiltonianMatrix(pHFIntegrals hf, pTwoElectronCoulombOperator coulomb, pRelativisticConfigList relconfigs):
-    H_two_body(nullptr), H_three_body(nullptr), configs(relconfigs), most_chunk_rows(0)
+    comm(ProcessGroup), H_two_body(nullptr), H_three_body(nullptr), configs(relconfigs), most_chunk_rows(0)
 {
     // Set up Hamiltonian operator
     H_two_body = std::make_shared<TwoBodyHamiltonianOperator>(hf, coulomb);
@@ -49,73 +63,201 @@ HamiltonianMatrix::HamiltonianMatrix(pHFIntegrals hf, pTwoElectronCoulombOperato
     // Set up three-body operator
     H_three_body = std::make_shared<ThreeBodyHamiltonianOperator>(hf, coulomb, sigma3);
     leading_configs = leadconfigs;
+
+    // Flag leading configurations once, rather than searching for every pair of configurations
+    leading_config_flags.reserve(configs->size());
+    for(const auto& config: *configs)
+        leading_config_flags.push_back(std::binary_search(leading_configs->first.begin(), leading_configs->first.end(), NonRelConfiguration(config)));
 }
 
 HamiltonianMatrix::~HamiltonianMatrix()
-{}
+{
+    RemoveChunkFile();
+}
 
 void HamiltonianMatrix::GenerateMatrix(unsigned int configs_per_chunk)
 {
-    chunks.clear();
+    GenerateMatrices(std::vector<HamiltonianMatrix*>(1, this), configs_per_chunk);
+}
 
-    if(N <= SMALL_MATRIX_LIM)
+void HamiltonianMatrix::GenerateMatrices(const std::vector<HamiltonianMatrix*>& matrices, unsigned int configs_per_chunk)
+{
+    if(matrices.empty())
+        return;
+
+    ProfileTimer timer("HamiltonianMatrix/GenerateMatrix");
+    HamiltonianMatrix* first = matrices.front();
+    pRelativisticConfigList configs = first->configs;
+    unsigned int N = first->N;
+    unsigned int Nsmall = first->Nsmall;
+
+    for(HamiltonianMatrix* H: matrices)
     {
-        configs_per_chunk = configs->size();
+        bool same_leading_configs = (H->leading_configs == first->leading_configs)
+                || (H->leading_configs && first->leading_configs && H->leading_configs->first == first->leading_configs->first);
+        if(H->configs != configs || bool(H->H_three_body) != bool(first->H_three_body) || !same_leading_configs
+           || H->comm.Size() != first->comm.Size() || H->comm.Rank() != first->comm.Rank())
+        {   *errstream << "HamiltonianMatrix::GenerateMatrices: matrices must share configurations, leading configurations and processes." << std::endl;
+            exit(1);
+        }
+        H->chunks.clear();
+        H->most_chunk_rows = 0;
     }
 
-    // Total number of chunks = ceiling(number of configs/configs_per_chunk)
-    unsigned int total_num_chunks = (configs->size() + configs_per_chunk - 1)/configs_per_chunk;
+    // Divide up chunks: every matrix gets the same chunks.
+    // Single precision is only used for matrices that will be solved with Davidson's method.
+    std::vector<ChunkBounds> bounds = DivideChunks(*configs, configs_per_chunk);
+    for(unsigned int chunk_index = 0; chunk_index < bounds.size(); chunk_index++)
+    {
+        const ChunkBounds& current = bounds[chunk_index];
+        for(HamiltonianMatrix* H: matrices)
+        {
+            // Make chunk
+            if(int(chunk_index%first->comm.Size()) == first->comm.Rank())
+                H->chunks.emplace_back(current.config_start, current.config_end, current.start_row, current.num_rows, Nsmall,
+                                       H->single_precision && N > SMALL_MATRIX_LIM);
 
-    // Divide up chunks
-    auto config_it = configs->begin();
-    unsigned int config_index = 0;
-    unsigned int csf_start = 0;
-    for(int chunk_index = 0; chunk_index < total_num_chunks; chunk_index++)
+            H->most_chunk_rows = mmax(H->most_chunk_rows, current.num_rows);
+        }
+    }
+
+    for(HamiltonianMatrix* H: matrices)
+        if(H->IsOutOfCore())
+            H->CreateChunkFile();
+
+    // Finished chunks go to their storage: out-of-core and single-precision matrices give up the memory straight away.
+    // Only the lower triangle is ever calculated or used.
+    std::vector<std::vector<MatrixChunk>*> matrix_chunks;
+    for(HamiltonianMatrix* H: matrices)
+        matrix_chunks.push_back(&H->chunks);
+
+    CalculateChunks(matrices, matrix_chunks, [&](unsigned int chunk_index)
     {
-        // Get chunk num_rows and number of configs. Allocates resources for the chunks.
-        unsigned int current_num_rows = 0;
-        unsigned int current_num_configs = 0;
-        while(config_it != configs->end() && current_num_configs < configs_per_chunk)
+        for(HamiltonianMatrix* H: matrices)
         {
-            current_num_rows += config_it->NumCSFs();
-            current_num_configs++;
-            config_it++;
+            MatrixChunk& matrix_section = H->chunks[chunk_index];
+            if(H->IsOutOfCore() || matrix_section.single_precision)
+                H->StoreChunk(matrix_section);
         }
+    });
+}
 
-        if(current_num_rows == 0)
-            break;
+void HamiltonianMatrix::CalculateChunks(const std::vector<HamiltonianMatrix*>& matrices, const std::vector<std::vector<MatrixChunk>*>& matrix_chunks, const std::function<void(unsigned int)>& finish_chunk)
+{
+    HamiltonianMatrix* first = matrices.front();
+    pRelativisticConfigList configs = first->configs;
+    unsigned int num_matrices = matrices.size();
 
-        // Make chunk
-        if(chunk_index%NumProcessors == ProcessorRank)
-            chunks.emplace_back(config_index, config_index+current_num_configs, csf_start, current_num_rows, Nsmall);
+    const std::vector<bool>& leading_config = first->leading_config_flags;
+    bool use_three_body = bool(first->H_three_body);
 
-        config_index += current_num_configs;
-        csf_start += current_num_rows;
-        most_chunk_rows = mmax(most_chunk_rows, current_num_rows);
-    }
+    auto config_it = configs->begin();
 
     // Loop through my chunks
     RelativisticConfigList::const_iterator configsubsetend_it = configs->small_end();
     unsigned int configsubsetend = configs->small_size();
 
+    // Contiguous copy of all projections and CSFs for the loops below
+    auto packed_projections = configs->GetPackedProjections();
+    const PackedProjectionList& packed = *packed_projections;
+
     unsigned int chunk_index;
+    unsigned int num_chunks = matrix_chunks.front()->size();
 #ifdef AMBIT_USE_OPENMP
     #pragma omp parallel for default(shared) private(chunk_index, config_it) schedule(dynamic)
 #endif
-    for(chunk_index = 0; chunk_index < chunks.size(); chunk_index++)
+    for(chunk_index = 0; chunk_index < num_chunks; chunk_index++)
     {
-        auto& current_chunk = chunks[chunk_index];
-        Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>& M = current_chunk.chunk;
-        Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>& D = current_chunk.diagonal;
+        const auto& current_chunk = (*matrix_chunks.front())[chunk_index];
+        unsigned long long num_matrix_elements = 0;
+
+        for(auto* sections: matrix_chunks)
+            (*sections)[chunk_index].Allocate();
+
+        // Differences between projections are found once (by the first matrix's operator)
+        // and used for the matrix element of every matrix
+        TwoBodyHamiltonianOperator::IndirectProjectionStruct two_body_differences;
+        ThreeBodyHamiltonianOperator::IndirectProjectionStruct three_body_differences;
+        std::vector<double> operatorH(num_matrices);
+
+        // Add operatorH[k] * <proj_i|CSF_i> <proj_j|CSF_j> to lower triangle of each matrix (offset by row_offset and col_offset)
+        auto add_projection_pair = [&](bool diagonal_section, int row_offset, int col_offset, unsigned int proj_i, unsigned int proj_j)
+        {
+            auto proj_it = packed[proj_i];
+            auto proj_jt = packed[proj_j];
+
+            for(auto coeff_i = proj_it.CSF_begin(); coeff_i != proj_it.CSF_end(); coeff_i++)
+            {
+                RelativisticConfigList::const_CSF_iterator start_j = proj_jt.CSF_begin();
+
+                if(proj_i == proj_j)
+                    start_j = coeff_i;
+
+                for(auto coeff_j = start_j; coeff_j != proj_jt.CSF_end(); coeff_j++)
+                {
+                    // See notes for an explanation
+                    int i = coeff_i.index();
+                    int j = coeff_j.index();
+                    double angular = (*coeff_i) * (*coeff_j);
+
+                    int row, col;
+                    if(i > j)
+                    {   row = i - row_offset;
+                        col = j - col_offset;
+                    }
+                    else if(i < j)
+                    {   row = j - row_offset;
+                        col = i - col_offset;
+                    }
+                    else
+                    {   row = i - row_offset;
+                        col = j - col_offset;
+                        if(proj_i != proj_j)
+                            angular *= 2.;
+                    }
+
+                    for(unsigned int k = 0; k < num_matrices; k++)
+                    {
+                        auto& section = (*matrix_chunks[k])[chunk_index];
+                        RowMajorMatrix& matrix = diagonal_section? section.diagonal: section.chunk;
+                        matrix(row, col) += operatorH[k] * angular;
+                    }
+                }
+            }
+        };
+
+        // Get matrix elements of all operators; return false if they are all negligible
+        auto get_matrix_elements = [&](unsigned int proj_i, unsigned int proj_j, bool do_three_body)
+        {
+            bool nonzero = false;
+            if(do_three_body)
+            {
+                int num_diffs = first->H_three_body->FindDifferences(packed[proj_i], packed[proj_j], three_body_differences);
+                for(unsigned int k = 0; k < num_matrices; k++)
+                {   operatorH[k] = matrices[k]->H_three_body->GetMatrixElement(three_body_differences, num_diffs);
+                    nonzero = nonzero || (fabs(operatorH[k]) > 1.e-15);
+                }
+            }
+            else
+            {
+                int num_diffs = first->H_two_body->FindDifferences(packed[proj_i], packed[proj_j], two_body_differences);
+                for(unsigned int k = 0; k < num_matrices; k++)
+                {   operatorH[k] = matrices[k]->H_two_body->GetMatrixElement(two_body_differences, num_diffs);
+                    nonzero = nonzero || (fabs(operatorH[k]) > 1.e-15);
+                }
+            }
+            return nonzero;
+        };
 
         // Loop through configs for this chunk
         config_it = (*configs)[current_chunk.config_indices.first];
         for(unsigned int config_index = current_chunk.config_indices.first; config_index < current_chunk.config_indices.second; config_index++)
         {
-            bool leading_config_i = H_three_body && std::binary_search(leading_configs->first.begin(), leading_configs->first.end(), NonRelConfiguration(*config_it));
+            bool leading_config_i = use_three_body && leading_config[config_index];
 
             // Loop through the rest of the configs
             auto config_jt = configs->begin();
+            unsigned int config_jndex = 0;
             RelativisticConfigList::const_iterator config_jend;
             if(config_index < configsubsetend)
             {   config_jend = config_it;
@@ -126,67 +268,36 @@ void HamiltonianMatrix::GenerateMatrix(unsigned int configs_per_chunk)
 
             while(config_jt != config_jend)
             {
-                bool leading_config_j = H_three_body && std::binary_search(leading_configs->first.begin(), leading_configs->first.end(), NonRelConfiguration(*config_jt));
-
+                bool leading_config_j = use_three_body && leading_config[config_jndex];
                 int config_diff_num = config_it->GetConfigDifferencesCount(*config_jt);
                 bool do_three_body = (leading_config_i || leading_config_j) && (config_diff_num <= 3);
 
                 // Check that the number of differences is small enough
                 if(do_three_body || (config_diff_num <= 2))
                 {
+                    unsigned int max_diffs = (do_three_body? 3: 2);
+
                     // Loop through projections
-                    auto proj_it = config_it.projection_begin();
-                    while(proj_it != config_it.projection_end())
+                    for(unsigned int proj_i = packed.projection_begin(config_index); proj_i < packed.projection_end(config_index); proj_i++)
                     {
-                        RelativisticConfiguration::const_projection_iterator proj_jt;
-                        if(config_jt == config_it)
-                            proj_jt = proj_it;
-                        else
-                            proj_jt = config_jt.projection_begin();
+                        unsigned int proj_j = packed.projection_begin(config_jndex);
+                        if(config_jndex == config_index)
+                            proj_j = proj_i;
 
-                        while(proj_jt != config_jt.projection_end())
+                        for(; proj_j < packed.projection_end(config_jndex); proj_j++)
                         {
-                            double operatorH;
-                            if(do_three_body)
-                            {
-                                operatorH = H_three_body->GetMatrixElement(*proj_it, *proj_jt);
-                            }
-                            else
-                            {
-                                operatorH = H_two_body->GetMatrixElement(*proj_it, *proj_jt);
-                            }
-                            if(fabs(operatorH) > 1.e-15)
-                            {
-                                for(auto coeff_i = proj_it.CSF_begin(); coeff_i != proj_it.CSF_end(); coeff_i++)
-                                {
-                                    RelativisticConfigList::const_CSF_iterator start_j = proj_jt.CSF_begin();
-
-                                    if(proj_it == proj_jt)
-                                        start_j = coeff_i;
-
-                                    for(auto coeff_j = start_j; coeff_j != proj_jt.CSF_end(); coeff_j++)
-                                    {
-                                        // See notes for an explanation
-                                        int i = coeff_i.index();
-                                        int j = coeff_j.index();
-
-                                        if(i > j)
-                                            M(i - current_chunk.start_row, j) += operatorH * (*coeff_i) * (*coeff_j);
-                                        else if(i < j)
-                                            M(j - current_chunk.start_row, i) += operatorH * (*coeff_i) * (*coeff_j);
-                                        else if(proj_it == proj_jt)
-                                            M(i - current_chunk.start_row, j) += operatorH * (*coeff_i) * (*coeff_j);
-                                        else
-                                            M(i - current_chunk.start_row, j) += 2. * operatorH * (*coeff_i) * (*coeff_j);
-                                    }
-                                }
-                            }
-                            proj_jt++;
+                            // Skip pairs of projections with too many differences using packed records
+                            if(!packed.WithinDifferences(proj_i, proj_j, max_diffs))
+                                continue;
+
+                            num_matrix_elements += num_matrices;
+                            if(get_matrix_elements(proj_i, proj_j, do_three_body))
+                                add_projection_pair(false, current_chunk.start_row, 0, proj_i, proj_j);
                         }
-                        proj_it++;
                     }
                 }
                 config_jt++;
+                config_jndex++;
             }
 
             // Diagonal
@@ -195,72 +306,393 @@ void HamiltonianMatrix::GenerateMatrix(unsigned int configs_per_chunk)
                 int diag_offset = current_chunk.start_row + current_chunk.num_rows - current_chunk.diagonal.rows();
 
                 // Loop through projections
-                auto proj_it = config_it.projection_begin();
-                while(proj_it != config_it.projection_end())
+                for(unsigned int proj_i = packed.projection_begin(config_index); proj_i < packed.projection_end(config_index); proj_i++)
                 {
-                    RelativisticConfiguration::const_projection_iterator proj_jt = proj_it;
-
-                    while(proj_jt != config_it.projection_end())
+                    for(unsigned int proj_j = proj_i; proj_j < packed.projection_end(config_index); proj_j++)
                     {
-                        double operatorH = H_two_body->GetMatrixElement(*proj_it, *proj_jt);
+                        if(!packed.WithinDifferences(proj_i, proj_j, 2))
+                            continue;
 
-                        if(fabs(operatorH) > 1.e-15)
-                        {
-                            for(auto coeff_i = proj_it.CSF_begin(); coeff_i != proj_it.CSF_end(); coeff_i++)
-                            {
-                                RelativisticConfigList::const_CSF_iterator start_j = proj_jt.CSF_begin();
-
-                                if(proj_it == proj_jt)
-                                    start_j = coeff_i;
-
-                                for(auto coeff_j = start_j; coeff_j != proj_jt.CSF_end(); coeff_j++)
-                                {
-                                    // See notes for an explanation
-                                    int i = coeff_i.index();
-                                    int j = coeff_j.index();
-
-                                    if(i > j)
-                                        D(i - diag_offset, j - diag_offset) += operatorH * (*coeff_i) * (*coeff_j);
-                                    else if(i < j)
-                                        D(j - diag_offset, i - diag_offset) += operatorH * (*coeff_i) * (*coeff_j);
-                                    else if(proj_it == proj_jt)
-                                        D(i - diag_offset, j - diag_offset) += operatorH * (*coeff_i) * (*coeff_j);
-                                    else
-                                        D(i - diag_offset, j - diag_offset) += 2. * operatorH * (*coeff_i) * (*coeff_j);
-                                }
-                            }
-                        }
-                        proj_jt++;
+                        num_matrix_elements += num_matrices;
+                        if(get_matrix_elements(proj_i, proj_j, false))
+                            add_projection_pair(true, diag_offset, diag_offset, proj_i, proj_j);
                     }
-                    proj_it++;
                 }
             }
             config_it++;
         } // Configs in chunk
+
+        finish_chunk(chunk_index);
+
+        if(Profiler::Instance()->Enabled())
+            Profiler::Instance()->AddCount("Hamiltonian matrix elements evaluated", num_matrix_elements);
     } // Chunks
+}
+
+void HamiltonianMatrix::SetOutOfCore(const std::string& directory)
+{
+    if(!directory.empty() && !std::filesystem::is_directory(directory))
+    {   *errstream << "HamiltonianMatrix: out-of-core directory " << directory << " does not exist." << std::endl;
+        exit(1);
+    }
+
+    chunk_directory = directory;
+}
 
+void HamiltonianMatrix::CreateChunkFile()
+{
+    RemoveChunkFile();
+
+    // Chunks start on page boundaries so that each can be mapped separately
+    uint64_t page_size = boost::interprocess::mapped_region::get_page_size();
+    uint64_t file_size = 0;
     for(auto& matrix_section: chunks)
-        matrix_section.Symmetrize();
+    {
+        matrix_section.file_offset = file_size;
+        uint64_t chunk_size = matrix_section.StorageSize();
+        file_size += (chunk_size + page_size - 1)/page_size * page_size;
+    }
+
+    if(file_size == 0)
+        return;
+
+    std::error_code ec;
+    std::filesystem::space_info space = std::filesystem::space(chunk_directory, ec);
+    if(!ec && space.available < file_size)
+    {   *errstream << "HamiltonianMatrix: not enough space in " << chunk_directory << " for out-of-core matrix ("
+                   << file_size/(1024. * 1024.) << " MB needed)." << std::endl;
+        exit(1);
+    }
+
+    // File name unique to this matrix, even between jobs sharing the directory
+    std::string filename = "hamiltonian." + itoa(ProcessorRank) + ".";
+#if defined(__unix__) || defined(__APPLE__)
+    std::string name_template = (std::filesystem::path(chunk_directory) / (filename + "XXXXXX")).string();
+    int fd = mkstemp(&name_template[0]);
+    if(fd < 0)
+    {   *errstream << "HamiltonianMatrix: couldn't create out-of-core file in " << chunk_directory << ": "
+                   << std::strerror(errno) << std::endl;
+        exit(1);
+    }
+    close(fd);
+    chunk_filename = name_template;
+#else
+    static std::atomic<unsigned int> file_count(0);
+    chunk_filename = (std::filesystem::path(chunk_directory) / (filename + itoa(file_count++) + ".chunks")).string();
+#endif
+
+    try
+    {   std::ofstream create(chunk_filename, std::ios::binary | std::ios::trunc);
+        create.close();
+        std::filesystem::resize_file(chunk_filename, file_size);
+        chunk_file = boost::interprocess::file_mapping(chunk_filename.c_str(), boost::interprocess::read_write);
+    }
+    catch(std::exception& e)
+    {   *errstream << "HamiltonianMatrix: couldn't create out-of-core file " << chunk_filename << ": " << e.what() << std::endl;
+        exit(1);
+    }
+}
+
+void HamiltonianMatrix::StoreChunk(MatrixChunk& matrix_section)
+{
+    if(matrix_section.single_precision)
+        matrix_section.chunk_float = matrix_section.chunk.cast<float>();
+
+    std::size_t chunk_size = matrix_section.StorageSize();
+    if(IsOutOfCore() && chunk_size)
+    {
+        try
+        {   matrix_section.region = std::make_shared<boost::interprocess::mapped_region>(chunk_file, boost::interprocess::read_write, matrix_section.file_offset, chunk_size);
+        }
+        catch(boost::interprocess::interprocess_exception& e)
+        {   *errstream << "HamiltonianMatrix: couldn't map out-of-core file " << chunk_filename << ": " << e.what() << std::endl;
+            exit(1);
+        }
+
+        if(matrix_section.single_precision)
+        {   std::memcpy(matrix_section.region->get_address(), matrix_section.chunk_float.data(), chunk_size);
+            matrix_section.chunk_float = RowMajorMatrixFloat();
+        }
+        else
+            std::memcpy(matrix_section.region->get_address(), matrix_section.chunk.data(), chunk_size);
+
+        // Start writing to disk and let the pages go; chunks are read in order by MatrixMultiply()
+        matrix_section.region->flush(0, 0, true);
+        matrix_section.region->advise(boost::interprocess::mapped_region::advice_dontneed);
+        matrix_section.region->advise(boost::interprocess::mapped_region::advice_sequential);
+    }
+
+    matrix_section.chunk = RowMajorMatrix();
+}
+
+void HamiltonianMatrix::RemoveChunkFile()
+{
+    chunk_file = boost::interprocess::file_mapping();
+    if(!chunk_filename.empty())
+    {   // Mapped chunks remain valid until they are unmapped
+        std::error_code ec;
+        std::filesystem::remove(chunk_filename, ec);
+        chunk_filename.clear();
+    }
+}
+
+std::vector<HamiltonianMatrix::ChunkBounds> HamiltonianMatrix::DivideChunks(const RelativisticConfigList& configs, unsigned int configs_per_chunk)
+{
+    if(configs.NumCSFs() <= SMALL_MATRIX_LIM)
+        configs_per_chunk = configs.size();
+
+    std::vector<ChunkBounds> bounds;
+    unsigned int config_index = 0;
+    unsigned int csf_start = 0;
+    auto config_it = configs.begin();
+    while(config_it != configs.end())
+    {
+        // Get chunk num_rows and number of configs
+        ChunkBounds chunk = {config_index, config_index, csf_start, 0};
+        while(config_it != configs.end() && chunk.config_end - chunk.config_start < configs_per_chunk)
+        {
+            chunk.num_rows += config_it->NumCSFs();
+            chunk.config_end++;
+            config_it++;
+        }
+
+        if(chunk.num_rows == 0)
+            break;
+
+        bounds.push_back(chunk);
+        config_index = chunk.config_end;
+        csf_start += chunk.num_rows;
+    }
+
+    return bounds;
+}
+
+std::vector<unsigned long long> HamiltonianMatrix::CountMatrixElements() const
+{
+    unsigned int num_configs = configs->size();
+    unsigned int small_size = configs->small_size();
+    bool use_three_body = bool(H_three_body);
+
+    std::vector<unsigned long long> proj_size(num_configs);
+    unsigned int index = 0;
+    for(auto config_it = configs->begin(); config_it != configs->end(); config_it++, index++)
+        proj_size[index] = config_it->projection_size();
+
+    // Same loops as GenerateMatrices()
+    std::vector<unsigned long long> counts(num_configs, 0);
+#ifdef AMBIT_USE_OPENMP
+    #pragma omp parallel for schedule(dynamic)
+#endif
+    for(unsigned int i = 0; i < num_configs; i++)
+    {
+        auto config_it = (*configs)[i];
+        auto config_jt = configs->begin();
+        unsigned int j_end = (i < small_size)? i + 1: small_size;
+
+        for(unsigned int j = 0; j < j_end; j++, config_jt++)
+        {
+            int config_diff_num = config_it->GetConfigDifferencesCount(*config_jt);
+            if(config_diff_num <= 2 || (use_three_body && (leading_config_flags[i] || leading_config_flags[j]) && config_diff_num <= 3))
+                counts[i] += (i == j)? proj_size[i] * (proj_size[i] + 1)/2: proj_size[i] * proj_size[j];
+        }
+
+        // Diagonal
+        if(i >= small_size)
+            counts[i] += proj_size[i] * (proj_size[i] + 1)/2;
+    }
+
+    return counts;
+}
+
+double HamiltonianMatrix::TimeMatrixElements(unsigned int num_samples) const
+{
+    std::vector<unsigned long long> counts = CountMatrixElements();
+    unsigned long long total = std::accumulate(counts.begin(), counts.end(), 0ULL);
+    if(total == 0 || num_samples == 0)
+        return 0.;
+
+    auto packed_projections = configs->GetPackedProjections();
+    const PackedProjectionList& packed = *packed_projections;
+    unsigned int small_size = configs->small_size();
+    bool use_three_body = bool(H_three_body);
+
+    // Choose every stride'th projection pair in the order counted by CountMatrixElements()
+    struct Sample
+    {   unsigned int proj_i;
+        unsigned int proj_j;
+        bool three_body;
+    };
+    std::vector<Sample> samples;
+    samples.reserve(num_samples);
+
+    unsigned long long stride = mmax(total/num_samples, 1ULL);
+    unsigned long long position = 0;
+    unsigned long long next_sample = stride/2;
+
+    // Add samples from the n projection pairs of configs i and j
+    auto add_samples = [&](unsigned int i, unsigned int j, unsigned long long n, bool three_body)
+    {
+        unsigned long long size_j = packed.projection_end(j) - packed.projection_begin(j);
+        while(next_sample < position + n && samples.size() < num_samples)
+        {
+            unsigned long long k = next_sample - position;
+            unsigned int proj_i = packed.projection_begin(i) + k/size_j;
+            unsigned int proj_j = packed.projection_begin(j) + k%size_j;
+            if(i == j && proj_j < proj_i)
+                std::swap(proj_i, proj_j);
+
+            samples.push_back({proj_i, proj_j, three_body});
+            next_sample += stride;
+        }
+        position += n;
+    };
+
+    auto config_it = configs->begin();
+    for(unsigned int i = 0; i < configs->size() && samples.size() < num_samples; i++, config_it++)
+    {
+        unsigned long long size_i = packed.projection_end(i) - packed.projection_begin(i);
+        bool leading_config_i = use_three_body && leading_config_flags[i];
+        unsigned int j_end = (i < small_size)? i + 1: small_size;
+
+        auto config_jt = configs->begin();
+        for(unsigned int j = 0; j < j_end; j++, config_jt++)
+        {
+            bool leading_config_j = use_three_body && leading_config_flags[j];
+            int config_diff_num = config_it->GetConfigDifferencesCount(*config_jt);
+            bool do_three_body = (leading_config_i || leading_config_j) && (config_diff_num <= 3);
+
+            if(do_three_body || config_diff_num <= 2)
+            {
+                unsigned long long size_j = packed.projection_end(j) - packed.projection_begin(j);
+                add_samples(i, j, (i == j)? size_i * (size_i + 1)/2: size_i * size_j, do_three_body);
+            }
+        }
+
+        if(i >= small_size)
+            add_samples(i, i, size_i * (size_i + 1)/2, false);
+    }
+
+    // Time the samples as GenerateMatrices() does them
+    TwoBodyHamiltonianOperator::IndirectProjectionStruct two_body_differences;
+    ThreeBodyHamiltonianOperator::IndirectProjectionStruct three_body_differences;
+    double sum = 0.;
+
+    auto start = std::chrono::steady_clock::now();
+    for(const Sample& sample: samples)
+    {
+        if(!packed.WithinDifferences(sample.proj_i, sample.proj_j, sample.three_body? 3: 2))
+            continue;
+
+        if(sample.three_body)
+        {   int num_diffs = H_three_body->FindDifferences(packed[sample.proj_i], packed[sample.proj_j], three_body_differences);
+            sum += H_three_body->GetMatrixElement(three_body_differences, num_diffs);
+        }
+        else
+        {   int num_diffs = H_two_body->FindDifferences(packed[sample.proj_i], packed[sample.proj_j], two_body_differences);
+            sum += H_two_body->GetMatrixElement(two_body_differences, num_diffs);
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    // Keep the compiler from dropping the matrix elements
+    volatile double sink = sum;
+    (void)sink;
+
+    return samples.size()? elapsed.count()/samples.size(): 0.;
+}
+
+HamiltonianMatrix::GenerationEstimate HamiltonianMatrix::EstimateGeneration(const std::vector<unsigned long long>& config_elements, unsigned int configs_per_chunk, int num_processes, int num_threads) const
+{
+    std::vector<ChunkBounds> bounds = DivideChunks(*configs, configs_per_chunk);
+    std::vector<double> memory(num_processes, 0.);
+    std::vector<double> elements(num_processes, 0.);
+    std::vector<double> largest_chunk(num_processes, 0.);
+    double element_size = (single_precision && N > SMALL_MATRIX_LIM)? sizeof(float): sizeof(double);
+
+    for(unsigned int chunk_index = 0; chunk_index < bounds.size(); chunk_index++)
+    {
+        const ChunkBounds& chunk = bounds[chunk_index];
+        int proc = chunk_index%num_processes;
+
+        // Same sizes as MatrixChunk
+        double size = double(chunk.num_rows) * mmin(chunk.start_row + chunk.num_rows, Nsmall) * element_size;
+        if(Nsmall < chunk.start_row + chunk.num_rows)
+        {   double diagonal_size = mmin(chunk.num_rows, chunk.start_row + chunk.num_rows - Nsmall);
+            size += diagonal_size * diagonal_size * sizeof(double);
+        }
+        memory[proc] += size/(1024. * 1024.);
+
+        double chunk_elements = std::accumulate(config_elements.begin() + chunk.config_start, config_elements.begin() + chunk.config_end, 0.);
+        elements[proc] += chunk_elements;
+        largest_chunk[proc] = mmax(largest_chunk[proc], chunk_elements);
+    }
+
+    // Threads take chunks dynamically, but can't share a chunk
+    GenerationEstimate estimate;
+    estimate.num_chunks = bounds.size();
+    estimate.max_memory_MB = *std::max_element(memory.begin(), memory.end());
+    estimate.total_memory_MB = std::accumulate(memory.begin(), memory.end(), 0.);
+    estimate.elapsed_elements = 0.;
+    for(int proc = 0; proc < num_processes; proc++)
+        estimate.elapsed_elements = mmax(estimate.elapsed_elements, mmax(elements[proc]/num_threads, largest_chunk[proc]));
+
+    return estimate;
+}
+
+double HamiltonianMatrix::SolveMemoryMB(unsigned int N, unsigned int num_solutions, bool single_precision, int num_threads)
+{
+    // Eigen solvers copy the matrix and make all eigenvectors, otherwise Davidson
+    double memory;
+    double product_columns = 0.;
+    if(N <= SMALL_MATRIX_LIM || num_solutions > MANY_LEVELS_LIM)
+        memory = 2. * N * N * sizeof(double)/(1024. * 1024.);
+    else
+    {   memory = Eigensolver::DavidsonMemoryMB(N, num_solutions);
+        product_columns = num_solutions;
+    }
+
+    // RefineSolutions(): basis, its product with H and residuals, all of up to 2 * num_solutions columns
+    bool refine = MaxRefineIterations(N, single_precision);
+    if(refine)
+    {   product_columns = 2. * num_solutions;
+        memory += 3. * N * product_columns * sizeof(double)/(1024. * 1024.);
+    }
+
+    // Products of each thread kept by MatrixMultiply() and MatrixFreeMultiply()
+    if(num_threads > 1 || refine)
+        memory += double(num_threads) * N * product_columns * sizeof(double)/(1024. * 1024.);
+
+    return memory;
+}
+
+unsigned int HamiltonianMatrix::MaxRefineIterations(unsigned int N, bool single_precision)
+{
+    return (single_precision && N > SMALL_MATRIX_LIM)? 4: 0;
 }
 
 LevelVector HamiltonianMatrix::SolveMatrix(pHamiltonianID hID, unsigned int num_solutions)
 {
+    ProfileTimer timer("HamiltonianMatrix/SolveMatrix");
     LevelVector levelvec(hID);
     levelvec.configs = configs;
 
     unsigned int NumSolutions = mmin(num_solutions, N);
 
+    // Single-precision matrices are refined against the double-precision matrix
+    bool refine = single_precision && N > SMALL_MATRIX_LIM;
+
     if(NumSolutions == 0)
     {
         *outstream << "\nNo solutions" << std::endl;
     }
     else
-    {   if(N <= SMALL_MATRIX_LIM && NumProcessors == 1 && Nsmall == N)
+    {   if(N <= SMALL_MATRIX_LIM && comm.Size() == 1 && Nsmall == N)
         {
             *outstream << "; Finding solutions using Eigen..." << std::endl;
             levelvec.levels.reserve(NumSolutions);
 
-            Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(chunks.front().chunk);
+            // Eigen only uses the lower triangle
+            Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(chunks.front().ChunkDouble());
             const Eigen::VectorXd& E = es.eigenvalues();
             const Eigen::MatrixXd& V = es.eigenvectors();
 
@@ -277,12 +709,15 @@ LevelVector HamiltonianMatrix::SolveMatrix(pHamiltonianID hID, unsigned int num_
             RowMajorMatrix M = RowMajorMatrix::Zero(N, N);
             for(auto& chunk: chunks)
             {
-                M.block(chunk.start_row, 0, chunk.chunk.rows(), chunk.chunk.cols()) = chunk.chunk;
+                M.block(chunk.start_row, 0, chunk.num_rows, chunk.num_cols) = chunk.ChunkDouble();
             }
 
             Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(M);
-            const Eigen::VectorXd& E = es.eigenvalues();
-            const Eigen::MatrixXd& V = es.eigenvectors();
+            Eigen::VectorXd E = es.eigenvalues().head(NumSolutions);
+            Eigen::MatrixXd V = es.eigenvectors().leftCols(NumSolutions);
+
+            if(refine)
+                RefineSolutions(E.data(), V.data(), NumSolutions);
 
             for(unsigned int i = 0; i < NumSolutions; i++)
             {
@@ -291,18 +726,22 @@ LevelVector HamiltonianMatrix::SolveMatrix(pHamiltonianID hID, unsigned int num_
         }
         else
         {   *outstream << "; Finding solutions using Davidson..." << std::endl;
+            ProfileTimer davidson_timer("Davidson");
             levelvec.levels.reserve(NumSolutions);
 
             double* V = new double[NumSolutions * N];
             double* E = new double[NumSolutions];
 
-            Eigensolver solver;
+            Eigensolver solver(comm);
             #ifdef AMBIT_USE_MPI
                 solver.MPISolveLargeSymmetric(this, E, V, N, NumSolutions);
             #else
                 solver.SolveLargeSymmetric(this, E, V, N, NumSolutions);
             #endif
 
+            if(refine)
+                RefineSolutions(E, V, NumSolutions);
+
             for(unsigned int i = 0; i < NumSolutions; i++)
             {
                 levelvec.levels.push_back(std::make_shared<Level>(E[i], (V + N * i), hID, N));
@@ -333,17 +772,17 @@ LevelVector HamiltonianMatrix::SolveMatrixScalapack(pHamiltonianID hID, unsigned
     {   *outstream << "; Finding solutions using ScaLAPACK ..." << std::endl;
 
         // Write temporary matrix file, clear current Hamiltonian to make space,
-        // then read in to ScalapackMatrix
+        // then read in to ScalapackMatrix (named by symmetry since groups of processes may be solving others)
         char* jobid = getenv("PBS_JOBID");
         std::string filename = "temp";
         if(jobid)
             filename += jobid;
-        filename += ".matrix";
+        filename += "." + hID->Name() + ".matrix";
 
         Write(filename);
         Clear();
 
-        ScalapackMatrix SM(N);
+        ScalapackMatrix SM(N, comm);
         SM.ReadLowerTriangle(filename);
 
         // Diagonalise
@@ -393,13 +832,15 @@ std::ostream& operator<<(std::ostream& stream, const HamiltonianMatrix& matrix)
 {
     for(auto& matrix_section: matrix.chunks)
     {
+        HamiltonianMatrix::RowMajorMatrix chunk = matrix_section.ChunkDouble();
+
         // Each row separately
         for(unsigned int row = 0; row < matrix_section.num_rows; row++)
         {
             int cols = mmin(matrix_section.start_row + row + 1, matrix.Nsmall);
 
             // Lower triangular matrix part of row
-            stream << matrix_section.chunk.block(row, 0, 1, cols) << " ";
+            stream << chunk.block(row, 0, 1, cols) << " ";
 
             // Trailing zeros
             stream << Eigen::VectorXd::Zero(matrix.Nsmall - cols).transpose() << "\n";
@@ -417,13 +858,14 @@ void HamiltonianMatrix::Write(const std::string& filename) const
     auto chunk_it = chunks.begin();
 
     // Send rows to root node, which writes them sequentially.
-    if(ProcessorRank == 0)
+    if(comm.Rank() == 0)
     {
         // Write size of matrix.
         fp = file_err_handler->fopen(filename.c_str(), "wb");
         file_err_handler->fwrite(&N, sizeof(unsigned int), 1, fp);
         const double* pbuf;
         const double* pdiag;
+        RowMajorMatrix current_chunk;
         std::vector<double> zeros(N-Nsmall, 0.);
 
     #ifdef AMBIT_USE_MPI
@@ -441,7 +883,8 @@ void HamiltonianMatrix::Write(const std::string& filename) const
             if(row == chunk_it->start_row)
             {
                 num_rows = chunk_it->num_rows;
-                pbuf = chunk_it->chunk.data();
+                current_chunk = chunk_it->ChunkDouble();
+                pbuf = current_chunk.data();
                 diag_rows = chunk_it->diagonal.rows();
                 pdiag = chunk_it->diagonal.data();
                 chunk_it++;
@@ -449,11 +892,11 @@ void HamiltonianMatrix::Write(const std::string& filename) const
         #ifdef AMBIT_USE_MPI
             else
             {   // Broadcast row number
-                MPI_Bcast(&row, 1, MPI_INT, 0, MPI_COMM_WORLD);
+                MPI_Bcast(&row, 1, MPI_INT, 0, comm.Comm());
 
                 // Receive chunk
                 MPI_Status status;
-                MPI_Recv(&buf, Nsmall*most_chunk_rows, MPI_DOUBLE, MPI_ANY_SOURCE, row, MPI_COMM_WORLD, &status);
+                MPI_Recv(&buf, Nsmall*most_chunk_rows, MPI_DOUBLE, MPI_ANY_SOURCE, row, comm.Comm(), &status);
 
                 // Get number of rows in chunk
                 int data_count;
@@ -473,7 +916,7 @@ void HamiltonianMatrix::Write(const std::string& filename) const
                 // Receive diagonal
                 if(row + num_rows > Nsmall)
                 {
-                    MPI_Recv(&diagbuf, most_chunk_rows*most_chunk_rows, MPI_DOUBLE, MPI_ANY_SOURCE, row+1, MPI_COMM_WORLD, &status);
+                    MPI_Recv(&diagbuf, most_chunk_rows*most_chunk_rows, MPI_DOUBLE, MPI_ANY_SOURCE, row+1, comm.Comm(), &status);
 
                     // Check diagonal size
                     diag_rows = mmin(num_rows, row + num_rows - Nsmall);
@@ -511,7 +954,7 @@ void HamiltonianMatrix::Write(const std::string& filename) const
 
     #ifdef AMBIT_USE_MPI
         // Send finished signal
-        MPI_Bcast(&row, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&row, 1, MPI_INT, 0, comm.Comm());
     #endif
 
         file_err_handler->fclose(fp);
@@ -523,16 +966,17 @@ void HamiltonianMatrix::Write(const std::string& filename) const
         while(row < N)
         {
             // Received row number
-            MPI_Bcast(&row, 1, MPI_INT, 0, MPI_COMM_WORLD);
+            MPI_Bcast(&row, 1, MPI_INT, 0, comm.Comm());
 
             // If it is our row, send chunk
             if(chunk_it != chunks.end() && row == chunk_it->start_row)
             {
-                MPI_Send(chunk_it->chunk.data(), chunk_it->chunk.size(), MPI_DOUBLE, 0, row, MPI_COMM_WORLD);
+                RowMajorMatrix current_chunk = chunk_it->ChunkDouble();
+                MPI_Send(current_chunk.data(), current_chunk.size(), MPI_DOUBLE, 0, row, comm.Comm());
 
                 // Send diagonal if it exists
                 if(chunk_it->diagonal.size())
-                    MPI_Send(chunk_it->diagonal.data(), chunk_it->diagonal.size(), MPI_DOUBLE, 0, row+1, MPI_COMM_WORLD);
+                    MPI_Send(chunk_it->diagonal.data(), chunk_it->diagonal.size(), MPI_DOUBLE, 0, row+1, comm.Comm());
 
                 chunk_it++;
             }
@@ -541,7 +985,7 @@ void HamiltonianMatrix::Write(const std::string& filename) const
     }
 
 #ifdef AMBIT_USE_MPI
-    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Barrier(comm.Comm());
 #endif
 }
 
@@ -550,12 +994,13 @@ double HamiltonianMatrix::PollMatrix(double epsilon) const
     unsigned int i, j, count = 0;
     double value;
 
-    // Iterate over chunks
+    // Iterate over lower triangle of chunks
     for(const auto& it: chunks)
     {
+        RowMajorMatrix chunk = it.ChunkDouble();
         for(i = 0; i < it.num_rows; i++)
-            for(j = i; j < it.chunk.cols(); j++)
-                if(fabs(it.chunk(i, j)) > epsilon)
+            for(j = 0; j < mmin(it.start_row + i + 1, it.num_cols); j++)
+                if(fabs(chunk(i, j)) > epsilon)
                     count++;
     }
 
@@ -565,46 +1010,272 @@ double HamiltonianMatrix::PollMatrix(double epsilon) const
 
 void HamiltonianMatrix::MatrixMultiply(int m, double* b, double* c) const
 {
+    ProfileTimer timer("HamiltonianMatrix/MatrixMultiply");
     Eigen::Map<Eigen::MatrixXd> b_mapped(b, N, m);
     Eigen::Map<Eigen::MatrixXd> c_mapped(c, N, m);
-    c_mapped = Eigen::MatrixXd::Zero(N, m);
+    int num_chunks = chunks.size();
 
-    // Multiply each chunk
-    for(const auto& matrix_section: chunks)
+    // Multiply chunk i, reading ahead the next out-of-core chunk (i-1) while it is multiplied.
+    // Later chunks are larger so they are done first.
+    auto multiply_chunk = [&](int i, Eigen::Map<Eigen::MatrixXd>& product)
     {
-        unsigned int start = matrix_section.start_row;
-        unsigned int cols = matrix_section.chunk.cols();
-
-        // Lower triangular part
-        c_mapped.middleRows(start, matrix_section.num_rows)
-            += matrix_section.chunk * b_mapped.topRows(cols);
-
-        // Upper triangular part
-        if(start > 0)
-        {   unsigned int upper1_rows = mmin(start, Nsmall);
-            c_mapped.topRows(upper1_rows)
-                += matrix_section.chunk.leftCols(upper1_rows).transpose() * b_mapped.middleRows(start, matrix_section.num_rows);
+        if(i > 0 && chunks[i-1].region)
+            chunks[i-1].region->advise(boost::interprocess::mapped_region::advice_willneed);
+
+        MultiplyChunk(chunks[i], b_mapped, product);
+
+        // Finished with out-of-core chunk: release its pages
+        if(chunks[i].region)
+            chunks[i].region->advise(boost::interprocess::mapped_region::advice_dontneed);
+    };
+
+    if(num_chunks && chunks.back().region)
+        chunks.back().region->advise(boost::interprocess::mapped_region::advice_willneed);
+
+#ifdef AMBIT_USE_OPENMP
+    if(num_chunks > 1 && omp_get_max_threads() > 1)
+    {
+        // The transposed (upper triangle) part of every chunk adds to the top rows of c, so each thread
+        // sums its chunks in its own copy of c. Copies are then added together in blocks of rows.
+        if(int(thread_products.size()) < omp_get_max_threads())
+            thread_products.resize(omp_get_max_threads());
+
+        #pragma omp parallel
+        {
+            int thread = omp_get_thread_num();
+            int num_threads = omp_get_num_threads();
+            thread_products[thread].resize(N, m);
+            thread_products[thread].setZero();
+            Eigen::Map<Eigen::MatrixXd> product(thread_products[thread].data(), N, m);
+
+            #pragma omp for schedule(dynamic)
+            for(int i = num_chunks - 1; i >= 0; i--)
+                multiply_chunk(i, product);
+
+            const int block_rows = 1024;
+            int num_blocks = (N + block_rows - 1)/block_rows;
+
+            #pragma omp for schedule(static)
+            for(int block = 0; block < num_blocks; block++)
+            {
+                int start = block * block_rows;
+                int rows = mmin(block_rows, int(N) - start);
+                c_mapped.middleRows(start, rows) = thread_products[0].middleRows(start, rows);
+                for(int t = 1; t < num_threads; t++)
+                    c_mapped.middleRows(start, rows) += thread_products[t].middleRows(start, rows);
+            }
         }
+        return;
+    }
+#endif
+
+    c_mapped = Eigen::MatrixXd::Zero(N, m);
+    for(int i = num_chunks - 1; i >= 0; i--)
+        multiply_chunk(i, c_mapped);
+}
+
+void HamiltonianMatrix::ClearThreadProducts(int num_threads, int m) const
+{
+    if(int(thread_products.size()) < num_threads)
+        thread_products.resize(num_threads);
 
-        // Extra upper part
-        if(start < Nsmall && Nsmall < (start + matrix_section.num_rows))
+    for(int thread = 0; thread < num_threads; thread++)
+    {   thread_products[thread].resize(N, m);
+        thread_products[thread].setZero();
+    }
+}
+
+void HamiltonianMatrix::MultiplyChunk(const MatrixChunk& matrix_section, const Eigen::Map<Eigen::MatrixXd>& b_mapped, Eigen::Map<Eigen::MatrixXd>& c_mapped) const
+{
+    unsigned int start = matrix_section.start_row;
+    unsigned int rows = matrix_section.num_rows;
+    unsigned int cols = matrix_section.num_cols;
+
+    // Block X below the diagonal with top left corner at (row, col): add X and its transpose
+    auto add_lower = [&](const auto& X, unsigned int row, unsigned int col)
+    {
+        c_mapped.middleRows(row, X.rows()).noalias() += X * b_mapped.middleRows(col, X.cols());
+        c_mapped.middleRows(col, X.cols()).noalias() += X.transpose() * b_mapped.middleRows(row, X.rows());
+    };
+
+    // Square block X on the diagonal at (row, row): only its lower triangle is stored
+    auto add_diagonal = [&](const auto& X, unsigned int row)
+    {
+        c_mapped.middleRows(row, X.rows()).noalias() += X.template selfadjointView<Eigen::Lower>() * b_mapped.middleRows(row, X.rows());
+    };
+
+    if(matrix_section.single_precision)
+    {
+        // Convert tiles small enough to stay in cache to double precision and multiply those.
+        // Tiles of each band of rows are below the diagonal, except one that is on it.
+        const unsigned int tile_rows = 64;
+        const unsigned int tile_cols = 2048;
+        auto chunk = matrix_section.ChunkFloat();
+        RowMajorMatrix tile;
+
+        for(unsigned int r0 = 0; r0 < rows; r0 += tile_rows)
         {
-            unsigned int upper2_cols = start + matrix_section.num_rows - Nsmall;
+            unsigned int h = mmin(tile_rows, rows - r0);
+            unsigned int row = start + r0;
+            unsigned int lower_cols = mmin(row, cols);
 
-            c_mapped.middleRows(start, Nsmall - start)
-                += matrix_section.chunk.block(Nsmall - start, start, upper2_cols, Nsmall - start).transpose()
-                    * b_mapped.middleRows(Nsmall, upper2_cols);
+            for(unsigned int j0 = 0; j0 < lower_cols; j0 += tile_cols)
+            {
+                unsigned int w = mmin(tile_cols, lower_cols - j0);
+                tile = chunk.block(r0, j0, h, w).cast<double>();
+                add_lower(tile, row, j0);
+            }
+
+            if(row < cols)
+            {   // Rows past Nsmall are below the diagonal
+                unsigned int square = mmin(h, cols - row);
+                tile = chunk.block(r0, row, h, square).cast<double>();
+                add_diagonal(tile.topRows(square), row);
+                if(h > square)
+                    add_lower(tile.bottomRows(h - square), row + square, row);
+            }
         }
+    }
+    else
+    {
+        auto chunk = matrix_section.Chunk();
+
+        // Columns before the chunk's rows
+        unsigned int lower_cols = mmin(start, cols);
+        if(lower_cols)
+            add_lower(chunk.leftCols(lower_cols), start, 0);
+
+        // Square on the diagonal, and the extra part with rows past Nsmall
+        if(start < cols)
+        {   unsigned int square = cols - start;
+            add_diagonal(chunk.block(0, start, square, square), start);
+            if(rows > square)
+                add_lower(chunk.block(square, start, rows - square, square), start + square, start);
+        }
+    }
+
+    // Diagonal part
+    if(matrix_section.diagonal.rows())
+    {
+        unsigned int diag_rows  = matrix_section.diagonal.rows();
+        unsigned int diag_start = start + rows - diag_rows;
+        add_diagonal(matrix_section.diagonal, diag_start);
+    }
+}
+
+void HamiltonianMatrix::MatrixFreeMultiply(int m, const double* b, double* c)
+{
+    ProfileTimer timer("HamiltonianMatrix/MatrixFreeMultiply");
+    Eigen::Map<Eigen::MatrixXd> b_mapped(const_cast<double*>(b), N, m);
+    Eigen::Map<Eigen::MatrixXd> c_mapped(c, N, m);
+    c_mapped = Eigen::MatrixXd::Zero(N, m);
+
+    // Double-precision copies of my chunks, each only held while it is multiplied
+    std::vector<MatrixChunk> work_chunks;
+    for(const auto& matrix_section: chunks)
+        work_chunks.emplace_back(matrix_section.config_indices.first, matrix_section.config_indices.second, matrix_section.start_row, matrix_section.num_rows, Nsmall);
+
+    // Each thread sums the products of its chunks in its own copy of c
+    int num_threads = 1;
+#ifdef AMBIT_USE_OPENMP
+    num_threads = omp_get_max_threads();
+#endif
+    ClearThreadProducts(num_threads, m);
 
-        // Diagonal part
-        if(matrix_section.diagonal.rows())
+    CalculateChunks({this}, {&work_chunks}, [&](unsigned int chunk_index)
+    {
+        MatrixChunk& matrix_section = work_chunks[chunk_index];
+
+        int thread = 0;
+    #ifdef AMBIT_USE_OPENMP
+        thread = omp_get_thread_num();
+    #endif
+        Eigen::Map<Eigen::MatrixXd> product(thread_products[thread].data(), N, m);
+        MultiplyChunk(matrix_section, b_mapped, product);
+
+        matrix_section.chunk = RowMajorMatrix();
+        matrix_section.diagonal = RowMajorMatrix();
+    });
+
+    for(int thread = 0; thread < num_threads; thread++)
+        c_mapped += thread_products[thread];
+
+#ifdef AMBIT_USE_MPI
+    MPI_Allreduce(MPI_IN_PLACE, c, m * N, MPI_DOUBLE, MPI_SUM, comm.Comm());
+#endif
+}
+
+void HamiltonianMatrix::RefineSolutions(double* E, double* V, unsigned int num_solutions)
+{
+    ProfileTimer timer("HamiltonianMatrix/RefineSolutions");
+
+    // Each iteration recalculates the matrix once
+    const unsigned int max_iterations = MaxRefineIterations(N, true);
+
+    Eigen::Map<Eigen::VectorXd> E_mapped(E, num_solutions);
+    Eigen::Map<Eigen::MatrixXd> V_mapped(V, N, num_solutions);
+
+    // Diagonal of the stored matrix is good enough for the preconditioner
+    Eigen::VectorXd diag(N);
+    GetDiagonal(diag.data());
+#ifdef AMBIT_USE_MPI
+    MPI_Allreduce(MPI_IN_PLACE, diag.data(), N, MPI_DOUBLE, MPI_SUM, comm.Comm());
+#endif
+
+    Eigen::MatrixXd basis = V_mapped;
+    double max_residual = 0.;
+    unsigned int iteration = 0;
+    while(true)
+    {
+        // Rayleigh-Ritz in the orthonormalised basis using the double-precision matrix
+        Eigen::HouseholderQR<Eigen::MatrixXd> qr(basis);
+        basis = qr.householderQ() * Eigen::MatrixXd::Identity(N, basis.cols());
+
+        Eigen::MatrixXd H_basis(N, basis.cols());
+        MatrixFreeMultiply(basis.cols(), basis.data(), H_basis.data());
+        iteration++;
+
+        Eigen::MatrixXd projected = basis.transpose() * H_basis;
+        projected = (0.5 * (projected + projected.transpose())).eval();
+        Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(projected);
+
+        E_mapped = es.eigenvalues().head(num_solutions);
+        V_mapped = basis * es.eigenvectors().leftCols(num_solutions);
+
+        // Residuals H * V - E * V
+        Eigen::MatrixXd residuals = H_basis * es.eigenvectors().leftCols(num_solutions) - V_mapped * E_mapped.asDiagonal();
+        Eigen::VectorXd residual_norms = residuals.colwise().norm();
+        max_residual = residual_norms.maxCoeff();
+
+        if(max_residual < refine_tolerance || iteration >= max_iterations)
+            break;
+
+        // Add Davidson corrections r/(E - diag) of unconverged solutions
+        std::vector<unsigned int> unconverged;
+        for(unsigned int i = 0; i < num_solutions && num_solutions + unconverged.size() < N; i++)
+            if(residual_norms(i) >= refine_tolerance)
+                unconverged.push_back(i);
+
+        if(unconverged.empty())
+            break;
+
+        basis.resize(N, num_solutions + unconverged.size());
+        basis.leftCols(num_solutions) = V_mapped;
+        for(unsigned int k = 0; k < unconverged.size(); k++)
         {
-            unsigned int diag_rows  = matrix_section.diagonal.rows();
-            unsigned int diag_start = matrix_section.start_row + matrix_section.num_rows - diag_rows;
-            c_mapped.middleRows(diag_start, diag_rows)
-                += matrix_section.diagonal * b_mapped.middleRows(diag_start, diag_rows);
+            unsigned int i = unconverged[k];
+            Eigen::ArrayXd denominator = E_mapped(i) - diag.array();
+            denominator = denominator.unaryExpr([](double d){ return (fabs(d) < 1.e-8)? (d < 0.? -1.e-8: 1.e-8): d; });
+            basis.col(num_solutions + k) = residuals.col(i).array()/denominator;
         }
     }
+
+    *outstream << "    Refined single-precision solutions: maximum residual " << std::setprecision(3) << max_residual
+               << " after " << iteration << " double-precision iteration(s)" << std::endl;
+
+    if(max_residual >= refine_tolerance)
+        *errstream << "HamiltonianMatrix: Warning: single-precision solutions not refined to residual " << std::setprecision(3)
+                   << refine_tolerance << " (reached " << max_residual << " after " << iteration << " iterations)." << std::endl;
 }
 
 void HamiltonianMatrix::GetDiagonal(double* diag) const
@@ -618,8 +1289,12 @@ void HamiltonianMatrix::GetDiagonal(double* diag) const
         if(matrix_section.start_row < Nsmall)
         {
             unsigned int length = mmin(matrix_section.num_rows, Nsmall - matrix_section.start_row);
-            diag_mapped.segment(matrix_section.start_row, length).noalias()
-                = matrix_section.chunk.rightCols(length).diagonal();
+            if(matrix_section.single_precision)
+                diag_mapped.segment(matrix_section.start_row, length).noalias()
+                    = matrix_section.ChunkFloat().rightCols(length).diagonal().cast<double>();
+            else
+                diag_mapped.segment(matrix_section.start_row, length).noalias()
+                    = matrix_section.Chunk().rightCols(length).diagonal();
         }
 
         if(Nsmall < matrix_section.start_row + matrix_section.num_rows)
@@ -12,6 +12,10 @@
 #include "MBPT/TwoElectronCoulombOperator.h"
 #include "MBPT/Sigma3Calculator.h"
 #include <Eigen/Eigen>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <functional>
+#include <memory>
 
 namespace Ambit
 {
@@ -41,6 +45,48 @@ public:
     /** Generate Hamiltonian matrix. */
     virtual void GenerateMatrix(unsigned int configs_per_chunk = 4);
 
+    /** Generate several Hamiltonian matrices in a single sweep over pairs of projections.
+        The matrices must share the same RelativisticConfigList (pointer) and leading configurations,
+        and differ only in their integrals (e.g. multirun variants of an atom). Differences between
+        projections and the CSF coefficients are found once and used for every matrix, but all
+        matrices are held in memory together.
+     */
+    static void GenerateMatrices(const std::vector<HamiltonianMatrix*>& matrices, unsigned int configs_per_chunk = 4);
+
+    /** Number of projection pairs of each configuration (row) that GenerateMatrix() will consider, counted from
+        screening pairs of configurations by their number of differences. Nothing is calculated.
+     */
+    std::vector<unsigned long long> CountMatrixElements() const;
+
+    /** Mean time (seconds) per projection pair counted by CountMatrixElements(), from calculating matrix elements
+        of num_samples pairs spread evenly through the matrix.
+        PRE: the Hamiltonian has integrals.
+     */
+    double TimeMatrixElements(unsigned int num_samples) const;
+
+    /** Estimate of GenerateMatrix(configs_per_chunk) on num_processes processes with num_threads threads each,
+        using the counts from CountMatrixElements(). Time is in units of one projection pair.
+     */
+    struct GenerationEstimate
+    {
+        unsigned int num_chunks;
+        double max_memory_MB;       //!< Matrix memory of the process with the most
+        double total_memory_MB;     //!< Matrix memory of all processes
+        double elapsed_elements;    //!< Projection pairs done by the slowest thread
+    };
+    GenerationEstimate EstimateGeneration(const std::vector<unsigned long long>& config_elements, unsigned int configs_per_chunk, int num_processes, int num_threads) const;
+
+    /** Memory (MB) used by SolveMatrix() on the root process for an N * N matrix, in addition to the matrix.
+        Products of each of num_threads threads are included, as is work space for refining the solutions
+        of a single-precision matrix.
+     */
+    static double SolveMemoryMB(unsigned int N, unsigned int num_solutions, bool single_precision = false, int num_threads = 1);
+
+    /** Most times SolveMatrix() recalculates an N * N single-precision matrix in double precision to refine
+        its solutions (zero if it doesn't).
+     */
+    static unsigned int MaxRefineIterations(unsigned int N, bool single_precision);
+
     /** Print upper triangular part of matrix (text). Lower triangular part is zeroed. */
     friend std::ostream& operator<<(std::ostream& stream, const HamiltonianMatrix& matrix);
 
@@ -65,19 +111,61 @@ public:
 #endif
 
     /** Clear matrix and recover memory. */
-    virtual void Clear() { chunks.clear(); }
+    virtual void Clear() { chunks.clear(); thread_products.clear(); RemoveChunkFile(); }
+
+    /** Keep the matrix out-of-core in a memory-mapped file in directory (e.g. on node-local SSD) rather than in memory.
+        Each chunk is moved to the file as soon as it has been generated, and MatrixMultiply() streams the chunks
+        back with read-ahead. An empty directory keeps the matrix in memory. Must be called before GenerateMatrix().
+     */
+    void SetOutOfCore(const std::string& directory);
+    bool IsOutOfCore() const { return !chunk_directory.empty(); }
+
+    /** Store the matrix in single precision, halving its memory and the memory traffic of MatrixMultiply()
+        (products are still made in double precision). SolveMatrix() then refines the solutions against the
+        double-precision matrix, recalculated on the fly, until the residuals of all solutions are below
+        residual_tolerance. Small matrices that are not solved with Davidson's method are always stored in
+        double precision. Must be called before GenerateMatrix().
+     */
+    void SetSinglePrecision(bool single, double residual_tolerance = 1.e-6)
+    {   single_precision = single;
+        refine_tolerance = residual_tolerance;
+    }
+    bool IsSinglePrecision() const { return single_precision; }
+
+    /** Distribute the matrix over the processes of communicator rather than ProcessGroup, e.g. to solve
+        several Hamiltonians at once on separate groups of processes. Must be called before GenerateMatrix().
+     */
+    void SetCommunicator(const Communicator& communicator) { comm = communicator; }
+    const Communicator& GetCommunicator() const { return comm; }
 
 protected:
+    Communicator comm;
     pRelativisticConfigList configs;
     pTwoBodyHamiltonianOperator H_two_body;
 
     pConfigListConst leading_configs;           //!< Leading configs for sigma3
+    std::vector<bool> leading_config_flags;     //!< Whether each of configs is a leading config (sigma3 only)
     pThreeBodyHamiltonianOperator H_three_body; //!< Three-body operator is null if sigma3 not used
 
     unsigned int Nsmall;            //!< For non-square CI, the smaller matrix size
 
 protected:
     typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMajorMatrix;
+    typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMajorMatrixFloat;
+
+    /** Configurations [config_start, config_end) and rows [start_row, start_row + num_rows) of a chunk. */
+    struct ChunkBounds
+    {
+        unsigned int config_start;
+        unsigned int config_end;
+        unsigned int start_row;
+        unsigned int num_rows;
+    };
+
+    /** Divide configs into chunks of configs_per_chunk configurations (or a single chunk for small matrices).
+        Chunk i is made by process i%comm.Size().
+     */
+    static std::vector<ChunkBounds> DivideChunks(const RelativisticConfigList& configs, unsigned int configs_per_chunk);
 
     /** MatrixChunk is a rectangular section of the lower triangular part of the HamiltonianMatrix.
         The top left corner of the section is at (start_row, 0).
@@ -85,50 +173,133 @@ protected:
         The rows correspond to a number of RelativisticConfigurations in configs, as distributed by GenerateMatrix().
         RelativisticConfigurations included are [config_indices.first, config_indices.second).
         The matrix section "diagonal" is a square on the diagonal of the Hamiltonian that is outside Nsmall.
+        Only the lower triangle of the Hamiltonian is stored: elements of chunk and diagonal above the diagonal
+        of the Hamiltonian are zero and unused.
+        Memory for the sections is only allocated by Allocate(). Once generated, the lower triangle section is
+        converted to single precision (chunk_float) if single_precision and/or moved to the chunk file (region)
+        if the matrix is out-of-core; use Chunk() or ChunkFloat() to access it in any case.
      */
     class MatrixChunk
     {
     public:
-        MatrixChunk(unsigned int config_index_start, unsigned int config_index_end, unsigned int row_start, unsigned int num_rows, unsigned int Nsmall):
-            start_row(row_start), num_rows(num_rows)
+        typedef Eigen::Map<const RowMajorMatrix> ConstMatrixMap;
+        typedef Eigen::Map<const RowMajorMatrixFloat> ConstMatrixFloatMap;
+
+        MatrixChunk(unsigned int config_index_start, unsigned int config_index_end, unsigned int row_start, unsigned int num_rows, unsigned int Nsmall, bool single_precision = false):
+            start_row(row_start), num_rows(num_rows), num_cols(mmin(row_start + num_rows, Nsmall)), diagonal_size(0),
+            single_precision(single_precision), file_offset(0)
         {
             config_indices.first = config_index_start;
             config_indices.second = config_index_end;
-            chunk = RowMajorMatrix::Zero(num_rows, mmin(start_row + num_rows, Nsmall));
 
             if(Nsmall < start_row + num_rows)
-            {   unsigned int diagonal_size = mmin(num_rows, start_row + num_rows - Nsmall);
-                diagonal = RowMajorMatrix::Zero(diagonal_size, diagonal_size);
-            }
+                diagonal_size = mmin(num_rows, start_row + num_rows - Nsmall);
         }
 
         std::pair<unsigned int, unsigned int> config_indices;
         unsigned int start_row;
         unsigned int num_rows;
+        unsigned int num_cols;
+        unsigned int diagonal_size;
         RowMajorMatrix chunk;
         RowMajorMatrix diagonal;
 
-        /** Make upper triangle part of the matrix chunk match the lower. */
-        void Symmetrize()
+        bool single_precision;          //!< Lower triangle section is stored in single precision
+        RowMajorMatrixFloat chunk_float;
+
+        uint64_t file_offset;   //!< Position of chunk in the chunk file (out-of-core only)
+        std::shared_ptr<boost::interprocess::mapped_region> region;  //!< Mapping of chunk in the chunk file (out-of-core only)
+
+        /** Allocate zeroed sections. */
+        void Allocate()
+        {
+            chunk = RowMajorMatrix::Zero(num_rows, num_cols);
+            diagonal = RowMajorMatrix::Zero(diagonal_size, diagonal_size);
+        }
+
+        /** Lower triangle section, either in memory or mapped from the chunk file.
+            PRE: !single_precision
+         */
+        ConstMatrixMap Chunk() const
+        {
+            if(region)
+                return ConstMatrixMap(static_cast<const double*>(region->get_address()), num_rows, num_cols);
+            else
+                return ConstMatrixMap(chunk.data(), chunk.rows(), chunk.cols());
+        }
+
+        /** Single-precision lower triangle section, either in memory or mapped from the chunk file.
+            PRE: single_precision
+         */
+        ConstMatrixFloatMap ChunkFloat() const
         {
-            if(start_row < chunk.cols())
-            {
-                for(unsigned int i = 0; i < chunk.cols() - start_row - 1; i++)
-                    for(unsigned int j = i+start_row+1; j < chunk.cols(); j++)
-                        chunk(i, j) = chunk(j - start_row, i + start_row);
-            }
-
-            if(diagonal.size())
-            {
-                for(unsigned int i = 0; i < diagonal.rows() - 1; i++)
-                    for(unsigned int j = i + 1; j < diagonal.cols(); j++)
-                        diagonal(i, j) = diagonal(j, i);
-            }
+            if(region)
+                return ConstMatrixFloatMap(static_cast<const float*>(region->get_address()), num_rows, num_cols);
+            else
+                return ConstMatrixFloatMap(chunk_float.data(), chunk_float.rows(), chunk_float.cols());
+        }
+
+        /** Copy of lower triangle section in double precision, however it is stored. */
+        RowMajorMatrix ChunkDouble() const
+        {
+            if(single_precision)
+                return ChunkFloat().cast<double>();
+            else
+                return Chunk();
+        }
+
+        /** Size in bytes of the stored lower triangle section. */
+        uint64_t StorageSize() const
+        {   return uint64_t(num_rows) * num_cols * (single_precision? sizeof(float): sizeof(double));
         }
     };
 
     std::vector<MatrixChunk> chunks;
     unsigned int most_chunk_rows;
+
+    /** Sums of the chunk products of each thread in MatrixMultiply() and MatrixFreeMultiply(),
+        kept between calls so that they aren't reallocated at every Davidson iteration.
+     */
+    mutable std::vector<Eigen::MatrixXd> thread_products;
+
+    /** Zero the product of each of num_threads threads for m columns. */
+    void ClearThreadProducts(int num_threads, int m) const;
+
+    bool single_precision = false;
+    double refine_tolerance = 1.e-6;
+
+    std::string chunk_directory;    //!< Directory for chunk file if out-of-core
+    std::string chunk_filename;
+    boost::interprocess::file_mapping chunk_file;
+
+    /** Create the chunk file of an out-of-core matrix with space for all of its chunks. */
+    void CreateChunkFile();
+
+    /** Move generated chunk to its storage: single precision and/or its place in the chunk file.
+        Releases the double-precision section.
+     */
+    void StoreChunk(MatrixChunk& chunk);
+
+    /** Calculate the matrix elements of matrix_chunks[k] (divided and not yet allocated) for each of matrices[k].
+        The chunks are shared out between threads; each calls finish_chunk(chunk_index) when that chunk is complete.
+     */
+    static void CalculateChunks(const std::vector<HamiltonianMatrix*>& matrices, const std::vector<std::vector<MatrixChunk>*>& matrix_chunks, const std::function<void(unsigned int)>& finish_chunk);
+
+    /** Add the product of a chunk section (and its transpose) with b to c. */
+    void MultiplyChunk(const MatrixChunk& matrix_section, const Eigen::Map<Eigen::MatrixXd>& b_mapped, Eigen::Map<Eigen::MatrixXd>& c_mapped) const;
+
+    /** c = H * b for the double-precision matrix, with the chunks of this process recalculated one at a time
+        (so not stored); c is summed over comm.
+     */
+    void MatrixFreeMultiply(int m, const double* b, double* c);
+
+    /** Refine solutions V (N * num_solutions) and energies E of a single-precision matrix against the double-precision
+        matrix using MatrixFreeMultiply() in Rayleigh-Ritz and Davidson correction steps.
+     */
+    void RefineSolutions(double* E, double* V, unsigned int num_solutions);
+
+    /** Remove the chunk file of an out-of-core matrix. */
+    void RemoveChunkFile();
 };
 
 }
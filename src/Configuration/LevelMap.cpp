@@ -4,6 +4,19 @@
 
 namespace Ambit
 {
+pTransitionDensityConst LevelStore::GetTransitionDensity(const LevelVector& left, const LevelVector& right, int K)
+{
+    TransitionDensityKey key(left.hID, right.hID, K);
+
+    auto it = transition_densities.find(key);
+    if(it != transition_densities.end())
+        return it->second;
+
+    pTransitionDensityConst density = std::make_shared<TransitionDensity>(left, right, K);
+    transition_densities[key] = density;
+    return density;
+}
+
 LevelMap::LevelMap(pAngularDataLibrary lib): angular_library(lib) {}
 
 LevelMap::LevelMap(const std::string& file_id, pAngularDataLibrary lib):
@@ -110,6 +123,7 @@ void LevelMap::ReadLevelMap(pHamiltonianIDConst hamiltonian_example)
 
         // These should be generated already, but in case they weren't saved...
         angular_library->GenerateCSFs();
+        levelvec.configs->ClearOffsets();
 
         // Read all level information
         unsigned int num_levels;
@@ -192,6 +206,7 @@ LevelVector FileSystemLevelStore::GetLevels(pHamiltonianID key)
 
         // These should be generated already, but in case they weren't saved...
         angular_library->GenerateCSFs();
+        levelvec.configs->ClearOffsets();
 
         // Read all level information
         unsigned int num_levels;
@@ -228,6 +243,7 @@ LevelVector FileSystemLevelStore::GetLevels(pHamiltonianID key)
 void FileSystemLevelStore::Store(pHamiltonianID key, const LevelVector& level_vector)
 {
     keys.insert(key);
+    ClearTransitionDensities();     // Stored levels may have changed
     if(ProcessorRank != 0 || level_vector.configs == nullptr || level_vector.levels.size() == 0)
         return;
 
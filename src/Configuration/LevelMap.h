@@ -4,6 +4,8 @@
 #include "Level.h"
 #include "LevelVector.h"
 #include "NonRelConfiguration.h"
+#include "TransitionDensity.h"
+#include <tuple>
 #include <vector>
 #include <map>
 #include <filesystem>
@@ -69,9 +71,37 @@ public:
     {   return gfactors_needed;
     }
 
+    /** Get the transition density of rank K between all levels of left and right, calculating and
+        storing it if it has not been requested before. Transition densities are kept in memory only.
+        PRE: left and right should be the stored LevelVectors (i.e. from GetLevels()).
+     */
+    pTransitionDensityConst GetTransitionDensity(const LevelVector& left, const LevelVector& right, int K);
+
+    /** Clear stored transition densities. */
+    void ClearTransitionDensities() { transition_densities.clear(); }
+
 protected:
     bool gfactors_needed = true;
 
+    typedef std::tuple<pHamiltonianID, pHamiltonianID, int> TransitionDensityKey;
+    struct TransitionDensityKeyComparator
+    {
+        bool operator()(const TransitionDensityKey& first, const TransitionDensityKey& second) const
+        {
+            if(*std::get<0>(first) < *std::get<0>(second))
+                return true;
+            if(*std::get<0>(second) < *std::get<0>(first))
+                return false;
+            if(*std::get<1>(first) < *std::get<1>(second))
+                return true;
+            if(*std::get<1>(second) < *std::get<1>(first))
+                return false;
+            return std::get<2>(first) < std::get<2>(second);
+        }
+    };
+
+    std::map<TransitionDensityKey, pTransitionDensityConst, TransitionDensityKeyComparator> transition_densities;
+
 };
 
 typedef std::shared_ptr<LevelStore> pLevelStore;
@@ -3,6 +3,8 @@
 
 #include "Projection.h"
 #include "LevelVector.h"
+#include "PackedProjectionList.h"
+#include "Universal/Communicator.h"
 #include <tuple>
 #include <boost/iterator/counting_iterator.hpp>
 #include <boost/iterator/indirect_iterator.hpp>
@@ -32,7 +34,7 @@ template <typename... pElectronOperators>
 class ManyBodyOperator
 {
 public:
-    ManyBodyOperator(pElectronOperators... operators): pOperators(operators...)
+    ManyBodyOperator(pElectronOperators... operators): pOperators(operators...), comm(ProcessGroup)
     {   static_assert(sizeof...(pElectronOperators) < 4, "ManyBodyOperator<> instantiated with too many operators (template arguments).");
 #ifdef AMBIT_USE_OPENMP
         indirects_list.resize(omp_get_max_threads());
@@ -42,14 +44,27 @@ public:
     }
 
     typedef std::vector<const ElectronInfo*> IndirectProjection;
+    typedef PackedProjectionList::PackedElectron PackedElectron;
 
-    // Bundle all the indirect projections into a struct to allow each thread to have its own persistent copy
-    struct IndirectProjectionStruct {
+    /** Indirect projections for GetProjectionDifferences(), pointing to electrons (const ElectronInfo*)
+        or to packed records (const PackedElectron*).
+     */
+    template<class ElectronPointer>
+    struct IndirectStruct {
+        typedef ElectronPointer pointer;
         // left and right are inputs for GetProjectionDifferences.
-        IndirectProjection left, right;
+        std::vector<ElectronPointer> left, right;
         // diff1, diff2, sorted_p1, and sorted_p2 are just for internal use by GetProjectionDifferences.
-        IndirectProjection diff1, diff2;
-        IndirectProjection sorted_p1, sorted_p2;
+        std::vector<ElectronPointer> diff1, diff2;
+        std::vector<ElectronPointer> sorted_p1, sorted_p2;
+    };
+
+    // Bundle all the indirect projections into a struct to allow each thread to have its own persistent copy
+    struct IndirectProjectionStruct: public IndirectStruct<const ElectronInfo*> {
+        // For projections of a PackedProjectionList: the differences are found between packed records,
+        // then left and right point to the electrons that are unpacked from them.
+        IndirectStruct<const PackedElectron*> packed;
+        std::vector<ElectronInfo> unpacked;
     };
 
     /** Rearrange indirects.left and indirects.right so that differences are at the beginning (up to 
@@ -62,17 +77,38 @@ public:
 
         N.B. This must be public to allow unit tests to call it
      */
-    template<int max_diffs>
-    inline int GetProjectionDifferences(IndirectProjectionStruct& indirects, const ElectronInfo* skipped_p2_electron = nullptr) const;
+    template<int max_diffs, class ElectronPointer>
+    inline int GetProjectionDifferences(IndirectStruct<ElectronPointer>& indirects, typename IndirectStruct<ElectronPointer>::pointer skipped_p2_electron = nullptr) const;
  
-    inline void make_indirect_projection(const Projection& proj, IndirectProjection& indirect_proj) const;
+    /** ProjectionType is Projection (ElectronPointer is const ElectronInfo*) or
+        PackedProjectionList::ProjectionView (ElectronPointer is const PackedElectron*).
+     */
+    template<class ProjectionType, class ElectronPointer>
+    inline void make_indirect_projection(const ProjectionType& proj, std::vector<ElectronPointer>& indirect_proj) const;
 
     /** Matrix element between two projections.
         If eplsion != nullptr, we want
             < proj_left | O | {proj_right, epsilon} >
         where proj_left is one electron larger than proj_right.
      */
-    inline double GetMatrixElement(const Projection& proj_left, const Projection& proj_right, const ElectronInfo* epsilon = nullptr) const;
+    template<class ProjectionType>
+    inline double GetMatrixElement(const ProjectionType& proj_left, const ProjectionType& proj_right, const ElectronInfo* epsilon = nullptr) const;
+
+    /** The angular part of GetMatrixElement(proj_left, proj_right, epsilon): find the differences between
+        the projections and store them in differences. Return value is as for GetProjectionDifferences().
+        Operators that differ only in their integrals can then share the differences via
+        GetMatrixElement(differences, num_diffs).
+     */
+    template<class ProjectionType>
+    inline int FindDifferences(const ProjectionType& proj_left, const ProjectionType& proj_right, IndirectProjectionStruct& differences, const ElectronInfo* epsilon = nullptr) const;
+
+    /** As above for projections of a PackedProjectionList: the differences are found by comparing packed
+        records, and only the electrons needed by GetMatrixElement(differences, num_diffs) are unpacked.
+     */
+    inline int FindDifferences(const PackedProjectionList::ProjectionView& proj_left, const PackedProjectionList::ProjectionView& proj_right, IndirectProjectionStruct& differences, const ElectronInfo* epsilon = nullptr) const;
+
+    /** Matrix element between projections with differences found by FindDifferences() (of this or any other operator). */
+    inline double GetMatrixElement(const IndirectProjectionStruct& differences, int num_diffs) const;
 
     /** Equivalent to calculating GetMatrixElement(level, level) for each level in vector.
         Return vector of matrix elements.
@@ -87,12 +123,24 @@ public:
      */
     inline std::vector<double> GetMatrixElement(const LevelVector& left_levels, const LevelVector& right_levels, const ElectronInfo* epsilon = nullptr) const;
 
+    /** Divide the work of GetMatrixElement(levels) between the processes of communicator rather than ProcessGroup. */
+    void SetCommunicator(const Communicator& communicator) { comm = communicator; }
+
 protected:
     std::tuple<pElectronOperators...> pOperators;
+    Communicator comm;
 
     // NB: Indirect projections are class members to prevent expensive memory (de)allocations
     mutable std::vector<IndirectProjectionStruct> indirects_list;
 
+    // Electron comparisons for GetProjectionDifferences()
+    static bool SameElectron(const ElectronInfo* first, const ElectronInfo* second) { return *first == *second; }
+    static bool SameElectron(const PackedElectron* first, const PackedElectron* second) { return PackedProjectionList::SameState(*first, *second); }
+    static bool ElectronLess(const ElectronInfo* first, const ElectronInfo* second) { return *first < *second; }
+    static bool ElectronLess(const PackedElectron* first, const PackedElectron* second) { return *first < *second; }
+    static bool IsHoleElectron(const ElectronInfo* electron) { return electron->IsHole(); }
+    static bool IsHoleElectron(const PackedElectron* electron) { return PackedProjectionList::IsHole(*electron); }
+
     // There is always a one-body operator
     inline double OneBodyMatrixElements(const ElectronInfo& la, const ElectronInfo& ra) const
     {
@@ -139,31 +187,90 @@ protected:
     }
 
     bool IsMyJob(unsigned long long index) const
-    {   return index%NumProcessors == ProcessorRank;
+    {   return index%comm.Size() == comm.Rank();
     }
 };
 
 /** ManyBodyOperator: one body operator specialization. */
 template <typename... pElectronOperators>
-double ManyBodyOperator<pElectronOperators...>::GetMatrixElement(const Projection& proj_left, const Projection& proj_right, const ElectronInfo* epsilon) const
+template <class ProjectionType>
+double ManyBodyOperator<pElectronOperators...>::GetMatrixElement(const ProjectionType& proj_left, const ProjectionType& proj_right, const ElectronInfo* epsilon) const
 {
-    int num_diffs = 0;
-
 #ifdef AMBIT_USE_OPENMP
     // Get the indirect projections for this thread
     IndirectProjectionStruct& my_projections = indirects_list[omp_get_thread_num()];
 #else
     IndirectProjectionStruct& my_projections = indirects_list[0];
 #endif
-    make_indirect_projection(proj_left, my_projections.left);
+    int num_diffs = FindDifferences(proj_left, proj_right, my_projections, epsilon);
+    return GetMatrixElement(my_projections, num_diffs);
+}
+
+template <typename... pElectronOperators>
+template <class ProjectionType>
+int ManyBodyOperator<pElectronOperators...>::FindDifferences(const ProjectionType& proj_left, const ProjectionType& proj_right, IndirectProjectionStruct& differences, const ElectronInfo* epsilon) const
+{
+    int num_diffs = 0;
+    make_indirect_projection(proj_left, differences.left);
+
+    // Skip this for same projection
+    if(proj_left.data() != proj_right.data())
+    {
+        make_indirect_projection(proj_right, differences.right);
+        num_diffs = GetProjectionDifferences<sizeof...(pElectronOperators)>(differences, epsilon);
+    }
+
+    return num_diffs;
+}
+
+template <typename... pElectronOperators>
+int ManyBodyOperator<pElectronOperators...>::FindDifferences(const PackedProjectionList::ProjectionView& proj_left, const PackedProjectionList::ProjectionView& proj_right, IndirectProjectionStruct& differences, const ElectronInfo* epsilon) const
+{
+    auto& packed = differences.packed;
+    int num_diffs = 0;
+    make_indirect_projection(proj_left, packed.left);
 
     // Skip this for same projection
-    if(&proj_left != &proj_right)
+    if(proj_left.data() != proj_right.data())
     {
-        make_indirect_projection(proj_right, my_projections.right);
-        num_diffs = GetProjectionDifferences<sizeof...(pElectronOperators)>(my_projections, epsilon);
+        make_indirect_projection(proj_right, packed.right);
+
+        PackedElectron packed_epsilon;
+        const PackedElectron* skipped = nullptr;
+        if(epsilon)
+        {   packed_epsilon = PackedProjectionList::Pack(*epsilon);
+            skipped = &packed_epsilon;
+        }
+        num_diffs = GetProjectionDifferences<sizeof...(pElectronOperators)>(packed, skipped);
     }
 
+    // No matrix element
+    unsigned int abs_diffs = abs(num_diffs);
+    if(abs_diffs > sizeof...(pElectronOperators))
+        return num_diffs;
+
+    // Matrix elements need all of left (differences first) and the differences of right
+    unsigned int left_size = packed.left.size();
+    differences.unpacked.clear();
+    differences.unpacked.reserve(left_size + abs_diffs);
+    for(unsigned int i = 0; i < left_size; i++)
+        differences.unpacked.push_back(PackedProjectionList::Unpack(*packed.left[i]));
+    for(unsigned int i = 0; i < abs_diffs; i++)
+        differences.unpacked.push_back(PackedProjectionList::Unpack(*packed.right[i]));
+
+    differences.left.resize(left_size);
+    differences.right.resize(abs_diffs);
+    for(unsigned int i = 0; i < left_size; i++)
+        differences.left[i] = &differences.unpacked[i];
+    for(unsigned int i = 0; i < abs_diffs; i++)
+        differences.right[i] = &differences.unpacked[left_size + i];
+
+    return num_diffs;
+}
+
+template <typename... pElectronOperators>
+double ManyBodyOperator<pElectronOperators...>::GetMatrixElement(const IndirectProjectionStruct& my_projections, int num_diffs) const
+{
     double matrix_element = 0.0;
 
     switch(sizeof...(pElectronOperators))
@@ -302,7 +409,8 @@ double ManyBodyOperator<pElectronOperators...>::GetMatrixElement(const Projectio
 }
 
 template<typename... pElectronOperators>
-void ManyBodyOperator<pElectronOperators...>::make_indirect_projection(const Projection& proj, IndirectProjection& indirect_proj) const
+template<class ProjectionType, class ElectronPointer>
+void ManyBodyOperator<pElectronOperators...>::make_indirect_projection(const ProjectionType& proj, std::vector<ElectronPointer>& indirect_proj) const
 {
     if(indirect_proj.size() != proj.size())
         indirect_proj.resize(proj.size());
@@ -313,8 +421,8 @@ void ManyBodyOperator<pElectronOperators...>::make_indirect_projection(const Pro
 }
 
 template<typename... pElectronOperators>
-template<int max_diffs>
-int ManyBodyOperator<pElectronOperators...>::GetProjectionDifferences(IndirectProjectionStruct& indirects, const ElectronInfo* skipped_p2_electron) const
+template<int max_diffs, class ElectronPointer>
+int ManyBodyOperator<pElectronOperators...>::GetProjectionDifferences(IndirectStruct<ElectronPointer>& indirects, typename IndirectStruct<ElectronPointer>::pointer skipped_p2_electron) const
 {
     indirects.diff1.clear();
     indirects.diff2.clear();
@@ -347,18 +455,18 @@ int ManyBodyOperator<pElectronOperators...>::GetProjectionDifferences(IndirectPr
 
     while(indirects.diff1.size() <= max_diffs && indirects.diff2.size() <= max_diffs && it1 != indirects.left.end() && it2 != indirects.right.end())
     {
-        const ElectronInfo& e1(**it1);
-        const ElectronInfo& e2(**it2);
+        ElectronPointer e1 = *it1;
+        ElectronPointer e2 = *it2;
 
-        if(e1 == e2)
+        if(SameElectron(e1, e2))
         {   indirects.sorted_p1.push_back(*it1++);
             indirects.sorted_p2.push_back(*it2++);
             num_same++;
         }
-        else if(e1 < e2)
+        else if(ElectronLess(e1, e2))
         {
             permutations += num_same;
-            if(e1.IsHole())
+            if(IsHoleElectron(e1))
             {
                 indirects.diff2.push_back(*it1++);
 
@@ -390,7 +498,7 @@ int ManyBodyOperator<pElectronOperators...>::GetProjectionDifferences(IndirectPr
         else
         {
             permutations += num_same;
-            if(e2.IsHole())
+            if(IsHoleElectron(e2))
             {
                 indirects.diff1.push_back(*it2++);
 
@@ -423,7 +531,7 @@ int ManyBodyOperator<pElectronOperators...>::GetProjectionDifferences(IndirectPr
     while(it1 != indirects.left.end() && (indirects.diff1.size() <= max_diffs))
     {
         permutations += num_same;
-        if((*it1)->IsHole())
+        if(IsHoleElectron(*it1))
         {
             indirects.diff2.push_back(*it1++);
 
@@ -455,7 +563,7 @@ int ManyBodyOperator<pElectronOperators...>::GetProjectionDifferences(IndirectPr
     while(it2 != indirects.right.end() && (indirects.diff2.size() <= max_diffs))
     {
         permutations += num_same;
-        if((*it2)->IsHole())
+        if(IsHoleElectron(*it2))
         {
             indirects.diff1.push_back(*it2++);
 
@@ -498,7 +606,7 @@ int ManyBodyOperator<pElectronOperators...>::GetProjectionDifferences(IndirectPr
     it2 = indirects.diff2.begin();
     while(it1 != indirects.diff1.end())
     {
-        if((*it1)->IsHole() || (*it2)->IsHole())
+        if(IsHoleElectron(*it1) || IsHoleElectron(*it2))
             permutations++;
 
         it1++;
@@ -535,6 +643,10 @@ std::vector<double> ManyBodyOperator<pElectronOperators...>::GetMatrixElement(co
 
     std::vector<double> total(eigenvector.size(), 0.);
 
+    // Contiguous copy of all projections and CSFs
+    auto packed_projections = configs->GetPackedProjections();
+    const PackedProjectionList& packed = *packed_projections;
+
 #ifdef AMBIT_USE_OPENMP
     /* Make a vector to hold the running total for each thread. This needs to be shared so its contents 
      * persist across different OpenMP tasks (N.B. this is only here because gcc and clang have 
@@ -546,15 +658,12 @@ std::vector<double> ManyBodyOperator<pElectronOperators...>::GetMatrixElement(co
 
 #ifdef AMBIT_USE_OPENMP
     #pragma omp parallel for default(none) \
-                             shared(my_total, configs, eigenvector) \
+                             shared(my_total, configs, eigenvector, packed) \
                              schedule(dynamic)
 #endif
     for(unsigned long long ii = 0; ii < configs->size(); ii++)
     {
-        // Increment config_it to bring it up to our loop variable. This isn't a great approach, but
-        // OpenMP doesn't play nicely with non-random-access iterators
-        auto config_it = configs->begin();
-        std::advance(config_it, ii);
+        auto config_it = (*configs)[ii];
 
         unsigned long long config_index = ii * configs->size();
 
@@ -566,29 +675,30 @@ std::vector<double> ManyBodyOperator<pElectronOperators...>::GetMatrixElement(co
                 if(IsMyJob(config_index))
                 {
                     // Iterate over projections
-                    auto proj_it = config_it.projection_begin();
-                    while(proj_it != config_it.projection_end())
+                    unsigned int jj = config_jt - configs->begin();
+                    for(unsigned int proj_i = packed.projection_begin(ii); proj_i < packed.projection_end(ii); proj_i++)
                     {
-                        RelativisticConfiguration::const_projection_iterator proj_jt;
-                        if(config_it == config_jt)
-                            proj_jt = proj_it;
-                        else
-                            proj_jt = config_jt.projection_begin();
-
-                        while(proj_jt != config_jt.projection_end())
+                        unsigned int proj_j = (ii == jj)? proj_i: packed.projection_begin(jj);
+                        for(; proj_j < packed.projection_end(jj); proj_j++)
                         {
+                            // Skip pairs of projections with too many differences using packed records
+                            if(!packed.WithinDifferences(proj_i, proj_j, sizeof...(pElectronOperators)))
+                                continue;
+
                             // This thread's running total will get stored at this offset
 #ifdef AMBIT_USE_OPENMP
                             int my_offset = omp_get_thread_num() * eigenvector.size();
 #endif
 
-                            double matrix_element = GetMatrixElement(*proj_it, *proj_jt);
+                            auto proj_it = packed[proj_i];
+                            auto proj_jt = packed[proj_j];
+                            double matrix_element = GetMatrixElement(proj_it, proj_jt);
 
                             // coefficients
                             if(matrix_element)
                             {
                                 // If the projections are different, count twice
-                                if(proj_it != proj_jt)
+                                if(proj_i != proj_j)
                                 {   matrix_element *= 2.;
                                 }
 
@@ -598,26 +708,20 @@ std::vector<double> ManyBodyOperator<pElectronOperators...>::GetMatrixElement(co
                                     {
                                         double left_coeff_and_matrix_element = matrix_element * (*coeff_i) * eigenvector[solution][coeff_i.index()];
 
-                                        RelativisticConfigList::const_CSF_iterator start_j = proj_jt.CSF_begin();
-
-                                        const double* pright = &eigenvector[solution][start_j.index()];
-                                        for(auto coeff_j = start_j; coeff_j != proj_jt.CSF_end(); coeff_j++)
+                                        for(auto coeff_j = proj_jt.CSF_begin(); coeff_j != proj_jt.CSF_end(); coeff_j++)
                                         {
 #ifdef AMBIT_USE_OPENMP
                                             my_total[my_offset + solution] += left_coeff_and_matrix_element
-                                                                * (*coeff_j) * (*pright);
+                                                                * (*coeff_j) * eigenvector[solution][coeff_j.index()];
 #else
                                             total[solution] += left_coeff_and_matrix_element
-                                                                * (*coeff_j) * (*pright);
+                                                                * (*coeff_j) * eigenvector[solution][coeff_j.index()];
 #endif
-                                            pright++;
                                         }
                                     }
                                 }
                             }
-                            proj_jt++;
                         }
-                    proj_it++;
                     }
                 } // MPI work distribution
 
@@ -638,7 +742,7 @@ std::vector<double> ManyBodyOperator<pElectronOperators...>::GetMatrixElement(co
 
 #ifdef AMBIT_USE_MPI
     std::vector<double> reduced_total(total.size(), 0.);
-    MPI_Allreduce(total.data(), reduced_total.data(), total.size(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(total.data(), reduced_total.data(), total.size(), MPI_DOUBLE, MPI_SUM, comm.Comm());
     return reduced_total;
 #else
     return total;
@@ -685,11 +789,7 @@ std::vector<double> ManyBodyOperator<pElectronOperators...>::GetMatrixElement(co
 #endif
     for(unsigned long long ii = 0; ii < configs_left->size(); ii++)
     {
-        // Increment config_it to keep it in step with our loop variable. This isn't a great 
-        // approach, but OpenMP doesn't play nicely with non-random-access iterators so we don't
-        // have much of a choice
-        auto config_it = configs_left->begin();
-        std::advance(config_it, ii);
+        auto config_it = (*configs_left)[ii];
 
         unsigned long long config_index = ii * configs_left->size();
 
@@ -707,9 +807,6 @@ std::vector<double> ManyBodyOperator<pElectronOperators...>::GetMatrixElement(co
                     auto proj_it = config_it.projection_begin();
                     while(proj_it != config_it.projection_end())
                     {
-                        int left_start_CSF_index = proj_it.CSF_begin().index();
-                        int left_end_CSF_index = proj_it.CSF_end().index();
-
                         auto proj_jt = config_jt.projection_begin();
                         while(proj_jt != config_jt.projection_end())
                         {
@@ -718,32 +815,25 @@ std::vector<double> ManyBodyOperator<pElectronOperators...>::GetMatrixElement(co
                             // coefficients
                             if(matrix_element)
                             {
-                                int right_start_CSF_index = proj_jt.CSF_begin().index();
-                                int right_end_CSF_index = proj_jt.CSF_end().index();
-
                                 int solution = 0;
                                 for(unsigned int left_index = 0; left_index < left_eigenvector.size(); left_index++)
                                 {
                                     for(unsigned int right_index = 0; right_index < right_eigenvector.size(); right_index++)
                                     {
-                                        auto coeff_i = proj_it.CSF_begin();
-                                        for(const double* pleft = &left_eigenvector[left_index][left_start_CSF_index];
-                                            pleft != &left_eigenvector[left_index][left_end_CSF_index]; pleft++)
+                                        const double* left = left_eigenvector[left_index];
+                                        const double* right = right_eigenvector[right_index];
+                                        for(auto coeff_i = proj_it.CSF_begin(); coeff_i != proj_it.CSF_end(); coeff_i++)
                                         {
-                                            double left_coeff_and_matrix_element = matrix_element * (*coeff_i) * (*pleft);
+                                            double left_coeff_and_matrix_element = matrix_element * (*coeff_i) * left[coeff_i.index()];
 
-                                            auto coeff_j = proj_jt.CSF_begin();
-                                            for(const double* pright = &right_eigenvector[right_index][right_start_CSF_index];
-                                                pright != &right_eigenvector[right_index][right_end_CSF_index]; pright++)
+                                            for(auto coeff_j = proj_jt.CSF_begin(); coeff_j != proj_jt.CSF_end(); coeff_j++)
                                             {
 #ifdef AMBIT_USE_OPENMP
-                                                my_total[my_offset + solution] += left_coeff_and_matrix_element * (*coeff_j) * (*pright);
+                                                my_total[my_offset + solution] += left_coeff_and_matrix_element * (*coeff_j) * right[coeff_j.index()];
 #else
-                                                total[solution] += left_coeff_and_matrix_element * (*coeff_j) * (*pright);
+                                                total[solution] += left_coeff_and_matrix_element * (*coeff_j) * right[coeff_j.index()];
 #endif
-                                                coeff_j++;
                                             }
-                                            coeff_i++;
                                         }
 
                                         solution++;
@@ -774,7 +864,7 @@ std::vector<double> ManyBodyOperator<pElectronOperators...>::GetMatrixElement(co
 
 #ifdef AMBIT_USE_MPI
     std::vector<double> reduced_total(return_size, 0.);
-    MPI_Allreduce(total.data(), reduced_total.data(), return_size, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(total.data(), reduced_total.data(), return_size, MPI_DOUBLE, MPI_SUM, comm.Comm());
     return reduced_total;
 #else
     return total;
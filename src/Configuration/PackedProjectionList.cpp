@@ -0,0 +1,166 @@
+#include "Include.h"
+#include "PackedProjectionList.h"
+#include <map>
+
+namespace Ambit
+{
+PackedProjectionList::PackedProjectionList(const RelativisticConfigList& configs)
+{
+    unsigned int num_projections = configs.projection_size();
+    electron_start.reserve(num_projections + 1);
+    projection_config.reserve(num_projections);
+    coefficient_start.reserve(num_projections);
+    coefficient_end.reserve(num_projections);
+    config_projection_start.reserve(configs.size() + 1);
+    config_csf_start.reserve(configs.size());
+    config_num_CSFs.reserve(configs.size());
+
+    // Configurations with the same AngularData share their CSF coefficients:
+    // map from start of AngularData coefficients to index of first projection that uses them
+    std::map<const double*, unsigned int> coefficient_offsets;
+
+    for(auto config_it = configs.begin(); config_it != configs.end(); config_it++)
+    {
+        unsigned int config_index = config_projection_start.size();
+        unsigned int num_CSFs = config_it->NumCSFs();
+
+        config_projection_start.push_back(projection_config.size());
+        config_csf_start.push_back(config_it.csf_offset());
+        config_num_CSFs.push_back(num_CSFs);
+
+        auto proj_it = config_it.projection_begin();
+        if(proj_it == config_it.projection_end())
+            continue;
+
+        // Copy coefficients (with CSF index relative to the configuration) of all projections
+        // the first time that the AngularData is seen
+        int csf_offset = config_it.csf_offset();
+        const double* CSFs = proj_it.CSF_begin().base();
+        unsigned int first_projection = coefficient_start.size();
+        auto found = coefficient_offsets.find(CSFs);
+        if(CSFs == nullptr)
+        {   // No stored coefficients
+            coefficient_start.insert(coefficient_start.end(), config_it.projection_size(), coefficients.size());
+            coefficient_end.insert(coefficient_end.end(), config_it.projection_size(), coefficients.size());
+        }
+        else if(found == coefficient_offsets.end())
+        {   coefficient_offsets[CSFs] = first_projection;
+            for(auto it = proj_it; it != config_it.projection_end(); it++)
+            {
+                coefficient_start.push_back(coefficients.size());
+                for(auto coeff = it.CSF_begin(); coeff != it.CSF_end(); coeff++)
+                {   coefficients.push_back(*coeff);
+                    coefficient_index.push_back(coeff.index() - csf_offset);
+                }
+                coefficient_end.push_back(coefficients.size());
+            }
+        }
+        else
+        {   unsigned int source = found->second;
+            for(unsigned int i = 0; i < config_it.projection_size(); i++)
+            {   coefficient_start.push_back(coefficient_start[source + i]);
+                coefficient_end.push_back(coefficient_end[source + i]);
+            }
+        }
+
+        while(proj_it != config_it.projection_end())
+        {
+            electron_start.push_back(packed.size());
+            projection_config.push_back(config_index);
+
+            for(const auto& electron: *proj_it)
+                packed.push_back(Pack(electron));
+            proj_it++;
+        }
+    }
+
+    electron_start.push_back(packed.size());
+    config_projection_start.push_back(projection_config.size());
+}
+
+PackedProjectionList::PackedElectron PackedProjectionList::Pack(const ElectronInfo& electron)
+{
+    unsigned int pqn = electron.PQN();
+    unsigned int abs_kappa = abs(electron.Kappa());
+    int two_m = electron.TwoM();
+
+    if(pqn >= (1u << 10) || abs_kappa >= (1u << 7) || abs(two_m) >= TwoMOffset)
+    {   *errstream << "PackedProjectionList: cannot pack electron " << electron.Name() << std::endl;
+        exit(1);
+    }
+
+    PackedElectron record = (PackedElectron(abs_kappa) << 24) | (PackedElectron(pqn) << 13);
+    if(electron.Kappa() > 0)
+        record |= (1u << 23);
+
+    if(electron.IsHole())
+        record |= PackedElectron(TwoMOffset + two_m);
+    else
+        record |= ParticleBit | PackedElectron(TwoMOffset - two_m);
+
+    return record;
+}
+
+ElectronInfo PackedProjectionList::Unpack(PackedElectron electron)
+{
+    unsigned int pqn = (electron >> 13) & 0x3FF;
+    int kappa = (electron >> 24) & 0x7F;
+    if((electron & (1u << 23)) == 0)
+        kappa = -kappa;
+
+    return ElectronInfo(pqn, kappa, PackedTwoM(electron), IsHole(electron));
+}
+
+bool PackedProjectionList::WithinDifferences(unsigned int left_index, unsigned int right_index, unsigned int max_diffs) const
+{
+    const PackedElectron* it1 = packed.data() + electron_start[left_index];
+    const PackedElectron* end1 = packed.data() + electron_start[left_index+1];
+    const PackedElectron* it2 = packed.data() + electron_start[right_index];
+    const PackedElectron* end2 = packed.data() + electron_start[right_index+1];
+
+    // Count as in ManyBodyOperator::GetProjectionDifferences(): particles missing from the other side
+    // and holes missing from this side are differences on this side.
+    unsigned int num_diffs1 = 0;
+    unsigned int num_diffs2 = 0;
+
+    while(num_diffs1 <= max_diffs && num_diffs2 <= max_diffs && it1 != end1 && it2 != end2)
+    {
+        if(SameState(*it1, *it2))
+        {   it1++;
+            it2++;
+        }
+        else if(*it1 < *it2)
+        {   if(*it1 & ParticleBit)
+                num_diffs1++;
+            else
+                num_diffs2++;
+            it1++;
+        }
+        else
+        {   if(*it2 & ParticleBit)
+                num_diffs2++;
+            else
+                num_diffs1++;
+            it2++;
+        }
+    }
+
+    while(num_diffs1 <= max_diffs && num_diffs2 <= max_diffs && it1 != end1)
+    {   if(*it1 & ParticleBit)
+            num_diffs1++;
+        else
+            num_diffs2++;
+        it1++;
+    }
+
+    while(num_diffs1 <= max_diffs && num_diffs2 <= max_diffs && it2 != end2)
+    {   if(*it2 & ParticleBit)
+            num_diffs2++;
+        else
+            num_diffs1++;
+        it2++;
+    }
+
+    return (num_diffs1 <= max_diffs && num_diffs2 <= max_diffs);
+}
+}
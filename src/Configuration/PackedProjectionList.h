@@ -0,0 +1,131 @@
+#ifndef PACKED_PROJECTION_LIST_H
+#define PACKED_PROJECTION_LIST_H
+
+#include "RelativisticConfigList.h"
+#include <cstdint>
+#include <vector>
+
+namespace Ambit
+{
+/** PackedProjectionList stores all projections and CSF coefficients of a RelativisticConfigList
+    contiguously, so that loops over pairs of projections (e.g. HamiltonianMatrix::GenerateMatrix())
+    don't chase a pointer for every projection and CSF:
+        - electrons of all projections in one array of 32-bit packed records, which are compared without
+          calling ElectronInfo's virtual operators (ManyBodyOperator unpacks only the electrons it needs);
+        - projections of configuration i are [projection_begin(i), projection_end(i));
+        - one array of CSF coefficients with their CSF indices, shared between configurations with the
+          same AngularData (only non-zero coefficients are kept if the AngularData is sparse).
+    The list is a snapshot: use RelativisticConfigList::GetPackedProjections(), which builds it once
+    and rebuilds it only if the list or its CSFs change.
+ */
+class PackedProjectionList
+{
+public:
+    PackedProjectionList(const RelativisticConfigList& configs);
+
+    /** Packed electron record:
+            bit 31      not hole
+            bits 24-30  |kappa|
+            bit 23      kappa > 0
+            bits 13-22  pqn
+            bits 0-12   2M (ascending for holes, descending for particles)
+        so that comparison of records is the same as ElectronInfo::operator<().
+     */
+    typedef uint32_t PackedElectron;
+    static PackedElectron Pack(const ElectronInfo& electron);
+
+    /** Inverse of Pack(). */
+    static ElectronInfo Unpack(PackedElectron electron);
+
+    /** ElectronInfo::IsHole() of a packed record. */
+    static bool IsHole(PackedElectron electron) { return (electron & ParticleBit) == 0; }
+
+    /** Same orbital and 2M (but possibly different hole flag), i.e. ElectronInfo::operator==(). */
+    static bool SameState(PackedElectron first, PackedElectron second)
+    {   return ((first ^ second) & OrbitalMask) == 0 && PackedTwoM(first) == PackedTwoM(second);
+    }
+
+    /** View of a projection in the list: its packed electron records (see ManyBodyOperator::FindDifferences()),
+        and its CSFs as for a RelativisticConfiguration::const_projection_iterator.
+     */
+    class ProjectionView
+    {
+    public:
+        ProjectionView(const PackedElectron* begin, const PackedElectron* end, const double* CSFs, const double* CSFs_end,
+                       const int* CSF_indices, unsigned int num_CSFs, int csf_index):
+            m_begin(begin), m_end(end), m_CSFs(CSFs), m_CSFs_end(CSFs_end), m_CSF_indices(CSF_indices), m_num_CSFs(num_CSFs), m_csf_index(csf_index)
+        {}
+
+        typedef const PackedElectron* const_iterator;
+        const_iterator begin() const { return m_begin; }
+        const_iterator end() const { return m_end; }
+        const PackedElectron* data() const { return m_begin; }
+        unsigned int size() const { return m_end - m_begin; }
+
+        typedef RelativisticConfiguration::const_CSF_iterator const_CSF_iterator;
+        const_CSF_iterator CSF_begin() const { return const_CSF_iterator(m_CSFs, m_CSF_indices, m_csf_index); }
+        const_CSF_iterator CSF_end() const { return const_CSF_iterator(m_CSFs_end, m_CSF_indices + (m_CSFs_end - m_CSFs), m_csf_index); }
+        unsigned int NumCSFs() const { return m_num_CSFs; }
+
+    protected:
+        const PackedElectron* m_begin;
+        const PackedElectron* m_end;
+        const double* m_CSFs;
+        const double* m_CSFs_end;
+        const int* m_CSF_indices;
+        unsigned int m_num_CSFs;
+        int m_csf_index;
+    };
+
+    /** Projection by index in the list of all projections. */
+    ProjectionView operator[](unsigned int proj_index) const
+    {
+        unsigned int config_index = projection_config[proj_index];
+        return ProjectionView(packed.data() + electron_start[proj_index], packed.data() + electron_start[proj_index+1],
+                              coefficients.data() + coefficient_start[proj_index], coefficients.data() + coefficient_end[proj_index],
+                              coefficient_index.data() + coefficient_start[proj_index], config_num_CSFs[config_index],
+                              config_csf_start[config_index]);
+    }
+
+    /** Index of first projection of the ith configuration. */
+    unsigned int projection_begin(unsigned int config_index) const { return config_projection_start[config_index]; }
+
+    /** Index just past the last projection of the ith configuration. */
+    unsigned int projection_end(unsigned int config_index) const { return config_projection_start[config_index+1]; }
+
+    /** Total number of projections. */
+    unsigned int size() const { return projection_config.size(); }
+
+    /** Return true if the numbers of differences counted by ManyBodyOperator::GetProjectionDifferences()
+        between two projections are both no more than max_diffs. This only compares packed records, so it
+        is a cheap test to skip pairs of projections that have no matrix element.
+     */
+    bool WithinDifferences(unsigned int left_index, unsigned int right_index, unsigned int max_diffs) const;
+
+protected:
+    static constexpr PackedElectron ParticleBit = 1u << 31;
+    static constexpr PackedElectron OrbitalMask = 0x7FFFE000u;
+    static constexpr int TwoMOffset = 1 << 12;
+
+    static int PackedTwoM(PackedElectron electron)
+    {   int m = electron & 0x1FFF;
+        return (electron & ParticleBit)? TwoMOffset - m: m - TwoMOffset;
+    }
+
+protected:
+    std::vector<PackedElectron> packed;
+    std::vector<unsigned int> electron_start;       //!< Size num_projections + 1
+    std::vector<unsigned int> projection_config;    //!< Configuration index of each projection
+
+    std::vector<double> coefficients;
+    std::vector<int> coefficient_index;             //!< CSF index of each coefficient within its configuration
+    std::vector<unsigned int> coefficient_start;    //!< Start of CSF coefficients for each projection
+    std::vector<unsigned int> coefficient_end;      //!< End of CSF coefficients for each projection
+
+    std::vector<unsigned int> config_projection_start;  //!< Size num_configs + 1
+    std::vector<int> config_csf_start;              //!< CSF index of first CSF of each configuration
+    std::vector<unsigned int> config_num_CSFs;
+};
+
+}
+#endif
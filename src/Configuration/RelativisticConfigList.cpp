@@ -1,4 +1,5 @@
 #include "RelativisticConfigList.h"
+#include "PackedProjectionList.h"
 
 namespace Ambit
 {
@@ -17,6 +18,25 @@ unsigned int RelativisticConfigList::NumCSFs() const
     return total;
 }
 
+bool RelativisticConfigList::SameCSFs(const RelativisticConfigList& other) const
+{
+    if(m_list.size() != other.m_list.size() || Nsmall != other.Nsmall)
+        return false;
+
+    auto it = m_list.begin();
+    auto jt = other.m_list.begin();
+    while(it != m_list.end())
+    {
+        // CSFs are only the same if the AngularData is shared (i.e. comes from the same AngularDataLibrary)
+        if(!(*it == *jt) || it->angular_data != jt->angular_data)
+            return false;
+        it++;
+        jt++;
+    }
+
+    return true;
+}
+
 unsigned int RelativisticConfigList::NumCSFsSmall() const
 {
     unsigned int total = 0;
@@ -30,31 +50,80 @@ unsigned int RelativisticConfigList::NumCSFsSmall() const
 
 RelativisticConfigList::iterator RelativisticConfigList::erase(iterator position)
 {
+    int csf_index = position.csf_offset();
     auto it = m_list.erase(position.base());
     if(it - m_list.begin() < Nsmall)
         Nsmall--;
+    ClearOffsets();
 
-    return iterator(it);
+    return iterator(it, csf_index, this);
 }
 
 RelativisticConfigList::iterator RelativisticConfigList::erase(iterator first, iterator last)
 {
+    int csf_index = first.csf_offset();
     int start = first.base() - m_list.begin();
     int num_removed = last.base() - first.base();
     if(start < Nsmall)
         Nsmall -= mmin(Nsmall - start, num_removed);
+    ClearOffsets();
 
-    return iterator(m_list.erase(first.base(), last.base()));
+    return iterator(m_list.erase(first.base(), last.base()), csf_index, this);
 }
 
 RelativisticConfigList::iterator RelativisticConfigList::operator[](unsigned int i)
 {
-    return std::next(begin(), i);
+    return iterator(std::next(m_list.begin(), i), CSFOffset(i), this);
 }
 
 RelativisticConfigList::const_iterator RelativisticConfigList::operator[](unsigned int i) const
 {
-    return std::next(begin(), i);
+    return const_iterator(std::next(m_list.begin(), i), CSFOffset(i), this);
+}
+
+std::shared_ptr<const RelativisticConfigList::Offsets> RelativisticConfigList::GetOffsets() const
+{
+    std::shared_ptr<const Offsets> current = std::atomic_load(&offsets);
+    if(current)
+        return current;
+
+    // Several threads may get here together, but they all build the same table
+    auto new_offsets = std::make_shared<Offsets>();
+    new_offsets->complete = true;
+    new_offsets->csf.reserve(m_list.size() + 1);
+    new_offsets->projection.reserve(m_list.size() + 1);
+
+    int csf_total = 0;
+    unsigned int projection_total = 0;
+    for(const auto& rconfig: m_list)
+    {
+        new_offsets->csf.push_back(csf_total);
+        new_offsets->projection.push_back(projection_total);
+        csf_total += rconfig.NumCSFs();
+        projection_total += rconfig.projection_size();
+        if(!rconfig.angular_data || !rconfig.angular_data->CSFs_calculated())
+            new_offsets->complete = false;
+    }
+    new_offsets->csf.push_back(csf_total);
+    new_offsets->projection.push_back(projection_total);
+
+    // CSFs still to be generated would change the offsets
+    current = new_offsets;
+    if(current->complete)
+        std::atomic_store(&offsets, current);
+    return current;
+}
+
+std::shared_ptr<const PackedProjectionList> RelativisticConfigList::GetPackedProjections() const
+{
+    std::shared_ptr<const PackedProjectionList> current = std::atomic_load(&packed_projections);
+    if(current)
+        return current;
+
+    current = std::make_shared<const PackedProjectionList>(*this);
+    if(GetOffsets()->complete)
+        std::atomic_store(&packed_projections, current);
+    return current;
 }
 
 RelativisticConfigList::const_projection_iterator RelativisticConfigList::projection_begin() const
@@ -109,6 +178,7 @@ void RelativisticConfigList::unique()
                          return (ia != itsmall && *ia == x);
                        });
     m_list.resize(iter - m_list.begin());
+    ClearOffsets();
 }
 
 void RelativisticConfigList::Read(FILE* fp)
@@ -125,6 +195,7 @@ void RelativisticConfigList::Read(FILE* fp)
         config.Read(fp);
         m_list.push_back(config);
     }
+    ClearOffsets();
 }
 
 void RelativisticConfigList::Write(FILE* fp) const
@@ -2,10 +2,12 @@
 #define RELATIVISTIC_CONFIG_LIST_H
 
 #include "RelativisticConfiguration.h"
+#include <atomic>
 
 namespace Ambit
 {
 class ConfigurationComparator;
+class PackedProjectionList;
 class MostCSFsFirstComparator;
 class FewestProjectionsFirstComparator;
 class MostProjectionsFirstComparator;
@@ -19,8 +21,13 @@ class MostProjectionsFirstComparator;
             except it iterates over all projections in all configurations in the list and from which
             CSF coefficients can be accessed in exactly the same manner.
 
-    To facilitate multithreading over individual RelativisticConfigurations, a "random access"
-    operator[] is provided that returns the RelativisticConfiguration iterator and the CSF offset.
+    To facilitate multithreading over individual RelativisticConfigurations, (const_)iterator is
+    random access and operator[] returns the RelativisticConfiguration iterator with its CSF offset
+    in constant time. This uses prefix sums of CSFs and projections over the list, which are built
+    when first needed and kept once every configuration has its CSFs. They are cleared when the list
+    changes; after changing the projections or CSFs of configurations in the list through its iterators,
+    call ClearOffsets(). A PackedProjectionList copy of all projections and CSFs for loops over pairs of
+    projections is kept in the same way.
 
     Besides begin() and end() RelativisticConfigList also has an iterator small_end() that demarks the
     end of the small section of the Nsmall * N Hamiltonian matrix.
@@ -43,21 +50,21 @@ public: // Define iterators
         relconfiglist_iterator<Base>,
         Base,
         boost::use_default,
-        boost::bidirectional_traversal_tag>
+        boost::random_access_traversal_tag>
     {
     private:
         struct enabler {};
 
     public:
-        relconfiglist_iterator(): relconfiglist_iterator::iterator_adaptor_(), m_csf_index(0) {}
+        relconfiglist_iterator(): relconfiglist_iterator::iterator_adaptor_(), m_csf_index(0), m_list(nullptr) {}
 
-        explicit relconfiglist_iterator(Base p, int start_index = 0):
-        relconfiglist_iterator::iterator_adaptor_(p), m_csf_index(start_index) {}
+        explicit relconfiglist_iterator(Base p, int start_index = 0, const RelativisticConfigList* list = nullptr):
+        relconfiglist_iterator::iterator_adaptor_(p), m_csf_index(start_index), m_list(list) {}
 
         template <class OtherBase>
         relconfiglist_iterator(relconfiglist_iterator<OtherBase> const& other,
                                typename boost::enable_if<boost::is_convertible<OtherBase,Base>, enabler>::type = enabler()):
-        relconfiglist_iterator::iterator_adaptor_(other.base()), m_csf_index(other.csf_offset()) {}
+        relconfiglist_iterator::iterator_adaptor_(other.base()), m_csf_index(other.csf_offset()), m_list(other.list()) {}
 
         /** Get iterator over the projection list of the current RelativisticConfiguration. */
         RelativisticConfiguration::const_projection_iterator projection_begin() const
@@ -86,9 +93,32 @@ public: // Define iterators
         /** Start index of current CSFs (i.e. those from current RelativisticConfiguration) in the complete RelativisticConfigList. */
         int csf_offset() const { return m_csf_index; }
 
+        /** List that this iterator belongs to (may be null). */
+        const RelativisticConfigList* list() const { return m_list; }
+
     private:
         friend class boost::iterator_core_access;
         int m_csf_index;
+        const RelativisticConfigList* m_list;
+
+        void advance(typename relconfiglist_iterator::difference_type n)
+        {
+            if(m_list)
+            {   this->base_reference() += n;
+                m_csf_index = m_list->CSFOffset(this->base_reference() - m_list->m_list.begin());
+            }
+            else
+            {   // No offsets available: step through configurations
+                while(n > 0)
+                {   increment();
+                    n--;
+                }
+                while(n < 0)
+                {   decrement();
+                    n++;
+                }
+            }
+        }
 
         void increment()
         {   m_csf_index += this->base_reference()->NumCSFs();
@@ -169,16 +199,18 @@ public: // Define iterators
 public:
     /** Add all elements of other list to end of this list. Nsmall is unchanged. */
     void append(const RelativisticConfigList& other)
-    {   m_list.insert(m_list.end(), other.m_list.begin(), other.m_list.end()); }
+    {   m_list.insert(m_list.end(), other.m_list.begin(), other.m_list.end());
+        ClearOffsets();
+    }
 
-    iterator begin() { return iterator(m_list.begin(), 0); }
-    const_iterator begin() const { return const_iterator(m_list.begin(), 0); }
+    iterator begin() { return iterator(m_list.begin(), 0, this); }
+    const_iterator begin() const { return const_iterator(m_list.begin(), 0, this); }
 
-    iterator end() { return iterator(m_list.end()); }
-    const_iterator end() const { return const_iterator(m_list.end()); }
+    iterator end() { return iterator(m_list.end(), 0, this); }
+    const_iterator end() const { return const_iterator(m_list.end(), 0, this); }
 
-    iterator small_end() { return iterator(std::next(m_list.begin(), Nsmall)); }
-    const_iterator small_end() const { return const_iterator(std::next(m_list.begin(), Nsmall)); }
+    iterator small_end() { return iterator(std::next(m_list.begin(), Nsmall), 0, this); }
+    const_iterator small_end() const { return const_iterator(std::next(m_list.begin(), Nsmall), 0, this); }
 
     iterator erase(iterator position);
     iterator erase(iterator first, iterator last);
@@ -186,7 +218,7 @@ public:
     RelativisticConfiguration& front() { return m_list.front(); }
     const RelativisticConfiguration& front() const { return m_list.front(); }
 
-    /** Get iterator for the ith RelativisticConfiguration (with correct CSF offset).
+    /** Get iterator for the ith RelativisticConfiguration (with correct CSF offset) in constant time.
         PRE: i <= size().
      */
     iterator operator[](unsigned int i);
@@ -197,8 +229,8 @@ public:
     unsigned int projection_size() const;   //!< Total number of projections stored in entire list
 
     /** Add element to end of this list. Nsmall is unchanged. */
-    void push_back(const RelativisticConfiguration& val) { m_list.push_back(val); }
-    void push_back(RelativisticConfiguration&& val) { m_list.push_back(val); }
+    void push_back(const RelativisticConfiguration& val) { m_list.push_back(val); ClearOffsets(); }
+    void push_back(RelativisticConfiguration&& val) { m_list.push_back(val); ClearOffsets(); }
 
     unsigned int size() const { return m_list.size(); }
     unsigned int small_size() const { return Nsmall; }
@@ -216,14 +248,58 @@ public:
     unsigned int NumCSFs() const;   //!< Total number of CSFs stored in entire list
     unsigned int NumCSFsSmall() const;  //!< Number of CSFs stored in subset [0, Nsmall)
 
+    /** Return true if other has the same configurations in the same order (and the same Nsmall), sharing
+        the same AngularData objects, so that matrices built on either list have identical CSFs.
+     */
+    bool SameCSFs(const RelativisticConfigList& other) const;
+
+    /** Index of first CSF of the ith RelativisticConfiguration. PRE: i <= size(). */
+    int CSFOffset(unsigned int i) const { return GetOffsets()->csf[i]; }
+
+    /** Index of first projection of the ith RelativisticConfiguration in the list of all
+        projections (i.e. as counted by const_projection_iterator). PRE: i <= size().
+     */
+    unsigned int ProjectionOffset(unsigned int i) const { return GetOffsets()->projection[i]; }
+
+    /** Contiguous copy of all projections and CSFs in the list, built when first needed and kept
+        until the list or its CSFs change. Safe to call from several threads at once.
+     */
+    std::shared_ptr<const PackedProjectionList> GetPackedProjections() const;
+
+    /** Discard the CSF and projection offsets and packed projections; they will be rebuilt when next needed.
+        Changes to the list itself do this automatically; call it after changing the projections or CSFs
+        of configurations in the list (e.g. with RelativisticConfiguration::GetProjections()).
+     */
+    void ClearOffsets()
+    {   std::atomic_store(&offsets, std::shared_ptr<const Offsets>());
+        std::atomic_store(&packed_projections, std::shared_ptr<const PackedProjectionList>());
+    }
+
     void SetSmallSize(unsigned int Nsmall_configs) { Nsmall = Nsmall_configs; }
 
     void Read(FILE* fp);            //!< Read configurations
     void Write(FILE* fp) const;     //!< Write configurations
 
+protected:
+    /** Prefix sums of CSFs and projections: csf[i] is the number of CSFs in configurations [0, i).
+        If not complete, some configurations did not have their CSFs yet and the offsets are not kept.
+     */
+    struct Offsets
+    {
+        std::vector<int> csf;
+        std::vector<unsigned int> projection;
+        bool complete;
+    };
+
+    /** Build offsets if required. Safe to call from several threads at once. */
+    std::shared_ptr<const Offsets> GetOffsets() const;
+
 protected:
     BaseList m_list;
     unsigned int Nsmall {0};
+
+    mutable std::shared_ptr<const Offsets> offsets;
+    mutable std::shared_ptr<const PackedProjectionList> packed_projections;
 };
 
 class ConfigurationComparator
@@ -312,6 +388,7 @@ void RelativisticConfigList::sort(Comparator comp)
     auto itsmall = std::next(m_list.begin(), Nsmall);
     std::sort(m_list.begin(), itsmall, comp);
     std::sort(itsmall, m_list.end(), comp);
+    ClearOffsets();
 }
 
 typedef std::shared_ptr<RelativisticConfigList> pRelativisticConfigList;
@@ -125,12 +125,16 @@ void RelativisticConfiguration::Print(bool include_CSFs) const
 
     if(print_CSFs)
     {
-        const double* data = angular_data->GetCSFs();
         int num_CSFs = angular_data->NumCSFs();
         unsigned int num_projections = angular_data->projection_size();
-    
+        std::vector<double> data(num_projections * num_CSFs, 0.);
+
+        for(unsigned int j = 0; j < num_projections; j++)
+            for(auto it = angular_data->CSF_begin(j); it != angular_data->CSF_end(j); it++)
+                data[j * num_CSFs + it.index()] = *it;
+
         for(int i = 0; i < num_CSFs; i++)
-        {   for(int j = 0; j < num_projections; j++)
+        {   for(unsigned int j = 0; j < num_projections; j++)
                 *outstream << data[j * num_CSFs + i] << " ";
             *outstream << std::endl;
         }
@@ -37,7 +37,7 @@ public:
     RelativisticConfiguration& operator=(const RelativisticConfiguration&) = default;
     RelativisticConfiguration& operator=(RelativisticConfiguration&&) = default;
 
-    typedef indexed_iterator<const double*> const_CSF_iterator;
+    typedef AngularData::const_CSF_iterator const_CSF_iterator;
 
     /** Return whether a suitable projection with (J, M) was found. */
     bool GetProjections(pAngularDataLibrary data, const Symmetry& sym, int two_m);
@@ -80,35 +80,40 @@ public:
     {
     public:
         const_projection_iterator():
-            const_projection_iterator::iterator_adaptor_(), current_CSFs_start(nullptr), index_offset(0)
+            const_projection_iterator::iterator_adaptor_(), angular_data(nullptr), proj_index(0), num_CSFs(0), index_offset(0)
         {}
 
         const_projection_iterator(ProjectionList::const_iterator p):
-            const_projection_iterator::iterator_adaptor_(p), current_CSFs_start(nullptr), index_offset(0)
+            const_projection_iterator::iterator_adaptor_(p), angular_data(nullptr), proj_index(0), num_CSFs(0), index_offset(0)
         {}
 
-        const_projection_iterator(ProjectionList::const_iterator p, const pAngularDataConst& angular_data, int offset = 0):
-            const_projection_iterator::iterator_adaptor_(p), current_CSFs_start(angular_data->GetCSFs()), num_CSFs(angular_data->NumCSFs()), index_offset(offset)
+        /** p must be the projection with index proj_index in angular_data. */
+        const_projection_iterator(ProjectionList::const_iterator p, const pAngularDataConst& angular_data, int offset = 0, unsigned int proj_index = 0):
+            const_projection_iterator::iterator_adaptor_(p), angular_data(angular_data.get()), proj_index(proj_index), num_CSFs(angular_data->NumCSFs()), index_offset(offset)
         {}
 
         const_projection_iterator(const RelativisticConfiguration& rconfig, int offset = 0):
-            const_projection_iterator::iterator_adaptor_(rconfig.projections.begin()), current_CSFs_start(rconfig.angular_data->GetCSFs()), num_CSFs(rconfig.angular_data->NumCSFs()), index_offset(offset)
+            const_projection_iterator::iterator_adaptor_(rconfig.projections.begin()), angular_data(rconfig.angular_data.get()), proj_index(0), num_CSFs(rconfig.angular_data->NumCSFs()), index_offset(offset)
         {}
 
         const_projection_iterator(const const_projection_iterator& other):
-            const_projection_iterator::iterator_adaptor_(other.base_reference()), current_CSFs_start(other.current_CSFs_start), num_CSFs(other.num_CSFs), index_offset(other.index_offset)
+            const_projection_iterator::iterator_adaptor_(other.base_reference()), angular_data(other.angular_data), proj_index(other.proj_index), num_CSFs(other.num_CSFs), index_offset(other.index_offset)
         {}
 
-        const_CSF_iterator CSF_begin() const { return const_CSF_iterator(current_CSFs_start, index_offset); }
-        const_CSF_iterator CSF_end() const { return const_CSF_iterator(current_CSFs_start + num_CSFs, index_offset + num_CSFs); }
+        /** Iterate over CSF coefficients of this projection; const_CSF_iterator::index() gives the CSF index.
+            If the AngularData is sparse, only non-zero coefficients are visited.
+         */
+        const_CSF_iterator CSF_begin() const { return angular_data->CSF_begin(proj_index, index_offset); }
+        const_CSF_iterator CSF_end() const { return angular_data->CSF_end(proj_index, index_offset); }
         unsigned int NumCSFs() const { return num_CSFs; }
 
     protected:
         friend class boost::iterator_core_access;
-        void increment() { this->base_reference()++; current_CSFs_start += num_CSFs; }
+        void increment() { this->base_reference()++; proj_index++; }
 
     protected:
-        const double* current_CSFs_start;
+        const AngularData* angular_data;
+        unsigned int proj_index;
         unsigned int num_CSFs;
         int index_offset;
     };
@@ -127,7 +132,7 @@ public:
 
     const_projection_iterator projection_end(int csf_offset) const
     {
-        return const_projection_iterator(projections.end(), angular_data, csf_offset);
+        return const_projection_iterator(projections.end(), angular_data, csf_offset, projections.size());
     }
 
     unsigned int projection_size() const
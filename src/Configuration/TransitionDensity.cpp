@@ -0,0 +1,298 @@
+#include "TransitionDensity.h"
+#include "Include.h"
+#include "ManyBodyOperator.h"
+#include "Universal/Communicator.h"
+#include "Universal/MathConstant.h"
+#include "Universal/Profiler.h"
+#include <algorithm>
+#include <map>
+#ifdef AMBIT_USE_OPENMP
+    #include <omp.h>
+#endif
+#ifdef AMBIT_USE_MPI
+    #include <mpi.h>
+#endif
+
+namespace Ambit
+{
+TransitionDensity::TransitionDensity(const LevelVector& left, const LevelVector& right, int K):
+    K(K), num_left(left.levels.size()), num_right(right.levels.size()), diagonal(false)
+{
+    Calculate(left, right);
+}
+
+TransitionDensity::TransitionDensity(const LevelVector& levels, int K):
+    K(K), num_left(levels.levels.size()), num_right(levels.levels.size()), diagonal(true)
+{
+    Calculate(levels, levels);
+}
+
+void TransitionDensity::Calculate(const LevelVector& left_levelvec, const LevelVector& right_levelvec)
+{
+    ProfileTimer timer("TransitionDensity");
+    unsigned int return_size = NumSolutions();
+    if(return_size == 0)
+        return;
+
+    std::vector<const double*> left_eigenvector;
+    std::vector<const double*> right_eigenvector;
+
+    auto& configs_left = left_levelvec.configs;
+    auto& configs_right = right_levelvec.configs;
+
+    left_eigenvector.reserve(num_left);
+    for(auto& level: left_levelvec.levels)
+        left_eigenvector.push_back(level->GetEigenvector().data());
+
+    right_eigenvector.reserve(num_right);
+    for(auto& level: right_levelvec.levels)
+        right_eigenvector.push_back(level->GetEigenvector().data());
+
+    // Index all orbitals that appear on each side
+    std::map<OrbitalInfo, unsigned int> left_orbital_index, right_orbital_index;
+    for(const auto& rconfig: *configs_left)
+        for(const auto& orb_pair: rconfig)
+            left_orbital_index.insert(std::make_pair(orb_pair.first, 0));
+    for(const auto& rconfig: *configs_right)
+        for(const auto& orb_pair: rconfig)
+            right_orbital_index.insert(std::make_pair(orb_pair.first, 0));
+
+    std::vector<OrbitalInfo> left_orbitals, right_orbitals;
+    for(auto& pair: left_orbital_index)
+    {   pair.second = left_orbitals.size();
+        left_orbitals.push_back(pair.first);
+    }
+    for(auto& pair: right_orbital_index)
+    {   pair.second = right_orbitals.size();
+        right_orbitals.push_back(pair.first);
+    }
+
+    unsigned int num_right_orbitals = right_orbitals.size();
+
+    // Only orbital pairs that satisfy the triangle condition with K can have non-zero density:
+    // pair_block[a * num_right_orbitals + b] is the index of pair (a, b) in allowed_pairs, or -1.
+    MathConstant* math = MathConstant::Instance();
+    std::vector<int> pair_block(left_orbitals.size() * num_right_orbitals, -1);
+    std::vector<std::pair<OrbitalInfo, OrbitalInfo>> allowed_pairs;
+    for(unsigned int a = 0; a < left_orbitals.size(); a++)
+        for(unsigned int b = 0; b < num_right_orbitals; b++)
+            if(math->triangular_condition(left_orbitals[a].TwoJ(), right_orbitals[b].TwoJ(), 2 * K))
+            {   pair_block[a * num_right_orbitals + b] = allowed_pairs.size();
+                allowed_pairs.push_back(std::make_pair(left_orbitals[a], right_orbitals[b]));
+            }
+
+    // Only used for its projection differences
+    typedef ManyBodyOperator<const ZeroOperator*> DifferenceOperator;
+    DifferenceOperator differences(nullptr);
+
+    // Amplitude of each projection of a configuration in each level:
+    //     amplitude[proj * num_levels + level] = Sum_{CSF} < proj | CSF > eigenvector[level][CSF]
+    // The overlap of a pair of levels within a pair of projections is then just a product of
+    // amplitudes, rather than a sum over all pairs of CSFs.
+    auto get_amplitudes = [](RelativisticConfigList::const_iterator config, const std::vector<const double*>& eigenvector, std::vector<double>& amplitude)
+    {
+        unsigned int num_levels = eigenvector.size();
+        amplitude.assign(config->projection_size() * num_levels, 0.);
+
+        double* amp = amplitude.data();
+        for(auto proj_it = config.projection_begin(); proj_it != config.projection_end(); proj_it++)
+        {
+            for(unsigned int level = 0; level < num_levels; level++)
+            {
+                const double* coeff = eigenvector[level];
+                for(auto coeff_i = proj_it.CSF_begin(); coeff_i != proj_it.CSF_end(); coeff_i++)
+                    amp[level] += (*coeff_i) * coeff[coeff_i.index()];
+            }
+            amp += num_levels;
+        }
+    };
+
+#ifdef AMBIT_USE_OPENMP
+    int num_threads = omp_get_max_threads();
+#else
+    int num_threads = 1;
+#endif
+    // Each thread only stores the pairs it touches, as blocks of return_size:
+    // thread_offset[thread][pair] is the start of the block for that pair in thread_density[thread], or -1.
+    std::vector<std::vector<long long>> thread_offset(num_threads, std::vector<long long>(allowed_pairs.size(), -1));
+    std::vector<std::vector<double>> thread_density(num_threads);
+    std::vector<DifferenceOperator::IndirectProjectionStruct> indirects_list(num_threads);
+    int num_processors = NumProcessors;
+    int processor_rank = ProcessorRank;
+
+#ifdef AMBIT_USE_OPENMP
+    #pragma omp parallel for default(none) \
+                             shared(thread_offset, thread_density, indirects_list, differences, configs_left, configs_right, \
+                                    left_eigenvector, right_eigenvector, left_orbital_index, right_orbital_index, pair_block, \
+                                    math, num_right_orbitals, return_size, get_amplitudes, num_processors, processor_rank) \
+                             schedule(dynamic)
+#endif
+    for(unsigned long long ii = 0; ii < configs_left->size(); ii++)
+    {
+#ifdef AMBIT_USE_OPENMP
+        int thread = omp_get_thread_num();
+#else
+        int thread = 0;
+#endif
+        std::vector<long long>& my_offset = thread_offset[thread];
+        std::vector<double>& my_density = thread_density[thread];
+        DifferenceOperator::IndirectProjectionStruct& indirects = indirects_list[thread];
+        std::vector<double> overlap(return_size);
+        std::vector<double> left_amplitude, right_amplitude;
+
+        // Angular part of < e1 | t^K | e2 > (cf. OneElectronIntegrals::GetMatrixElement())
+        auto add_density = [&](const ElectronInfo& e1, const ElectronInfo& e2, double sign)
+        {
+            double angular = math->Electron3j(e2.TwoJ(), e1.TwoJ(), K, e2.TwoM(), -e1.TwoM());
+            if(!angular)
+                return;
+            angular *= sign * math->minus_one_to_the_power((e1.TwoJ()-e1.TwoM())/2);
+
+            // Non-zero angular part implies the triangle condition, so the pair is allowed
+            int pair_index = pair_block[left_orbital_index.at(e1) * num_right_orbitals + right_orbital_index.at(e2)];
+            long long& offset = my_offset[pair_index];
+            if(offset < 0)
+            {   offset = my_density.size();
+                my_density.resize(offset + return_size, 0.);
+            }
+
+            double* rho = &my_density[offset];
+            for(unsigned int solution = 0; solution < return_size; solution++)
+                rho[solution] += angular * overlap[solution];
+        };
+
+        auto config_it = (*configs_left)[ii];
+
+        unsigned long long config_index = ii * configs_left->size();
+
+        // Diagonal densities only need the upper triangle of configurations
+        auto config_jt = diagonal? config_it: configs_right->begin();
+        while(config_jt != configs_right->end())
+        {
+            if(config_it->GetConfigDifferencesCount(*config_jt) <= 1)
+            {
+                if(int(config_index%num_processors) == processor_rank)
+                {
+                    if(left_amplitude.empty())
+                        get_amplitudes(config_it, left_eigenvector, left_amplitude);
+                    get_amplitudes(config_jt, right_eigenvector, right_amplitude);
+
+                    unsigned int proj_i = 0;
+                    auto proj_it = config_it.projection_begin();
+                    while(proj_it != config_it.projection_end())
+                    {
+                        const double* left_amp = &left_amplitude[proj_i * num_left];
+
+                        // In the diagonal case, only take each pair of projections once
+                        unsigned int proj_j = 0;
+                        auto proj_jt = config_jt.projection_begin();
+                        if(diagonal && config_it == config_jt)
+                        {   proj_jt = proj_it;
+                            proj_j = proj_i;
+                        }
+
+                        while(proj_jt != config_jt.projection_end())
+                        {
+                            const double* right_amp = &right_amplitude[proj_j * num_right];
+
+                            differences.make_indirect_projection(*proj_it, indirects.left);
+                            differences.make_indirect_projection(*proj_jt, indirects.right);
+                            int num_diffs = differences.GetProjectionDifferences<1>(indirects);
+
+                            if(abs(num_diffs) <= 1)
+                            {
+                                // Overlap for each pair of levels
+                                if(diagonal)
+                                {   for(unsigned int level = 0; level < num_left; level++)
+                                        overlap[level] = left_amp[level] * right_amp[level];
+                                }
+                                else
+                                {   int solution = 0;
+                                    for(unsigned int left_index = 0; left_index < num_left; left_index++)
+                                        for(unsigned int right_index = 0; right_index < num_right; right_index++)
+                                            overlap[solution++] = left_amp[left_index] * right_amp[right_index];
+                                }
+
+                                if(num_diffs == 0)
+                                {
+                                    for(auto& e: indirects.left)
+                                        add_density(*e, *e, e->IsHole()? -1. : 1.);
+                                }
+                                else
+                                {   add_density(*indirects.left[0], *indirects.right[0], num_diffs);
+
+                                    // Include the transposed pair of projections
+                                    if(diagonal)
+                                        add_density(*indirects.right[0], *indirects.left[0], num_diffs);
+                                }
+                            }
+                            proj_jt++;
+                            proj_j++;
+                        }
+                        proj_it++;
+                        proj_i++;
+                    }
+                } // MPI work distribution
+
+                config_index++;
+            }
+            config_jt++;
+        } // config_jt loop
+    } // config_it loop
+
+    // Gather all the partial sums
+    std::vector<double> total(allowed_pairs.size() * return_size, 0.);
+    for(int thread = 0; thread < num_threads; thread++)
+    {
+        for(unsigned int pair_index = 0; pair_index < allowed_pairs.size(); pair_index++)
+        {
+            long long offset = thread_offset[thread][pair_index];
+            if(offset >= 0)
+            {   const double* rho = &thread_density[thread][offset];
+                double* sum = &total[pair_index * return_size];
+                for(unsigned int solution = 0; solution < return_size; solution++)
+                    sum[solution] += rho[solution];
+            }
+        }
+
+        // Free as we go
+        std::vector<long long>().swap(thread_offset[thread]);
+        std::vector<double>().swap(thread_density[thread]);
+    }
+
+#ifdef AMBIT_USE_MPI
+    std::vector<double> reduced_total(total.size(), 0.);
+    MPI_Allreduce(total.data(), reduced_total.data(), total.size(), MPI_DOUBLE, MPI_SUM, ProcessGroup.Comm());
+    total.swap(reduced_total);
+#endif
+
+    // Keep only orbital pairs with non-zero density. These stay in sorted order, for GetDensity().
+    for(unsigned int pair_index = 0; pair_index < allowed_pairs.size(); pair_index++)
+    {
+        const double* rho = &total[pair_index * return_size];
+        bool nonzero = false;
+        for(unsigned int solution = 0; solution < return_size && !nonzero; solution++)
+            nonzero = (rho[solution] != 0.);
+
+        if(nonzero)
+        {   orbital_pairs.push_back(allowed_pairs[pair_index]);
+            density.insert(density.end(), rho, rho + return_size);
+        }
+    }
+}
+
+double TransitionDensity::GetDensity(const OrbitalInfo& a, const OrbitalInfo& b, unsigned int left_index, unsigned int right_index) const
+{
+    if(diagonal && left_index != right_index)
+        return 0.;
+
+    unsigned int return_size = NumSolutions();
+    unsigned int solution = diagonal? left_index: left_index * num_right + right_index;
+    auto key = std::make_pair(a, b);
+    auto it = std::lower_bound(orbital_pairs.begin(), orbital_pairs.end(), key);
+    if(it != orbital_pairs.end() && *it == key)
+        return density[(it - orbital_pairs.begin()) * return_size + solution];
+
+    return 0.;
+}
+}
@@ -0,0 +1,100 @@
+#ifndef TRANSITION_DENSITY_H
+#define TRANSITION_DENSITY_H
+
+#include "LevelVector.h"
+#include "HartreeFock/OrbitalInfo.h"
+#include <vector>
+#include <memory>
+
+namespace Ambit
+{
+/** TransitionDensity stores the one-body transition density of rank K between all pairs of levels
+    of two LevelVectors:
+        < left_i | t^K | right_j > = Sum_{a, b} rho_{ab}(i, j) < a || t^K || b >
+    for any one-body operator t^K of rank K. The matrix elements are those of the stored
+    (stretched) projections, i.e. the same as those returned by
+        ManyBodyOperator<pTransitionIntegrals>::GetMatrixElement(left, right).
+    Calculating rho requires the full loop over configuration and projection pairs, but after that
+    each operator of rank K only costs a contraction with its reduced one-body integrals.
+    The diagonal density rho_{ab}(i, i) of a single LevelVector gives expectation values such as
+    g-factors for all levels in one pass.
+ */
+class TransitionDensity
+{
+public:
+    /** Calculate transition density of rank K between all levels in left and right.
+        This uses MPI and OpenMP, so all processes must call it together.
+     */
+    TransitionDensity(const LevelVector& left, const LevelVector& right, int K);
+
+    /** Calculate diagonal density of rank K for all levels, i.e. only < level_i | t^K | level_i >.
+        This uses MPI and OpenMP, so all processes must call it together.
+     */
+    TransitionDensity(const LevelVector& levels, int K);
+
+    int GetK() const { return K; }
+    unsigned int NumLeftLevels() const { return num_left; }
+    unsigned int NumRightLevels() const { return num_right; }
+    bool IsDiagonal() const { return diagonal; }
+
+    /** Size of array returned by GetMatrixElement(). */
+    unsigned int NumSolutions() const { return diagonal? num_left: num_left * num_right; }
+
+    /** Number of orbital pairs (a, b) with non-zero density. */
+    unsigned int size() const { return orbital_pairs.size(); }
+
+    /** Get rho_{ab}(left_index, right_index) (zero off the diagonal for diagonal densities). */
+    double GetDensity(const OrbitalInfo& a, const OrbitalInfo& b, unsigned int left_index, unsigned int right_index) const;
+
+    /** Contract with reduced one-body integrals, which must supply
+            GetReducedMatrixElement(const OrbitalInfo& a, const OrbitalInfo& b)
+        (e.g. TransitionIntegrals), for an operator of rank GetK().
+        Return array of matrix elements indexed by left_index * NumRightLevels() + right_index,
+        or by level for diagonal densities.
+     */
+    template<class OneBodyIntegrals>
+    std::vector<double> GetMatrixElement(const OneBodyIntegrals& integrals) const;
+
+protected:
+    void Calculate(const LevelVector& left, const LevelVector& right);
+
+protected:
+    int K;
+    unsigned int num_left, num_right;
+    bool diagonal;
+
+    std::vector<std::pair<OrbitalInfo, OrbitalInfo>> orbital_pairs;
+
+    /** density[pair_index * NumSolutions() + left_index * num_right + right_index],
+        or density[pair_index * NumSolutions() + level] if diagonal.
+     */
+    std::vector<double> density;
+};
+
+typedef std::shared_ptr<TransitionDensity> pTransitionDensity;
+typedef std::shared_ptr<const TransitionDensity> pTransitionDensityConst;
+
+template<class OneBodyIntegrals>
+std::vector<double> TransitionDensity::GetMatrixElement(const OneBodyIntegrals& integrals) const
+{
+    unsigned int return_size = NumSolutions();
+    std::vector<double> total(return_size, 0.);
+
+    const double* rho = density.data();
+    for(const auto& pair: orbital_pairs)
+    {
+        double reduced_matrix_element = integrals.GetReducedMatrixElement(pair.first, pair.second);
+        if(reduced_matrix_element)
+        {
+            for(unsigned int solution = 0; solution < return_size; solution++)
+                total[solution] += rho[solution] * reduced_matrix_element;
+        }
+
+        rho += return_size;
+    }
+
+    return total;
+}
+
+}
+#endif
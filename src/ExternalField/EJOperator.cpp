@@ -191,7 +191,7 @@ EMCalculator::EMCalculator(MultipolarityType type, int J, MultirunOptions& user_
     if(user_input.search("--rpa"))
     {
         auto op_rpa = MakeRPA(std::static_pointer_cast<TimeDependentSpinorOperator>(op), hf, atom.GetHartreeY());
-        double scale = user_input("RPA/Scale", 0.01);
+        scale = user_input("RPA/Scale", 0.01);
         op_rpa->SetScale(scale);
         op = op_rpa;
     }
@@ -227,24 +227,20 @@ void EMCalculator::PrintTransition(const LevelID& left, const LevelID& right, do
     int twoj2 = right.first->GetTwoJ();
     double value = matrix_element/math->Electron3j(twoj2, twoj1, J, twoj2, -twoj1);
 
-    double scale = 1.;
-    pRPAOperator rpa = std::dynamic_pointer_cast<RPAOperator>(op);
-    if(rpa)
-        scale = rpa->GetScale();
-
     // Read over the user input to see if we need to print the reduced matrix
     // elements or the transition line strengths
     if(user_input.search("--reduced-elements"))
     {
         *outstream << "  " << Ambit::Name(left) << " -> " << Ambit::Name(right)
-                   << " = " << std::setprecision(6) << value/scale << std::endl;
+                   << " = " << std::setprecision(6) << value << std::endl;
     }
     else
     {
         *outstream << "  " << Ambit::Name(left) << " -> " << Ambit::Name(right)
-                   << " = " << std::setprecision(6) << gsl_pow_2(value/scale) << std::endl;
+                   << " = " << std::setprecision(6) << gsl_pow_2(value) << std::endl;
     }
 
+    pRPAOperator rpa = std::dynamic_pointer_cast<RPAOperator>(op);
     if(rpa && user_input.search("RPA/--print-field"))
     {
         auto fp = fopen("RPAField.txt", "wt");
@@ -261,6 +257,42 @@ void EMCalculator::PrintTransition(const LevelID& left, const LevelID& right, do
     }
 }
 
+std::vector<std::string> EMCalculator::LineQuantityNames() const
+{
+    return {"S", "A", "gf"};
+}
+
+void EMCalculator::LineQuantities(const LevelID& left, const Level& left_level, const LevelID& right, const Level& right_level, double matrix_element, std::vector<double>& quantities) const
+{
+    MathConstant* math = MathConstant::Instance();
+
+    int twoj1 = left.first->GetTwoJ();
+    int twoj2 = right.first->GetTwoJ();
+
+    // Line strength, as printed by PrintTransition()
+    double S = gsl_pow_2(matrix_element/math->Electron3j(twoj2, twoj1, J, twoj2, -twoj1));
+
+    // Einstein A coefficient (atomic units) for emission from the upper level
+    double omega = fabs(left_level.GetEnergy() - right_level.GetEnergy());
+    int twoj_upper = (left_level.GetEnergy() > right_level.GetEnergy())? twoj1: twoj2;
+    double alpha = 1./math->SpeedOfLightAU();
+
+    double A = 2. * (2 * J + 1) * (J + 1)/(J * gsl_pow_2(boost::math::double_factorial<double>(2 * J + 1)))
+               * gsl_pow_int(alpha * omega, 2 * J + 1) * S/(twoj_upper + 1);
+
+    // Magnetic line strengths are in units of the Bohr magneton (alpha/2)
+    if(type == MultipolarityType::M)
+        A *= alpha * alpha/4.;
+
+    double gf = 0.;
+    if(omega)
+        gf = (twoj_upper + 1) * A/(2. * gsl_pow_3(alpha) * gsl_pow_2(omega));
+
+    quantities.push_back(S);
+    quantities.push_back(A * math->AtomicFrequencySI());
+    quantities.push_back(gf);
+}
+
 std::string EMCalculator::Name() const
 {
     return Ambit::Name(type) + itoa(J);
@@ -61,6 +61,11 @@ public:
 
     virtual std::string Name() const;
 
+protected:
+    /** Line strength S (a.u.), Einstein A coefficient (s^-1) and weighted oscillator strength gf. */
+    virtual std::vector<std::string> LineQuantityNames() const override;
+    virtual void LineQuantities(const LevelID& left, const Level& left_level, const LevelID& right, const Level& right_level, double matrix_element, std::vector<double>& quantities) const override;
+
 protected:
     MultipolarityType type;
     int J;
@@ -29,49 +29,77 @@ void TransitionCalculator::CalculateAndPrint()
         PrintHeader();
     }
 
+    // Collect all requested transitions first, so that frequency-dependent operators
+    // can be solved once for many transitions
+    std::vector<TransitionID> requested;
     for(int i = 0; i < num_transitions; i++)
-        CalculateTransition(user_input("MatrixElements", "", i));
-
-    if(!all_below)
     {
-        if(!num_transitions)
-            *outstream << "  No transitions requested." << std::endl;
-
-        return;
+        TransitionID transition = ParseTransition(user_input("MatrixElements", "", i));
+        if(transition.first.first && transition.second.first)
+            requested.push_back(transition);
     }
 
     // Calculate all transitions of a certain type below a given energy
     double max_energy = user_input("AllBelow", 0.0);
     bool found_one = false;
 
-    auto left_it = levels->begin();
-    while(left_it != levels->end())
+    if(all_below)
     {
-        auto right_it = left_it;
-        while(right_it != levels->end())
+        auto left_it = levels->begin();
+        while(left_it != levels->end())
         {
-            if(TransitionExists((*left_it)->GetSymmetry(), (*right_it)->GetSymmetry()))
+            auto right_it = left_it;
+            while(right_it != levels->end())
             {
-                LevelVector left_vec = levels->GetLevels(*left_it);
-                for(int i = 0; i < left_vec.levels.size(); i++)
+                if(TransitionExists((*left_it)->GetSymmetry(), (*right_it)->GetSymmetry()))
                 {
-                    if(left_vec.levels[i]->GetEnergy() > max_energy)
-                        break;
-
-                    LevelVector right_vec = levels->GetLevels(*right_it);
-                    for(int j = 0; j < right_vec.levels.size(); j++)
+                    LevelVector left_vec = levels->GetLevels(*left_it);
+                    for(unsigned int i = 0; i < left_vec.levels.size(); i++)
                     {
-                        if(right_vec.levels[j]->GetEnergy() > max_energy)
+                        if(left_vec.levels[i]->GetEnergy() > max_energy)
                             break;
 
-                        found_one = true;
-                        CalculateTransition(std::make_pair(*left_it, i), std::make_pair(*right_it, j));
+                        LevelVector right_vec = levels->GetLevels(*right_it);
+                        for(unsigned int j = 0; j < right_vec.levels.size(); j++)
+                        {
+                            if(right_vec.levels[j]->GetEnergy() > max_energy)
+                                break;
+
+                            found_one = true;
+                            requested.push_back(std::make_pair(std::make_pair(*left_it, int(i)), std::make_pair(*right_it, int(j))));
+                        }
                     }
                 }
+                right_it++;
             }
-            right_it++;
+            left_it++;
         }
-        left_it++;
+    }
+
+    if(variable_frequency_op)
+        CalculateTransitionsByFrequency(requested);
+
+    for(const auto& transition: requested)
+        CalculateTransition(transition.first, transition.second);
+
+    if(user_input.search("--all-lines"))
+    {
+        std::string filename = user_input("AllLines/Filename", "");
+        if(filename.empty())
+            *errstream << "TransitionCalculator: AllLines/Filename must be set for --all-lines." << std::endl;
+        else
+            CalculateAllLines(filename, user_input.search("AllLines/--binary"));
+
+        if(!num_transitions && !all_below)
+            return;
+    }
+
+    if(!all_below)
+    {
+        if(!num_transitions)
+            *outstream << "  No transitions requested." << std::endl;
+
+        return;
     }
 
     if(!found_one)
@@ -242,55 +270,24 @@ double TransitionCalculator::CalculateTransition(const LevelID& left, const Leve
                 double freq = left_level.GetEnergy() - right_level.GetEnergy();
 
                 if(fabs(tdop->GetFrequency() - freq) > 1.e-6 || integrals == nullptr)
-                {
-                    tdop->SetFrequency(freq);
-                    auto rpa = std::dynamic_pointer_cast<RPAOperator>(tdop);
-                    if(rpa)
-                        rpa->SolveRPA();
+                    SetOperatorFrequency(freq);
 
-                    if(integrals == nullptr)
-                    {
-                        // Create new TransitionIntegrals object and calculate integrals
-                        integrals = std::make_shared<TransitionIntegrals>(orbitals, op);
-                    }
-
-                    integrals->clear();
-                    integrals->CalculateOneElectronIntegrals(orbitals->valence, orbitals->valence);
-                }
-
-                ManyBodyOperator<pTransitionIntegrals> many_body_operator(integrals);
-
-                // Get matrix elements for all transitions with same HamiltonianIDs
-                std::vector<double> values = many_body_operator.GetMatrixElement(left_levels, right_levels);
+                // The transition density doesn't depend on frequency, so only the contraction is repeated
+                pTransitionDensityConst density = levels->GetTransitionDensity(left_levels, right_levels, op->GetK());
+                std::vector<double> values = density->GetMatrixElement(*integrals);
 
                 // Add to matrix_elements map
-                return_value = values[left.second * right_levels.levels.size() + right.second];
-                matrix_elements.insert(std::make_pair(id, return_value/scale));
+                return_value = values[left.second * right_levels.levels.size() + right.second]/scale;
+                matrix_elements.insert(std::make_pair(id, return_value));
             }
             else
             {   // Get transition integrals
-                if(integrals == nullptr)
-                {
-                    if(tdop)
-                    {
-                        double omega = user_input("Frequency", std::numeric_limits<double>::quiet_NaN());
-                        if(!std::isnan(omega))
-                            tdop->SetFrequency(omega);
+                MakeStaticIntegrals();
 
-                        auto rpa = std::dynamic_pointer_cast<RPAOperator>(tdop);
-                        if(rpa)
-                            rpa->SolveRPA();
-                    }
-
-                    // Create new TransitionIntegrals object and calculate integrals
-                    integrals = std::make_shared<TransitionIntegrals>(orbitals, op);
-                    integrals->CalculateOneElectronIntegrals(orbitals->valence, orbitals->valence);
-                }
-
-                ManyBodyOperator<pTransitionIntegrals> many_body_operator(integrals);
-
-                // Get matrix elements for all transitions with same HamiltonianIDs
-                std::vector<double> values = many_body_operator.GetMatrixElement(left_levels, right_levels);
+                // Get matrix elements for all transitions with same HamiltonianIDs.
+                // The transition density is shared by all operators of the same rank.
+                pTransitionDensityConst density = levels->GetTransitionDensity(left_levels, right_levels, op->GetK());
+                std::vector<double> values = density->GetMatrixElement(*integrals);
 
                 // Add to matrix_elements map
                 auto value_iterator = values.begin();
@@ -315,6 +312,15 @@ double TransitionCalculator::CalculateTransition(const LevelID& left, const Leve
 }
 
 double TransitionCalculator::CalculateTransition(const std::string& transition)
+{
+    TransitionID id = ParseTransition(transition);
+    if(!id.first.first || !id.second.first)
+        return 0.;
+
+    return CalculateTransition(id.first, id.second);
+}
+
+TransitionID TransitionCalculator::ParseTransition(const std::string& transition)
 {
     int pos = transition.find("->");
     if(pos == std::string::npos)
@@ -322,22 +328,328 @@ double TransitionCalculator::CalculateTransition(const std::string& transition)
         LevelID only(make_LevelID(transition.substr(0, pos)));
 
         if(!only.first)
-        {   *errstream << "TransitionCalculator: " << transition << " incorrectly formed." << std::endl;
-            return 0.;
-        }
-        return CalculateTransition(only, only);
+            *errstream << "TransitionCalculator: " << transition << " incorrectly formed." << std::endl;
+
+        return std::make_pair(only, only);
     }
     else
     {   LevelID left(make_LevelID(transition.substr(0, pos)));
         LevelID right(make_LevelID(transition.substr(pos+2)));
 
         if(!left.first || !right.first)
-        {   *errstream << "TransitionCalculator: " << transition << " incorrectly formed." << std::endl;
-            return 0.;
+            *errstream << "TransitionCalculator: " << transition << " incorrectly formed." << std::endl;
+
+        return std::make_pair(left, right);
+    }
+}
+
+void TransitionCalculator::SetOperatorFrequency(double frequency)
+{
+    pTimeDependentSpinorOperator tdop = std::dynamic_pointer_cast<TimeDependentSpinorOperator>(op);
+    tdop->SetFrequency(frequency);
+    auto rpa = std::dynamic_pointer_cast<RPAOperator>(tdop);
+    if(rpa)
+        rpa->SolveRPA();
+
+    if(integrals == nullptr)
+    {
+        // Create new TransitionIntegrals object and calculate integrals
+        integrals = std::make_shared<TransitionIntegrals>(orbitals, op);
+    }
+
+    integrals->clear();
+    integrals->CalculateOneElectronIntegrals(orbitals->valence, orbitals->valence);
+}
+
+void TransitionCalculator::MakeStaticIntegrals()
+{
+    if(integrals != nullptr)
+        return;
+
+    pTimeDependentSpinorOperator tdop = std::dynamic_pointer_cast<TimeDependentSpinorOperator>(op);
+    if(tdop)
+    {
+        double omega = user_input("Frequency", std::numeric_limits<double>::quiet_NaN());
+        if(!std::isnan(omega))
+            tdop->SetFrequency(omega);
+
+        auto rpa = std::dynamic_pointer_cast<RPAOperator>(tdop);
+        if(rpa)
+            rpa->SolveRPA();
+    }
+
+    // Create new TransitionIntegrals object and calculate integrals
+    integrals = std::make_shared<TransitionIntegrals>(orbitals, op);
+    integrals->CalculateOneElectronIntegrals(orbitals->valence, orbitals->valence);
+}
+
+void TransitionCalculator::CalculateTransitionsByFrequency(const std::vector<TransitionID>& transitions)
+{
+    pTimeDependentSpinorOperator tdop = std::dynamic_pointer_cast<TimeDependentSpinorOperator>(op);
+    if(!tdop)
+        return;
+
+    // Keep LevelVectors for the duration: some LevelStores read them from disk
+    std::map<pHamiltonianID, LevelVector, DereferenceComparator<pHamiltonianID>> level_vectors;
+    auto get_levels = [&](const pHamiltonianID& key) -> const LevelVector&
+    {
+        auto it = level_vectors.find(key);
+        if(it == level_vectors.end())
+            it = level_vectors.insert(std::make_pair(key, levels->GetLevels(key))).first;
+        return it->second;
+    };
+
+    // Find all transitions still to be calculated and their frequencies
+    std::vector<FrequencyTransition> planned;
+    std::set<TransitionID> planned_ids;
+    for(const auto& transition: transitions)
+    {
+        const LevelID& left = transition.first;
+        const LevelID& right = transition.second;
+
+        TransitionID id = make_transitionID(left, right);
+        if(!TransitionExists(left, right) || matrix_elements.count(id) || planned_ids.count(id))
+            continue;
+
+        // Missing levels are reported by CalculateTransition()
+        const LevelVector& left_levels = get_levels(left.first);
+        const LevelVector& right_levels = get_levels(right.first);
+        if(left_levels.levels.size() <= unsigned(left.second) || right_levels.levels.size() <= unsigned(right.second))
+            continue;
+
+        FrequencyTransition planned_transition;
+        planned_transition.frequency = left_levels.levels[left.second]->GetEnergy() - right_levels.levels[right.second]->GetEnergy();
+        planned_transition.density = levels->GetTransitionDensity(left_levels, right_levels, op->GetK());
+        planned_transition.index = left.second * right_levels.levels.size() + right.second;
+        planned_transition.id = id;
+
+        planned.push_back(planned_transition);
+        planned_ids.insert(id);
+    }
+
+    CalculateByFrequency(planned);
+
+    for(const auto& transition: planned)
+        matrix_elements.insert(std::make_pair(transition.id, transition.value));
+}
+
+std::vector<std::pair<double, double>> TransitionCalculator::FrequencyGroups(std::vector<double> frequencies) const
+{
+    double tolerance = user_input("FrequencyTolerance", 1.e-6);
+    std::sort(frequencies.begin(), frequencies.end());
+
+    // Group frequencies within tolerance of the first in the group
+    std::vector<std::pair<double, double>> groups;
+    for(double frequency: frequencies)
+    {
+        if(groups.empty() || frequency - groups.back().first > tolerance)
+            groups.push_back(std::make_pair(frequency, frequency));
+        else
+            groups.back().second = frequency;
+    }
+
+    return groups;
+}
+
+void TransitionCalculator::CalculateByFrequency(std::vector<FrequencyTransition>& transitions)
+{
+    bool interpolate = user_input.search("--interpolate-frequency");
+
+    std::sort(transitions.begin(), transitions.end(), [](const FrequencyTransition& first, const FrequencyTransition& second)
+              {   return first.frequency < second.frequency;
+              });
+
+    std::vector<double> frequencies;
+    frequencies.reserve(transitions.size());
+    for(const auto& transition: transitions)
+        frequencies.push_back(transition.frequency);
+    std::vector<std::pair<double, double>> groups = FrequencyGroups(frequencies);
+
+    // Contract each transition density with the current integrals only once per frequency
+    typedef std::map<const TransitionDensity*, std::vector<double>> ContractionMap;
+    auto get_matrix_element = [&](ContractionMap& contracted, const FrequencyTransition& transition)
+    {
+        auto it = contracted.find(transition.density.get());
+        if(it == contracted.end())
+            it = contracted.insert(std::make_pair(transition.density.get(), transition.density->GetMatrixElement(*integrals))).first;
+
+        return it->second[transition.index];
+    };
+
+    // Transitions are sorted, so the groups are in the same order
+    auto group_start = transitions.begin();
+    for(const auto& group: groups)
+    {
+        double low_freq = group.first;
+        double high_freq = group.second;
+
+        auto group_end = group_start;
+        while(group_end != transitions.end() && group_end->frequency <= high_freq)
+            group_end++;
+
+        if(interpolate && (high_freq - low_freq > 1.e-6))
+        {
+            // Solve at both ends of the group and interpolate linearly in frequency
+            ContractionMap low_contracted, high_contracted;
+
+            SetOperatorFrequency(low_freq);
+            for(auto it = group_start; it != group_end; it++)
+                it->value = get_matrix_element(low_contracted, *it);
+
+            SetOperatorFrequency(high_freq);
+            for(auto it = group_start; it != group_end; it++)
+            {
+                double x = (it->frequency - low_freq)/(high_freq - low_freq);
+                it->value = (1. - x) * it->value + x * get_matrix_element(high_contracted, *it);
+            }
+        }
+        else
+        {   ContractionMap contracted;
+
+            SetOperatorFrequency(0.5 * (low_freq + high_freq));
+            for(auto it = group_start; it != group_end; it++)
+                it->value = get_matrix_element(contracted, *it);
+        }
+
+        // Integrals are scaled
+        for(auto it = group_start; it != group_end; it++)
+            it->value /= scale;
+
+        group_start = group_end;
+    }
+}
+
+void TransitionCalculator::CalculateAllLines(const std::string& filename, bool binary)
+{
+    FILE* fp = nullptr;
+    if(ProcessorRank == 0)
+    {
+        fp = file_err_handler->fopen(filename.c_str(), binary? "wb": "wt");
+        if(!fp)
+        {   *errstream << "TransitionCalculator: couldn't open " << filename << " for writing." << std::endl;
+            return;
         }
+    }
 
-        return CalculateTransition(left, right);
+    std::vector<std::string> quantity_names = LineQuantityNames();
+    if(fp && binary)
+    {
+        int num_quantities = quantity_names.size();
+        file_err_handler->fwrite(&num_quantities, sizeof(int), 1, fp);
+    }
+    else if(fp)
+    {
+        fprintf(fp, "left,right,E_left,E_right");
+        for(const auto& name: quantity_names)
+            fprintf(fp, ",%s", name.c_str());
+        fprintf(fp, "\n");
+    }
+
+    auto write_name = [&](const std::string& name)
+    {
+        int length = name.size();
+        file_err_handler->fwrite(&length, sizeof(int), 1, fp);
+        file_err_handler->fwrite(name.data(), sizeof(char), length, fp);
+    };
+
+    if(!variable_frequency_op)
+        MakeStaticIntegrals();
+
+    unsigned int num_lines = 0;
+    std::vector<double> quantities;
+
+    // One block of lines per pair of symmetries, so that memory use doesn't grow with the
+    // number of lines. Transition densities are not stored in the LevelStore for the same reason,
+    // and frequency-dependent operators are solved per frequency group within the block.
+    auto left_it = levels->begin();
+    while(left_it != levels->end())
+    {
+        auto right_it = left_it;
+        while(right_it != levels->end())
+        {
+            if(TransitionExists((*left_it)->GetSymmetry(), (*right_it)->GetSymmetry()))
+            {
+                LevelVector left_levels = levels->GetLevels(*left_it);
+                LevelVector right_levels = levels->GetLevels(*right_it);
+                bool same_levels = (left_it == right_it);
+
+                if(left_levels.levels.size() && right_levels.levels.size())
+                {
+                    pTransitionDensityConst density = std::make_shared<TransitionDensity>(left_levels, right_levels, op->GetK());
+                    unsigned int num_right = right_levels.levels.size();
+
+                    std::vector<FrequencyTransition> block;
+                    for(unsigned int i = 0; i < left_levels.levels.size(); i++)
+                    {
+                        for(unsigned int j = (same_levels? i: 0); j < num_right; j++)
+                        {
+                            FrequencyTransition transition;
+                            transition.frequency = left_levels.levels[i]->GetEnergy() - right_levels.levels[j]->GetEnergy();
+                            transition.density = density;
+                            transition.index = i * num_right + j;
+                            transition.id = std::make_pair(std::make_pair(*left_it, int(i)), std::make_pair(*right_it, int(j)));
+                            block.push_back(transition);
+                        }
+                    }
+
+                    if(variable_frequency_op)
+                        CalculateByFrequency(block);
+                    else
+                    {   std::vector<double> values = density->GetMatrixElement(*integrals);
+                        for(auto& transition: block)
+                            transition.value = values[transition.index]/scale;
+                    }
+
+                    for(const auto& transition: block)
+                    {
+                        const LevelID& left = transition.id.first;
+                        const LevelID& right = transition.id.second;
+                        const Level& left_level = *left_levels.levels[left.second];
+                        const Level& right_level = *right_levels.levels[right.second];
+
+                        quantities.clear();
+                        LineQuantities(left, left_level, right, right_level, transition.value, quantities);
+                        num_lines++;
+
+                        if(!fp)
+                            continue;
+
+                        if(binary)
+                        {
+                            write_name(Name(left));
+                            write_name(Name(right));
+                            double energies[2] = {left_level.GetEnergy(), right_level.GetEnergy()};
+                            file_err_handler->fwrite(energies, sizeof(double), 2, fp);
+                            file_err_handler->fwrite(quantities.data(), sizeof(double), quantities.size(), fp);
+                        }
+                        else
+                        {   fprintf(fp, "%s,%s,%.10f,%.10f", Name(left).c_str(), Name(right).c_str(), left_level.GetEnergy(), right_level.GetEnergy());
+                            for(double q: quantities)
+                                fprintf(fp, ",%.6e", q);
+                            fprintf(fp, "\n");
+                        }
+                    }
+                }
+            }
+            right_it++;
+        }
+        left_it++;
     }
+
+    if(fp)
+        file_err_handler->fclose(fp);
+
+    *outstream << "  " << num_lines << " lines written to " << filename << std::endl;
+}
+
+std::vector<std::string> TransitionCalculator::LineQuantityNames() const
+{
+    return std::vector<std::string>(1, "matrix_element");
+}
+
+void TransitionCalculator::LineQuantities(const LevelID&, const Level&, const LevelID&, const Level&, double matrix_element, std::vector<double>& quantities) const
+{
+    quantities.push_back(matrix_element);
 }
 
 LevelID TransitionCalculator::make_LevelID(const std::string& name)
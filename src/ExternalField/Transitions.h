@@ -6,6 +6,8 @@
 #include "Universal/Enums.h"
 #include "RPAOperator.h"
 #include <map>
+#include <set>
+#include <vector>
 
 namespace Ambit
 {
@@ -57,7 +59,7 @@ protected:
     /** Print the header line to outstream, explaining transition type, units, etc. */
     virtual void PrintHeader() const = 0;
 
-    /** Print a line for the transition to outstream. */
+    /** Print a line for the transition to outstream. matrix_element is not scaled (it is divided by scale). */
     virtual void PrintTransition(const LevelID& left, const LevelID& right, double matrix_element) const = 0;
 
 protected:
@@ -91,6 +93,65 @@ protected:
      */
     double CalculateTransition(const std::string& transition);
 
+    /** Parse transition string (as for CalculateTransition()). If the string is not well-formed,
+        the returned LevelIDs have HamiltonianID nullptr.
+     */
+    TransitionID ParseTransition(const std::string& transition);
+
+    /** For frequency-dependent operators: set the frequency, solve RPA if required, and
+        recalculate integrals.
+     */
+    void SetOperatorFrequency(double frequency);
+
+    /** Create and calculate integrals for a frequency-independent operator (or fixed "Frequency"),
+        if this hasn't already been done.
+     */
+    void MakeStaticIntegrals();
+
+    /** For frequency-dependent operators: calculate all transitions together, grouped by
+        frequency, and add them to matrix_elements.
+     */
+    void CalculateTransitionsByFrequency(const std::vector<TransitionID>& transitions);
+
+    /** A transition to be calculated at a given frequency: element index of density.
+        value is the matrix element, not scaled (as stored in matrix_elements).
+     */
+    struct FrequencyTransition
+    {
+        double frequency;
+        pTransitionDensityConst density;
+        unsigned int index;
+        TransitionID id;
+        double value;
+    };
+
+    /** Calculate value for each transition, grouped by frequency so that RPA and the integrals
+        are only solved once per group.
+        Transitions whose frequencies lie within user_input("FrequencyTolerance") of the lowest in
+        their group are calculated at the centre of the group or, with --interpolate-frequency,
+        interpolated linearly between solutions at both ends of the group.
+     */
+    void CalculateByFrequency(std::vector<FrequencyTransition>& transitions);
+
+    /** Sort frequencies and group those within user_input("FrequencyTolerance") of the lowest in their group.
+        Return the lowest and highest frequency of each group.
+     */
+    std::vector<std::pair<double, double>> FrequencyGroups(std::vector<double> frequencies) const;
+
+    /** Calculate all transitions between all stored levels, one pair of symmetries at a time,
+        and write them to filename as they are calculated (CSV or binary). Nothing is stored, so memory
+        use does not depend on the number of lines.
+     */
+    virtual void CalculateAllLines(const std::string& filename, bool binary);
+
+    /** Names of the quantities written for each line by CalculateAllLines(). */
+    virtual std::vector<std::string> LineQuantityNames() const;
+
+    /** Append quantities for a line to be written by CalculateAllLines(); matrix_element is as
+        passed to PrintTransition(). By default this is just the matrix element.
+     */
+    virtual void LineQuantities(const LevelID& left, const Level& left_level, const LevelID& right, const Level& right_level, double matrix_element, std::vector<double>& quantities) const;
+
     /** Convert string to levelID. If name is not well-formed, return
             std::pair<nullptr, 0>
      */
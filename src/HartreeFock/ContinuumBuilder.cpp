@@ -0,0 +1,258 @@
+#include "Include.h"
+#include "ContinuumBuilder.h"
+#include "HartreeFocker.h"
+#include <boost/functional/hash.hpp>
+#include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/interprocess/sync/sharable_lock.hpp>
+#include <filesystem>
+#include <sstream>
+
+#ifdef AMBIT_USE_OPENMP
+    #include <omp.h>
+#endif
+
+namespace Ambit
+{
+ContinuumBuilder::ContinuumBuilder(pHFOperator hf, ContinuumNormalisation normalisation):
+    hf(hf), normalisation(normalisation)
+{}
+
+void ContinuumBuilder::Request(int kappa, double energy)
+{
+    KeyType key(kappa, energy);
+    if(waves.find(key) == waves.end())
+        pending.insert(key);
+}
+
+void ContinuumBuilder::CalculatePending()
+{
+    if(pending.empty())
+        return;
+
+    std::vector<KeyType> keys(pending.begin(), pending.end());
+    pending.clear();
+
+    Calculate(keys);
+}
+
+pContinuumWave ContinuumBuilder::GetContinuumWave(int kappa, double energy, int pqn)
+{
+    KeyType key(kappa, energy);
+    auto it = waves.find(key);
+    if(it == waves.end())
+    {   Calculate(std::vector<KeyType>(1, key));
+        it = waves.find(key);
+    }
+
+    pContinuumWave ret = it->second->Clone();
+    ret->SetPQN(pqn);
+    return ret;
+}
+
+void ContinuumBuilder::Calculate(const std::vector<KeyType>& requested_keys)
+{
+    // Read any waves that are already stored in the cache file
+    std::vector<KeyType> keys;
+    pLattice lattice = hf->GetLattice();
+    for(const auto& key: requested_keys)
+    {
+        auto cached = cache_index.find(key);
+        if(cached != cache_index.end())
+        {   pContinuumWave wave = ReadCachedWave(cached->second);
+            if(wave->size() > lattice->size())
+                lattice->resize(wave->size());
+            waves[key] = wave;
+        }
+        else
+            keys.push_back(key);
+    }
+
+    if(keys.empty())
+        return;
+
+    std::vector<pContinuumWave> solutions(keys.size());
+    std::vector<unsigned int> loops(keys.size(), 0);
+
+#ifdef AMBIT_USE_OPENMP
+    if(keys.size() > 1)
+    {
+        // The HF operator is not thread-safe, so make a separate clone for each thread
+        std::vector<pHFOperator> hf_operators;
+        for(int ii = 0; ii < omp_get_max_threads(); ++ii){
+            hf_operators.emplace_back(hf->Clone());
+        }
+        // Freeze the lattice: waves that need more points are left for the serial pass below.
+        // Decorators of the HF operator (nuclear, mass shift) use powers of R up to R^4.
+        LatticeSnapshot frozen_lattice(hf->GetLattice(), 4);
+        pIntegrator integrator = hf->GetIntegrator();
+        ContinuumNormalisation normalisation_type = normalisation;
+
+        #pragma omp parallel for schedule(dynamic, 1) default(none) \
+        shared(keys, solutions, loops, hf_operators, integrator, normalisation_type)
+        for(unsigned int ii = 0; ii < keys.size(); ii++)
+        {
+            pODESolver ode_solver(new AdamsSolver(integrator));
+            HartreeFocker HF_Solver(ode_solver);
+            HF_Solver.continuum_normalisation_type = normalisation_type;
+            HF_Solver.AllowLatticeExpansion = false;
+
+            solutions[ii] = std::make_shared<ContinuumWave>(keys[ii].first, 100, keys[ii].second);
+            loops[ii] = HF_Solver.CalculateContinuumWave(solutions[ii], hf_operators[omp_get_thread_num()]);
+        }
+    }
+#endif
+
+    // Serial pass: everything not yet solved, allowing the lattice to grow
+    pODESolver ode_solver(new AdamsSolver(hf->GetIntegrator()));
+    HartreeFocker HF_Solver(ode_solver);
+    HF_Solver.continuum_normalisation_type = normalisation;
+
+    for(unsigned int ii = 0; ii < keys.size(); ii++)
+    {
+        if(!loops[ii])
+        {   solutions[ii] = std::make_shared<ContinuumWave>(keys[ii].first, 100, keys[ii].second);
+            loops[ii] = HF_Solver.CalculateContinuumWave(solutions[ii], hf);
+        }
+
+        waves[keys[ii]] = solutions[ii];
+    }
+
+    if(!cache_filename.empty())
+    {   // Don't store failed solutions
+        std::vector<KeyType> solved;
+        for(unsigned int ii = 0; ii < keys.size(); ii++)
+            if(loops[ii])
+                solved.push_back(keys[ii]);
+
+        WriteCache(solved);
+    }
+}
+
+void ContinuumBuilder::SetCacheFile(const std::string& prefix)
+{
+    std::stringstream filename;
+    filename << prefix << "." << std::hex << GetPotentialHash() << ".continuum";
+    cache_filename = filename.str();
+
+    ReadCacheIndex();
+}
+
+std::size_t ContinuumBuilder::GetPotentialHash() const
+{
+    std::size_t seed = 0;
+
+    pLattice lattice = hf->GetLattice();
+    boost::hash_combine(seed, lattice->size());
+    boost::hash_combine(seed, lattice->H());
+    boost::hash_range(seed, lattice->R(), lattice->R() + lattice->size());
+
+    RadialFunction direct = hf->GetDirectPotential();
+    boost::hash_range(seed, direct.f.begin(), direct.f.end());
+
+    // The exchange potential is determined by the core orbitals
+    pCoreConst core = hf->GetCore();
+    for(const auto& pair: *core)
+    {
+        boost::hash_combine(seed, pair.second->Kappa());
+        boost::hash_combine(seed, pair.second->PQN());
+        boost::hash_combine(seed, pair.second->Energy());
+        boost::hash_combine(seed, core->GetOccupancy(pair.first));
+        boost::hash_range(seed, pair.second->f.begin(), pair.second->f.end());
+        boost::hash_range(seed, pair.second->g.begin(), pair.second->g.end());
+    }
+
+    boost::hash_combine(seed, hf->GetPhysicalConstant()->GetAlpha());
+    boost::hash_combine(seed, static_cast<int>(normalisation));
+
+    return seed;
+}
+
+void ContinuumBuilder::ReadCacheIndex()
+{
+    cache_index.clear();
+
+    if(!std::filesystem::exists(cache_filename))
+        return;
+
+    boost::interprocess::file_lock f_lock(cache_filename.c_str());
+    boost::interprocess::sharable_lock<boost::interprocess::file_lock> shlock(f_lock);
+
+    long file_size = std::filesystem::file_size(cache_filename);
+    FILE* fp = file_err_handler->fopen(cache_filename.c_str(), "rb");
+    if(!fp)
+        return;
+
+    // Each record is
+    //      kappa, energy key; then Orbital::Write() = pqn, energy, kappa, size, f, g, dfdr, dgdr.
+    // Only the keys and positions are read here; a truncated last record is ignored.
+    long position = 0;
+    while(position < file_size)
+    {
+        int kappa, pqn, orbital_kappa;
+        double energy, orbital_energy;
+        unsigned int size;
+
+        if(fread(&kappa, sizeof(int), 1, fp) != 1 || fread(&energy, sizeof(double), 1, fp) != 1)
+            break;
+
+        long offset = ftell(fp);
+        if(fread(&pqn, sizeof(int), 1, fp) != 1 || fread(&orbital_energy, sizeof(double), 1, fp) != 1
+           || fread(&orbital_kappa, sizeof(int), 1, fp) != 1 || fread(&size, sizeof(unsigned int), 1, fp) != 1)
+            break;
+
+        position = ftell(fp) + 4 * long(size) * long(sizeof(double));
+        if(position > file_size || fseek(fp, position, SEEK_SET))
+            break;
+
+        cache_index[KeyType(kappa, energy)] = offset;
+    }
+
+    file_err_handler->fclose(fp);
+}
+
+pContinuumWave ContinuumBuilder::ReadCachedWave(long offset) const
+{
+    boost::interprocess::file_lock f_lock(cache_filename.c_str());
+    boost::interprocess::sharable_lock<boost::interprocess::file_lock> shlock(f_lock);
+
+    FILE* fp = file_err_handler->fopen(cache_filename.c_str(), "rb");
+    if(!fp || fseek(fp, offset, SEEK_SET))
+    {   *errstream << "ContinuumBuilder: couldn't read " << cache_filename << std::endl;
+        exit(1);
+    }
+
+    pContinuumWave wave = std::make_shared<ContinuumWave>(0);
+    wave->Read(fp);
+    file_err_handler->fclose(fp);
+
+    return wave;
+}
+
+void ContinuumBuilder::WriteCache(const std::vector<KeyType>& keys)
+{
+    if(ProcessorRank == 0)
+    {
+        // Open for appending, creating the file if necessary, then wait for exclusive lock
+        FILE* fp = file_err_handler->fopen(cache_filename.c_str(), "ab");
+        if(!fp)
+        {   *errstream << "ContinuumBuilder: couldn't open file " << cache_filename << " for writing." << std::endl;
+            return;
+        }
+
+        boost::interprocess::file_lock f_lock(cache_filename.c_str());
+        boost::interprocess::scoped_lock<boost::interprocess::file_lock> exlock(f_lock);
+        fseek(fp, 0, SEEK_END);
+
+        for(const auto& key: keys)
+        {
+            file_err_handler->fwrite(&key.first, sizeof(int), 1, fp);
+            file_err_handler->fwrite(&key.second, sizeof(double), 1, fp);
+            cache_index[key] = ftell(fp);
+            waves[key]->Write(fp);
+        }
+
+        file_err_handler->fclose(fp);
+    }
+}
+}
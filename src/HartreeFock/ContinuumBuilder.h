@@ -0,0 +1,88 @@
+#ifndef CONTINUUM_BUILDER_H
+#define CONTINUUM_BUILDER_H
+
+#include "HFOperator.h"
+#include "Orbital.h"
+#include "Universal/Enums.h"
+#include <map>
+#include <set>
+#include <string>
+
+namespace Ambit
+{
+/** ContinuumBuilder creates continuum waves in the field of a fixed HF operator and stores them by
+    (kappa, energy), so that each wave is only integrated once however many times it is used.
+    Waves may be requested in advance and then solved together by CalculatePending(): the
+    (kappa, energy) points are independent, so they are solved concurrently using thread-private
+    clones of the HF operator. Waves that need a larger lattice are then redone serially,
+    since only the serial solver is allowed to expand the lattice.
+
+    Optionally the waves are also kept in a cache file (see SetCacheFile()) so that later runs
+    with the same potential can read them rather than integrate them again.
+ */
+class ContinuumBuilder
+{
+public:
+    ContinuumBuilder(pHFOperator hf, ContinuumNormalisation normalisation = ContinuumNormalisation::LandauEnergy);
+    virtual ~ContinuumBuilder() {}
+
+    /** Add (kappa, energy) to the list of waves to be calculated by CalculatePending(). */
+    virtual void Request(int kappa, double energy);
+
+    /** Calculate all requested continuum waves that are not already stored. */
+    virtual void CalculatePending();
+
+    /** Get a copy of the continuum wave with given kappa and energy, labelled with pqn.
+        If the wave has not already been calculated it is calculated now.
+     */
+    virtual pContinuumWave GetContinuumWave(int kappa, double energy, int pqn = 100);
+
+    /** Number of stored continuum waves. */
+    unsigned int size() const { return waves.size(); }
+
+    pHFOperatorConst GetHFOperator() const { return hf; }
+
+    /** Read previously stored waves from, and store newly calculated waves in, the file
+            prefix.<hash>.continuum
+        where the hash identifies the potential (lattice, direct potential, core orbitals) and
+        the normalisation. Stored waves are only read from the file when they are needed.
+        Only the root process writes to the file.
+     */
+    virtual void SetCacheFile(const std::string& prefix);
+
+    /** Number of waves available in the cache file. */
+    unsigned int CacheSize() const { return cache_index.size(); }
+
+protected:
+    typedef std::pair<int, double> KeyType;
+
+    /** Solve all keys, concurrently where possible, and store the results. */
+    virtual void Calculate(const std::vector<KeyType>& keys);
+
+    /** Hash of everything that the continuum waves depend on. */
+    std::size_t GetPotentialHash() const;
+
+    /** Read the list of stored waves and their positions (but not the waves) from cache_filename. */
+    void ReadCacheIndex();
+
+    /** Read the stored wave at position offset of cache_filename. */
+    pContinuumWave ReadCachedWave(long offset) const;
+
+    /** Append waves to cache_filename and add them to the index. */
+    void WriteCache(const std::vector<KeyType>& keys);
+
+protected:
+    pHFOperator hf;
+    ContinuumNormalisation normalisation;
+
+    std::map<KeyType, pContinuumWaveConst> waves;
+    std::set<KeyType> pending;
+
+    std::string cache_filename;             //!< Empty if there is no cache file
+    std::map<KeyType, long> cache_index;    //!< Position in cache_filename of each stored wave
+};
+
+typedef std::shared_ptr<ContinuumBuilder> pContinuumBuilder;
+
+}
+#endif
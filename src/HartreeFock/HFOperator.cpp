@@ -52,6 +52,13 @@ RadialFunction HFOperator::GetDirectPotential() const
     return directPotential;
 }
 
+pHFOperator HFOperator::Clone() const
+{
+    auto clone = std::make_shared<HFOperator>(*this);
+    clone->coulombSolver = std::make_shared<CoulombOperator>(*coulombSolver);
+    return clone;
+}
+
 void HFOperator::Alert()
 {
     unsigned int i = directPotential.size();
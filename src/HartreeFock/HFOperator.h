@@ -27,8 +27,10 @@ public:
 
     virtual RadialFunction GetDirectPotential() const override; //!< Get the direct potential.
 
-    /** Deep copy of the HFOperator object, particularly including wrapped objects (but not the core or physical constants). */
-    virtual pHFOperator Clone() const override { return std::make_shared<HFOperator>(*this); }
+    /** Deep copy of the HFOperator object, particularly including wrapped objects (but not the core or physical constants).
+        The clone gets its own CoulombOperator, so clones may be used concurrently on different threads.
+     */
+    virtual pHFOperator Clone() const override;
 
 public:
     /** Extend/reduce direct potential to match lattice size. */
@@ -683,7 +683,9 @@ unsigned int HartreeFocker::CalculateContinuumWave(pContinuumWave s, pHFOperator
 
         *previous_s = *s;
         start_sine = IntegrateContinuum(s, hf, exchange, final_amplitude, final_phase);
-        if(!start_sine)
+        if(!start_sine && !AllowLatticeExpansion)
+            return 0;
+        else if(!start_sine)
         {   // Likely reason for not reaching start_sine is that the lattice is too small. Extend it and try again.
 
             // Probably get a bit worried if we've had, say, fifty complete oscillations and still no good.
@@ -756,6 +758,9 @@ unsigned int HartreeFocker::CalculateContinuumWave(pContinuumWave s, pHFOperator
     (*s) *= final_amplitude;
 
     if(DebugOptions.LogHFContinuum())
+#ifdef AMBIT_USE_OPENMP
+    #pragma omp critical(LOGSTREAM)
+#endif
     {
         *logstream << std::setprecision(8);
 
@@ -67,6 +67,11 @@ public:
     double TailMatchingEnergyTolerance = 1.e-8;
     ContinuumNormalisation continuum_normalisation_type;
 
+    /** If false, CalculateContinuumWave() returns 0 rather than extending the lattice when
+        start_sine is not reached. Use this when solving on several threads with a frozen lattice.
+     */
+    bool AllowLatticeExpansion = true;
+
 protected:
     pODESolver odesolver;
     unsigned int MaxHFIterations = 500;
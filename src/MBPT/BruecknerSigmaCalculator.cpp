@@ -1,5 +1,6 @@
 #include "BruecknerSigmaCalculator.h"
 #include "Include.h"
+#include "Universal/Communicator.h"
 #ifdef AMBIT_USE_MPI
 #include <mpi.h>
 #endif
@@ -7,7 +8,7 @@
 namespace Ambit
 {
 BruecknerSigmaCalculator::BruecknerSigmaCalculator(pOrbitalManagerConst orbitals, pSpinorOperatorConst one_body, pHartreeY two_body, const std::string& fermi_orbitals):
-    MBPTCalculator(orbitals, fermi_orbitals, two_body->OffParityExists()), hf(one_body), hartreeY(two_body), core(orbitals->core), excited(orbitals->excited)
+    MBPTCalculator(orbitals, fermi_orbitals, two_body->OffParityExists()), hf(one_body), hartreeY(two_body), core(orbitals->core), excited(orbitals->excited), comm(ProcessGroup)
 {}
 
 void BruecknerSigmaCalculator::GetSecondOrderSigma(int kappa, SigmaPotential& sigma)
@@ -68,7 +69,7 @@ void BruecknerSigmaCalculator::CalculateCorrelation1and3(int kappa, SigmaPotenti
             while(k1 != -1)
             {
                 #ifdef AMBIT_USE_MPI
-                if(proc == ProcessorRank)
+                if(proc == comm.Rank())
                 {
                 #endif
 
@@ -146,7 +147,7 @@ void BruecknerSigmaCalculator::CalculateCorrelation1and3(int kappa, SigmaPotenti
                 #ifdef AMBIT_USE_MPI
                 }
 
-                if(++proc == NumProcessors)
+                if(++proc == comm.Size())
                     proc = 0;
                 #endif
 
@@ -159,17 +160,17 @@ void BruecknerSigmaCalculator::CalculateCorrelation1and3(int kappa, SigmaPotenti
 
 #ifdef AMBIT_USE_MPI
     SigmaMatrix reduced = SigmaMatrix::Zero(sigma.matrix_size, sigma.matrix_size);
-    MPI_Allreduce(new_sigma.ff.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(new_sigma.ff.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, comm.Comm());
     sigma.ff += reduced;
 
     if(sigma.use_fg)
-    {   MPI_Allreduce(new_sigma.fg.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    {   MPI_Allreduce(new_sigma.fg.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, comm.Comm());
         sigma.fg += reduced;
-        MPI_Allreduce(new_sigma.gf.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        MPI_Allreduce(new_sigma.gf.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, comm.Comm());
         sigma.gf += reduced;
     }
     if(sigma.use_gg)
-    {   MPI_Allreduce(new_sigma.gg.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    {   MPI_Allreduce(new_sigma.gg.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, comm.Comm());
         sigma.gg += reduced;
     }
 #endif
@@ -226,7 +227,7 @@ void BruecknerSigmaCalculator::CalculateCorrelation2(int kappa, SigmaPotential&
             while(k1 != -1)
             {
                 #ifdef AMBIT_USE_MPI
-                if(proc == ProcessorRank)
+                if(proc == comm.Rank())
                 {
                 #endif
 
@@ -294,7 +295,7 @@ void BruecknerSigmaCalculator::CalculateCorrelation2(int kappa, SigmaPotential&
                 #ifdef AMBIT_USE_MPI
                 }
 
-                if(++proc == NumProcessors)
+                if(++proc == comm.Size())
                     proc = 0;
                 #endif
 
@@ -307,17 +308,17 @@ void BruecknerSigmaCalculator::CalculateCorrelation2(int kappa, SigmaPotential&
 
 #ifdef AMBIT_USE_MPI
     SigmaMatrix reduced = SigmaMatrix::Zero(sigma.matrix_size, sigma.matrix_size);
-    MPI_Allreduce(new_sigma.ff.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(new_sigma.ff.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, comm.Comm());
     sigma.ff += reduced;
 
     if(sigma.use_fg)
-    {   MPI_Allreduce(new_sigma.fg.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    {   MPI_Allreduce(new_sigma.fg.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, comm.Comm());
         sigma.fg += reduced;
-        MPI_Allreduce(new_sigma.gf.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        MPI_Allreduce(new_sigma.gf.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, comm.Comm());
         sigma.gf += reduced;
     }
     if(sigma.use_gg)
-    {   MPI_Allreduce(new_sigma.gg.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    {   MPI_Allreduce(new_sigma.gg.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, comm.Comm());
         sigma.gg += reduced;
     }
 #endif
@@ -376,7 +377,7 @@ void BruecknerSigmaCalculator::CalculateCorrelation4(int kappa, SigmaPotential&
             while(k1 != -1)
             {
                 #ifdef AMBIT_USE_MPI
-                if(proc == ProcessorRank)
+                if(proc == comm.Rank())
                 {
                 #endif
 
@@ -445,7 +446,7 @@ void BruecknerSigmaCalculator::CalculateCorrelation4(int kappa, SigmaPotential&
                 #ifdef AMBIT_USE_MPI
                 }
 
-                if(++proc == NumProcessors)
+                if(++proc == comm.Size())
                     proc = 0;
                 #endif
 
@@ -458,17 +459,17 @@ void BruecknerSigmaCalculator::CalculateCorrelation4(int kappa, SigmaPotential&
 
 #ifdef AMBIT_USE_MPI
     SigmaMatrix reduced = SigmaMatrix::Zero(sigma.matrix_size, sigma.matrix_size);
-    MPI_Allreduce(new_sigma.ff.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(new_sigma.ff.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, comm.Comm());
     sigma.ff += reduced;
 
     if(sigma.use_fg)
-    {   MPI_Allreduce(new_sigma.fg.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    {   MPI_Allreduce(new_sigma.fg.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, comm.Comm());
         sigma.fg += reduced;
-        MPI_Allreduce(new_sigma.gf.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        MPI_Allreduce(new_sigma.gf.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, comm.Comm());
         sigma.gf += reduced;
     }
     if(sigma.use_gg)
-    {   MPI_Allreduce(new_sigma.gg.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    {   MPI_Allreduce(new_sigma.gg.data(), reduced.data(), sigma.matrix_size * sigma.matrix_size, MPI_DOUBLE, MPI_SUM, comm.Comm());
         sigma.gg += reduced;
     }
 #endif
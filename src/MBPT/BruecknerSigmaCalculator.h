@@ -4,6 +4,7 @@
 #include "MBPTCalculator.h"
 #include "SigmaPotential.h"
 #include "HartreeFock/HartreeY.h"
+#include "Universal/Communicator.h"
 
 namespace Ambit
 {
@@ -19,6 +20,9 @@ public:
     /** Create a second-order one-electron MBPT (sigma1) operator. */
     void GetSecondOrderSigma(int kappa, SigmaPotential& sigma);
 
+    /** Divide the calculation between the processes of communicator rather than ProcessGroup. */
+    void SetCommunicator(const Communicator& communicator) { comm = communicator; }
+
 protected:
     /** Calculate diagrams of second order (shown here 1 through 4).
      ->>------>------>>--  ->>------>------<---  ->>------<------>>--  ->>------<------>---
@@ -43,6 +47,7 @@ protected:
 
     pOrbitalMapConst core;
     pOrbitalMapConst excited;
+    Communicator comm;
 };
 
 inline bool BruecknerSigmaCalculator::ParityCheck(const int& La, const int& Lb, const int& k) const
@@ -1,4 +1,5 @@
 #include "Include.h"
+#include "Universal/Communicator.h"
 #include <filesystem>
 #include <chrono>
 #ifdef AMBIT_USE_MPI
@@ -19,8 +20,9 @@ template <class MapType>
 CoreValenceIntegrals<MapType>::CoreValenceIntegrals(pOrbitalManagerConst orbitals, pHFIntegrals one_body, pSlaterIntegrals bare_integrals, const std::string& write_file):
     SlaterIntegrals<MapType>(orbitals, false), write_file(write_file), core_PT(nullptr),
     include_core(true), include_core_subtraction(true), include_core_extra_box(true),
-    include_valence(false), include_valence_subtraction(false), include_valence_extra_box(false)
+    include_valence(false), include_valence_subtraction(false), include_valence_extra_box(false), comm(ProcessGroup)
 {
+    this->lookup_counter = &Profiler::Instance()->Counter("core-valence integral lookups");
     core_PT.reset(new CoreMBPTCalculator(this->orbitals, one_body, bare_integrals));
     valence_PT.reset(new ValenceMBPTCalculator(this->orbitals, one_body, bare_integrals));
 }
@@ -30,8 +32,9 @@ CoreValenceIntegrals<MapType>::CoreValenceIntegrals(pOrbitalManagerConst orbital
     SlaterIntegrals<MapType>(orbitals, false), write_file(write_file),
     core_PT(core_mbpt_calculator), valence_PT(valence_mbpt_calculator),
     include_core(false), include_core_subtraction(false), include_core_extra_box(false),
-    include_valence(false), include_valence_subtraction(false), include_valence_extra_box(false)
+    include_valence(false), include_valence_subtraction(false), include_valence_extra_box(false), comm(ProcessGroup)
 {
+    this->lookup_counter = &Profiler::Instance()->Counter("core-valence integral lookups");
     if(core_PT)
     {   include_core = true;
         include_core_subtraction = true;
@@ -141,7 +144,7 @@ unsigned int CoreValenceIntegrals<MapType>::CalculateTwoElectronIntegrals(pOrbit
                                         previous_keys.insert(key);
                                     #ifdef AMBIT_USE_MPI
                                         // Check if this is our job
-                                        if(count == ProcessorRank || check_size_only)
+                                        if(count == comm.Rank() || check_size_only)
                                         {
                                     #endif
                                             keys.push_back(key);
@@ -158,7 +161,7 @@ unsigned int CoreValenceIntegrals<MapType>::CalculateTwoElectronIntegrals(pOrbit
                                     #ifdef AMBIT_USE_MPI
                                         }
                                             count++;
-                                            if(count == NumProcessors)
+                                            if(count == comm.Size())
                                                 count = 0;
                                     #endif
                                     }
@@ -187,6 +190,12 @@ unsigned int CoreValenceIntegrals<MapType>::CalculateTwoElectronIntegrals(pOrbit
 
     // Now run through all of this process's keys and calculate the corresponding integrals
 #ifdef AMBIT_USE_OPENMP
+    // Freeze the lattice: it must not be resized underneath the threads.
+    // k <= max(TwoJ), and the kernels need R^(k+2), so precompute those powers now.
+    int max_two_j = 0;
+    for(const auto& pair: *this->orbitals->all)
+        max_two_j = mmax(max_two_j, pair.first.TwoJ());
+    LatticeSnapshot frozen_lattice(this->orbitals->GetLattice(), max_two_j + 2);
     #pragma omp parallel for default(none) shared(expanded_keys, keys, values, stderr) schedule(dynamic, 8)
 #endif
     for(int n = 0; n < expanded_keys.size(); n++)
@@ -234,7 +243,7 @@ unsigned int CoreValenceIntegrals<MapType>::CalculateTwoElectronIntegrals(pOrbit
     if(!check_size_only)
     {   // Gather to root node, write to file, and read back in
         my_calculations_done = true;
-        if(ProcessorRank == 0)
+        if(comm.Rank() == 0)
             root_complete = true;
 
         // Do loop protects processes that finished before root and therefore
@@ -288,20 +297,20 @@ void CoreValenceIntegrals<MapType>::Write(const std::string& filename, const std
             break;
     }
     
-    if(ProcessorRank == 0)
+    if(comm.Rank() == 0)
     {
         // Send completion status
         int complete = (my_calculations_done? 1: 0);
-        MPI_Bcast(&complete, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&complete, 1, MPI_INT, 0, comm.Comm());
 
         // Get number of integrals from all processes. 
-        std::vector<unsigned int> num_integrals(NumProcessors);
+        std::vector<unsigned int> num_integrals(comm.Size());
         num_integrals[0] = values.size();
 
         MPI_Status status;
-        for(int proc = 1; proc < NumProcessors; proc++)
+        for(int proc = 1; proc < comm.Size(); proc++)
         {
-            MPI_Recv(&num_integrals[proc], 1, MPI_UNSIGNED, proc, 1, MPI_COMM_WORLD, &status);
+            MPI_Recv(&num_integrals[proc], 1, MPI_UNSIGNED, proc, 1, comm.Comm(), &status);
         }
 
         // Open after it is clear that all processes are on board
@@ -339,13 +348,13 @@ void CoreValenceIntegrals<MapType>::Write(const std::string& filename, const std
         // Receive and write data from other processes
         std::vector<KeyType> mpi_keys;
         std::vector<double> mpi_values;
-        for(int proc = 1; proc < NumProcessors; proc++)
+        for(int proc = 1; proc < comm.Size(); proc++)
         {
             mpi_keys.resize(num_integrals[proc]);
             mpi_values.resize(num_integrals[proc]);
 
-            MPI_Recv(mpi_keys.data(), num_integrals[proc], mpikeytype, proc, 2, MPI_COMM_WORLD, &status);
-            MPI_Recv(mpi_values.data(), num_integrals[proc], MPI_DOUBLE, proc, 3, MPI_COMM_WORLD, &status);
+            MPI_Recv(mpi_keys.data(), num_integrals[proc], mpikeytype, proc, 2, comm.Comm(), &status);
+            MPI_Recv(mpi_values.data(), num_integrals[proc], MPI_DOUBLE, proc, 3, comm.Comm(), &status);
 
             for(int i = 0; i < num_integrals[proc]; i++)
             {
@@ -375,7 +384,7 @@ void CoreValenceIntegrals<MapType>::Write(const std::string& filename, const std
     {   // Receive root completion status
         if(!root_complete)
         {   int buffer;
-            MPI_Bcast(&buffer, 1, MPI_INT, 0, MPI_COMM_WORLD);
+            MPI_Bcast(&buffer, 1, MPI_INT, 0, comm.Comm());
             root_complete = (buffer != 0);
         }
 
@@ -385,14 +394,14 @@ void CoreValenceIntegrals<MapType>::Write(const std::string& filename, const std
 
         // Send data to root. First number of keys.
         unsigned int num_integrals = values.size();
-        MPI_Send(&num_integrals, 1, MPI_UNSIGNED, 0, 1, MPI_COMM_WORLD);
+        MPI_Send(&num_integrals, 1, MPI_UNSIGNED, 0, 1, comm.Comm());
 
         // Send keys and data to root
-        MPI_Send(keys.data(), num_integrals, mpikeytype, 0, 2, MPI_COMM_WORLD);
-        MPI_Send(values.data(), num_integrals, MPI_DOUBLE, 0, 3, MPI_COMM_WORLD);
+        MPI_Send(keys.data(), num_integrals, mpikeytype, 0, 2, comm.Comm());
+        MPI_Send(values.data(), num_integrals, MPI_DOUBLE, 0, 3, comm.Comm());
     }
 
-    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Barrier(comm.Comm());
 }
 #endif
 
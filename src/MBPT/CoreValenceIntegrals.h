@@ -4,6 +4,7 @@
 #include "SlaterIntegrals.h"
 #include "CoreMBPTCalculator.h"
 #include "ValenceMBPTCalculator.h"
+#include "Universal/Communicator.h"
 
 namespace Ambit
 {
@@ -45,6 +46,9 @@ public:
     void IncludeCore(bool include_mbpt, bool include_subtraction, bool include_wrong_parity_box_diagrams);
     void IncludeValence(bool include_mbpt, bool include_subtraction, bool include_wrong_parity_box_diagrams);
 
+    /** Divide the calculation between the processes of communicator rather than ProcessGroup. */
+    void SetCommunicator(const Communicator& communicator) { comm = communicator; }
+
 protected:
     pCoreMBPTCalculator core_PT;
     pValenceMBPTCalculator valence_PT;
@@ -60,6 +64,7 @@ protected:
     bool include_valence_extra_box;
 
     std::string write_file;
+    Communicator comm;
 #ifdef AMBIT_USE_MPI
     bool my_calculations_done;
     mutable bool root_complete;
@@ -1,4 +1,5 @@
 #include "OneElectronMBPT.h"
+#include "Universal/Communicator.h"
 #ifdef AMBIT_USE_MPI
 #include <mpi.h>
 #endif
@@ -13,7 +14,7 @@ OneElectronMBPT::OneElectronMBPT(pOrbitalManagerConst orbitals, pHFIntegrals bar
 
 OneElectronMBPT::OneElectronMBPT(pOrbitalManagerConst orbitals, pSpinorMatrixElementConst pOperator, pCoreMBPTCalculator core_mbpt_calculator, pValenceMBPTCalculator valence_mbpt_calculator, const std::string& write_file):
     OneElectronIntegrals(orbitals, pOperator), core_PT(core_mbpt_calculator), valence_PT(valence_mbpt_calculator), write_file(write_file),
-    include_core(false), include_core_subtraction(false), include_valence_subtraction(false)
+    include_core(false), include_core_subtraction(false), include_valence_subtraction(false), comm(ProcessGroup)
 {
     if(core_PT)
     {   include_core = true;
@@ -35,7 +36,7 @@ unsigned int OneElectronMBPT::CalculateOneElectronIntegrals(pOrbitalMapConst orb
     if(!check_size_only)
     {
         int new_keys_per_processor = CalculateOneElectronIntegrals(orbital_map_1, orbital_map_2, true);
-        new_keys_per_processor = (new_keys_per_processor + NumProcessors - 1)/NumProcessors;
+        new_keys_per_processor = (new_keys_per_processor + comm.Size() - 1)/comm.Size();
 
         new_keys.clear();
         new_keys.reserve(new_keys_per_processor);
@@ -82,7 +83,7 @@ unsigned int OneElectronMBPT::CalculateOneElectronIntegrals(pOrbitalMapConst orb
                     if(!found_keys.count(key))
                     {
                         // Check if this is our job
-                        if(count == ProcessorRank)
+                        if(count == comm.Rank())
                         {
                     #else
                     if(integrals.find(key) == integrals.end())
@@ -103,7 +104,7 @@ unsigned int OneElectronMBPT::CalculateOneElectronIntegrals(pOrbitalMapConst orb
 
                         found_keys.insert(key);
                         count++;
-                        if(count == NumProcessors)
+                        if(count == comm.Size())
                             count = 0;
                     #else
                         integrals[key] = value;
@@ -139,7 +140,7 @@ unsigned int OneElectronMBPT::CalculateOneElectronIntegrals(pOrbitalMapConst orb
 #ifdef AMBIT_USE_MPI
 void OneElectronMBPT::Write(const std::string& filename) const
 {
-    if(ProcessorRank == 0)
+    if(comm.Rank() == 0)
     {
         FILE* fp = file_err_handler->fopen(filename.c_str(), "wb");
 
@@ -147,13 +148,13 @@ void OneElectronMBPT::Write(const std::string& filename) const
         WriteOrbitalIndexes(orbitals->state_index, fp);
 
         // Get number of keys from all processes
-        std::vector<unsigned int> num_integrals(NumProcessors);
+        std::vector<unsigned int> num_integrals(comm.Size());
         num_integrals[0] = new_keys.size();
 
         MPI_Status status;
-        for(int proc = 1; proc < NumProcessors; proc++)
+        for(int proc = 1; proc < comm.Size(); proc++)
         {
-            MPI_Recv(&num_integrals[proc], 1, MPI_UNSIGNED, proc, 1, MPI_COMM_WORLD, &status);
+            MPI_Recv(&num_integrals[proc], 1, MPI_UNSIGNED, proc, 1, comm.Comm(), &status);
         }
 
         unsigned int total_integrals = std::accumulate(num_integrals.begin(), num_integrals.end(), size());
@@ -175,13 +176,13 @@ void OneElectronMBPT::Write(const std::string& filename) const
         // Receive and write data from other processes
         std::vector<unsigned int> keys;
         std::vector<double> values;
-        for(int proc = 1; proc < NumProcessors; proc++)
+        for(int proc = 1; proc < comm.Size(); proc++)
         {
             keys.resize(num_integrals[proc]);
             values.resize(num_integrals[proc]);
 
-            MPI_Recv(keys.data(), num_integrals[proc], MPI_UNSIGNED, proc, 2, MPI_COMM_WORLD, &status);
-            MPI_Recv(values.data(), num_integrals[proc], MPI_DOUBLE, proc, 3, MPI_COMM_WORLD, &status);
+            MPI_Recv(keys.data(), num_integrals[proc], MPI_UNSIGNED, proc, 2, comm.Comm(), &status);
+            MPI_Recv(values.data(), num_integrals[proc], MPI_DOUBLE, proc, 3, comm.Comm(), &status);
 
             for(int i = 0; i < num_integrals[proc]; i++)
             {
@@ -195,14 +196,14 @@ void OneElectronMBPT::Write(const std::string& filename) const
     else
     {   // Send data to root. First number of keys.
         unsigned int num_keys = new_keys.size();
-        MPI_Send(&num_keys, 1, MPI_UNSIGNED, 0, 1, MPI_COMM_WORLD);
+        MPI_Send(&num_keys, 1, MPI_UNSIGNED, 0, 1, comm.Comm());
 
         // Send keys and data to root
-        MPI_Send(new_keys.data(), num_keys, MPI_UNSIGNED, 0, 2, MPI_COMM_WORLD);
-        MPI_Send(new_values.data(), num_keys, MPI_DOUBLE, 0, 3, MPI_COMM_WORLD);
+        MPI_Send(new_keys.data(), num_keys, MPI_UNSIGNED, 0, 2, comm.Comm());
+        MPI_Send(new_values.data(), num_keys, MPI_DOUBLE, 0, 3, comm.Comm());
     }
 
-    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Barrier(comm.Comm());
 }
 #endif
 
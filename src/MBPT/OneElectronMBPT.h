@@ -4,6 +4,7 @@
 #include "OneElectronIntegrals.h"
 #include "CoreMBPTCalculator.h"
 #include "ValenceMBPTCalculator.h"
+#include "Universal/Communicator.h"
 
 namespace Ambit
 {
@@ -33,6 +34,9 @@ public:
     void IncludeCore(bool include_mbpt, bool include_subtraction);
     void IncludeValence(bool include_subtraction);
 
+    /** Divide the calculation between the processes of communicator rather than ProcessGroup. */
+    void SetCommunicator(const Communicator& communicator) { comm = communicator; }
+
 protected:
     pCoreMBPTCalculator core_PT;
     pValenceMBPTCalculator valence_PT;
@@ -47,6 +51,7 @@ protected:
     std::vector<unsigned int> new_keys;
     std::vector<double> new_values;
     std::string write_file;
+    Communicator comm;
 };
 
 typedef std::shared_ptr<OneElectronMBPT> pOneElectronMBPT;
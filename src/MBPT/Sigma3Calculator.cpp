@@ -1,13 +1,18 @@
 #include "Sigma3Calculator.h"
 #include "Include.h"
 #include "Universal/PhysicalConstant.h"
+#include <algorithm>
 
 namespace Ambit
 {
 Sigma3Calculator::Sigma3Calculator(pOrbitalManagerConst orbitals, pSlaterIntegrals two_body, const std::string& fermi_orbitals):
     MBPTCalculator(orbitals, fermi_orbitals, two_body->OffParityExists()), two_body(two_body), include_valence(false),
     include_core(true), deep(orbitals->deep), high(orbitals->high)
-{}
+{
+    SetCacheSize(1000000);
+    cache_hits = &Profiler::Instance()->Counter("Sigma3 cache hits");
+    cache_misses = &Profiler::Instance()->Counter("Sigma3 cache misses");
+}
 
 Sigma3Calculator::~Sigma3Calculator(void)
 {
@@ -17,11 +22,47 @@ Sigma3Calculator::~Sigma3Calculator(void)
 void Sigma3Calculator::IncludeCore(bool include_mbpt)
 {
     include_core = include_mbpt;
+    ClearCache();
 }
 
 void Sigma3Calculator::IncludeValence(bool include_mbpt)
 {
     include_valence = include_mbpt;
+    ClearCache();
+}
+
+void Sigma3Calculator::SetCacheSize(unsigned int max_entries)
+{
+    cache_shard_size = (max_entries + NumCacheShards - 1)/NumCacheShards;
+    ClearCache();
+}
+
+double Sigma3Calculator::CacheMemoryMB() const
+{
+    // Hash table node (next pointer, key, value and stored hash) and its bucket pointer
+    double entry_size = sizeof(void*) + sizeof(CacheKey) + sizeof(double) + sizeof(std::size_t) + sizeof(void*);
+    return double(cache_shard_size) * NumCacheShards * entry_size/(1024. * 1024.);
+}
+
+void Sigma3Calculator::ClearCache()
+{
+    for(auto& shard: cache)
+    {   std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.values.clear();
+    }
+}
+
+bool Sigma3Calculator::PackElectron(const ElectronInfo& e, uint64_t& packed)
+{
+    // 7 bits each for principal quantum number, kappa and TwoM
+    int pqn = e.PQN();
+    int kappa = e.Kappa() + 64;
+    int two_m = e.TwoM() + 64;
+    if(pqn < 0 || pqn >= 128 || kappa < 0 || kappa >= 128 || two_m < 0 || two_m >= 128)
+        return false;
+
+    packed = (uint64_t(pqn) << 14) | (uint64_t(kappa) << 7) | uint64_t(two_m);
+    return true;
 }
 
 unsigned int Sigma3Calculator::GetStorageSize()
@@ -37,6 +78,7 @@ unsigned int Sigma3Calculator::GetStorageSize()
 
 void Sigma3Calculator::UpdateIntegrals()
 {
+    ClearCache();
     SetValenceEnergies();
 
     if(include_core)
@@ -48,25 +90,66 @@ void Sigma3Calculator::UpdateIntegrals()
 double Sigma3Calculator::GetMatrixElement(const ElectronInfo& e1, const ElectronInfo& e2, const ElectronInfo& e3,
                                           const ElectronInfo& e4, const ElectronInfo& e5, const ElectronInfo& e6) const
 {
-    double value = 0.;
-
     if((e1.L() + e2.L() + e3.L() + e4.L() + e5.L() + e6.L())%2 ||
        (e1.TwoM() + e2.TwoM() + e3.TwoM() != e4.TwoM() + e5.TwoM() + e6.TwoM()))
-        return value;
+        return 0.;
 
-    // There are no sign changes, since there are the same number
-    // of permutations on both sides
+    if(!cache_shard_size)
+        return SumLinePermutations(e1, e2, e3, e4, e5, e6);
+
+    // The sum over line permutations doesn't depend on the order of the pairs (e1, e4), (e2, e5), (e3, e6),
+    // so sort them: the sorted pairs are the cache key, and the sum is always made in the same order.
+    struct Pair
+    {   uint64_t packed;
+        const ElectronInfo* left;
+        const ElectronInfo* right;
+        bool operator<(const Pair& other) const { return packed < other.packed; }
+    };
+    std::array<Pair, 3> pairs = {{{0, &e1, &e4}, {0, &e2, &e5}, {0, &e3, &e6}}};
+    for(Pair& pair: pairs)
+    {   uint64_t packed_left, packed_right;
+        if(!PackElectron(*pair.left, packed_left) || !PackElectron(*pair.right, packed_right))
+            return SumLinePermutations(e1, e2, e3, e4, e5, e6);
+        pair.packed = (packed_left << 21) | packed_right;
+    }
+    std::sort(pairs.begin(), pairs.end());
+
+    // 42 bits per pair
+    CacheKey key = {{pairs[0].packed | (pairs[1].packed << 42), (pairs[1].packed >> 22) | (pairs[2].packed << 20)}};
+    CacheShard& shard = cache[CacheKeyHash()(key)%NumCacheShards];
+    {   std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.values.find(key);
+        if(it != shard.values.end())
+        {   cache_hits->Add();
+            return it->second;
+        }
+    }
 
-    value = GetSecondOrderSigma3(e1, e2, e3, e4, e5, e6) +
-            GetSecondOrderSigma3(e2, e3, e1, e5, e6, e4) +
-            GetSecondOrderSigma3(e3, e1, e2, e6, e4, e5) +
-            GetSecondOrderSigma3(e3, e2, e1, e6, e5, e4) +
-            GetSecondOrderSigma3(e2, e1, e3, e5, e4, e6) +
-            GetSecondOrderSigma3(e1, e3, e2, e4, e6, e5);
+    cache_misses->Add();
+    double value = SumLinePermutations(*pairs[0].left, *pairs[1].left, *pairs[2].left, *pairs[0].right, *pairs[1].right, *pairs[2].right);
+
+    // Keep it while there is room
+    {   std::lock_guard<std::mutex> lock(shard.mutex);
+        if(shard.values.size() < cache_shard_size)
+            shard.values.emplace(key, value);
+    }
 
     return value;
 }
 
+double Sigma3Calculator::SumLinePermutations(const ElectronInfo& e1, const ElectronInfo& e2, const ElectronInfo& e3,
+                                             const ElectronInfo& e4, const ElectronInfo& e5, const ElectronInfo& e6) const
+{
+    // There are no sign changes, since there are the same number
+    // of permutations on both sides
+    return GetSecondOrderSigma3(e1, e2, e3, e4, e5, e6) +
+           GetSecondOrderSigma3(e2, e3, e1, e5, e6, e4) +
+           GetSecondOrderSigma3(e3, e1, e2, e6, e4, e5) +
+           GetSecondOrderSigma3(e3, e2, e1, e6, e5, e4) +
+           GetSecondOrderSigma3(e2, e1, e3, e5, e4, e6) +
+           GetSecondOrderSigma3(e1, e3, e2, e4, e6, e5);
+}
+
 double Sigma3Calculator::GetSecondOrderSigma3(const ElectronInfo& e1, const ElectronInfo& e2, const ElectronInfo& e3,
            const ElectronInfo& e4, const ElectronInfo& e5, const ElectronInfo& e6) const
 {
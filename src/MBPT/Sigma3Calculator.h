@@ -4,6 +4,9 @@
 #include "MBPTCalculator.h"
 #include "SlaterIntegrals.h"
 #include "Configuration/ElectronInfo.h"
+#include <array>
+#include <mutex>
+#include <unordered_map>
 
 namespace Ambit
 {
@@ -18,6 +21,8 @@ namespace Ambit
     Sigma3Calculator is different to other MBPT calculators since these diagrams are calculated on the fly,
     rather than being pre-calculated and stored.
     Sigma3Calculator has the GetMatrixElement() method that can be used directly in ManyBodyOperator.
+    Many pairs of projections need the same matrix elements, so these are kept in a cache (safe to use from
+    several threads) that is cleared whenever the integrals change.
  */
 class Sigma3Calculator : public MBPTCalculator
 {
@@ -28,6 +33,15 @@ public:
     void IncludeCore(bool include_mbpt);
     void IncludeValence(bool include_mbpt);
 
+    /** Keep at most max_entries matrix elements for reuse (default 1000000); zero switches off the cache. */
+    void SetCacheSize(unsigned int max_entries);
+
+    /** Memory (MB) used by the cache when it is full. */
+    double CacheMemoryMB() const;
+
+    /** Remove all matrix elements from the cache. */
+    void ClearCache();
+
     virtual unsigned int GetStorageSize() override;
     virtual void UpdateIntegrals() override;
 
@@ -58,6 +72,33 @@ protected:
     double GetSecondOrderSigma3(const ElectronInfo& e1, const ElectronInfo& e2, const ElectronInfo& e3,
                                 const ElectronInfo& e4, const ElectronInfo& e5, const ElectronInfo& e6) const;
 
+    /** Sum of GetSecondOrderSigma3() over line permutations. */
+    double SumLinePermutations(const ElectronInfo& e1, const ElectronInfo& e2, const ElectronInfo& e3,
+                               const ElectronInfo& e4, const ElectronInfo& e5, const ElectronInfo& e6) const;
+
+    /** Pack orbital and TwoM of electron into 21 bits for the cache key; return false if it doesn't fit. */
+    static bool PackElectron(const ElectronInfo& e, uint64_t& packed);
+
+    /** Cache key of a matrix element is its three sorted pairs of packed electrons (left, right). */
+    typedef std::array<uint64_t, 2> CacheKey;
+
+    struct CacheKeyHash
+    {   std::size_t operator()(const CacheKey& key) const
+        {   return std::hash<uint64_t>()(key[0] ^ (key[1] * 0x9E3779B97F4A7C15ULL));
+        }
+    };
+
+    /** Cache is split into shards with their own locks to keep threads from waiting for each other. */
+    static const unsigned int NumCacheShards = 64;
+    struct CacheShard
+    {   std::mutex mutex;
+        std::unordered_map<CacheKey, double, CacheKeyHash> values;
+    };
+    mutable std::array<CacheShard, NumCacheShards> cache;
+    unsigned int cache_shard_size;  //!< Maximum entries per shard
+    ProfileCounter* cache_hits;
+    ProfileCounter* cache_misses;
+
     bool include_core;
     bool include_valence;
     pSlaterIntegrals two_body;
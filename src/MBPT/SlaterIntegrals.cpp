@@ -14,6 +14,7 @@ SlaterIntegrals<MapType>::SlaterIntegrals(pOrbitalManagerConst orbitals, bool tw
     SlaterIntegralsInterface(orbitals, two_body_reverse_symmetry_exists)
 {
     NumStates = orbitals->size();
+    lookup_counter = &Profiler::Instance()->Counter("Slater integral lookups");
 }
 
 template <class MapType>
@@ -21,6 +22,7 @@ SlaterIntegrals<MapType>::SlaterIntegrals(pOrbitalManagerConst orbitals, pHartre
     SlaterIntegralsInterface(orbitals, two_body_reverse_symmetry_exists), hartreeY_operator(hartreeY_op)
 {
     NumStates = orbitals->size();
+    lookup_counter = &Profiler::Instance()->Counter("Slater integral lookups");
 }
 
 template <class MapType>
@@ -28,6 +30,7 @@ SlaterIntegrals<MapType>::SlaterIntegrals(pOrbitalManagerConst orbitals, pHartre
     SlaterIntegralsInterface(orbitals, hartreeY_op->ReverseSymmetryExists()), hartreeY_operator(hartreeY_op)
 {
     NumStates = orbitals->size();
+    lookup_counter = &Profiler::Instance()->Counter("Slater integral lookups");
 }
 
 template <class MapType>
@@ -51,6 +54,12 @@ unsigned int SlaterIntegrals<MapType>::CalculateTwoElectronIntegrals(pOrbitalMap
     for(int ii = 0; ii < omp_get_max_threads(); ++ii){
         hartreeY_operators.emplace_back(hartreeY_operator->Clone());
     }
+    // Freeze the lattice: it must not be resized underneath the threads.
+    // k <= max(TwoJ), and the kernels need R^(k+2), so precompute those powers now.
+    int max_two_j = 0;
+    for(const auto& pair: *orbitals->all)
+        max_two_j = mmax(max_two_j, pair.first.TwoJ());
+    LatticeSnapshot frozen_lattice(orbitals->GetLattice(), max_two_j + 2);
     #pragma omp parallel for schedule(dynamic, 4) if(!check_size_only) default(none) \
     private(k, i1, i2, i3, i4, s1, s2, s3, s4) \
     shared(hartreeY_operators, orbitals, orbital_map_1, orbital_map_2, \
@@ -214,6 +223,7 @@ double SlaterIntegrals<MapType>::GetTwoElectronIntegral(unsigned int k, const Or
     KeyType key = GetKey(k, i1, i2, i3, i4);
     double radial = 0.;
 
+    lookup_counter->Add();
     auto it = TwoElectronIntegrals.find(key);
     if(it != TwoElectronIntegrals.end())
     {
@@ -3,6 +3,7 @@
 
 #include "Basis/OrbitalManager.h"
 #include "HartreeFock/HartreeY.h"
+#include "Universal/Profiler.h"
 #include <map>
 #include <unordered_map>
 #include <absl/container/flat_hash_map.h>
@@ -147,6 +148,9 @@ protected:
 
     // TwoElectronIntegrals(k, i, j, l, m) = R_k(ij, lm): i->l, j->m
     MapType TwoElectronIntegrals;
+
+    /** Profile counter of GetTwoElectronIntegral() lookups. */
+    ProfileCounter* lookup_counter;
 };
 
 typedef SlaterIntegrals<std::map<unsigned long long int, double>> SlaterIntegralsMap;
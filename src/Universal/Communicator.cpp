@@ -0,0 +1,110 @@
+#include "Include.h"
+#include "Communicator.h"
+#include <algorithm>
+#include <numeric>
+
+namespace Ambit
+{
+Communicator ProcessGroup = Communicator::World();
+
+Communicator Communicator::World()
+{
+    Communicator world;
+#ifdef AMBIT_USE_MPI
+    // MPI may not be initialised yet (e.g. static initialisation of ProcessGroup)
+    world.comm = std::make_shared<MPI_Comm>(MPI_COMM_WORLD);
+
+    int initialised;
+    MPI_Initialized(&initialised);
+    if(initialised)
+    {   MPI_Comm_size(MPI_COMM_WORLD, &world.size);
+        MPI_Comm_rank(MPI_COMM_WORLD, &world.rank);
+    }
+#endif
+    return world;
+}
+
+Communicator Communicator::Split([[maybe_unused]] int colour) const
+{
+    Communicator group;
+#ifdef AMBIT_USE_MPI
+    MPI_Comm new_comm;
+    MPI_Comm_split(*comm, colour, rank, &new_comm);
+
+    group.comm = std::shared_ptr<MPI_Comm>(new MPI_Comm(new_comm), [](MPI_Comm* c)
+    {   int finalised;
+        MPI_Finalized(&finalised);
+        if(!finalised)
+            MPI_Comm_free(c);
+        delete c;
+    });
+    MPI_Comm_size(new_comm, &group.size);
+    MPI_Comm_rank(new_comm, &group.rank);
+#endif
+    return group;
+}
+
+void Communicator::Barrier() const
+{
+#ifdef AMBIT_USE_MPI
+    MPI_Barrier(*comm);
+#endif
+}
+
+void SetProcessGroup(const Communicator& comm)
+{
+    ProcessGroup = comm;
+    NumProcessors = comm.Size();
+    ProcessorRank = comm.Rank();
+}
+
+std::vector<int> PackTasks(const std::vector<double>& costs, int num_processes, std::vector<int>& group_start, std::vector<int>& group_size)
+{
+    int num_groups = mmin(num_processes, int(costs.size()));
+    std::vector<int> task_group(costs.size(), 0);
+    group_start.assign(num_groups, 0);
+    group_size.assign(num_groups, 1);
+    if(num_groups == 0)
+        return task_group;
+
+    // Largest first, onto the least loaded group
+    std::vector<unsigned int> order(costs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&costs](unsigned int a, unsigned int b) { return costs[a] > costs[b]; });
+
+    std::vector<double> load(num_groups, 0.);
+    for(unsigned int task: order)
+    {
+        int group = std::min_element(load.begin(), load.end()) - load.begin();
+        task_group[task] = group;
+        load[group] += costs[task];
+    }
+
+    // Share remaining processes in proportion to load, giving leftovers to the largest remainders
+    double total_load = std::accumulate(load.begin(), load.end(), 0.);
+    int spare = num_processes - num_groups;
+    std::vector<double> remainder(num_groups, 1.);
+    if(total_load > 0.)
+    {
+        for(int g = 0; g < num_groups; g++)
+        {   double share = spare * load[g]/total_load;
+            group_size[g] += int(share);
+            remainder[g] = share - int(share);
+        }
+    }
+
+    int assigned = std::accumulate(group_size.begin(), group_size.end(), 0);
+    std::vector<int> by_remainder(num_groups);
+    std::iota(by_remainder.begin(), by_remainder.end(), 0);
+    std::stable_sort(by_remainder.begin(), by_remainder.end(), [&remainder](int a, int b) { return remainder[a] > remainder[b]; });
+    for(int i = 0; assigned < num_processes; i = (i+1)%num_groups)
+    {   group_size[by_remainder[i]]++;
+        assigned++;
+    }
+
+    for(int g = 1; g < num_groups; g++)
+        group_start[g] = group_start[g-1] + group_size[g-1];
+
+    return task_group;
+}
+}
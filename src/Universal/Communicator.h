@@ -0,0 +1,64 @@
+#ifndef COMMUNICATOR_H
+#define COMMUNICATOR_H
+
+#ifdef AMBIT_USE_MPI
+#include <mpi.h>
+#endif
+#include <memory>
+#include <vector>
+
+namespace Ambit
+{
+/** A group of MPI processes: an MPI communicator together with its size and the rank of this process.
+    Without MPI it is a group of one process. Copies share the same underlying communicator, which is
+    freed when the last copy is destroyed (unless it is MPI_COMM_WORLD).
+ */
+class Communicator
+{
+public:
+    /** All processes. */
+    static Communicator World();
+
+    /** Divide into groups of processes with the same colour; rank order is preserved.
+        Collective over this communicator.
+     */
+    Communicator Split(int colour) const;
+
+    int Size() const { return size; }
+    int Rank() const { return rank; }
+
+    void Barrier() const;
+
+#ifdef AMBIT_USE_MPI
+    MPI_Comm Comm() const { return *comm; }
+#endif
+
+protected:
+    Communicator(): size(1), rank(0) {}
+
+#ifdef AMBIT_USE_MPI
+    std::shared_ptr<MPI_Comm> comm;
+#endif
+    int size;
+    int rank;
+};
+
+/** Communicator for all distributed calculations of this process: NumProcessors and ProcessorRank are
+    its size and rank. It is Communicator::World() except when groups of processes are working on separate
+    tasks (see AmbitInterface::EnergyCalculations()).
+ */
+extern Communicator ProcessGroup;
+
+/** Make comm the ProcessGroup, setting NumProcessors and ProcessorRank. */
+void SetProcessGroup(const Communicator& comm);
+
+/** Pack independent tasks with estimated costs onto groups of num_processes processes.
+    There are min(num_processes, costs.size()) groups. Tasks are placed largest first, each onto the group
+    with the least total cost so far; processes are then shared between groups in proportion to their total
+    cost, with at least one process each. Groups are numbered so that group g holds the processes
+    [group_start[g], group_start[g] + group_size[g]).
+    Return the group of each task.
+ */
+std::vector<int> PackTasks(const std::vector<double>& costs, int num_processes, std::vector<int>& group_start, std::vector<int>& group_size);
+}
+#endif
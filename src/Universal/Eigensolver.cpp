@@ -2,7 +2,9 @@
 #include <mpi.h>
 #endif
 #include "Include.h"
+#include "Communicator.h"
 #include "Eigensolver.h"
+#include "Profiler.h"
 
 #define SMALL_LIM 1000
 
@@ -46,22 +48,38 @@ void dsygv_(int*, char*, char*, int*, double*, int*, double*, int*, double*, dou
 
 #ifdef AMBIT_USE_MPI
 double* c_copy;
+MPI_Comm op_comm;
 
 extern "C" {
 int MPI_op(int *n, int *m, double* b, double* c)
 {
-    MPI_Bcast(m, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Bcast(b, (*n)*(*m), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Bcast(m, 1, MPI_INT, 0, op_comm);
+    MPI_Bcast(b, (*n)*(*m), MPI_DOUBLE, 0, op_comm);
 
     aa->MatrixMultiply(*m, b, c_copy);
 
-    MPI_Reduce(c_copy, c, (*n)*(*m), MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    // Root waits here for the slowest process
+    ProfileTimer timer("Davidson/MPI wait");
+    MPI_Reduce(c_copy, c, (*n)*(*m), MPI_DOUBLE, MPI_SUM, 0, op_comm);
 
     return 0;
 }
 }
 #endif
 
+double Eigensolver::DavidsonMemoryMB(unsigned int N, unsigned int num_solutions)
+{
+    // Same sizes as SolveLargeSymmetric() and MPISolveLargeSymmetric()
+    double n = N;
+    double lim = mmin(N, num_solutions+20);
+    double worksize = 2*n*lim + lim*lim + (num_solutions+10)*lim + num_solutions;
+    double size = worksize + n + num_solutions * n;     // work, diag, eigenvectors
+#ifdef AMBIT_USE_MPI
+    size += n + num_solutions * n;                      // my_diag, c_copy
+#endif
+    return size * sizeof(double)/(1024. * 1024.);
+}
+
 void Eigensolver::SolveSmallSymmetric(double* matrix, double* eigenvalues, unsigned int N)
 {
     if(N)
@@ -142,6 +160,8 @@ void Eigensolver::SolveLargeSymmetric(Matrix* matrix, double* eigenvalues, doubl
         }
     }
     *outstream << "    nloops=" << nloops << std::endl;;
+    if(Profiler::Instance()->Enabled() && comm.Rank() == 0)
+        Profiler::Instance()->AddCount("Davidson iterations", nloops);
 
     delete[] diag;
     delete[] iselec;
@@ -167,14 +187,15 @@ void Eigensolver::MPISolveLargeSymmetric(Matrix* matrix, double* eigenvalues, do
 
     n = N;
     c_copy = new double[num_solutions * N]; 
+    op_comm = comm.Comm();
 
     // Get diagonal
     diag = new double[n];
     double* my_diag = new double[n];
     matrix->GetDiagonal(my_diag);
-    MPI_Reduce(my_diag, diag, n, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(my_diag, diag, n, MPI_DOUBLE, MPI_SUM, 0, comm.Comm());
 
-    if(ProcessorRank == 0)
+    if(comm.Rank() == 0)
     {
         aa = matrix;
         lim = mmin(N, num_solutions+20);
@@ -211,10 +232,10 @@ void Eigensolver::MPISolveLargeSymmetric(Matrix* matrix, double* eigenvalues, do
 
         // send finish (m = 0)
         int finish_m = 0;
-        MPI_Bcast(&finish_m, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&finish_m, 1, MPI_INT, 0, comm.Comm());
 
         // send success
-        MPI_Bcast(&ierr, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&ierr, 1, MPI_INT, 0, comm.Comm());
 
         if(ierr != 0)
         {   *errstream << "dvdson failed, ierr = " << ierr << std::endl;
@@ -228,8 +249,8 @@ void Eigensolver::MPISolveLargeSymmetric(Matrix* matrix, double* eigenvalues, do
             }
 
             // broadcast results
-            MPI_Bcast(eigenvalues, num_solutions, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-            MPI_Bcast(eigenvectors, num_solutions * n, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+            MPI_Bcast(eigenvalues, num_solutions, MPI_DOUBLE, 0, comm.Comm());
+            MPI_Bcast(eigenvectors, num_solutions * n, MPI_DOUBLE, 0, comm.Comm());
         }
 
         delete[] iselec;
@@ -246,21 +267,25 @@ void Eigensolver::MPISolveLargeSymmetric(Matrix* matrix, double* eigenvalues, do
         int m = 1;
         while(m != 0)
         {
-            MPI_Bcast(&m, 1, MPI_INT, 0, MPI_COMM_WORLD);
+            // Workers wait here while root does the Davidson step
+            ProfileTimer timer("Davidson/MPI wait");
+            MPI_Bcast(&m, 1, MPI_INT, 0, comm.Comm());
+            timer.Stop();
+
             if(m != 0)
             {   nloops++;
-                MPI_Bcast(b, m * N, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+                MPI_Bcast(b, m * N, MPI_DOUBLE, 0, comm.Comm());
 
                 matrix->MatrixMultiply(m, b, c_copy);
 
-                MPI_Reduce(c_copy, c, m * N, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+                MPI_Reduce(c_copy, c, m * N, MPI_DOUBLE, MPI_SUM, 0, comm.Comm());
             }
         }
 
         delete[] b;
         delete[] c;
 
-        MPI_Bcast(&ierr, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&ierr, 1, MPI_INT, 0, comm.Comm());
 
         if(ierr != 0)
         {   *errstream << "dvdson failed, ierr = " << ierr << std::endl;
@@ -268,8 +293,8 @@ void Eigensolver::MPISolveLargeSymmetric(Matrix* matrix, double* eigenvalues, do
         }
         else
         {   // get broadcast results
-            MPI_Bcast(eigenvalues, num_solutions, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-            MPI_Bcast(eigenvectors, num_solutions * N, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+            MPI_Bcast(eigenvalues, num_solutions, MPI_DOUBLE, 0, comm.Comm());
+            MPI_Bcast(eigenvectors, num_solutions * N, MPI_DOUBLE, 0, comm.Comm());
         }
     }
 
@@ -277,6 +302,8 @@ void Eigensolver::MPISolveLargeSymmetric(Matrix* matrix, double* eigenvalues, do
     delete[] my_diag;
     delete[] diag;
     *outstream << "    nloops=" << nloops << std::endl;;
+    if(Profiler::Instance()->Enabled() && comm.Rank() == 0)
+        Profiler::Instance()->AddCount("Davidson iterations", nloops);
 }
 #endif
 
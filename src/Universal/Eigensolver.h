@@ -2,13 +2,15 @@
 #define EIGENSOLVER_H
 
 #include "Matrix.h"
+#include "Communicator.h"
 
 namespace Ambit
 {
 class Eigensolver
 {
 public:
-    Eigensolver() {}
+    /** MPISolveLargeSymmetric() is distributed over the processes of comm. */
+    Eigensolver(const Communicator& comm = ProcessGroup): comm(comm) {}
     ~Eigensolver() {}
 
     /** Solve a double symmetric matrix (using lapack routine "dsyev").
@@ -59,6 +61,14 @@ public:
               Eigenvalues are sorted in ascending order.                  
      */
     bool SolveMatrixEquation(double* A_matrix, double* B_matrix, double* eigenvalues, unsigned int N);
+
+    /** Memory (MB) of the working arrays of SolveLargeSymmetric() or MPISolveLargeSymmetric() on the root process,
+        which holds the Davidson basis, for an N * N matrix (not including the matrix itself).
+     */
+    static double DavidsonMemoryMB(unsigned int N, unsigned int num_solutions);
+
+protected:
+    Communicator comm;
 };
 
 }
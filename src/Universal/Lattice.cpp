@@ -1,11 +1,14 @@
 #include "Include.h"
 #include "Lattice.h"
 #include <fstream>
+#ifdef AMBIT_USE_OPENMP
+#include <omp.h>
+#endif
 
 namespace Ambit
 {
 Lattice::Lattice(unsigned int numpoints, double r_min, double r_max):
-    beta(4.0), num_points(numpoints), original_size(numpoints), rmin(r_min)
+    beta(4.0), num_points(numpoints), original_size(numpoints), rmin(r_min), frozen_count(0)
 {
     r.resize(num_points);
     dr.resize(num_points);
@@ -16,9 +19,12 @@ Lattice::Lattice(unsigned int numpoints, double r_min, double r_max):
     {   r[i] = lattice_to_real(i);
         dr[i] = calculate_dr(r[i]);
     }
+
+    PublishRpower();
 }
 
-Lattice::Lattice(FILE* binary_infile)
+Lattice::Lattice(FILE* binary_infile):
+    frozen_count(0)
 {
     file_err_handler->fread(&beta, sizeof(double), 1, binary_infile);
     file_err_handler->fread(&h, sizeof(double), 1, binary_infile);
@@ -32,15 +38,31 @@ Lattice::Lattice(FILE* binary_infile)
     file_err_handler->fread(dr.data(), sizeof(double), num_points, binary_infile);
 
     original_size = num_points;
+    PublishRpower();
+}
+
+Lattice::Lattice(const Lattice& other):
+    original_size(other.original_size), beta(other.beta), h(other.h), rmin(other.rmin),
+    num_points(other.num_points), r(other.r), dr(other.dr), r_power(other.r_power), frozen_count(0)
+{
+    PublishRpower();
 }
 
 unsigned int Lattice::resize(unsigned int new_size)
 {
+    std::lock_guard<std::recursive_mutex> lock(lattice_mutex);
+
     unsigned int old_size = size();
     new_size = mmax(new_size, original_size);
 
     if(old_size != new_size)
     {
+        if(IsFrozen())
+        {   *errstream << "Lattice::resize(): cannot resize lattice from " << old_size << " to " << new_size
+                       << " points while a LatticeSnapshot is in use." << std::endl;
+            exit(1);
+        }
+
         r.resize(new_size);
         dr.resize(new_size);
         for(auto& r_k: r_power)
@@ -64,6 +86,7 @@ unsigned int Lattice::resize(unsigned int new_size)
         }
 
         num_points = new_size;
+        PublishRpower();
         Notify();
     }
 
@@ -119,8 +142,39 @@ double Lattice::calculate_dr(double r_point) const
     return r_point/(beta + r_point) * h;
 }
 
+const double* Lattice::Rpower(unsigned int k)
+{
+    if(k == 1)
+        return r.data();
+
+    // Fast path: powers that have been calculated are never moved until the lattice is resized
+    if(k <= MaxPublishedPower)
+    {   const double* power = published_power[k].load(std::memory_order_acquire);
+        if(power)
+            return power;
+    }
+
+#ifdef AMBIT_USE_OPENMP
+    // Calculating here would serialise the threads on the lattice lock
+    if(omp_in_parallel())
+    {   *errstream << "Lattice::Rpower(): R^" << k << " requested inside a parallel region but not precomputed;"
+                   << " take a LatticeSnapshot with larger max_power before the region." << std::endl;
+        exit(1);
+    }
+#endif
+
+    return Calculate_Rpower(k);
+}
+
+void Lattice::PrecomputeRpower(unsigned int max_power)
+{
+    if(max_power >= 2)
+        Calculate_Rpower(max_power);
+}
+
 const double* Lattice::Calculate_Rpower(unsigned int k)
 {
+    std::lock_guard<std::recursive_mutex> lock(lattice_mutex);
     unsigned int kminustwo = k - 2;
 
     unsigned int old_size = r_power.size();
@@ -139,11 +193,27 @@ const double* Lattice::Calculate_Rpower(unsigned int k)
             current[i] = previous[i] * r[i];
     }
 
+    if(old_size <= kminustwo)
+        PublishRpower();
+
     return r_power[kminustwo].data();
 }
 
+void Lattice::PublishRpower()
+{
+    // R^0 and R^1 are not published: Rpower(1) returns r directly
+    published_power[0].store(nullptr, std::memory_order_relaxed);
+    published_power[1].store(nullptr, std::memory_order_relaxed);
+    for(unsigned int k = 2; k <= MaxPublishedPower; k++)
+    {   const double* power = (k - 2 < r_power.size())? r_power[k-2].data(): nullptr;
+        published_power[k].store(power, std::memory_order_release);
+    }
+}
+
 void Lattice::Subscribe(LatticeObserver* observer)
 {
+    std::lock_guard<std::recursive_mutex> lock(lattice_mutex);
+
     // Often (but not always) last to subscribe is first to unsubscribe.
     // So we add to front so that it is found more quickly in list.
     observers.push_front(observer);
@@ -151,6 +221,8 @@ void Lattice::Subscribe(LatticeObserver* observer)
 
 void Lattice::Unsubscribe(LatticeObserver* observer)
 {
+    std::lock_guard<std::recursive_mutex> lock(lattice_mutex);
+
     auto it = observers.begin();
     while(it != observers.end())
     {
@@ -173,4 +245,33 @@ void Lattice::Write(FILE* binary_outfile) const
     file_err_handler->fwrite(r.data(), sizeof(double), num_points, binary_outfile);
     file_err_handler->fwrite(dr.data(), sizeof(double), num_points, binary_outfile);
 }
+
+LatticeSnapshot::LatticeSnapshot(pLattice lattice, unsigned int max_power):
+    lattice(lattice)
+{
+    std::lock_guard<std::recursive_mutex> lock(lattice->lattice_mutex);
+
+    lattice->frozen_count++;
+    lattice->PrecomputeRpower(max_power);
+
+    num_points = lattice->size();
+    r = lattice->R();
+    dr = lattice->dR();
+
+    r_power.reserve(mmax(max_power, 1));
+    r_power.push_back(r);
+    for(unsigned int k = 2; k <= max_power; k++)
+        r_power.push_back(lattice->r_power[k-2].data());
+}
+
+LatticeSnapshot::LatticeSnapshot(const LatticeSnapshot& other):
+    lattice(other.lattice), num_points(other.num_points), r(other.r), dr(other.dr), r_power(other.r_power)
+{
+    lattice->frozen_count++;
+}
+
+LatticeSnapshot::~LatticeSnapshot()
+{
+    lattice->frozen_count--;
+}
 }
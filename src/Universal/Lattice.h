@@ -4,12 +4,16 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <array>
 #include <memory>
+#include <mutex>
+#include <atomic>
 #include <boost/weak_ptr.hpp>
 
 namespace Ambit
 {
 class LatticeObserver;
+class LatticeSnapshot;
 
 /** The lattice class provides a conversion between a lattice with even spacing (x),
     and a "real" space which may not (r).
@@ -20,12 +24,21 @@ class LatticeObserver;
     can expand if necessary.
     When the lattice size changes the lattice notifies observers that have registered
     using Attach().
+
+    resize() modifies the lattice and is not safe to call from inside a parallel region.
+    Threaded kernels should instead take a LatticeSnapshot before the parallel region:
+    this precomputes all required powers and freezes the lattice until the snapshot is released.
+    Rpower() reads precomputed powers without locking, so kernels inside the parallel region
+    (e.g. HF decorators) may call it for any power covered by the snapshot.
  */
 class Lattice
 {
+    friend class LatticeSnapshot;
 public:
     Lattice(unsigned int numpoints, double r_min, double r_max);
     Lattice(FILE* binary_infile);
+    /** Copy lattice points and powers, but not observers or snapshots. */
+    Lattice(const Lattice& other);
     virtual ~Lattice() {}
 
     /** Equality does not check size of lattice. */
@@ -38,6 +51,8 @@ public:
         That is, the lattice size is never smaller than original_size.
         Notifies observers if size changes.
         Returns new lattice size.
+        Resizing acts as a barrier: it is serialised with other resizes and subscriptions,
+        and it is an error to change the size while a LatticeSnapshot of this lattice exists.
      */
     unsigned int resize(unsigned int new_size);
 
@@ -61,9 +76,18 @@ public:
 
     /** Return all points of R^k, from 0 to size()-1.
         PRE: k > 0
+        Powers that have already been calculated are read without locking; others are calculated
+        under the lattice lock. Inside a parallel region the power must have been precomputed
+        (e.g. by a LatticeSnapshot), otherwise this is an error.
       */
     const double* Rpower(unsigned int k);
 
+    /** Calculate and store R^k for all k <= max_power. */
+    void PrecomputeRpower(unsigned int max_power);
+
+    /** True if a LatticeSnapshot of this lattice currently exists (so it may not be resized). */
+    bool IsFrozen() const { return (frozen_count > 0); }
+
     /** Add to observer list. */
     void Subscribe(LatticeObserver* observer);
 
@@ -87,13 +111,20 @@ public:
     virtual void Write(FILE* binary_outfile) const;
 
 protected:
-    Lattice(): original_size(0), num_points(0), beta(0.), h(0.), rmin(0.) {}
+    Lattice(): original_size(0), beta(0.), h(0.), rmin(0.), num_points(0), frozen_count(0)
+    {   PublishRpower();
+    }
 
     /** Calculate R^power and store, for all powers up to k.
         PRE: k >= 2
      */
     const double* Calculate_Rpower(unsigned int k);
 
+    /** Publish the current points of r_power for Rpower() to read without locking.
+        Call under the lattice lock whenever r_power is added to or its points move.
+     */
+    void PublishRpower();
+
     void Notify();
 
 protected:
@@ -107,13 +138,77 @@ protected:
     // r_power[k-2] = R^k, defined for k >= 2.
     std::vector<std::vector<double>> r_power;
 
+    // published_power[k] = r_power[k-2].data() (k >= 2) once R^k has been calculated, otherwise null.
+    // Written under the lock and read without it by Rpower().
+    static constexpr unsigned int MaxPublishedPower = 32;
+    std::array<std::atomic<const double*>, MaxPublishedPower + 1> published_power;
+
     // Observers
     std::list<LatticeObserver*> observers;
+
+    // Guards observers, resizing and growth of r_power. Recursive because observers may call
+    // Rpower() from Alert() during a resize.
+    std::recursive_mutex lattice_mutex;
+
+    // Number of live LatticeSnapshots of this lattice
+    std::atomic<unsigned int> frozen_count;
 };
 
 typedef std::shared_ptr<Lattice> pLattice;
 typedef std::shared_ptr<const Lattice> pLatticeConst;
 
+/** LatticeSnapshot is a frozen, read-only view of a Lattice that may be shared freely between threads.
+    All powers R^k with k <= max_power are calculated when the snapshot is taken,
+    and the lattice may not be resized until every snapshot of it has been destroyed.
+    Typical use is to take a snapshot immediately before an OpenMP parallel region:
+        LatticeSnapshot frozen_lattice(lattice, max_k + 2);
+        #pragma omp parallel for
+        for(...)
+            const double* RK = frozen_lattice.Rpower(k);
+ */
+class LatticeSnapshot
+{
+public:
+    LatticeSnapshot(pLattice lattice, unsigned int max_power = 1);
+    LatticeSnapshot(const LatticeSnapshot& other);
+    LatticeSnapshot& operator=(const LatticeSnapshot& other) = delete;
+    ~LatticeSnapshot();
+
+    /** Size of lattice when the snapshot was taken. */
+    unsigned int size() const { return num_points; }
+
+    /** PRE: i < size() */
+    inline double R(unsigned int i) const { return r[i]; }
+    inline double dR(unsigned int i) const { return dr[i]; }
+
+    const double* R() const { return r; }
+    const double* dR() const { return dr; }
+
+    /** Return all points of R^k, from 0 to size()-1.
+        PRE: 0 < k <= MaxPower()
+     */
+    inline const double* Rpower(unsigned int k) const
+    {   return r_power[k-1];
+    }
+
+    /** Largest power of R that is available. */
+    unsigned int MaxPower() const { return r_power.size(); }
+
+    double H() const { return lattice->H(); }
+    double MaxRealDistance() const { return r[num_points-1]; }
+
+    pLatticeConst GetLattice() const { return lattice; }
+
+protected:
+    pLattice lattice;
+    unsigned int num_points;
+    const double* r;
+    const double* dr;
+
+    // r_power[k-1] = R^k
+    std::vector<const double*> r_power;
+};
+
 /** LatticeObserver is an abstract interface for any class that needs to observe changes in the size of a lattice.
     The lattice that is under observation is passed in the Alert() function, since in some cases the observer
     may not need to keep a pointer to the lattice, but just be registered with it.
@@ -152,15 +247,5 @@ inline void Lattice::Notify()
         observer->Alert();
 }
 
-inline const double* Lattice::Rpower(unsigned int k)
-{
-    if(k == 1)
-        return r.data();
-    if(k <= r_power.size()+1)
-        return r_power[k - 2].data();
-    else
-        return Calculate_Rpower(k);
-}
-
 }
 #endif
@@ -0,0 +1,266 @@
+#ifdef AMBIT_USE_MPI
+#include <mpi.h>
+#endif
+#include "Include.h"
+#include "Profiler.h"
+#include <vector>
+#ifdef AMBIT_USE_OPENMP
+#include <omp.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace Ambit
+{
+Profiler* Profiler::Instance()
+{
+    static Profiler instance;
+    return &instance;
+}
+
+void Profiler::AddTime(const std::string& phase, double seconds)
+{
+    double memory = PeakMemoryMB();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    PhaseRecord& record = phases[phase];
+    record.seconds += seconds;
+    record.calls++;
+    record.peak_memory_MB = mmax(record.peak_memory_MB, memory);
+}
+
+void Profiler::AddCount(const std::string& counter, unsigned long long count)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    counters[counter] += count;
+}
+
+ProfileCounter& Profiler::Counter(const std::string& counter)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<ProfileCounter>& frequent = frequent_counters[counter];
+    if(!frequent)
+        frequent.reset(new ProfileCounter());
+    return *frequent;
+}
+
+void Profiler::Reset()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    phases.clear();
+    counters.clear();
+    for(auto& pair: frequent_counters)
+        pair.second->Clear();
+}
+
+double Profiler::PeakMemoryMB()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+    #ifdef __APPLE__
+        return usage.ru_maxrss/(1024. * 1024.);     // bytes
+    #else
+        return usage.ru_maxrss/1024.;               // kilobytes
+    #endif
+    }
+#endif
+    return 0.;
+}
+
+double Profiler::PhysicalMemoryMB()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGE_SIZE);
+    if(pages > 0 && page_size > 0)
+        return double(pages) * double(page_size)/(1024. * 1024.);
+#endif
+    return 0.;
+}
+
+std::string Profiler::Serialise() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ostringstream ss;
+    ss << std::setprecision(12);
+
+    ss << "M\t" << PeakMemoryMB() << "\n";
+    for(const auto& pair: phases)
+        ss << "T\t" << pair.first << "\t" << pair.second.seconds << "\t" << pair.second.calls << "\t" << pair.second.peak_memory_MB << "\n";
+    std::map<std::string, unsigned long long> all_counters(counters);
+    for(const auto& pair: frequent_counters)
+    {   unsigned long long total = pair.second->Total();
+        if(total)
+            all_counters[pair.first] += total;
+    }
+    for(const auto& pair: all_counters)
+        ss << "C\t" << pair.first << "\t" << pair.second << "\n";
+
+    return ss.str();
+}
+
+unsigned int ProfileCounter::ThreadSlot()
+{
+    // Threads take slots in turn; more than NumSlots threads share slots (still correct, since adds are atomic)
+    static std::atomic<unsigned int> next_slot {0};
+    thread_local unsigned int slot = next_slot.fetch_add(1, std::memory_order_relaxed) % NumSlots;
+    return slot;
+}
+
+unsigned long long ProfileCounter::Total() const
+{
+    unsigned long long total = 0;
+    for(const Slot& slot: slots)
+        total += slot.count.load(std::memory_order_relaxed);
+    return total;
+}
+
+void ProfileCounter::Clear()
+{
+    for(Slot& slot: slots)
+        slot.count.store(0, std::memory_order_relaxed);
+}
+
+namespace
+{
+    std::string JSONString(const std::string& str)
+    {
+        std::string escaped = "\"";
+        for(char c: str)
+        {   if(c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped + "\"";
+    }
+}
+
+void Profiler::WriteReport(const std::string& filename, const Communicator& comm) const
+{
+    std::string mine = Serialise();
+
+    // Collect all processes' records on root
+    std::vector<std::string> all_records;
+#ifdef AMBIT_USE_MPI
+    int my_size = mine.size();
+    std::vector<int> sizes(comm.Size()), displacements(comm.Size(), 0);
+    MPI_Gather(&my_size, 1, MPI_INT, sizes.data(), 1, MPI_INT, 0, comm.Comm());
+
+    std::vector<char> buffer;
+    if(comm.Rank() == 0)
+    {   for(int proc = 1; proc < comm.Size(); proc++)
+            displacements[proc] = displacements[proc-1] + sizes[proc-1];
+        buffer.resize(displacements.back() + sizes.back());
+    }
+    MPI_Gatherv(mine.data(), my_size, MPI_CHAR, buffer.data(), sizes.data(), displacements.data(), MPI_CHAR, 0, comm.Comm());
+
+    if(comm.Rank() == 0)
+    {   for(int proc = 0; proc < comm.Size(); proc++)
+            all_records.emplace_back(buffer.data() + displacements[proc], sizes[proc]);
+    }
+#else
+    all_records.push_back(mine);
+#endif
+
+    if(comm.Rank() != 0)
+        return;
+
+    // Combine: seconds of each phase on each process, total calls, and largest memory
+    unsigned int num_processes = all_records.size();
+    std::map<std::string, std::vector<double>> seconds;
+    std::map<std::string, PhaseRecord> combined_phases;
+    std::map<std::string, unsigned long long> combined_counters;
+    double peak_memory = 0.;
+
+    for(unsigned int proc = 0; proc < num_processes; proc++)
+    {
+        std::istringstream records(all_records[proc]);
+        std::string line;
+        while(std::getline(records, line))
+        {
+            std::vector<std::string> fields;
+            std::istringstream line_stream(line);
+            std::string field;
+            while(std::getline(line_stream, field, '\t'))
+                fields.push_back(field);
+
+            if(fields.empty())
+                continue;
+            else if(fields[0] == "M")
+                peak_memory = mmax(peak_memory, std::stod(fields[1]));
+            else if(fields[0] == "T")
+            {   auto& proc_seconds = seconds[fields[1]];
+                proc_seconds.resize(num_processes, 0.);
+                proc_seconds[proc] = std::stod(fields[2]);
+
+                PhaseRecord& record = combined_phases[fields[1]];
+                record.seconds += proc_seconds[proc];
+                record.calls += std::stoull(fields[3]);
+                record.peak_memory_MB = mmax(record.peak_memory_MB, std::stod(fields[4]));
+            }
+            else if(fields[0] == "C")
+                combined_counters[fields[1]] += std::stoull(fields[2]);
+        }
+    }
+
+    FILE* fp = file_err_handler->fopen(filename.c_str(), "w");
+    if(!fp)
+    {   *errstream << "Profiler: could not open " << filename << std::endl;
+        return;
+    }
+
+    std::ostringstream json;
+    json << std::setprecision(6);
+    json << "{\n";
+    json << "  \"processes\": " << num_processes << ",\n";
+#ifdef AMBIT_USE_OPENMP
+    json << "  \"threads\": " << omp_get_max_threads() << ",\n";
+#else
+    json << "  \"threads\": 1,\n";
+#endif
+    json << "  \"peak_memory_MB\": " << peak_memory << ",\n";
+
+    // Phases: imbalance is the slowest process relative to the mean
+    json << "  \"phases\": {";
+    bool first = true;
+    for(const auto& pair: combined_phases)
+    {
+        const std::vector<double>& proc_seconds = seconds[pair.first];
+        double min_seconds = proc_seconds[0], max_seconds = proc_seconds[0];
+        for(double s: proc_seconds)
+        {   min_seconds = mmin(min_seconds, s);
+            max_seconds = mmax(max_seconds, s);
+        }
+        double mean_seconds = pair.second.seconds/num_processes;
+        double imbalance = (mean_seconds > 0.)? max_seconds/mean_seconds: 1.;
+
+        json << (first? "\n": ",\n");
+        json << "    " << JSONString(pair.first) << ": {"
+             << "\"calls\": " << pair.second.calls
+             << ", \"seconds\": {\"min\": " << min_seconds << ", \"mean\": " << mean_seconds << ", \"max\": " << max_seconds << "}"
+             << ", \"imbalance\": " << imbalance
+             << ", \"peak_memory_MB\": " << pair.second.peak_memory_MB << "}";
+        first = false;
+    }
+    json << "\n  },\n";
+
+    json << "  \"counters\": {";
+    first = true;
+    for(const auto& pair: combined_counters)
+    {
+        json << (first? "\n": ",\n");
+        json << "    " << JSONString(pair.first) << ": " << pair.second;
+        first = false;
+    }
+    json << "\n  }\n";
+    json << "}\n";
+
+    std::string report = json.str();
+    file_err_handler->fwrite(report.data(), sizeof(char), report.size(), fp);
+    file_err_handler->fclose(fp);
+}
+}
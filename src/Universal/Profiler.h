@@ -0,0 +1,137 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "Communicator.h"
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace Ambit
+{
+class ProfileCounter;
+
+/** Lightweight instrumentation of the main phases of a calculation, following the Singleton pattern.
+    When enabled, the Profiler accumulates
+        - time and number of calls for each named phase (see ProfileTimer),
+        - the memory high-water mark (peak resident set size) at the end of each phase,
+        - named counters (e.g. matrix elements evaluated, cache hits).
+    Times and counts from all OpenMP threads are added together. WriteReport() gathers results from all
+    MPI processes (of a Communicator) so that load imbalance between processes is visible, and writes them as JSON.
+    When disabled (the default) timers and counters do nothing but check Enabled().
+    Phases should be coarse (e.g. one matrix build, one matrix multiplication): inner loops should
+    count locally and call AddCount() once, or use a ProfileCounter from Counter().
+ */
+class Profiler
+{
+public:
+    static Profiler* Instance();
+
+    void Enable(bool enable = true) { enabled = enable; }
+    bool Enabled() const { return enabled; }
+
+    /** Add time spent in a phase and record memory high-water mark. Thread-safe. */
+    void AddTime(const std::string& phase, double seconds);
+
+    /** Add to named counter. Thread-safe. */
+    void AddCount(const std::string& counter, unsigned long long count);
+
+    /** Counter for events too frequent for AddCount() (e.g. integral lookups); it is reported with
+        the named counters. Calls with the same name return the same counter, which lives as long as the Profiler.
+     */
+    ProfileCounter& Counter(const std::string& counter);
+
+    /** Clear all timers and counters. */
+    void Reset();
+
+    /** Peak resident set size of this process in MB. */
+    static double PeakMemoryMB();
+
+    /** Physical memory of this machine (node) in MB, or 0 if unknown. */
+    static double PhysicalMemoryMB();
+
+    /** Gather timers and counters from the processes of comm and write JSON report to filename (root of comm only).
+        This uses MPI, so all processes of comm must call it together.
+     */
+    void WriteReport(const std::string& filename, const Communicator& comm = ProcessGroup) const;
+
+protected:
+    Profiler(): enabled(false) {}
+
+    struct PhaseRecord
+    {
+        double seconds = 0.;
+        unsigned long long calls = 0;
+        double peak_memory_MB = 0.;
+    };
+
+    /** Serialise this process's records as lines "T<tab>name<tab>seconds<tab>calls<tab>memory" and "C<tab>name<tab>count". */
+    std::string Serialise() const;
+
+protected:
+    bool enabled;
+    mutable std::mutex mutex;
+    std::map<std::string, PhaseRecord> phases;
+    std::map<std::string, unsigned long long> counters;
+    std::map<std::string, std::unique_ptr<ProfileCounter>> frequent_counters;
+};
+
+/** Count frequent events, such as lookups or cache hits in inner loops, without taking the Profiler's mutex.
+    Each thread adds to its own slot (on its own cache line); Profiler adds up the slots when reporting.
+    Does nothing if the Profiler is disabled. Get one from Profiler::Counter().
+ */
+class ProfileCounter
+{
+public:
+    ProfileCounter(): profiler(Profiler::Instance()) {}
+
+    void Add(unsigned long long count = 1)
+    {   if(profiler->Enabled())
+            slots[ThreadSlot()].count.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    unsigned long long Total() const;
+    void Clear();
+
+protected:
+    static unsigned int ThreadSlot();
+
+    static constexpr unsigned int NumSlots = 64;
+    struct alignas(64) Slot
+    {
+        std::atomic<unsigned long long> count {0};
+    };
+
+    const Profiler* profiler;
+    Slot slots[NumSlots];
+};
+
+/** Time the enclosing scope (or until Stop()) as a phase of Profiler. Does nothing if the Profiler is disabled. */
+class ProfileTimer
+{
+public:
+    ProfileTimer(const char* phase): phase(phase), active(Profiler::Instance()->Enabled())
+    {   if(active)
+            start = std::chrono::steady_clock::now();
+    }
+
+    ~ProfileTimer() { Stop(); }
+
+    void Stop()
+    {   if(active)
+        {   std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            Profiler::Instance()->AddTime(phase, elapsed.count());
+            active = false;
+        }
+    }
+
+protected:
+    const char* phase;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+};
+
+}
+#endif
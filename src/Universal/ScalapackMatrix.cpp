@@ -11,7 +11,6 @@
 #define USE_PDSYEVD false
 
 #if !(_FUS)
-    #define sl_init_        sl_init
     #define blacs_gridinfo_ blacs_gridinfo
     #define numroc_         numroc
     #define descinit_       descinit
@@ -32,7 +31,6 @@ const static int CSRC = 0;
 
 extern "C"{
 /** ScaLAPACK and BLACS routines */
-void sl_init_(int*, const int*, const int*);
 void blacs_gridinfo_(const int*, int*, int*, int*, int*);
 int  numroc_(const int*, const int*, const int*, const int*, const int*);
 void descinit_(int*, const int*, const int*, const int*, const int*, const int*, const int*,
@@ -44,28 +42,36 @@ void pdsyevd_(const char* JOBZ, const char* UPLO, const int* N, double* A, const
 void pdsyev_(const char* JOBZ, const char* UPLO, const int* N, double* A, const int* IA, const int* JA,
              const int* DESCA, double* W, double* Z, const int* IZ, const int* JZ, const int* DESCZ,
              double* WORK, const int* LWORK, int* INFO);
+
+/** C interface to BLACS, needed to make a process grid from an MPI communicator. */
+void Cblacs_pinfo(int* mypnum, int* nprocs);
+int  Csys2blacs_handle(MPI_Comm SysCtxt);
+void Cblacs_gridinit(int* ConTxt, const char* order, int nprow, int npcol);
 }
 
 namespace Ambit
 {
-ScalapackMatrix::ScalapackMatrix(unsigned int size):
-    Matrix()
+ScalapackMatrix::ScalapackMatrix(unsigned int size, const Communicator& communicator):
+    Matrix(), comm(communicator)
 {
     N = size;
 
     // Get number of processor rows and columns
-    num_proc_rows = (int)sqrt(double(NumProcessors));
-    num_proc_cols = NumProcessors/num_proc_rows;
+    num_proc_rows = (int)sqrt(double(comm.Size()));
+    num_proc_cols = comm.Size()/num_proc_rows;
 
-    while(num_proc_cols * num_proc_rows != NumProcessors)
+    while(num_proc_cols * num_proc_rows != comm.Size())
     {   num_proc_rows--;
-        num_proc_cols = NumProcessors/num_proc_rows;
+        num_proc_cols = comm.Size()/num_proc_rows;
     }
     if(DebugOptions.LogScalapack())
         *logstream << "ScalapackMatrix decomposition: " << num_proc_rows << " * " << num_proc_cols << std::endl;
 
-    // Initialise process grid
-    sl_init_(&ICTXT, &num_proc_rows, &num_proc_cols);
+    // Initialise process grid over the processes of comm
+    int blacs_rank, blacs_num_processes;
+    Cblacs_pinfo(&blacs_rank, &blacs_num_processes);
+    ICTXT = Csys2blacs_handle(comm.Comm());
+    Cblacs_gridinit(&ICTXT, "Row", num_proc_rows, num_proc_cols);
     blacs_gridinfo_(&ICTXT, &num_proc_rows, &num_proc_cols, &proc_row, &proc_col);
 
     // Get dimensions of local array
@@ -187,7 +193,7 @@ void ScalapackMatrix::MatrixMultiply(int m, double* b, double* c) const
 
         }
 
-        MPI_Allreduce(buffer, &c[k * N], N, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        MPI_Allreduce(buffer, &c[k * N], N, MPI_DOUBLE, MPI_SUM, comm.Comm());
     }
 }
 
@@ -217,7 +223,7 @@ void ScalapackMatrix::GetDiagonal(double* diag) const
         i++;
     }
 
-    MPI_Allreduce(buffer, diag, N, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(buffer, diag, N, MPI_DOUBLE, MPI_SUM, comm.Comm());
 
     delete[] buffer;
 }
@@ -374,7 +380,7 @@ void ScalapackMatrix::WriteToFile(const std::string& filename) const
     double* writebuf;
 
     FILE* fp;
-    if(ProcessorRank == 0)
+    if(comm.Rank() == 0)
     {
         fp = file_err_handler->fopen(filename.c_str(), "wb");
 
@@ -413,15 +419,15 @@ void ScalapackMatrix::WriteToFile(const std::string& filename) const
             M_j++;
         }
 
-        MPI_Reduce(buffer, writebuf, N, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce(buffer, writebuf, N, MPI_DOUBLE, MPI_SUM, 0, comm.Comm());
 
-        if(ProcessorRank == 0)
+        if(comm.Rank() == 0)
         {   file_err_handler->fwrite(writebuf, sizeof(double), N, fp);
         }
     }
 
     delete[] buffer;
-    if(ProcessorRank == 0)
+    if(comm.Rank() == 0)
     {   delete[] writebuf;
         file_err_handler->fclose(fp);
     }
@@ -526,7 +532,7 @@ void ScalapackMatrix::GetRow(unsigned int row_number, double* row) const
         }
     }
 
-    MPI_Allreduce(buffer, row, N, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(buffer, row, N, MPI_DOUBLE, MPI_SUM, comm.Comm());
 
     delete[] buffer;
 }
@@ -570,7 +576,7 @@ void ScalapackMatrix::GetColumn(unsigned int col_number, double* col) const
         }
     }
 
-    MPI_Allreduce(buffer, col, N, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(buffer, col, N, MPI_DOUBLE, MPI_SUM, comm.Comm());
 
     delete[] buffer;
 }
@@ -631,7 +637,7 @@ void ScalapackMatrix::GetColumns(unsigned int col_begin, unsigned int col_end, d
     if(DebugOptions.LogScalapack())
         *logstream << std::endl;
 
-    MPI_Allreduce(buffer, cols, N * num_cols, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(buffer, cols, N * num_cols, MPI_DOUBLE, MPI_SUM, comm.Comm());
 
     delete[] buffer;
 }
@@ -676,7 +682,7 @@ void ScalapackMatrix::TestEigenvalues(const double* eigenvalues, const double* V
             }
         }
 
-        MPI_Allreduce(buffer, column, N, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        MPI_Allreduce(buffer, column, N, MPI_DOUBLE, MPI_SUM, comm.Comm());
 
         // Mulitiply by M
         memset(MtimesV, 0, sizeof(double) * N);
@@ -2,17 +2,20 @@
 #define SCALAPACK_MATRIX_H
 
 #include "Matrix.h"
+#include "Communicator.h"
 
 namespace Ambit
 {
 /** Storage container for a matrix decomposed as per ScaLAPACK requirements.
     The entire matrix is stored in memory.
     The local array is stored in column-first (fortran style) format.
+    The matrix is distributed over the processes of a Communicator (default ProcessGroup), all of which
+    must take part in collective operations such as Diagonalise() and GetColumn().
  */
 class ScalapackMatrix: public Matrix
 {
 public:
-    ScalapackMatrix(unsigned int size);
+    ScalapackMatrix(unsigned int size, const Communicator& communicator = ProcessGroup);
     virtual ~ScalapackMatrix(void);
 
     virtual void MatrixMultiply(int m, double* b, double* c) const override;
@@ -74,6 +77,8 @@ protected:
     unsigned int* M_row_numbers;    // Index of row and column numbers in global array
     unsigned int* M_col_numbers;
 
+    Communicator comm;
+
     // ScaLAPACK variables
     int ICTXT;      // BLACS context identifying the created process grid
     int DESC[9];    // Array descriptor
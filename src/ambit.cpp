@@ -5,6 +5,8 @@
 #include "Atom/OutStreams.h"
 #include "gitInfo.h"
 #include "ambit.h"
+#include "Universal/Communicator.h"
+#include "Universal/Profiler.h"
 #include "Atom/Atom.h"
 #include "ExternalField/EJOperator.h"
 #include "ExternalField/Hyperfine.h"
@@ -67,6 +69,7 @@ int main(int argc, char* argv[])
         NumProcessors = 1;
         ProcessorRank = 0;
     #endif
+    SetProcessGroup(Communicator::World());
 
     // Set the file permissions so generated files can be read and written to by group, as well as user
     // (so AngularData files can be reused by different users) and register our custom signal handler
@@ -171,6 +174,10 @@ int main(int argc, char* argv[])
             }
         }
 
+        // Timers and counters for the main phases of the calculation
+        if(fileInput.search("--profile"))
+            Profiler::Instance()->Enable();
+
         Ambit::AmbitInterface ambit(fileInput, identifier);
         ambit.EnergyCalculations();
 
@@ -180,6 +187,9 @@ int main(int argc, char* argv[])
             ambit.Recombination();
             ambit.InternalConversion();
         }
+
+        if(Profiler::Instance()->Enabled())
+            Profiler::Instance()->WriteReport(identifier + ".profile.json", Communicator::World());
     }
     catch(std::bad_alloc& ba)
     {   *errstream << ba.what() << std::endl;
@@ -340,6 +350,20 @@ void AmbitInterface::EnergyCalculations()
 //            atom.WriteGraspMCDF();
 //    }
 
+    // Independent runs can be done at the same time by separate groups of processes
+    unsigned int num_groups = mmin((unsigned int)mmax(user_input("ConcurrentRuns", 1), 1), run_indexes.size());
+    num_groups = mmin(num_groups, (unsigned int)NumProcessors);
+    if(num_groups > 1 && user_input.search("CI/--scalapack"))
+    {   *outstream << "ConcurrentRuns cannot be used with CI/--scalapack: runs will be done one at a time.\n" << std::endl;
+        num_groups = 1;
+    }
+
+    if(num_groups > 1 && !user_input.search("--check-sizes") && !user_input.search(2, "--ci-complete", "--CI-complete"))
+    {
+        ConcurrentEnergyCalculations(num_groups);
+        return;
+    }
+
     // Generate Brueckner orbitals and MBPT integrals
     for(auto& atom: atoms)
         atom.MakeMBPTIntegrals();
@@ -360,8 +384,32 @@ void AmbitInterface::EnergyCalculations()
             atoms[i].ChooseHamiltoniansAndRead(angular_data_lib);
         }
 
+        // Symmetries solved at the same time on groups of processes: each run is done in turn
+        if(user_input.search("CI/--parallel-symmetries"))
+        {
+            std::vector<pHamiltonianID> keys(levels->begin(), levels->end());
+            for(unsigned int i = 0; i < run_indexes.size(); i++)
+            {
+                if(user_input.GetNumRuns() > 1)
+                {   user_input.SetRun(run_indexes[i]);
+                    user_input.PrintCurrentRunCondition(*outstream, "\n");
+                }
+                atoms[i].CalculateEnergies(keys);
+            }
+            return;
+        }
+
+        // Multiple runs share angular data, so they can generate their matrices together
+        // (holding all of them in memory at once)
+        bool together = (run_indexes.size() > 1) && user_input.search("CI/--runs-together");
+
         for(auto& key: levels->keys)
         {
+            if(together)
+            {   CalculateEnergiesTogether(key);
+                continue;
+            }
+
             for(int i = 0; i < run_indexes.size(); i++)
             {
                 // This if statement is just to switch off printing the run condition for only one run
@@ -375,6 +423,130 @@ void AmbitInterface::EnergyCalculations()
     }
 }
 
+void AmbitInterface::ConcurrentEnergyCalculations(unsigned int num_groups)
+{
+    // Divide processes into groups of (nearly) equal size; runs are dealt out to the groups in turn
+    Communicator world = Communicator::World();
+    auto group_of_rank = [&](int rank) { return (unsigned int)((long long)rank * num_groups/world.Size()); };
+    unsigned int my_group = group_of_rank(world.Rank());
+
+    *outstream << "Dividing " << run_indexes.size() << " runs between " << num_groups << " groups of processes.\n" << std::endl;
+    SetProcessGroup(world.Split(my_group));
+
+    // Output of each run is buffered on its group's root and printed in order when all runs are complete
+    std::vector<std::ostringstream> run_output(run_indexes.size());
+    std::ostream* stored_outstream = outstream;
+    pAngularDataLibrary angular_data_lib;
+
+    for(unsigned int i = my_group; i < run_indexes.size(); i += num_groups)
+    {
+        if(ProcessorRank == 0)
+            outstream = &run_output[i];
+
+        user_input.SetRun(run_indexes[i]);
+        user_input.PrintCurrentRunCondition(*outstream, "\n");
+
+        atoms[i].MakeMBPTIntegrals();
+        pLevelStore levels = atoms[i].ChooseHamiltoniansAndRead(angular_data_lib);
+        angular_data_lib = atoms[i].GetAngularDataLibrary();
+
+        atoms[i].CalculateEnergies(std::vector<pHamiltonianID>(levels->begin(), levels->end()));
+
+        outstream = stored_outstream;
+    }
+
+    SetProcessGroup(world);
+    world.Barrier();
+
+    for(unsigned int i = 0; i < run_indexes.size(); i++)
+    {
+        // Root of the group that did this run
+        int root = 0;
+        while(group_of_rank(root) != i % num_groups)
+            root++;
+
+        if(root == 0)
+        {   if(ProcessorRank == 0)
+                *outstream << run_output[i].str();
+        }
+    #ifdef AMBIT_USE_MPI
+        else if(ProcessorRank == 0)
+        {   int size;
+            MPI_Recv(&size, 1, MPI_INT, root, i, world.Comm(), MPI_STATUS_IGNORE);
+            std::string text(size, ' ');
+            MPI_Recv(&text[0], size, MPI_CHAR, root, i, world.Comm(), MPI_STATUS_IGNORE);
+            *outstream << text;
+        }
+        else if(ProcessorRank == root)
+        {   std::string text = run_output[i].str();
+            int size = text.size();
+            MPI_Send(&size, 1, MPI_INT, 0, i, world.Comm());
+            MPI_Send(text.data(), size, MPI_CHAR, 0, i, world.Comm());
+        }
+    #endif
+    }
+    *outstream << std::flush;
+
+    // All processes need the levels of the first run (e.g. for transitions)
+    if(first_run_index % num_groups != my_group)
+        atoms[first_run_index].ReadResults(angular_data_lib);
+}
+
+void AmbitInterface::CalculateEnergiesTogether(pHamiltonianID key)
+{
+    unsigned int num_runs = run_indexes.size();
+    std::vector<LevelVector> levelvecs(num_runs);
+    std::vector<unsigned int> num_solutions(num_runs);
+    std::vector<bool> do_CI(num_runs);
+    std::vector<std::unique_ptr<HamiltonianMatrix>> H(num_runs);
+
+    for(unsigned int i = 0; i < num_runs; i++)
+        do_CI[i] = atoms[i].PrepareCI(key, levelvecs[i], num_solutions[i]);
+
+    // Group runs with the same CSFs; each group shares a single configuration list
+    std::vector<bool> done(num_runs, false);
+    for(unsigned int i = 0; i < num_runs; i++)
+    {
+        if(!do_CI[i] || done[i])
+            continue;
+
+        std::vector<unsigned int> group(1, i);
+        for(unsigned int j = i+1; j < num_runs; j++)
+        {
+            if(do_CI[j] && !done[j] && levelvecs[j].configs->SameCSFs(*levelvecs[i].configs))
+            {   levelvecs[j].configs = levelvecs[i].configs;
+                group.push_back(j);
+            }
+        }
+
+        std::vector<HamiltonianMatrix*> matrices;
+        for(unsigned int run: group)
+        {
+            user_input.SetRun(run_indexes[run]);
+            user_input.PrintCurrentRunCondition(*outstream, "\n");
+            H[run] = atoms[run].MakeHamiltonian(levelvecs[run].configs);
+            *outstream << std::endl;
+
+            matrices.push_back(H[run].get());
+            done[run] = true;
+        }
+
+        HamiltonianMatrix::GenerateMatrices(matrices, user_input("CI/ChunkSize", 4));
+    }
+
+    for(unsigned int i = 0; i < num_runs; i++)
+    {
+        user_input.SetRun(run_indexes[i]);
+        user_input.PrintCurrentRunCondition(*outstream, "\n");
+
+        if(do_CI[i])
+        {   atoms[i].SolveHamiltonian(key, *H[i], levelvecs[i], num_solutions[i]);
+            H[i].reset();
+        }
+        atoms[i].FinishLevels(key, levelvecs[i]);
+    }
+}
+
 // Used below to run all transition types. Can only be used if they have constructor
 //      TransitionCalculatorType(user_input, atom)
 #define RUN_AND_STORE_TRANSITION(id, TRANSITION_CALCULATOR_TYPE) \
@@ -391,6 +563,7 @@ do { \
 
 void AmbitInterface::TransitionCalculations()
 {
+    ProfileTimer timer("Transitions");
     Atom& atom = atoms[first_run_index];
 
     // EM types
@@ -446,6 +619,7 @@ void AmbitInterface::TransitionCalculations()
 
 void AmbitInterface::Recombination()
 {
+    ProfileTimer timer("Recombination");
     std::string target_file = user_input("DR/Target/Filename", "");
     if(target_file.length() == 0)
         return;
@@ -511,6 +685,7 @@ void AmbitInterface::Recombination()
 
 void AmbitInterface::InternalConversion()
 {
+    ProfileTimer timer("InternalConversion");
     std::string source_file = user_input("IC/Source/Filename", "");
     if(source_file.length() == 0)
         return;
@@ -20,6 +20,20 @@ public:
 
     static void PrintHelp(const std::string& ApplicationName);
 
+protected:
+    /** Calculate levels for key in all runs. Runs that need CI and have the same configurations generate
+        their Hamiltonian matrices in a single sweep (HamiltonianMatrix::GenerateMatrices()).
+     */
+    void CalculateEnergiesTogether(pHamiltonianID key);
+
+    /** Divide processes into num_groups groups, each of which calculates levels for a subset of the runs
+        (from MBPT integrals onwards). Output is printed in order of runs when all groups have finished.
+        PRE: all atoms have a basis.
+     */
+    void ConcurrentEnergyCalculations(unsigned int num_groups);
+
+public:
+
     std::string identifier;
     MultirunOptions& user_input;
 
@@ -0,0 +1,814 @@
+// Auto-generated source/build information.
+#define GIT_LAST_TAG ""
+#define GIT_SOURCE_DESCRIPTION "master 2b7d8ab"
+#define COMPILE_DATE "Mon Oct 19 05:18:19 UTC 2026"
+#define GIT_DIFF_OUTPUT "diff --git a/doc/UserGuide/user_guide.tex b/doc/UserGuide/user_guide.tex\n\
+index 7cf7..55a3 100644\n\
+--- a/doc/UserGuide/user_guide.tex\n\
++++ b/doc/UserGuide/user_guide.tex\n\
+@@ -1574,8 +1574,8 @@ it in full.\n\
+ \\texttt{--profile}\n\
+ \\begin{adjustwidth}{1cm}{}\n\
+ Time the main phases of the calculation (angular data, integrals, MBPT, building and diagonalising the\n\
+-CI matrix, transitions) and count matrix elements evaluated, angular data library hits and Davidson\n\
+-iterations. At the end of the run the times, counts and peak memory use of each phase, combined over all\n\
++CI matrix, transitions) and count matrix elements evaluated, angular data library hits, Slater and\n\
++core-valence integral lookups, $\\Sigma_3$ cache hits and Davidson iterations. At the end of the run the times, counts and peak memory use of each phase, combined over all\n\
+ threads and MPI processes, are written to \\texttt{<ID>.profile.json}. The ``imbalance'' of each phase is\n\
+ the time of the slowest process divided by the mean over processes, and \\texttt{Davidson/MPI wait}\n\
+ measures time spent waiting for other processes during diagonalisation. Without this option the timers\n\
+diff --git a/src/Configuration/HamiltonianMatrix.cpp b/src/Configuration/HamiltonianMatrix.cpp\n\
+index 7e78..854c 100644\n\
+--- a/src/Configuration/HamiltonianMatrix.cpp\n\
++++ b/src/Configuration/HamiltonianMatrix.cpp\n\
+@@ -772,17 +772,17 @@ LevelVector HamiltonianMatrix::SolveMatrixScalapack(pHamiltonianID hID, unsigned\n\
+     {   *outstream << \"; Finding solutions using ScaLAPACK ...\" << std::endl;\n\
+ \n\
+         // Write temporary matrix file, clear current Hamiltonian to make space,\n\
+-        // then read in to ScalapackMatrix\n\
++        // then read in to ScalapackMatrix (named by symmetry since groups of processes may be solving others)\n\
+         char* jobid = getenv(\"PBS_JOBID\");\n\
+         std::string filename = \"temp\";\n\
+         if(jobid)\n\
+             filename += jobid;\n\
+-        filename += \".matrix\";\n\
++        filename += \".\" + hID->Name() + \".matrix\";\n\
+ \n\
+         Write(filename);\n\
+         Clear();\n\
+ \n\
+-        ScalapackMatrix SM(N);\n\
++        ScalapackMatrix SM(N, comm);\n\
+         SM.ReadLowerTriangle(filename);\n\
+ \n\
+         // Diagonalise\n\
+diff --git a/src/ExternalField/EJOperator.cpp b/src/ExternalField/EJOperator.cpp\n\
+index 00d2..c394 100644\n\
+--- a/src/ExternalField/EJOperator.cpp\n\
++++ b/src/ExternalField/EJOperator.cpp\n\
+@@ -191,7 +191,7 @@ EMCalculator::EMCalculator(MultipolarityType type, int J, MultirunOptions& user_\n\
+     if(user_input.search(\"--rpa\"))\n\
+     {\n\
+         auto op_rpa = MakeRPA(std::static_pointer_cast<TimeDependentSpinorOperator>(op), hf, atom.GetHartreeY());\n\
+-        double scale = user_input(\"RPA/Scale\", 0.01);\n\
++        scale = user_input(\"RPA/Scale\", 0.01);\n\
+         op_rpa->SetScale(scale);\n\
+         op = op_rpa;\n\
+     }\n\
+@@ -227,24 +227,20 @@ void EMCalculator::PrintTransition(const LevelID& left, const LevelID& right, do\n\
+     int twoj2 = right.first->GetTwoJ();\n\
+     double value = matrix_element/math->Electron3j(twoj2, twoj1, J, twoj2, -twoj1);\n\
+ \n\
+-    double scale = 1.;\n\
+-    pRPAOperator rpa = std::dynamic_pointer_cast<RPAOperator>(op);\n\
+-    if(rpa)\n\
+-        scale = rpa->GetScale();\n\
+-\n\
+     // Read over the user input to see if we need to print the reduced matrix\n\
+     // elements or the transition line strengths\n\
+     if(user_input.search(\"--reduced-elements\"))\n\
+     {\n\
+         *outstream << \"  \" << Ambit::Name(left) << \" -> \" << Ambit::Name(right)\n\
+-                   << \" = \" << std::setprecision(6) << value/scale << std::endl;\n\
++                   << \" = \" << std::setprecision(6) << value << std::endl;\n\
+     }\n\
+     else\n\
+     {\n\
+         *outstream << \"  \" << Ambit::Name(left) << \" -> \" << Ambit::Name(right)\n\
+-                   << \" = \" << std::setprecision(6) << gsl_pow_2(value/scale) << std::endl;\n\
++                   << \" = \" << std::setprecision(6) << gsl_pow_2(value) << std::endl;\n\
+     }\n\
+ \n\
++    pRPAOperator rpa = std::dynamic_pointer_cast<RPAOperator>(op);\n\
+     if(rpa && user_input.search(\"RPA/--print-field\"))\n\
+     {\n\
+         auto fp = fopen(\"RPAField.txt\", \"wt\");\n\
+diff --git a/src/ExternalField/Transitions.cpp b/src/ExternalField/Transitions.cpp\n\
+index a0bb..a6f7 100644\n\
+--- a/src/ExternalField/Transitions.cpp\n\
++++ b/src/ExternalField/Transitions.cpp\n\
+@@ -54,19 +54,19 @@ void TransitionCalculator::CalculateAndPrint()\n\
+                 if(TransitionExists((*left_it)->GetSymmetry(), (*right_it)->GetSymmetry()))\n\
+                 {\n\
+                     LevelVector left_vec = levels->GetLevels(*left_it);\n\
+-                    for(int i = 0; i < left_vec.levels.size(); i++)\n\
++                    for(unsigned int i = 0; i < left_vec.levels.size(); i++)\n\
+                     {\n\
+                         if(left_vec.levels[i]->GetEnergy() > max_energy)\n\
+                             break;\n\
+ \n\
+                         LevelVector right_vec = levels->GetLevels(*right_it);\n\
+-                        for(int j = 0; j < right_vec.levels.size(); j++)\n\
++                        for(unsigned int j = 0; j < right_vec.levels.size(); j++)\n\
+                         {\n\
+                             if(right_vec.levels[j]->GetEnergy() > max_energy)\n\
+                                 break;\n\
+ \n\
+                             found_one = true;\n\
+-                            requested.push_back(std::make_pair(std::make_pair(*left_it, i), std::make_pair(*right_it, j)));\n\
++                            requested.push_back(std::make_pair(std::make_pair(*left_it, int(i)), std::make_pair(*right_it, int(j))));\n\
+                         }\n\
+                     }\n\
+                 }\n\
+@@ -246,8 +246,6 @@ double TransitionCalculator::CalculateTransition(const LevelID& left, const Leve\n\
+         if(found_it != matrix_elements.end())\n\
+         {\n\
+             return_value = found_it->second;\n\
+-            if(unprinted_frequency_transitions.erase(id))\n\
+-                return_value *= scale;\n\
+         }\n\
+         else\n\
+         {   // Get levels\n\
+@@ -279,8 +277,8 @@ double TransitionCalculator::CalculateTransition(const LevelID& left, const Leve\n\
+                 std::vector<double> values = density->GetMatrixElement(*integrals);\n\
+ \n\
+                 // Add to matrix_elements map\n\
+-                return_value = values[left.second * right_levels.levels.size() + right.second];\n\
+-                matrix_elements.insert(std::make_pair(id, return_value/scale));\n\
++                return_value = values[left.second * right_levels.levels.size() + right.second]/scale;\n\
++                matrix_elements.insert(std::make_pair(id, return_value));\n\
+             }\n\
+             else\n\
+             {   // Get transition integrals\n\
+@@ -416,7 +414,7 @@ void TransitionCalculator::CalculateTransitionsByFrequency(const std::vector<Tra\n\
+         // Missing levels are reported by CalculateTransition()\n\
+         const LevelVector& left_levels = get_levels(left.first);\n\
+         const LevelVector& right_levels = get_levels(right.first);\n\
+-        if(left_levels.levels.size() <= left.second || right_levels.levels.size() <= right.second)\n\
++        if(left_levels.levels.size() <= unsigned(left.second) || right_levels.levels.size() <= unsigned(right.second))\n\
+             continue;\n\
+ \n\
+         FrequencyTransition planned_transition;\n\
+@@ -432,9 +430,7 @@ void TransitionCalculator::CalculateTransitionsByFrequency(const std::vector<Tra\n\
+     CalculateByFrequency(planned);\n\
+ \n\
+     for(const auto& transition: planned)\n\
+-    {   matrix_elements.insert(std::make_pair(transition.id, transition.value/scale));\n\
+-        unprinted_frequency_transitions.insert(transition.id);\n\
+-    }\n\
++        matrix_elements.insert(std::make_pair(transition.id, transition.value));\n\
+ }\n\
+ \n\
+ std::vector<std::pair<double, double>> TransitionCalculator::FrequencyGroups(std::vector<double> frequencies) const\n\
+@@ -546,6 +542,10 @@ void TransitionCalculator::CalculateByFrequency(std::vector<FrequencyTransition>\n\
+                 it->value = get_matrix_element(contracted, *it);\n\
+         }\n\
+ \n\
++        // Integrals are scaled\n\
++        for(auto it = group_start; it != group_end; it++)\n\
++            it->value /= scale;\n\
++\n\
+         group_start = group_end;\n\
+     }\n\
+ }\n\
+@@ -654,7 +654,7 @@ void TransitionCalculator::CalculateAllLines(const std::string& filename, bool b\n\
+                     else\n\
+                     {   std::vector<double> values = density->GetMatrixElement(*integrals);\n\
+                         for(auto& transition: block)\n\
+-                            transition.value = values[transition.index];\n\
++                            transition.value = values[transition.index]/scale;\n\
+                     }\n\
+ \n\
+                     for(const auto& transition: block)\n\
+@@ -665,7 +665,7 @@ void TransitionCalculator::CalculateAllLines(const std::string& filename, bool b\n\
+                         const Level& right_level = *right_levels.levels[right.second];\n\
+ \n\
+                         quantities.clear();\n\
+-                        LineQuantities(left, left_level, right, right_level, transition.value/scale, quantities);\n\
++                        LineQuantities(left, left_level, right, right_level, transition.value, quantities);\n\
+                         num_lines++;\n\
+ \n\
+                         if(!fp)\n\
+diff --git a/src/ExternalField/Transitions.h b/src/ExternalField/Transitions.h\n\
+index de05..4f5b 100644\n\
+--- a/src/ExternalField/Transitions.h\n\
++++ b/src/ExternalField/Transitions.h\n\
+@@ -59,7 +59,7 @@ protected:\n\
+     /** Print the header line to outstream, explaining transition type, units, etc. */\n\
+     virtual void PrintHeader() const = 0;\n\
+ \n\
+-    /** Print a line for the transition to outstream. */\n\
++    /** Print a line for the transition to outstream. matrix_element is not scaled (it is divided by scale). */\n\
+     virtual void PrintTransition(const LevelID& left, const LevelID& right, double matrix_element) const = 0;\n\
+ \n\
+ protected:\n\
+@@ -114,7 +114,7 @@ protected:\n\
+     void CalculateTransitionsByFrequency(const std::vector<TransitionID>& transitions);\n\
+ \n\
+     /** A transition to be calculated at a given frequency: element index of density.\n\
+-        value is the (unscaled) matrix element.\n\
++        value is the matrix element, not scaled (as stored in matrix_elements).\n\
+      */\n\
+     struct FrequencyTransition\n\
+     {\n\
+@@ -186,11 +186,6 @@ protected:\n\
+     double scale;\n\
+     pTransitionIntegrals integrals;     // Scaled one-electron integrals\n\
+     std::map<TransitionID, double> matrix_elements; // Not scaled\n\
+-\n\
+-    /** Transitions added by CalculateTransitionsByFrequency() that have not been requested yet.\n\
+-        The first request prints the scaled value, as when they are calculated one at a time.\n\
+-     */\n\
+-    std::set<TransitionID> unprinted_frequency_transitions;\n\
+ };\n\
+ \n\
+ }\n\
+diff --git a/src/MBPT/CoreValenceIntegrals.cpp b/src/MBPT/CoreValenceIntegrals.cpp\n\
+index cdfe..be3b 100644\n\
+--- a/src/MBPT/CoreValenceIntegrals.cpp\n\
++++ b/src/MBPT/CoreValenceIntegrals.cpp\n\
+@@ -22,6 +22,7 @@ CoreValenceIntegrals<MapType>::CoreValenceIntegrals(pOrbitalManagerConst orbital\n\
+     include_core(true), include_core_subtraction(true), include_core_extra_box(true),\n\
+     include_valence(false), include_valence_subtraction(false), include_valence_extra_box(false), comm(ProcessGroup)\n\
+ {\n\
++    this->lookup_counter = &Profiler::Instance()->Counter(\"core-valence integral lookups\");\n\
+     core_PT.reset(new CoreMBPTCalculator(this->orbitals, one_body, bare_integrals));\n\
+     valence_PT.reset(new ValenceMBPTCalculator(this->orbitals, one_body, bare_integrals));\n\
+ }\n\
+@@ -33,6 +34,7 @@ CoreValenceIntegrals<MapType>::CoreValenceIntegrals(pOrbitalManagerConst orbital\n\
+     include_core(false), include_core_subtraction(false), include_core_extra_box(false),\n\
+     include_valence(false), include_valence_subtraction(false), include_valence_extra_box(false), comm(ProcessGroup)\n\
+ {\n\
++    this->lookup_counter = &Profiler::Instance()->Counter(\"core-valence integral lookups\");\n\
+     if(core_PT)\n\
+     {   include_core = true;\n\
+         include_core_subtraction = true;\n\
+diff --git a/src/MBPT/Sigma3Calculator.cpp b/src/MBPT/Sigma3Calculator.cpp\n\
+index d1d3..f546 100644\n\
+--- a/src/MBPT/Sigma3Calculator.cpp\n\
++++ b/src/MBPT/Sigma3Calculator.cpp\n\
+@@ -10,6 +10,8 @@ Sigma3Calculator::Sigma3Calculator(pOrbitalManagerConst orbitals, pSlaterIntegra\n\
+     include_core(true), deep(orbitals->deep), high(orbitals->high)\n\
+ {\n\
+     SetCacheSize(1000000);\n\
++    cache_hits = &Profiler::Instance()->Counter(\"Sigma3 cache hits\");\n\
++    cache_misses = &Profiler::Instance()->Counter(\"Sigma3 cache misses\");\n\
+ }\n\
+ \n\
+ Sigma3Calculator::~Sigma3Calculator(void)\n\
+@@ -118,9 +120,12 @@ double Sigma3Calculator::GetMatrixElement(const ElectronInfo& e1, const Electron\n\
+     {   std::lock_guard<std::mutex> lock(shard.mutex);\n\
+         auto it = shard.values.find(key);\n\
+         if(it != shard.values.end())\n\
++        {   cache_hits->Add();\n\
+             return it->second;\n\
+         }\n\
++    }\n\
+ \n\
++    cache_misses->Add();\n\
+     double value = SumLinePermutations(*pairs[0].left, *pairs[1].left, *pairs[2].left, *pairs[0].right, *pairs[1].right, *pairs[2].right);\n\
+ \n\
+     // Keep it while there is room\n\
+diff --git a/src/MBPT/Sigma3Calculator.h b/src/MBPT/Sigma3Calculator.h\n\
+index 63f1..17cd 100644\n\
+--- a/src/MBPT/Sigma3Calculator.h\n\
++++ b/src/MBPT/Sigma3Calculator.h\n\
+@@ -96,6 +96,8 @@ protected:\n\
+     };\n\
+     mutable std::array<CacheShard, NumCacheShards> cache;\n\
+     unsigned int cache_shard_size;  //!< Maximum entries per shard\n\
++    ProfileCounter* cache_hits;\n\
++    ProfileCounter* cache_misses;\n\
+ \n\
+     bool include_core;\n\
+     bool include_valence;\n\
+diff --git a/src/MBPT/SlaterIntegrals.cpp b/src/MBPT/SlaterIntegrals.cpp\n\
+index b1c0..4a83 100644\n\
+--- a/src/MBPT/SlaterIntegrals.cpp\n\
++++ b/src/MBPT/SlaterIntegrals.cpp\n\
+@@ -14,6 +14,7 @@ SlaterIntegrals<MapType>::SlaterIntegrals(pOrbitalManagerConst orbitals, bool tw\n\
+     SlaterIntegralsInterface(orbitals, two_body_reverse_symmetry_exists)\n\
+ {\n\
+     NumStates = orbitals->size();\n\
++    lookup_counter = &Profiler::Instance()->Counter(\"Slater integral lookups\");\n\
+ }\n\
+ \n\
+ template <class MapType>\n\
+@@ -21,6 +22,7 @@ SlaterIntegrals<MapType>::SlaterIntegrals(pOrbitalManagerConst orbitals, pHartre\n\
+     SlaterIntegralsInterface(orbitals, two_body_reverse_symmetry_exists), hartreeY_operator(hartreeY_op)\n\
+ {\n\
+     NumStates = orbitals->size();\n\
++    lookup_counter = &Profiler::Instance()->Counter(\"Slater integral lookups\");\n\
+ }\n\
+ \n\
+ template <class MapType>\n\
+@@ -28,6 +30,7 @@ SlaterIntegrals<MapType>::SlaterIntegrals(pOrbitalManagerConst orbitals, pHartre\n\
+     SlaterIntegralsInterface(orbitals, hartreeY_op->ReverseSymmetryExists()), hartreeY_operator(hartreeY_op)\n\
+ {\n\
+     NumStates = orbitals->size();\n\
++    lookup_counter = &Profiler::Instance()->Counter(\"Slater integral lookups\");\n\
+ }\n\
+ \n\
+ template <class MapType>\n\
+@@ -220,6 +223,7 @@ double SlaterIntegrals<MapType>::GetTwoElectronIntegral(unsigned int k, const Or\n\
+     KeyType key = GetKey(k, i1, i2, i3, i4);\n\
+     double radial = 0.;\n\
+ \n\
++    lookup_counter->Add();\n\
+     auto it = TwoElectronIntegrals.find(key);\n\
+     if(it != TwoElectronIntegrals.end())\n\
+     {\n\
+diff --git a/src/MBPT/SlaterIntegrals.h b/src/MBPT/SlaterIntegrals.h\n\
+index 032a..f102 100644\n\
+--- a/src/MBPT/SlaterIntegrals.h\n\
++++ b/src/MBPT/SlaterIntegrals.h\n\
+@@ -3,6 +3,7 @@\n\
+ \n\
+ #include \"Basis/OrbitalManager.h\"\n\
+ #include \"HartreeFock/HartreeY.h\"\n\
++#include \"Universal/Profiler.h\"\n\
+ #include <map>\n\
+ #include <unordered_map>\n\
+ #include <absl/container/flat_hash_map.h>\n\
+@@ -147,6 +148,9 @@ protected:\n\
+ \n\
+     // TwoElectronIntegrals(k, i, j, l, m) = R_k(ij, lm): i->l, j->m\n\
+     MapType TwoElectronIntegrals;\n\
++\n\
++    /** Profile counter of GetTwoElectronIntegral() lookups. */\n\
++    ProfileCounter* lookup_counter;\n\
+ };\n\
+ \n\
+ typedef SlaterIntegrals<std::map<unsigned long long int, double>> SlaterIntegralsMap;\n\
+diff --git a/src/Universal/Profiler.cpp b/src/Universal/Profiler.cpp\n\
+index f184..4cc4 100644\n\
+--- a/src/Universal/Profiler.cpp\n\
++++ b/src/Universal/Profiler.cpp\n\
+@@ -37,11 +37,22 @@ void Profiler::AddCount(const std::string& counter, unsigned long long count)\n\
+     counters[counter] += count;\n\
+ }\n\
+ \n\
++ProfileCounter& Profiler::Counter(const std::string& counter)\n\
++{\n\
++    std::lock_guard<std::mutex> lock(mutex);\n\
++    std::unique_ptr<ProfileCounter>& frequent = frequent_counters[counter];\n\
++    if(!frequent)\n\
++        frequent.reset(new ProfileCounter());\n\
++    return *frequent;\n\
++}\n\
++\n\
+ void Profiler::Reset()\n\
+ {\n\
+     std::lock_guard<std::mutex> lock(mutex);\n\
+     phases.clear();\n\
+     counters.clear();\n\
++    for(auto& pair: frequent_counters)\n\
++        pair.second->Clear();\n\
+ }\n\
+ \n\
+ double Profiler::PeakMemoryMB()\n\
+@@ -80,12 +91,40 @@ std::string Profiler::Serialise() const\n\
+     ss << \"M\\t\" << PeakMemoryMB() << \"\\n\";\n\
+     for(const auto& pair: phases)\n\
+         ss << \"T\\t\" << pair.first << \"\\t\" << pair.second.seconds << \"\\t\" << pair.second.calls << \"\\t\" << pair.second.peak_memory_MB << \"\\n\";\n\
+-    for(const auto& pair: counters)\n\
++    std::map<std::string, unsigned long long> all_counters(counters);\n\
++    for(const auto& pair: frequent_counters)\n\
++    {   unsigned long long total = pair.second->Total();\n\
++        if(total)\n\
++            all_counters[pair.first] += total;\n\
++    }\n\
++    for(const auto& pair: all_counters)\n\
+         ss << \"C\\t\" << pair.first << \"\\t\" << pair.second << \"\\n\";\n\
+ \n\
+     return ss.str();\n\
+ }\n\
+ \n\
++unsigned int ProfileCounter::ThreadSlot()\n\
++{\n\
++    // Threads take slots in turn; more than NumSlots threads share slots (still correct, since adds are atomic)\n\
++    static std::atomic<unsigned int> next_slot {0};\n\
++    thread_local unsigned int slot = next_slot.fetch_add(1, std::memory_order_relaxed) % NumSlots;\n\
++    return slot;\n\
++}\n\
++\n\
++unsigned long long ProfileCounter::Total() const\n\
++{\n\
++    unsigned long long total = 0;\n\
++    for(const Slot& slot: slots)\n\
++        total += slot.count.load(std::memory_order_relaxed);\n\
++    return total;\n\
++}\n\
++\n\
++void ProfileCounter::Clear()\n\
++{\n\
++    for(Slot& slot: slots)\n\
++        slot.count.store(0, std::memory_order_relaxed);\n\
++}\n\
++\n\
+ namespace\n\
+ {\n\
+     std::string JSONString(const std::string& str)\n\
+@@ -100,7 +139,7 @@ namespace\n\
+     }\n\
+ }\n\
+ \n\
+-void Profiler::WriteReport(const std::string& filename) const\n\
++void Profiler::WriteReport(const std::string& filename, const Communicator& comm) const\n\
+ {\n\
+     std::string mine = Serialise();\n\
+ \n\
+@@ -108,26 +147,26 @@ void Profiler::WriteReport(const std::string& filename) const\n\
+     std::vector<std::string> all_records;\n\
+ #ifdef AMBIT_USE_MPI\n\
+     int my_size = mine.size();\n\
+-    std::vector<int> sizes(NumProcessors), displacements(NumProcessors, 0);\n\
+-    MPI_Gather(&my_size, 1, MPI_INT, sizes.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);\n\
++    std::vector<int> sizes(comm.Size()), displacements(comm.Size(), 0);\n\
++    MPI_Gather(&my_size, 1, MPI_INT, sizes.data(), 1, MPI_INT, 0, comm.Comm());\n\
+ \n\
+     std::vector<char> buffer;\n\
+-    if(ProcessorRank == 0)\n\
+-    {   for(int proc = 1; proc < NumProcessors; proc++)\n\
++    if(comm.Rank() == 0)\n\
++    {   for(int proc = 1; proc < comm.Size(); proc++)\n\
+             displacements[proc] = displacements[proc-1] + sizes[proc-1];\n\
+         buffer.resize(displacements.back() + sizes.back());\n\
+     }\n\
+-    MPI_Gatherv(mine.data(), my_size, MPI_CHAR, buffer.data(), sizes.data(), displacements.data(), MPI_CHAR, 0, MPI_COMM_WORLD);\n\
++    MPI_Gatherv(mine.data(), my_size, MPI_CHAR, buffer.data(), sizes.data(), displacements.data(), MPI_CHAR, 0, comm.Comm());\n\
+ \n\
+-    if(ProcessorRank == 0)\n\
+-    {   for(int proc = 0; proc < NumProcessors; proc++)\n\
++    if(comm.Rank() == 0)\n\
++    {   for(int proc = 0; proc < comm.Size(); proc++)\n\
+             all_records.emplace_back(buffer.data() + displacements[proc], sizes[proc]);\n\
+     }\n\
+ #else\n\
+     all_records.push_back(mine);\n\
+ #endif\n\
+ \n\
+-    if(ProcessorRank != 0)\n\
++    if(comm.Rank() != 0)\n\
+         return;\n\
+ \n\
+     // Combine: seconds of each phase on each process, total calls, and largest memory\n\
+diff --git a/src/Universal/Profiler.h b/src/Universal/Profiler.h\n\
+index 9040..22c3 100644\n\
+--- a/src/Universal/Profiler.h\n\
++++ b/src/Universal/Profiler.h\n\
+@@ -1,23 +1,28 @@\n\
+ #ifndef PROFILER_H\n\
+ #define PROFILER_H\n\
+ \n\
++#include \"Communicator.h\"\n\
++#include <atomic>\n\
+ #include <chrono>\n\
+ #include <map>\n\
++#include <memory>\n\
+ #include <mutex>\n\
+ #include <string>\n\
+ \n\
+ namespace Ambit\n\
+ {\n\
++class ProfileCounter;\n\
++\n\
+ /** Lightweight instrumentation of the main phases of a calculation, following the Singleton pattern.\n\
+     When enabled, the Profiler accumulates\n\
+         - time and number of calls for each named phase (see ProfileTimer),\n\
+         - the memory high-water mark (peak resident set size) at the end of each phase,\n\
+         - named counters (e.g. matrix elements evaluated, cache hits).\n\
+     Times and counts from all OpenMP threads are added together. WriteReport() gathers results from all\n\
+-    MPI processes so that load imbalance between processes is visible, and writes them as JSON.\n\
++    MPI processes (of a Communicator) so that load imbalance between processes is visible, and writes them as JSON.\n\
+     When disabled (the default) timers and counters do nothing but check Enabled().\n\
+     Phases should be coarse (e.g. one matrix build, one matrix multiplication): inner loops should\n\
+-    count locally and call AddCount() once.\n\
++    count locally and call AddCount() once, or use a ProfileCounter from Counter().\n\
+  */\n\
+ class Profiler\n\
+ {\n\
+@@ -33,6 +38,11 @@ public:\n\
+     /** Add to named counter. Thread-safe. */\n\
+     void AddCount(const std::string& counter, unsigned long long count);\n\
+ \n\
++    /** Counter for events too frequent for AddCount() (e.g. integral lookups); it is reported with\n\
++        the named counters. Calls with the same name return the same counter, which lives as long as the Profiler.\n\
++     */\n\
++    ProfileCounter& Counter(const std::string& counter);\n\
++\n\
+     /** Clear all timers and counters. */\n\
+     void Reset();\n\
+ \n\
+@@ -42,10 +52,10 @@ public:\n\
+     /** Physical memory of this machine (node) in MB, or 0 if unknown. */\n\
+     static double PhysicalMemoryMB();\n\
+ \n\
+-    /** Gather timers and counters from all processes and write JSON report to filename (root process only).\n\
+-        This uses MPI, so all processes must call it together.\n\
++    /** Gather timers and counters from the processes of comm and write JSON report to filename (root of comm only).\n\
++        This uses MPI, so all processes of comm must call it together.\n\
+      */\n\
+-    void WriteReport(const std::string& filename) const;\n\
++    void WriteReport(const std::string& filename, const Communicator& comm = ProcessGroup) const;\n\
+ \n\
+ protected:\n\
+     Profiler(): enabled(false) {}\n\
+@@ -65,6 +75,37 @@ protected:\n\
+     mutable std::mutex mutex;\n\
+     std::map<std::string, PhaseRecord> phases;\n\
+     std::map<std::string, unsigned long long> counters;\n\
++    std::map<std::string, std::unique_ptr<ProfileCounter>> frequent_counters;\n\
++};\n\
++\n\
++/** Count frequent events, such as lookups or cache hits in inner loops, without taking the Profiler's mutex.\n\
++    Each thread adds to its own slot (on its own cache line); Profiler adds up the slots when reporting.\n\
++    Does nothing if the Profiler is disabled. Get one from Profiler::Counter().\n\
++ */\n\
++class ProfileCounter\n\
++{\n\
++public:\n\
++    ProfileCounter(): profiler(Profiler::Instance()) {}\n\
++\n\
++    void Add(unsigned long long count = 1)\n\
++    {   if(profiler->Enabled())\n\
++            slots[ThreadSlot()].count.fetch_add(count, std::memory_order_relaxed);\n\
++    }\n\
++\n\
++    unsigned long long Total() const;\n\
++    void Clear();\n\
++\n\
++protected:\n\
++    static unsigned int ThreadSlot();\n\
++\n\
++    static constexpr unsigned int NumSlots = 64;\n\
++    struct alignas(64) Slot\n\
++    {\n\
++        std::atomic<unsigned long long> count {0};\n\
++    };\n\
++\n\
++    const Profiler* profiler;\n\
++    Slot slots[NumSlots];\n\
+ };\n\
+ \n\
+ /** Time the enclosing scope (or until Stop()) as a phase of Profiler. Does nothing if the Profiler is disabled. */\n\
+diff --git a/src/Universal/ScalapackMatrix.cpp b/src/Universal/ScalapackMatrix.cpp\n\
+index 5f22..a36e 100644\n\
+--- a/src/Universal/ScalapackMatrix.cpp\n\
++++ b/src/Universal/ScalapackMatrix.cpp\n\
+@@ -11,7 +11,6 @@\n\
+ #define USE_PDSYEVD false\n\
+ \n\
+ #if !(_FUS)\n\
+-    #define sl_init_        sl_init\n\
+     #define blacs_gridinfo_ blacs_gridinfo\n\
+     #define numroc_         numroc\n\
+     #define descinit_       descinit\n\
+@@ -32,7 +31,6 @@ const static int CSRC = 0;\n\
+ \n\
+ extern \"C\"{\n\
+ /** ScaLAPACK and BLACS routines */\n\
+-void sl_init_(int*, const int*, const int*);\n\
+ void blacs_gridinfo_(const int*, int*, int*, int*, int*);\n\
+ int  numroc_(const int*, const int*, const int*, const int*, const int*);\n\
+ void descinit_(int*, const int*, const int*, const int*, const int*, const int*, const int*,\n\
+@@ -44,28 +42,36 @@ void pdsyevd_(const char* JOBZ, const char* UPLO, const int* N, double* A, const\n\
+ void pdsyev_(const char* JOBZ, const char* UPLO, const int* N, double* A, const int* IA, const int* JA,\n\
+              const int* DESCA, double* W, double* Z, const int* IZ, const int* JZ, const int* DESCZ,\n\
+              double* WORK, const int* LWORK, int* INFO);\n\
++\n\
++/** C interface to BLACS, needed to make a process grid from an MPI communicator. */\n\
++void Cblacs_pinfo(int* mypnum, int* nprocs);\n\
++int  Csys2blacs_handle(MPI_Comm SysCtxt);\n\
++void Cblacs_gridinit(int* ConTxt, const char* order, int nprow, int npcol);\n\
+ }\n\
+ \n\
+ namespace Ambit\n\
+ {\n\
+-ScalapackMatrix::ScalapackMatrix(unsigned int size):\n\
+-    Matrix()\n\
++ScalapackMatrix::ScalapackMatrix(unsigned int size, const Communicator& communicator):\n\
++    Matrix(), comm(communicator)\n\
+ {\n\
+     N = size;\n\
+ \n\
+     // Get number of processor rows and columns\n\
+-    num_proc_rows = (int)sqrt(double(NumProcessors));\n\
+-    num_proc_cols = NumProcessors/num_proc_rows;\n\
++    num_proc_rows = (int)sqrt(double(comm.Size()));\n\
++    num_proc_cols = comm.Size()/num_proc_rows;\n\
+ \n\
+-    while(num_proc_cols * num_proc_rows != NumProcessors)\n\
++    while(num_proc_cols * num_proc_rows != comm.Size())\n\
+     {   num_proc_rows--;\n\
+-        num_proc_cols = NumProcessors/num_proc_rows;\n\
++        num_proc_cols = comm.Size()/num_proc_rows;\n\
+     }\n\
+     if(DebugOptions.LogScalapack())\n\
+         *logstream << \"ScalapackMatrix decomposition: \" << num_proc_rows << \" * \" << num_proc_cols << std::endl;\n\
+ \n\
+-    // Initialise process grid\n\
+-    sl_init_(&ICTXT, &num_proc_rows, &num_proc_cols);\n\
++    // Initialise process grid over the processes of comm\n\
++    int blacs_rank, blacs_num_processes;\n\
++    Cblacs_pinfo(&blacs_rank, &blacs_num_processes);\n\
++    ICTXT = Csys2blacs_handle(comm.Comm());\n\
++    Cblacs_gridinit(&ICTXT, \"Row\", num_proc_rows, num_proc_cols);\n\
+     blacs_gridinfo_(&ICTXT, &num_proc_rows, &num_proc_cols, &proc_row, &proc_col);\n\
+ \n\
+     // Get dimensions of local array\n\
+@@ -187,7 +193,7 @@ void ScalapackMatrix::MatrixMultiply(int m, double* b, double* c) const\n\
+ \n\
+         }\n\
+ \n\
+-        MPI_Allreduce(buffer, &c[k * N], N, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);\n\
++        MPI_Allreduce(buffer, &c[k * N], N, MPI_DOUBLE, MPI_SUM, comm.Comm());\n\
+     }\n\
+ }\n\
+ \n\
+@@ -217,7 +223,7 @@ void ScalapackMatrix::GetDiagonal(double* diag) const\n\
+         i++;\n\
+     }\n\
+ \n\
+-    MPI_Allreduce(buffer, diag, N, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);\n\
++    MPI_Allreduce(buffer, diag, N, MPI_DOUBLE, MPI_SUM, comm.Comm());\n\
+ \n\
+     delete[] buffer;\n\
+ }\n\
+@@ -374,7 +380,7 @@ void ScalapackMatrix::WriteToFile(const std::string& filename) const\n\
+     double* writebuf;\n\
+ \n\
+     FILE* fp;\n\
+-    if(ProcessorRank == 0)\n\
++    if(comm.Rank() == 0)\n\
+     {\n\
+         fp = file_err_handler->fopen(filename.c_str(), \"wb\");\n\
+ \n\
+@@ -413,15 +419,15 @@ void ScalapackMatrix::WriteToFile(const std::string& filename) const\n\
+             M_j++;\n\
+         }\n\
+ \n\
+-        MPI_Reduce(buffer, writebuf, N, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);\n\
++        MPI_Reduce(buffer, writebuf, N, MPI_DOUBLE, MPI_SUM, 0, comm.Comm());\n\
+ \n\
+-        if(ProcessorRank == 0)\n\
++        if(comm.Rank() == 0)\n\
+         {   file_err_handler->fwrite(writebuf, sizeof(double), N, fp);\n\
+         }\n\
+     }\n\
+ \n\
+     delete[] buffer;\n\
+-    if(ProcessorRank == 0)\n\
++    if(comm.Rank() == 0)\n\
+     {   delete[] writebuf;\n\
+         file_err_handler->fclose(fp);\n\
+     }\n\
+@@ -526,7 +532,7 @@ void ScalapackMatrix::GetRow(unsigned int row_number, double* row) const\n\
+         }\n\
+     }\n\
+ \n\
+-    MPI_Allreduce(buffer, row, N, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);\n\
++    MPI_Allreduce(buffer, row, N, MPI_DOUBLE, MPI_SUM, comm.Comm());\n\
+ \n\
+     delete[] buffer;\n\
+ }\n\
+@@ -570,7 +576,7 @@ void ScalapackMatrix::GetColumn(unsigned int col_number, double* col) const\n\
+         }\n\
+     }\n\
+ \n\
+-    MPI_Allreduce(buffer, col, N, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);\n\
++    MPI_Allreduce(buffer, col, N, MPI_DOUBLE, MPI_SUM, comm.Comm());\n\
+ \n\
+     delete[] buffer;\n\
+ }\n\
+@@ -631,7 +637,7 @@ void ScalapackMatrix::GetColumns(unsigned int col_begin, unsigned int col_end, d\n\
+     if(DebugOptions.LogScalapack())\n\
+         *logstream << std::endl;\n\
+ \n\
+-    MPI_Allreduce(buffer, cols, N * num_cols, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);\n\
++    MPI_Allreduce(buffer, cols, N * num_cols, MPI_DOUBLE, MPI_SUM, comm.Comm());\n\
+ \n\
+     delete[] buffer;\n\
+ }\n\
+@@ -676,7 +682,7 @@ void ScalapackMatrix::TestEigenvalues(const double* eigenvalues, const double* V\n\
+             }\n\
+         }\n\
+ \n\
+-        MPI_Allreduce(buffer, column, N, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);\n\
++        MPI_Allreduce(buffer, column, N, MPI_DOUBLE, MPI_SUM, comm.Comm());\n\
+ \n\
+         // Mulitiply by M\n\
+         memset(MtimesV, 0, sizeof(double) * N);\n\
+diff --git a/src/Universal/ScalapackMatrix.h b/src/Universal/ScalapackMatrix.h\n\
+index 0cf1..558a 100644\n\
+--- a/src/Universal/ScalapackMatrix.h\n\
++++ b/src/Universal/ScalapackMatrix.h\n\
+@@ -2,17 +2,20 @@\n\
+ #define SCALAPACK_MATRIX_H\n\
+ \n\
+ #include \"Matrix.h\"\n\
++#include \"Communicator.h\"\n\
+ \n\
+ namespace Ambit\n\
+ {\n\
+ /** Storage container for a matrix decomposed as per ScaLAPACK requirements.\n\
+     The entire matrix is stored in memory.\n\
+     The local array is stored in column-first (fortran style) format.\n\
++    The matrix is distributed over the processes of a Communicator (default ProcessGroup), all of which\n\
++    must take part in collective operations such as Diagonalise() and GetColumn().\n\
+  */\n\
+ class ScalapackMatrix: public Matrix\n\
+ {\n\
+ public:\n\
+-    ScalapackMatrix(unsigned int size);\n\
++    ScalapackMatrix(unsigned int size, const Communicator& communicator = ProcessGroup);\n\
+     virtual ~ScalapackMatrix(void);\n\
+ \n\
+     virtual void MatrixMultiply(int m, double* b, double* c) const override;\n\
+@@ -74,6 +77,8 @@ protected:\n\
+     unsigned int* M_row_numbers;    // Index of row and column numbers in global array\n\
+     unsigned int* M_col_numbers;\n\
+ \n\
++    Communicator comm;\n\
++\n\
+     // ScaLAPACK variables\n\
+     int ICTXT;      // BLACS context identifying the created process grid\n\
+     int DESC[9];    // Array descriptor\n\
+diff --git a/src/ambit.cpp b/src/ambit.cpp\n\
+index 79c7..b359 100644\n\
+--- a/src/ambit.cpp\n\
++++ b/src/ambit.cpp\n\
+@@ -189,7 +189,7 @@ int main(int argc, char* argv[])\n\
+         }\n\
+ \n\
+         if(Profiler::Instance()->Enabled())\n\
+-            Profiler::Instance()->WriteReport(identifier + \".profile.json\");\n\
++            Profiler::Instance()->WriteReport(identifier + \".profile.json\", Communicator::World());\n\
+     }\n\
+     catch(std::bad_alloc& ba)\n\
+     {   *errstream << ba.what() << std::endl;\n\
+diff --git a/test/CMakeLists.txt b/test/CMakeLists.txt\n\
+index 3069..8c20 100644\n\
+--- a/test/CMakeLists.txt\n\
++++ b/test/CMakeLists.txt\n\
+@@ -35,6 +35,7 @@ if(CMAKE_PROJECT_NAME STREQUAL PROJECT_NAME AND BUILD_TESTING)\n\
+                    RadiativePotential.test.cpp\n\
+                    Sigma3Calculator.test.cpp\n\
+                    TransitionDensity.test.cpp\n\
++                   Transitions.test.cpp\n\
+                    ambit.test.cpp\n\
+                    CACHE INTERNAL \"\")\n\
+ \n\
+diff --git a/test/Profiler.test.cpp b/test/Profiler.test.cpp\n\
+index 4d3d..31de 100644\n\
+--- a/test/Profiler.test.cpp\n\
++++ b/test/Profiler.test.cpp\n\
+@@ -24,6 +24,15 @@ TEST(ProfilerTester, Report)\n\
+     }\n\
+     profiler->AddCount(\"Test counter\", 5);\n\
+     profiler->AddCount(\"Test counter\", 7);\n\
++\n\
++    // Frequent counters add over threads and report with the named counters\n\
++    ProfileCounter& frequent = profiler->Counter(\"Test frequent counter\");\n\
++    EXPECT_EQ(&frequent, &profiler->Counter(\"Test frequent counter\"));\n\
++    #pragma omp parallel for\n\
++    for(int i = 0; i < 1000; i++)\n\
++        frequent.Add();\n\
++    frequent.Add(20);\n\
++    EXPECT_EQ(1020u, frequent.Total());\n\
+     EXPECT_LT(0., Profiler::PeakMemoryMB());\n\
+     EXPECT_LT(0., Profiler::PhysicalMemoryMB());\n\
+ \n\
+@@ -31,6 +40,7 @@ TEST(ProfilerTester, Report)\n\
+     profiler->WriteReport(filepath.string());\n\
+     profiler->Enable(false);\n\
+     profiler->Reset();\n\
++    EXPECT_EQ(0u, frequent.Total());\n\
+ \n\
+     if(ProcessorRank == 0)\n\
+     {\n\
+@@ -43,8 +53,34 @@ TEST(ProfilerTester, Report)\n\
+         EXPECT_NE(std::string::npos, report.find(\"\\\"Stopped phase\\\"\"));\n\
+         EXPECT_EQ(std::string::npos, report.find(\"\\\"Disabled phase\\\"\"));\n\
+         EXPECT_NE(std::string::npos, report.find(\"\\\"Test counter\\\": \" + itoa(12 * NumProcessors)));\n\
++        EXPECT_NE(std::string::npos, report.find(\"\\\"Test frequent counter\\\": \" + itoa(1020 * NumProcessors)));\n\
+         EXPECT_NE(std::string::npos, report.find(\"\\\"peak_memory_MB\\\"\"));\n\
+ \n\
+         std::filesystem::remove(filepath);\n\
+     }\n\
+ }\n\
++\n\
++TEST(ProfilerTester, GroupReport)\n\
++{\n\
++    Profiler* profiler = Profiler::Instance();\n\
++    profiler->Reset();\n\
++    profiler->Enable();\n\
++    profiler->AddCount(\"Group counter\", 3);\n\
++\n\
++    // Each process reports alone: the report holds only its own counts\n\
++    Communicator alone = Communicator::World().Split(ProcessorRank);\n\
++    std::filesystem::path filepath = std::filesystem::temp_directory_path() / (\"ProfilerTest\" + itoa(ProcessorRank) + \".profile.json\");\n\
++    profiler->WriteReport(filepath.string(), alone);\n\
++    profiler->Enable(false);\n\
++    profiler->Reset();\n\
++\n\
++    std::ifstream file(filepath);\n\
++    std::stringstream contents;\n\
++    contents << file.rdbuf();\n\
++    std::string report = contents.str();\n\
++\n\
++    EXPECT_NE(std::string::npos, report.find(\"\\\"processes\\\": 1,\"));\n\
++    EXPECT_NE(std::string::npos, report.find(\"\\\"Group counter\\\": 3\"));\n\
++\n\
++    std::filesystem::remove(filepath);\n\
++}\n"
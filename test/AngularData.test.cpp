@@ -3,6 +3,8 @@
 #include "gtest/gtest.h"
 #include "Include.h"
 #include "HartreeFock/Core.h"
+#include <cstring>
+#include <filesystem>
 
 using namespace Ambit;
 
@@ -264,3 +266,281 @@ TEST(AngularDataTester, LadderOperator)
     for(int i = 0; i < from_lib->projection_size() * from_lib->NumCSFs(); i++)
         EXPECT_NEAR(CSFs1[i], CSFs2[i], 1.e-9);
 }
+
+TEST(AngularDataTester, LibraryFile)
+{
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "AngularDataLibraryTest";
+    std::filesystem::remove_all(directory);
+
+    // 4p 3d*2 and 4p 4d2 share the same file for each M
+    RelativisticConfiguration first, second;
+    first.insert(std::make_pair(OrbitalInfo(4, 1), 1));
+    first.insert(std::make_pair(OrbitalInfo(3, -3), 2));
+    second.insert(std::make_pair(OrbitalInfo(4, 1), 1));
+    second.insert(std::make_pair(OrbitalInfo(4, 2), 2));
+    Symmetry sym(3, Parity::odd);
+
+    std::vector<double> expected;
+    {   AngularDataLibrary lib(directory.string());
+        pAngularData ang = lib.GetData(first, sym, 1);
+        EXPECT_FALSE(ang->CSFs_calculated());
+        lib.GenerateCSFs();
+        lib.Write();
+        expected.assign(ang->GetCSFs(), ang->GetCSFs() + ang->NumCSFs() * ang->projection_size());
+    }
+
+    std::filesystem::path filepath = directory / "3.3.odd.1.angular";
+    ASSERT_TRUE(std::filesystem::exists(filepath));
+    auto first_size = std::filesystem::file_size(filepath);
+
+    // Make it a version 1 file: these only have dense records, and are converted when appended to
+    {   FILE* fp = fopen(filepath.string().c_str(), "r+b");
+        ASSERT_TRUE(fp != nullptr);
+        fseek(fp, 7, SEEK_SET);
+        fputc('1', fp);
+        fclose(fp);
+    }
+
+    // New CSFs are appended to the file
+    {   AngularDataLibrary lib(directory.string());
+        pAngularData ang = lib.GetData(second, sym, 1);
+        EXPECT_FALSE(ang->CSFs_calculated());
+        lib.GenerateCSFs();
+        lib.Write();
+    }
+    auto second_size = std::filesystem::file_size(filepath);
+    EXPECT_LT(first_size, second_size);
+    {   FILE* fp = fopen(filepath.string().c_str(), "rb");
+        ASSERT_TRUE(fp != nullptr);
+        fseek(fp, 7, SEEK_SET);
+        EXPECT_EQ('2', fgetc(fp));
+        fclose(fp);
+    }
+
+    // Both are read back, and writing again doesn't change the file
+    {   AngularDataLibrary lib(directory.string());
+        pAngularData ang = lib.GetData(first, sym, 1);
+        ASSERT_TRUE(ang->CSFs_calculated());
+        ASSERT_EQ(expected.size(), ang->NumCSFs() * ang->projection_size());
+        for(unsigned int i = 0; i < expected.size(); i++)
+            EXPECT_DOUBLE_EQ(expected[i], ang->GetCSFs()[i]);
+
+        EXPECT_TRUE(lib.GetData(second, sym, 1)->CSFs_calculated());
+        lib.GenerateCSFs();
+        lib.Write();
+    }
+    EXPECT_EQ(second_size, std::filesystem::file_size(filepath));
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST(AngularDataTester, LegacyLibraryFile)
+{
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "AngularDataLegacyTest";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directory(directory);
+
+    // 4p 3d*2 and 4p 4d2 share the same file for each M
+    RelativisticConfiguration first, second;
+    first.insert(std::make_pair(OrbitalInfo(4, 1), 1));
+    first.insert(std::make_pair(OrbitalInfo(3, -3), 2));
+    second.insert(std::make_pair(OrbitalInfo(4, 1), 1));
+    second.insert(std::make_pair(OrbitalInfo(4, 2), 2));
+    Symmetry sym(3, Parity::odd);
+    int two_m = 1;
+
+    // Old format: number of objects, then for each object the key, projections and dense CSFs
+    AngularData old_data(first, two_m, sym.GetTwoJ());
+    ASSERT_LT(0, old_data.NumCSFs());
+    std::filesystem::path filepath = directory / "3.3.odd.1.angular";
+    {   FILE* fp = fopen(filepath.string().c_str(), "wb");
+        ASSERT_TRUE(fp != nullptr);
+
+        int num_objects = 1;
+        fwrite(&num_objects, sizeof(int), 1, fp);
+
+        int key_size = first.size() + 1;
+        fwrite(&key_size, sizeof(int), 1, fp);
+        int key_pair[2] = {sym.GetJpi(), two_m};
+        fwrite(key_pair, sizeof(int), 2, fp);
+        for(auto& pair: first)
+        {   key_pair[0] = pair.first.Kappa();
+            key_pair[1] = pair.second;
+            fwrite(key_pair, sizeof(int), 2, fp);
+        }
+
+        int num_projections = old_data.projection_size();
+        int particle_number = old_data.projection_begin()->size();
+        fwrite(&num_projections, sizeof(int), 1, fp);
+        fwrite(&particle_number, sizeof(int), 1, fp);
+        for(auto it = old_data.projection_begin(); it != old_data.projection_end(); it++)
+            fwrite(it->data(), sizeof(int), particle_number, fp);
+
+        int num_CSFs = old_data.NumCSFs();
+        fwrite(&num_CSFs, sizeof(int), 1, fp);
+        fwrite(old_data.GetCSFs(), sizeof(double), num_CSFs * num_projections, fp);
+        fclose(fp);
+    }
+
+    // Old objects are read, and the file is converted when new CSFs are written
+    {   AngularDataLibrary lib(directory.string());
+        pAngularData ang = lib.GetData(first, sym, two_m);
+        ASSERT_TRUE(ang->CSFs_calculated());
+        EXPECT_EQ(old_data.NumCSFs(), ang->NumCSFs());
+
+        EXPECT_FALSE(lib.GetData(second, sym, two_m)->CSFs_calculated());
+        lib.GenerateCSFs();
+        lib.Write();
+    }
+
+    char magic[8];
+    {   FILE* fp = fopen(filepath.string().c_str(), "rb");
+        ASSERT_TRUE(fp != nullptr);
+        ASSERT_EQ(8, fread(magic, sizeof(char), 8, fp));
+        fclose(fp);
+    }
+    EXPECT_EQ(0, std::memcmp(magic, "AMBiTAD", 7));
+
+    // Both are read back from the new format, and writing again doesn't change the file
+    auto converted_size = std::filesystem::file_size(filepath);
+    {   AngularDataLibrary lib(directory.string());
+        pAngularData ang = lib.GetData(first, sym, two_m);
+        ASSERT_TRUE(ang->CSFs_calculated());
+        ASSERT_EQ(old_data.NumCSFs(), ang->NumCSFs());
+        ASSERT_EQ(old_data.projection_size(), ang->projection_size());
+        for(unsigned int i = 0; i < old_data.projection_size() * old_data.NumCSFs(); i++)
+            EXPECT_DOUBLE_EQ(old_data.GetCSFs()[i], ang->GetCSFs()[i]);
+
+        EXPECT_TRUE(lib.GetData(second, sym, two_m)->CSFs_calculated());
+        lib.GenerateCSFs();
+        lib.Write();
+    }
+    EXPECT_EQ(converted_size, std::filesystem::file_size(filepath));
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST(AngularDataTester, SparseCSFs)
+{
+    // 4f7/2^2 4f5/2^2 5d3/2^2 6s: too many projections for dense diagonalisation
+    RelativisticConfiguration rconfig;
+    rconfig.insert(std::make_pair(OrbitalInfo(4, -4), 2));
+    rconfig.insert(std::make_pair(OrbitalInfo(4, 3), 2));
+    rconfig.insert(std::make_pair(OrbitalInfo(5, 2), 2));
+    rconfig.insert(std::make_pair(OrbitalInfo(6, -1), 1));
+
+    int two_j = 3;
+    AngularData dense(rconfig, two_j);
+    AngularData sparse(rconfig, two_j);
+    ASSERT_LT(AngularData::SparseSizeLimit, sparse.projection_size());
+
+    dense.GenerateCSFs(rconfig, two_j, false);
+    sparse.GenerateCSFs(rconfig, two_j);
+    ASSERT_EQ(dense.NumCSFs(), sparse.NumCSFs());
+    ASSERT_LT(0, sparse.NumCSFs());
+
+    // CSFs with the same J are only defined up to a rotation,
+    // so compare projection operators onto the space of CSFs.
+    int N = sparse.projection_size();
+    int num_CSFs = sparse.NumCSFs();
+    const double* dense_CSFs = dense.GetCSFs();
+    const double* sparse_CSFs = sparse.GetCSFs();
+    double max_difference = 0.;
+    for(int i = 0; i < N; i++)
+        for(int j = 0; j <= i; j++)
+        {
+            double dense_projector = 0., sparse_projector = 0.;
+            for(int csf = 0; csf < num_CSFs; csf++)
+            {   dense_projector += dense_CSFs[i * num_CSFs + csf] * dense_CSFs[j * num_CSFs + csf];
+                sparse_projector += sparse_CSFs[i * num_CSFs + csf] * sparse_CSFs[j * num_CSFs + csf];
+            }
+            max_difference = mmax(max_difference, fabs(dense_projector - sparse_projector));
+        }
+    EXPECT_NEAR(0., max_difference, 1.e-10);
+
+    // Orthonormal
+    for(int csf = 0; csf < num_CSFs; csf++)
+    {
+        double norm = 0.;
+        for(int i = 0; i < N; i++)
+            norm += sparse_CSFs[i * num_CSFs + csf] * sparse_CSFs[i * num_CSFs + csf];
+        EXPECT_NEAR(1., norm, 1.e-10);
+    }
+}
+
+TEST(AngularDataTester, SparseStorage)
+{
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "AngularDataSparseTest";
+    std::filesystem::remove_all(directory);
+
+    // 4p 3d*2 4d
+    RelativisticConfiguration rconfig;
+    rconfig.insert(std::make_pair(OrbitalInfo(4, 1), 1));
+    rconfig.insert(std::make_pair(OrbitalInfo(3, -3), 2));
+    rconfig.insert(std::make_pair(OrbitalInfo(4, 2), 1));
+    Symmetry sym(4, Parity::odd);
+
+    AngularData dense(rconfig, 2, 4);
+    AngularData sparse(dense);
+    ASSERT_LT(0, dense.NumCSFs());
+    EXPECT_FALSE(sparse.IsSparse());
+    EXPECT_TRUE(sparse.MakeSparse(1.));
+    EXPECT_TRUE(sparse.IsSparse());
+    EXPECT_EQ(nullptr, sparse.GetCSFs());
+
+    // Sparse iteration visits exactly the non-zero coefficients with the right CSF index
+    int offset = 7;
+    int num_CSFs = dense.NumCSFs();
+    unsigned int num_stored = 0;
+    for(unsigned int i = 0; i < dense.projection_size(); i++)
+    {
+        std::vector<double> expanded(num_CSFs, 0.);
+        for(auto it = sparse.CSF_begin(i, offset); it != sparse.CSF_end(i, offset); it++)
+        {   EXPECT_NE(0., *it);
+            expanded[it.index() - offset] = *it;
+            num_stored++;
+        }
+
+        auto dense_it = dense.CSF_begin(i, offset);
+        for(int j = 0; j < num_CSFs; j++)
+        {   EXPECT_EQ(j + offset, dense_it.index());
+            EXPECT_DOUBLE_EQ(*dense_it, expanded[j]);
+            dense_it++;
+        }
+    }
+    EXPECT_LT(num_stored, dense.projection_size() * num_CSFs);
+
+    sparse.MakeDense();
+    EXPECT_FALSE(sparse.IsSparse());
+    for(unsigned int i = 0; i < dense.projection_size() * num_CSFs; i++)
+        EXPECT_DOUBLE_EQ(dense.GetCSFs()[i], sparse.GetCSFs()[i]);
+
+    // Sparse records are written to and read from the library, and can be used to generate lower M
+    {   AngularDataLibrary lib(directory.string());
+        lib.SetSparseStorage(1.);
+        lib.GetData(rconfig, sym, 4);
+        lib.GenerateCSFs();
+        EXPECT_TRUE(lib.GetData(rconfig, sym, 4)->IsSparse());
+        lib.Write();
+    }
+    {   AngularDataLibrary lib(directory.string());
+        pAngularData stretched = lib.GetData(rconfig, sym, 4);
+        ASSERT_TRUE(stretched->IsSparse());
+        EXPECT_EQ(num_CSFs, stretched->NumCSFs());
+
+        pAngularData lowered = lib.GetData(rconfig, sym, 2);
+        EXPECT_FALSE(lowered->CSFs_calculated());
+        lib.GenerateCSFs();
+        ASSERT_EQ(dense.projection_size(), lowered->projection_size());
+        ASSERT_EQ(num_CSFs, lowered->NumCSFs());
+
+        // Same as lowering from dense storage
+        AngularData dense_stretched(rconfig, 4, 4);
+        AngularData expected(rconfig, 2);
+        expected.LadderLowering(rconfig, dense_stretched);
+        for(unsigned int i = 0; i < expected.projection_size() * num_CSFs; i++)
+            EXPECT_NEAR(expected.GetCSFs()[i], lowered->GetCSFs()[i], 1.e-10);
+    }
+
+    std::filesystem::remove_all(directory);
+}
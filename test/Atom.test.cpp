@@ -0,0 +1,129 @@
+#include "Atom/Atom.h"
+#include "gtest/gtest.h"
+#include "Include.h"
+#include <filesystem>
+
+using namespace Ambit;
+
+namespace
+{
+    /** MgI in a small basis. Ungrouped options (e.g. Multirun) go in global_options. */
+    std::string MgInput(const std::filesystem::path& directory, const std::string& extra_options, const std::string& global_options = "")
+    {
+        return global_options +
+            "-c\n" +
+            "Z = 12\n" +
+            "AngularDataDirectory = " + (directory / "angular").string() + "\n" +
+            "[Lattice]\n" +
+            "NumPoints = 1000\n" +
+            "StartPoint = 1.e-6\n" +
+            "EndPoint = 50.\n" +
+            "[HF]\n" +
+            "N = 11\n" +
+            "Configuration = '1s2 2s2 2p6 : 3s1'\n" +
+            "[Basis]\n" +
+            "--bspline-basis\n" +
+            "ValenceBasis = 5spd\n" +
+            "FrozenCore = 2sp\n" +
+            "[CI]\n" +
+            "LeadingConfigurations = '3s2, 3s1 3p1'\n" +
+            "ElectronExcitations = 2\n" +
+            "NumSolutions = 3\n" +
+            "EvenParityTwoJ = '0, 2'\n" +
+            "OddParityTwoJ = '0, 2'\n" +
+            extra_options;
+    }
+
+    /** Energies of all levels of MgI, calculated with Atom::CalculateEnergies(keys). */
+    std::vector<double> MgEnergies(const std::filesystem::path& directory, const std::string& ci_options)
+    {
+        std::stringstream user_input_stream(MgInput(directory, ci_options));
+        MultirunOptions user_input(user_input_stream, "//", "\n", ",");
+
+        Atom atom(user_input, 12, (directory / "MgI").string());
+        atom.MakeBasis();
+        pLevelStore levels = atom.ChooseHamiltoniansAndRead();
+
+        std::vector<pHamiltonianID> keys(levels->begin(), levels->end());
+        EXPECT_EQ(4, keys.size());
+        atom.CalculateEnergies(keys);
+
+        std::vector<double> energies;
+        for(auto& key: keys)
+            for(auto& level: levels->GetLevels(key).levels)
+                energies.push_back(level->GetEnergy());
+
+        return energies;
+    }
+
+    /** Output of Atom::CheckMatrixSizes() for MgI. */
+    std::string MgCheckSizes(const std::filesystem::path& directory, const std::string& extra_options, const std::string& global_options = "")
+    {
+        std::stringstream user_input_stream(MgInput(directory, extra_options, global_options));
+        MultirunOptions user_input(user_input_stream, "//", "\n", ",");
+
+        Atom atom(user_input, 12, (directory / "MgI").string());
+        atom.MakeBasis();
+
+        std::ostringstream output;
+        std::ostream* stored_outstream = outstream;
+        outstream = &output;
+        atom.CheckMatrixSizes();
+        outstream = stored_outstream;
+
+        return output.str();
+    }
+}
+
+TEST(AtomTester, ParallelSymmetries)
+{
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "AtomParallelSymmetriesTest";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directory(directory);
+
+    std::vector<double> serial = MgEnergies(directory, "");
+
+    // All symmetries are prepared first and solved on groups of processes (here a single group)
+    std::vector<double> concurrent = MgEnergies(directory, "--parallel-symmetries\n");
+
+    ASSERT_EQ(12, serial.size());
+    ASSERT_EQ(serial.size(), concurrent.size());
+    for(unsigned int i = 0; i < serial.size(); i++)
+        EXPECT_NEAR(serial[i], concurrent[i], 1.e-10);
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST(AtomTester, EstimateResources)
+{
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "AtomEstimateResourcesTest";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directory(directory);
+
+    auto recommendation = [](const std::string& output)
+    {   std::size_t start = output.find("Recommended:");
+        if(start == std::string::npos)
+            return std::string();
+        return output.substr(start, output.find("\n", start) - start);
+    };
+
+    // Plenty of memory: processes and threads are recommended
+    std::string output = MgCheckSizes(directory, "[CheckSizes]\nMemoryPerNode = 1.e6\n");
+    EXPECT_NE(std::string::npos, recommendation(output).find("processes x"));
+    EXPECT_EQ(std::string::npos, output.find("do not fit"));
+
+    // Memory limit exceeded: no allocation of processes fits
+    output = MgCheckSizes(directory, "[CheckSizes]\nMemoryPerNode = 1.e-3\n");
+    EXPECT_NE(std::string::npos, recommendation(output).find("CI/ChunkSize"));
+    EXPECT_EQ(std::string::npos, recommendation(output).find("processes x"));
+    EXPECT_NE(std::string::npos, output.find("CI matrices do not fit in the memory of 1 node(s)"));
+
+    // Matrices of all runs are only held together when asked for
+    std::string multirun = "Multirun = 'AlphaSquaredVariation'\nAlphaSquaredVariation = '0.0, 0.1'\n";
+    output = MgCheckSizes(directory, "[CheckSizes]\nMemoryPerNode = 1.e6\n", multirun);
+    EXPECT_EQ(std::string::npos, output.find("runs together"));
+    output = MgCheckSizes(directory, "--runs-together\n[CheckSizes]\nMemoryPerNode = 1.e6\n", multirun);
+    EXPECT_NE(std::string::npos, output.find("x 2 runs together"));
+
+    std::filesystem::remove_all(directory);
+}
@@ -0,0 +1,41 @@
+#include "Include.h"
+#include "Universal/Communicator.h"
+#include "gtest/gtest.h"
+
+using namespace Ambit;
+
+TEST(CommunicatorTester, PackTasks)
+{
+    std::vector<int> group_start, group_size;
+
+    // More processes than tasks: one task per group, processes in proportion to cost
+    std::vector<double> costs = {1., 8., 1.};
+    std::vector<int> task_group = PackTasks(costs, 10, group_start, group_size);
+
+    ASSERT_EQ(3, group_size.size());
+    EXPECT_EQ(0, task_group[1]);
+    EXPECT_NE(task_group[0], task_group[2]);
+    EXPECT_EQ(10, group_size[0] + group_size[1] + group_size[2]);
+    EXPECT_GT(group_size[0], group_size[task_group[0]]);
+    EXPECT_GE(group_size[task_group[2]], 1);
+    for(unsigned int g = 1; g < group_start.size(); g++)
+        EXPECT_EQ(group_start[g-1] + group_size[g-1], group_start[g]);
+
+    // More tasks than processes: largest first onto least loaded group
+    costs = {5., 4., 3., 3., 1.};
+    task_group = PackTasks(costs, 2, group_start, group_size);
+
+    ASSERT_EQ(2, group_size.size());
+    EXPECT_EQ(1, group_size[0]);
+    EXPECT_EQ(1, group_size[1]);
+    double load[2] = {0., 0.};
+    for(unsigned int i = 0; i < costs.size(); i++)
+        load[task_group[i]] += costs[i];
+    EXPECT_DOUBLE_EQ(8., load[0]);
+    EXPECT_DOUBLE_EQ(8., load[1]);
+
+    // No tasks
+    task_group = PackTasks(std::vector<double>(), 4, group_start, group_size);
+    EXPECT_TRUE(task_group.empty());
+    EXPECT_TRUE(group_size.empty());
+}
@@ -121,6 +121,38 @@ TEST(ConfigGeneratorTester, CountConfigurations)
 
     EXPECT_EQ(projection_count, iterator_count);
     EXPECT_EQ(projection_count, relconfigs->projection_size());
+
+    // Random access matches stepping through the list
+    const RelativisticConfigList& const_relconfigs = *relconfigs;
+    auto config_it = const_relconfigs.begin();
+    int csf_count = 0;
+    projection_count = 0;
+    for(unsigned int i = 0; i < const_relconfigs.size(); i++)
+    {
+        EXPECT_EQ(config_it, const_relconfigs[i]);
+        EXPECT_EQ(csf_count, const_relconfigs[i].csf_offset());
+        EXPECT_EQ(csf_count, (const_relconfigs.begin() + i).csf_offset());
+        EXPECT_EQ(projection_count, const_relconfigs.ProjectionOffset(i));
+
+        csf_count += config_it->NumCSFs();
+        projection_count += config_it->projection_size();
+        config_it++;
+    }
+    EXPECT_EQ(relconfigs->NumCSFs(), const_relconfigs.CSFOffset(const_relconfigs.size()));
+    EXPECT_EQ(const_relconfigs.size(), const_relconfigs.end() - const_relconfigs.begin());
+    EXPECT_EQ(csf_count - (config_it - 1)->NumCSFs(), (const_relconfigs.end() - 1).csf_offset());
+
+    // Offsets follow changes to the CSFs of configurations made through non-const iterators
+    // once they are cleared
+    unsigned int old_projection_size = relconfigs->projection_size();
+    Symmetry sym(2, Parity::odd);
+    for(auto& rconfig: *relconfigs)
+        rconfig.GetProjections(angular_library, sym, sym.GetTwoJ());
+    angular_library->GenerateCSFs();
+    relconfigs->ClearOffsets();
+    EXPECT_NE(old_projection_size, relconfigs->projection_size());
+    EXPECT_EQ(relconfigs->NumCSFs(), const_relconfigs.CSFOffset(const_relconfigs.size()));
+    EXPECT_EQ(relconfigs->projection_size(), const_relconfigs.ProjectionOffset(const_relconfigs.size()));
 }
 
 TEST(ConfigGeneratorTester, HolesVsElectrons)
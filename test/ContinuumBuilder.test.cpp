@@ -0,0 +1,79 @@
+#include "HartreeFock/ContinuumBuilder.h"
+#include "gtest/gtest.h"
+#include "HartreeFock/Core.h"
+#include "Include.h"
+#include "HartreeFock/ODESolver.h"
+#include "Universal/MathConstant.h"
+#include "HartreeFock/HartreeFocker.h"
+#include <filesystem>
+
+using namespace Ambit;
+
+TEST(ContinuumBuilderTester, Cache)
+{
+    pLattice lattice(new Lattice(1500, 1.e-6, 100.));
+
+    // F V
+    unsigned int Z = 9;
+    std::string filling = "1s2 2s1";
+
+    pCore core(new Core(lattice, filling));
+
+    pIntegrator integrator(new SimpsonsIntegrator(lattice));
+    pODESolver ode_solver(new AdamsSolver(integrator));
+    pCoulombOperator coulomb(new CoulombOperator(lattice, ode_solver));
+    pPhysicalConstant physical_constant(new PhysicalConstant());
+    pHFOperator t(new HFOperator(Z, core, physical_constant, integrator, coulomb));
+    HartreeFocker HF_Solver(ode_solver);
+
+    HF_Solver.StartCore(core, t);
+    HF_Solver.SolveCore(core, t);
+
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "ContinuumBuilderTest";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directory(directory);
+    std::string prefix = (directory / "FV").string();
+
+    double eV = 1./MathConstant::Instance()->HartreeEnergyIneV();
+    std::vector<int> kappas = {-1, 1, -2, 2, -3};
+
+    // Calculate all waves together and compare with direct calculation
+    ContinuumBuilder builder(t);
+    builder.SetCacheFile(prefix);
+    EXPECT_EQ(0, builder.CacheSize());
+
+    for(int kappa: kappas)
+        builder.Request(kappa, eV);
+    builder.CalculatePending();
+    EXPECT_EQ(kappas.size(), builder.size());
+    EXPECT_EQ(kappas.size(), builder.CacheSize());
+
+    pContinuumWave direct(new ContinuumWave(-2, 100, eV));
+    EXPECT_NE(0, HF_Solver.CalculateContinuumWave(direct, t));
+
+    pContinuumWave built = builder.GetContinuumWave(-2, eV, 101);
+    EXPECT_EQ(101, built->PQN());
+    EXPECT_EQ(direct->size(), built->size());
+    for(unsigned int i = 0; i < direct->size(); i += 50)
+        EXPECT_NEAR(direct->f[i], built->f[i], 1.e-10);
+
+    // New builder with same potential reads from the cache
+    ContinuumBuilder reader(t);
+    reader.SetCacheFile(prefix);
+    EXPECT_EQ(kappas.size(), reader.CacheSize());
+
+    pContinuumWave read = reader.GetContinuumWave(-2, eV, 101);
+    EXPECT_EQ(built->size(), read->size());
+    EXPECT_DOUBLE_EQ(built->Energy(), read->Energy());
+    for(unsigned int i = 0; i < built->size(); i++)
+    {   EXPECT_DOUBLE_EQ(built->f[i], read->f[i]);
+        EXPECT_DOUBLE_EQ(built->g[i], read->g[i]);
+    }
+
+    // Different potential uses a different cache
+    ContinuumBuilder other(t, ContinuumNormalisation::Unitary);
+    other.SetCacheFile(prefix);
+    EXPECT_EQ(0, other.CacheSize());
+
+    std::filesystem::remove_all(directory);
+}
@@ -7,6 +7,11 @@
 #include "Configuration/ConfigGenerator.h"
 #include "Configuration/GFactor.h"
 #include "Atom/MultirunOptions.h"
+#include <filesystem>
+#include <numeric>
+#ifdef AMBIT_USE_OPENMP
+#include <omp.h>
+#endif
 
 using namespace Ambit;
 
@@ -674,3 +679,449 @@ TEST(HamiltonianMatrixTester, NonStretchedStates)
         }
     }
 }
+
+TEST(HamiltonianMatrixTester, GenerateMatrices)
+{
+    pLattice lattice(new Lattice(1000, 1.e-6, 50.));
+    pAngularDataLibrary angular_library = std::make_shared<AngularDataLibrary>();
+    Symmetry sym(2, Parity::odd);
+
+    // Two-electron ions with different nuclear charge share configurations but not integrals
+    std::vector<pHFIntegrals> hf_electrons;
+    std::vector<pTwoElectronCoulombOperator> twobody_electrons;
+    pRelativisticConfigList relconfigs;
+
+    for(int Z: {2, 3})
+    {
+        std::string user_input_string = std::string() +
+            "NuclearRadius = 1.5\n" +
+            "NuclearThickness = 2.3\n" +
+            "Z = " + itoa(Z) + "\n" +
+            "[HF]\n" +
+            "N = 0\n" +
+            "[Basis]\n" +
+            "--bspline-basis\n" +
+            "ValenceBasis = 5spd\n" +
+            "BSpline/Rmax = 50.0\n" +
+            "[CI]\n" +
+            "LeadingConfigurations = '1s1 2p1'\n" +
+            "ElectronExcitations = 2\n";
+
+        std::stringstream user_input_stream(user_input_string);
+        MultirunOptions userInput(user_input_stream, "//", "\n", ",");
+
+        BasisGenerator basis_generator(lattice, userInput);
+        basis_generator.GenerateHFCore();
+        pOrbitalManagerConst orbitals = basis_generator.GenerateBasis();
+
+        pHFOperator hf = basis_generator.GetClosedHFOperator();
+        pHFIntegrals hf_electron(new HFIntegrals(orbitals, hf));
+        hf_electron->CalculateOneElectronIntegrals(orbitals->valence, orbitals->valence);
+
+        pCoulombOperator coulomb(new CoulombOperator(lattice));
+        pHartreeY hartreeY(new HartreeY(hf->GetIntegrator(), coulomb));
+        pSlaterIntegrals integrals(new SlaterIntegralsFlatHash(orbitals, hartreeY));
+        integrals->CalculateTwoElectronIntegrals(orbitals->valence, orbitals->valence, orbitals->valence, orbitals->valence);
+
+        hf_electrons.push_back(hf_electron);
+        twobody_electrons.push_back(std::make_shared<TwoElectronCoulombOperator>(integrals));
+
+        if(!relconfigs)
+        {   ConfigGenerator config_generator(orbitals, userInput);
+            relconfigs = config_generator.GenerateRelativisticConfigurations(config_generator.GenerateConfigurations(), sym, angular_library);
+        }
+    }
+
+    // Both matrices in one sweep
+    HamiltonianMatrix H_first(hf_electrons[0], twobody_electrons[0], relconfigs);
+    HamiltonianMatrix H_second(hf_electrons[1], twobody_electrons[1], relconfigs);
+    HamiltonianMatrix::GenerateMatrices({&H_first, &H_second}, 2);
+
+    for(unsigned int i = 0; i < 2; i++)
+    {
+        HamiltonianMatrix H_single(hf_electrons[i], twobody_electrons[i], relconfigs);
+        H_single.GenerateMatrix(2);
+
+        pHamiltonianID key = std::make_shared<HamiltonianID>(sym);
+        LevelVector expected = H_single.SolveMatrix(key, 3);
+        LevelVector levels = (i == 0? H_first: H_second).SolveMatrix(key, 3);
+
+        ASSERT_EQ(expected.levels.size(), levels.levels.size());
+        for(unsigned int j = 0; j < levels.levels.size(); j++)
+            EXPECT_NEAR(expected.levels[j]->GetEnergy(), levels.levels[j]->GetEnergy(), 1.e-12);
+    }
+}
+
+TEST(HamiltonianMatrixTester, EstimateGeneration)
+{
+    pLattice lattice(new Lattice(1000, 1.e-6, 50.));
+    pAngularDataLibrary angular_library = std::make_shared<AngularDataLibrary>();
+    Symmetry sym(2, Parity::odd);
+
+    std::string user_input_string = std::string() +
+        "NuclearRadius = 1.5\n" +
+        "NuclearThickness = 2.3\n" +
+        "Z = 2\n" +
+        "[HF]\n" +
+        "N = 0\n" +
+        "[Basis]\n" +
+        "--bspline-basis\n" +
+        "ValenceBasis = 5spd\n" +
+        "BSpline/Rmax = 50.0\n" +
+        "[CI]\n" +
+        "LeadingConfigurations = '1s1 2p1'\n" +
+        "ElectronExcitations = 2\n";
+
+    std::stringstream user_input_stream(user_input_string);
+    MultirunOptions userInput(user_input_stream, "//", "\n", ",");
+
+    BasisGenerator basis_generator(lattice, userInput);
+    basis_generator.GenerateHFCore();
+    pOrbitalManagerConst orbitals = basis_generator.GenerateBasis();
+
+    pHFOperator hf = basis_generator.GetClosedHFOperator();
+    pHFIntegrals hf_electron(new HFIntegrals(orbitals, hf));
+    hf_electron->CalculateOneElectronIntegrals(orbitals->valence, orbitals->valence);
+
+    pCoulombOperator coulomb(new CoulombOperator(lattice));
+    pHartreeY hartreeY(new HartreeY(hf->GetIntegrator(), coulomb));
+    pSlaterIntegrals integrals(new SlaterIntegralsFlatHash(orbitals, hartreeY));
+    integrals->CalculateTwoElectronIntegrals(orbitals->valence, orbitals->valence, orbitals->valence, orbitals->valence);
+
+    ConfigGenerator config_generator(orbitals, userInput);
+    pRelativisticConfigList relconfigs = config_generator.GenerateRelativisticConfigurations(config_generator.GenerateConfigurations(), sym, angular_library);
+
+    HamiltonianMatrix H(hf_electron, std::make_shared<TwoElectronCoulombOperator>(integrals), relconfigs);
+    std::vector<unsigned long long> counts = H.CountMatrixElements();
+    ASSERT_EQ(relconfigs->size(), counts.size());
+    double total = std::accumulate(counts.begin(), counts.end(), 0.);
+    EXPECT_GT(total, 0.);
+
+    // Small matrix is one chunk holding the whole lower triangle
+    unsigned int N = relconfigs->NumCSFs();
+    ASSERT_LE(N, 200);
+    HamiltonianMatrix::GenerationEstimate estimate = H.EstimateGeneration(counts, 4, 1, 1);
+    EXPECT_EQ(1, estimate.num_chunks);
+    EXPECT_DOUBLE_EQ(double(N) * N * sizeof(double)/(1024. * 1024.), estimate.total_memory_MB);
+    EXPECT_DOUBLE_EQ(estimate.total_memory_MB, estimate.max_memory_MB);
+    EXPECT_DOUBLE_EQ(total, estimate.elapsed_elements);
+
+    // Extra processes can't share the chunk
+    estimate = H.EstimateGeneration(counts, 4, 3, 2);
+    EXPECT_DOUBLE_EQ(total, estimate.elapsed_elements);
+
+    EXPECT_GT(H.TimeMatrixElements(100), 0.);
+}
+
+TEST(HamiltonianMatrixTester, OutOfCore)
+{
+    pLattice lattice(new Lattice(1000, 1.e-6, 50.));
+    pAngularDataLibrary angular_library = std::make_shared<AngularDataLibrary>();
+    Symmetry sym(2, Parity::odd);
+
+    // Large enough for Davidson's method and for several chunks in the file
+    std::string user_input_string = std::string() +
+        "NuclearRadius = 1.5\n" +
+        "NuclearThickness = 2.3\n" +
+        "Z = 2\n" +
+        "[HF]\n" +
+        "N = 0\n" +
+        "[Basis]\n" +
+        "--bspline-basis\n" +
+        "ValenceBasis = 8spdf\n" +
+        "BSpline/Rmax = 50.0\n" +
+        "[CI]\n" +
+        "LeadingConfigurations = '1s1 2p1'\n" +
+        "ElectronExcitations = 2\n";
+
+    std::stringstream user_input_stream(user_input_string);
+    MultirunOptions userInput(user_input_stream, "//", "\n", ",");
+
+    BasisGenerator basis_generator(lattice, userInput);
+    basis_generator.GenerateHFCore();
+    pOrbitalManagerConst orbitals = basis_generator.GenerateBasis();
+
+    pHFOperator hf = basis_generator.GetClosedHFOperator();
+    pHFIntegrals hf_electron(new HFIntegrals(orbitals, hf));
+    hf_electron->CalculateOneElectronIntegrals(orbitals->valence, orbitals->valence);
+
+    pCoulombOperator coulomb(new CoulombOperator(lattice));
+    pHartreeY hartreeY(new HartreeY(hf->GetIntegrator(), coulomb));
+    pSlaterIntegrals integrals(new SlaterIntegralsFlatHash(orbitals, hartreeY));
+    integrals->CalculateTwoElectronIntegrals(orbitals->valence, orbitals->valence, orbitals->valence, orbitals->valence);
+    pTwoElectronCoulombOperator twobody_electron = std::make_shared<TwoElectronCoulombOperator>(integrals);
+
+    ConfigGenerator config_generator(orbitals, userInput);
+    pRelativisticConfigList relconfigs = config_generator.GenerateRelativisticConfigurations(config_generator.GenerateConfigurations(), sym, angular_library);
+    unsigned int N = relconfigs->NumCSFs();
+    ASSERT_GT(N, 200);
+
+    HamiltonianMatrix H_memory(hf_electron, twobody_electron, relconfigs);
+    H_memory.GenerateMatrix(2);
+
+    HamiltonianMatrix H_file(hf_electron, twobody_electron, relconfigs);
+    H_file.SetOutOfCore(std::filesystem::temp_directory_path().string());
+    EXPECT_TRUE(H_file.IsOutOfCore());
+    H_file.GenerateMatrix(2);
+    EXPECT_GT(H_file.EstimateGeneration(H_file.CountMatrixElements(), 2, 1, 1).num_chunks, 1);
+
+    // Same products and diagonal from chunks in memory and in the file
+    std::vector<double> b(2 * N), c_memory(2 * N), c_file(2 * N);
+    for(unsigned int i = 0; i < 2 * N; i++)
+        b[i] = double(i%7) - 3.;
+    H_memory.MatrixMultiply(2, b.data(), c_memory.data());
+    H_file.MatrixMultiply(2, b.data(), c_file.data());
+    for(unsigned int i = 0; i < 2 * N; i++)
+        EXPECT_DOUBLE_EQ(c_memory[i], c_file[i]);
+
+    std::vector<double> diag_memory(N), diag_file(N);
+    H_memory.GetDiagonal(diag_memory.data());
+    H_file.GetDiagonal(diag_file.data());
+    for(unsigned int i = 0; i < N; i++)
+        EXPECT_DOUBLE_EQ(diag_memory[i], diag_file[i]);
+
+    pHamiltonianID key = std::make_shared<HamiltonianID>(sym);
+    LevelVector expected = H_memory.SolveMatrix(key, 3);
+    LevelVector levels = H_file.SolveMatrix(key, 3);
+    ASSERT_EQ(expected.levels.size(), levels.levels.size());
+    for(unsigned int j = 0; j < levels.levels.size(); j++)
+        EXPECT_DOUBLE_EQ(expected.levels[j]->GetEnergy(), levels.levels[j]->GetEnergy());
+}
+
+TEST(HamiltonianMatrixTester, ThreadedMultiply)
+{
+    pLattice lattice(new Lattice(1000, 1.e-6, 50.));
+    pAngularDataLibrary angular_library = std::make_shared<AngularDataLibrary>();
+    Symmetry sym(2, Parity::odd);
+
+    std::string user_input_string = std::string() +
+        "NuclearRadius = 1.5\n" +
+        "NuclearThickness = 2.3\n" +
+        "Z = 2\n" +
+        "[HF]\n" +
+        "N = 0\n" +
+        "[Basis]\n" +
+        "--bspline-basis\n" +
+        "ValenceBasis = 8spdf\n" +
+        "BSpline/Rmax = 50.0\n" +
+        "[CI]\n" +
+        "LeadingConfigurations = '1s1 2p1'\n" +
+        "ElectronExcitations = 2\n";
+
+    std::stringstream user_input_stream(user_input_string);
+    MultirunOptions userInput(user_input_stream, "//", "\n", ",");
+
+    BasisGenerator basis_generator(lattice, userInput);
+    basis_generator.GenerateHFCore();
+    pOrbitalManagerConst orbitals = basis_generator.GenerateBasis();
+
+    pHFOperator hf = basis_generator.GetClosedHFOperator();
+    pHFIntegrals hf_electron(new HFIntegrals(orbitals, hf));
+    hf_electron->CalculateOneElectronIntegrals(orbitals->valence, orbitals->valence);
+
+    pCoulombOperator coulomb(new CoulombOperator(lattice));
+    pHartreeY hartreeY(new HartreeY(hf->GetIntegrator(), coulomb));
+    pSlaterIntegrals integrals(new SlaterIntegralsFlatHash(orbitals, hartreeY));
+    integrals->CalculateTwoElectronIntegrals(orbitals->valence, orbitals->valence, orbitals->valence, orbitals->valence);
+    pTwoElectronCoulombOperator twobody_electron = std::make_shared<TwoElectronCoulombOperator>(integrals);
+
+    ConfigGenerator config_generator(orbitals, userInput);
+    pRelativisticConfigList relconfigs = config_generator.GenerateRelativisticConfigurations(config_generator.GenerateConfigurations(), sym, angular_library);
+    unsigned int N = relconfigs->NumCSFs();
+
+    HamiltonianMatrix H(hf_electron, twobody_electron, relconfigs);
+    H.GenerateMatrix(2);
+    EXPECT_GT(H.EstimateGeneration(H.CountMatrixElements(), 2, 1, 1).num_chunks, 1);
+
+#ifdef AMBIT_USE_OPENMP
+    int stored_num_threads = omp_get_max_threads();
+#endif
+
+    // Products on one thread and on several, each twice with different numbers of columns
+    // so that the products of each thread are reused
+    for(int m: {3, 1, 3})
+    {
+        std::vector<double> b(m * N), c_serial(m * N), c_threaded(m * N);
+        for(unsigned int i = 0; i < m * N; i++)
+            b[i] = double((i + m)%7) - 3.;
+
+    #ifdef AMBIT_USE_OPENMP
+        omp_set_num_threads(1);
+    #endif
+        H.MatrixMultiply(m, b.data(), c_serial.data());
+
+    #ifdef AMBIT_USE_OPENMP
+        omp_set_num_threads(4);
+    #endif
+        H.MatrixMultiply(m, b.data(), c_threaded.data());
+
+        double scale = Eigen::Map<Eigen::VectorXd>(c_serial.data(), m * N).lpNorm<Eigen::Infinity>();
+        for(unsigned int i = 0; i < m * N; i++)
+            EXPECT_NEAR(c_serial[i], c_threaded[i], 1.e-12 * scale);
+    }
+
+#ifdef AMBIT_USE_OPENMP
+    omp_set_num_threads(stored_num_threads);
+#endif
+}
+
+TEST(HamiltonianMatrixTester, DenseMultiply)
+{
+    pLattice lattice(new Lattice(1000, 1.e-6, 50.));
+    pAngularDataLibrary angular_library = std::make_shared<AngularDataLibrary>();
+    Symmetry sym(2, Parity::odd);
+
+    // Small side of single excitations, so that rows past Nsmall have diagonal blocks
+    std::string user_input_string = std::string() +
+        "NuclearRadius = 1.5\n" +
+        "NuclearThickness = 2.3\n" +
+        "Z = 2\n" +
+        "[HF]\n" +
+        "N = 0\n" +
+        "[Basis]\n" +
+        "--bspline-basis\n" +
+        "ValenceBasis = 8spdf\n" +
+        "BSpline/Rmax = 50.0\n" +
+        "[CI]\n" +
+        "LeadingConfigurations = '1s1 2p1'\n" +
+        "ElectronExcitations = 2\n" +
+        "[CI/SmallSide]\n" +
+        "LeadingConfigurations = '1s1 2p1'\n" +
+        "ElectronExcitations = 1\n";
+
+    std::stringstream user_input_stream(user_input_string);
+    MultirunOptions userInput(user_input_stream, "//", "\n", ",");
+
+    BasisGenerator basis_generator(lattice, userInput);
+    basis_generator.GenerateHFCore();
+    pOrbitalManagerConst orbitals = basis_generator.GenerateBasis();
+
+    pHFOperator hf = basis_generator.GetClosedHFOperator();
+    pHFIntegrals hf_electron(new HFIntegrals(orbitals, hf));
+    hf_electron->CalculateOneElectronIntegrals(orbitals->valence, orbitals->valence);
+
+    pCoulombOperator coulomb(new CoulombOperator(lattice));
+    pHartreeY hartreeY(new HartreeY(hf->GetIntegrator(), coulomb));
+    pSlaterIntegrals integrals(new SlaterIntegralsFlatHash(orbitals, hartreeY));
+    integrals->CalculateTwoElectronIntegrals(orbitals->valence, orbitals->valence, orbitals->valence, orbitals->valence);
+    pTwoElectronCoulombOperator twobody_electron = std::make_shared<TwoElectronCoulombOperator>(integrals);
+
+    ConfigGenerator config_generator(orbitals, userInput);
+    pRelativisticConfigList relconfigs = config_generator.GenerateRelativisticConfigurations(config_generator.GenerateConfigurations(), sym, angular_library);
+    unsigned int N = relconfigs->NumCSFs();
+    ASSERT_GT(N, 200);
+    ASSERT_LT(relconfigs->NumCSFsSmall(), N);
+
+    const int m = 3;
+    std::vector<double> b(m * N);
+    for(unsigned int i = 0; i < m * N; i++)
+        b[i] = double(i%7) - 3.;
+    Eigen::Map<Eigen::MatrixXd> b_mapped(b.data(), N, m);
+
+    std::string filename = (std::filesystem::temp_directory_path() / "HamiltonianMatrixDenseMultiply.matrix").string();
+
+    for(bool single_precision: {false, true})
+    {
+        HamiltonianMatrix H(hf_electron, twobody_electron, relconfigs);
+        H.SetSinglePrecision(single_precision);
+        H.GenerateMatrix(2);
+        EXPECT_GT(H.EstimateGeneration(H.CountMatrixElements(), 2, 1, 1).num_chunks, 1);
+
+        // Dense symmetric matrix from the lower triangle written by rows
+        H.Write(filename);
+        FILE* fp = fopen(filename.c_str(), "rb");
+        ASSERT_NE(nullptr, fp);
+        unsigned int size = 0;
+        ASSERT_EQ(1, fread(&size, sizeof(unsigned int), 1, fp));
+        ASSERT_EQ(N, size);
+
+        Eigen::MatrixXd M = Eigen::MatrixXd::Zero(N, N);
+        std::vector<double> row(N);
+        for(unsigned int i = 0; i < N; i++)
+        {   ASSERT_EQ(i + 1, fread(row.data(), sizeof(double), i + 1, fp));
+            for(unsigned int j = 0; j <= i; j++)
+                M(i, j) = M(j, i) = row[j];
+        }
+        fclose(fp);
+        std::filesystem::remove(filename);
+
+        std::vector<double> c(m * N);
+        H.MatrixMultiply(m, b.data(), c.data());
+        Eigen::MatrixXd expected = M * b_mapped;
+
+        double scale = expected.lpNorm<Eigen::Infinity>();
+        for(int j = 0; j < m; j++)
+            for(unsigned int i = 0; i < N; i++)
+                EXPECT_NEAR(expected(i, j), c[j * N + i], 1.e-12 * scale);
+    }
+}
+
+TEST(HamiltonianMatrixTester, SinglePrecision)
+{
+    pLattice lattice(new Lattice(1000, 1.e-6, 50.));
+    pAngularDataLibrary angular_library = std::make_shared<AngularDataLibrary>();
+    Symmetry sym(2, Parity::odd);
+
+    // Large enough to be solved with Davidson's method
+    std::string user_input_string = std::string() +
+        "NuclearRadius = 1.5\n" +
+        "NuclearThickness = 2.3\n" +
+        "Z = 2\n" +
+        "[HF]\n" +
+        "N = 0\n" +
+        "[Basis]\n" +
+        "--bspline-basis\n" +
+        "ValenceBasis = 8spdf\n" +
+        "BSpline/Rmax = 50.0\n" +
+        "[CI]\n" +
+        "LeadingConfigurations = '1s1 2p1'\n" +
+        "ElectronExcitations = 2\n";
+
+    std::stringstream user_input_stream(user_input_string);
+    MultirunOptions userInput(user_input_stream, "//", "\n", ",");
+
+    BasisGenerator basis_generator(lattice, userInput);
+    basis_generator.GenerateHFCore();
+    pOrbitalManagerConst orbitals = basis_generator.GenerateBasis();
+
+    pHFOperator hf = basis_generator.GetClosedHFOperator();
+    pHFIntegrals hf_electron(new HFIntegrals(orbitals, hf));
+    hf_electron->CalculateOneElectronIntegrals(orbitals->valence, orbitals->valence);
+
+    pCoulombOperator coulomb(new CoulombOperator(lattice));
+    pHartreeY hartreeY(new HartreeY(hf->GetIntegrator(), coulomb));
+    pSlaterIntegrals integrals(new SlaterIntegralsFlatHash(orbitals, hartreeY));
+    integrals->CalculateTwoElectronIntegrals(orbitals->valence, orbitals->valence, orbitals->valence, orbitals->valence);
+    pTwoElectronCoulombOperator twobody_electron = std::make_shared<TwoElectronCoulombOperator>(integrals);
+
+    ConfigGenerator config_generator(orbitals, userInput);
+    pRelativisticConfigList relconfigs = config_generator.GenerateRelativisticConfigurations(config_generator.GenerateConfigurations(), sym, angular_library);
+    ASSERT_GT(relconfigs->NumCSFs(), 200);
+
+    HamiltonianMatrix H_double(hf_electron, twobody_electron, relconfigs);
+    H_double.GenerateMatrix();
+
+    HamiltonianMatrix H_single(hf_electron, twobody_electron, relconfigs);
+    H_single.SetSinglePrecision(true);
+    EXPECT_TRUE(H_single.IsSinglePrecision());
+    H_single.GenerateMatrix();
+
+    // Half the matrix memory (the diagonal blocks stay in double precision)
+    std::vector<unsigned long long> counts = H_single.CountMatrixElements();
+    EXPECT_LT(H_single.EstimateGeneration(counts, 4, 1, 1).total_memory_MB, 0.6 * H_double.EstimateGeneration(counts, 4, 1, 1).total_memory_MB);
+
+    // Refinement needs more solver memory and generates the matrix again
+    unsigned int N = relconfigs->NumCSFs();
+    EXPECT_GT(HamiltonianMatrix::SolveMemoryMB(N, 3, true, 2), HamiltonianMatrix::SolveMemoryMB(N, 3, true, 1));
+    EXPECT_GT(HamiltonianMatrix::SolveMemoryMB(N, 3, true, 1), HamiltonianMatrix::SolveMemoryMB(N, 3));
+    EXPECT_GT(HamiltonianMatrix::MaxRefineIterations(N, true), 0);
+    EXPECT_EQ(0, HamiltonianMatrix::MaxRefineIterations(N, false));
+
+    // Refined energies match the double-precision ones
+    pHamiltonianID key = std::make_shared<HamiltonianID>(sym);
+    LevelVector expected = H_double.SolveMatrix(key, 3);
+    LevelVector levels = H_single.SolveMatrix(key, 3);
+    ASSERT_EQ(expected.levels.size(), levels.levels.size());
+    for(unsigned int j = 0; j < levels.levels.size(); j++)
+        EXPECT_NEAR(expected.levels[j]->GetEnergy(), levels.levels[j]->GetEnergy(), 1.e-9);
+}
@@ -0,0 +1,68 @@
+#include "Include.h"
+#include "Universal/Lattice.h"
+#include "gtest/gtest.h"
+
+using namespace Ambit;
+
+TEST(LatticeTester, Snapshot)
+{
+    pLattice lattice(new Lattice(1000, 1.e-6, 50.));
+    EXPECT_FALSE(lattice->IsFrozen());
+
+    {   LatticeSnapshot frozen_lattice(lattice, 4);
+        EXPECT_TRUE(lattice->IsFrozen());
+        EXPECT_EQ(frozen_lattice.size(), lattice->size());
+        EXPECT_EQ(frozen_lattice.MaxPower(), 4);
+
+        // Precomputed powers should agree with direct calculation
+        for(unsigned int i = 0; i < frozen_lattice.size(); i += 97)
+        {   double r = lattice->R(i);
+            EXPECT_DOUBLE_EQ(frozen_lattice.Rpower(1)[i], r);
+            EXPECT_NEAR(frozen_lattice.Rpower(3)[i], r * r * r, 1.e-12 * r * r * r);
+            EXPECT_NEAR(frozen_lattice.Rpower(4)[i], r * r * r * r, 1.e-12 * r * r * r * r);
+        }
+
+        // Copies keep the lattice frozen
+        LatticeSnapshot copy(frozen_lattice);
+        EXPECT_EQ(copy.Rpower(2), lattice->Rpower(2));
+    }
+
+    EXPECT_FALSE(lattice->IsFrozen());
+
+    // Powers are extended when the lattice grows
+    lattice->resize(1200);
+    LatticeSnapshot frozen_lattice(lattice, 3);
+    EXPECT_EQ(frozen_lattice.size(), 1200);
+    double r = lattice->R(1150);
+    EXPECT_NEAR(frozen_lattice.Rpower(3)[1150], r * r * r, 1.e-12 * r * r * r);
+
+    // Resizing to the current size is allowed while frozen
+    EXPECT_EQ(lattice->resize(1200), 1200);
+}
+
+TEST(LatticeTester, RpowerGrowth)
+{
+    pLattice lattice(new Lattice(1000, 1.e-6, 50.));
+    const double* R2 = lattice->Rpower(2);
+
+    // Adding higher powers must not move the points of existing powers
+    const double* R9 = lattice->Rpower(9);
+    EXPECT_EQ(R2, lattice->Rpower(2));
+
+    LatticeSnapshot frozen_lattice(lattice, 12);
+    EXPECT_EQ(R9, frozen_lattice.Rpower(9));
+
+    // Powers requested concurrently agree with the snapshot
+    std::vector<const double*> powers(12);
+    #pragma omp parallel for
+    for(int k = 1; k <= 12; k++)
+        powers[k-1] = lattice->Rpower(k);
+
+    for(unsigned int k = 1; k <= 12; k++)
+        EXPECT_EQ(powers[k-1], frozen_lattice.Rpower(k));
+
+    // Copies have their own powers
+    Lattice copy(*lattice);
+    EXPECT_NE(R9, copy.Rpower(9));
+    EXPECT_DOUBLE_EQ(R9[500], copy.Rpower(9)[500]);
+}
@@ -473,3 +473,127 @@ TEST(ManyBodyOperatorTester, ProjectionDifferencesSkipped)
         EXPECT_EQ(-2, diffs);
     }
 }
+
+TEST(ManyBodyOperatorTester, PackedProjections)
+{
+    // Packed projections must agree with ElectronInfo ordering and GetProjectionDifferences()
+    pAngularDataLibrary angular_library = std::make_shared<AngularDataLibrary>();
+    Symmetry sym(1, Parity::odd);
+    RelativisticConfigList configs;
+
+    RelativisticConfiguration config;
+    config.insert(std::make_pair(OrbitalInfo(4, -1), 1));
+    config.insert(std::make_pair(OrbitalInfo(4, 1), 1));
+    config.insert(std::make_pair(OrbitalInfo(3, 2), -1));
+    configs.push_back(config);
+
+    config.clear();
+    config.insert(std::make_pair(OrbitalInfo(4, -1), 1));
+    config.insert(std::make_pair(OrbitalInfo(4, -2), 1));
+    config.insert(std::make_pair(OrbitalInfo(3, -3), -1));
+    configs.push_back(config);
+
+    config.clear();
+    config.insert(std::make_pair(OrbitalInfo(5, -1), 1));
+    config.insert(std::make_pair(OrbitalInfo(4, 1), 1));
+    config.insert(std::make_pair(OrbitalInfo(3, 2), -1));
+    configs.push_back(config);
+
+    for(auto& rconfig: configs)
+        ASSERT_TRUE(rconfig.GetProjections(angular_library, sym, 1));
+    angular_library->GenerateCSFs();
+
+    PackedProjectionList packed(configs);
+    ASSERT_EQ(configs.projection_size(), packed.size());
+
+    // The list keeps a single packed copy until its CSFs change
+    auto cached = configs.GetPackedProjections();
+    EXPECT_EQ(cached, configs.GetPackedProjections());
+    EXPECT_EQ(packed.size(), cached->size());
+
+    // Another list is not kept until all its CSFs are generated (this configuration has new
+    // angular data), and generating them doesn't affect this list
+    RelativisticConfigList other_configs;
+    other_configs.push_back(configs.front());
+    config.clear();
+    config.insert(std::make_pair(OrbitalInfo(4, -1), 1));
+    config.insert(std::make_pair(OrbitalInfo(4, 1), 1));
+    config.insert(std::make_pair(OrbitalInfo(3, -3), -1));
+    ASSERT_TRUE(config.GetProjections(angular_library, sym, 1));
+    other_configs.push_back(config);
+
+    auto incomplete = other_configs.GetPackedProjections();
+    EXPECT_NE(incomplete, other_configs.GetPackedProjections());
+    angular_library->GenerateCSFs();
+    auto complete = other_configs.GetPackedProjections();
+    EXPECT_EQ(complete, other_configs.GetPackedProjections());
+    EXPECT_EQ(incomplete->size(), complete->size());
+    EXPECT_EQ(cached, configs.GetPackedProjections());
+
+    // Clearing offsets after changing configurations in place rebuilds the packed copy
+    configs.ClearOffsets();
+    EXPECT_NE(cached, configs.GetPackedProjections());
+
+    ManyBodyOperator<> many_body_operator;
+    ManyBodyOperator<>::IndirectProjectionStruct indirects;
+
+    // Only the number of operators matters for FindDifferences()
+    typedef ManyBodyOperator<ZeroOperator*, ZeroOperator*> TwoBodyOperator;
+    TwoBodyOperator two_body_operator(nullptr, nullptr);
+    TwoBodyOperator::IndirectProjectionStruct two_body_indirects, packed_indirects;
+
+    unsigned int i = 0;
+    for(auto proj_it = configs.projection_begin(); proj_it != configs.projection_end(); proj_it++, i++)
+    {
+        auto view = packed[i];
+        ASSERT_EQ(proj_it->size(), view.size());
+        EXPECT_EQ(proj_it.NumCSFs(), view.NumCSFs());
+        EXPECT_EQ(proj_it.CSF_begin().index(), view.CSF_begin().index());
+        EXPECT_EQ(*proj_it.CSF_begin(), *view.CSF_begin());
+
+        for(const auto& e1: *proj_it)
+        {
+            ElectronInfo unpacked = PackedProjectionList::Unpack(PackedProjectionList::Pack(e1));
+            EXPECT_EQ(e1, unpacked);
+            EXPECT_EQ(e1.IsHole(), unpacked.IsHole());
+
+            for(const auto& e2: *proj_it)
+            {   EXPECT_EQ(e1 < e2, PackedProjectionList::Pack(e1) < PackedProjectionList::Pack(e2));
+                EXPECT_EQ(e1 == e2, PackedProjectionList::SameState(PackedProjectionList::Pack(e1), PackedProjectionList::Pack(e2)));
+            }
+        }
+
+        unsigned int j = 0;
+        for(auto proj_jt = configs.projection_begin(); proj_jt != configs.projection_end(); proj_jt++, j++)
+        {
+            many_body_operator.make_indirect_projection(*proj_it, indirects.left);
+            many_body_operator.make_indirect_projection(*proj_jt, indirects.right);
+            for(unsigned int max_diffs = 1; max_diffs <= 2; max_diffs++)
+            {
+                int diffs = (max_diffs == 1)? many_body_operator.GetProjectionDifferences<1>(indirects)
+                                            : many_body_operator.GetProjectionDifferences<2>(indirects);
+                EXPECT_EQ(abs(diffs) <= max_diffs, packed.WithinDifferences(i, j, max_diffs));
+
+                many_body_operator.make_indirect_projection(*proj_it, indirects.left);
+                many_body_operator.make_indirect_projection(*proj_jt, indirects.right);
+            }
+
+            // Differences of packed projections give the same (unpacked) electrons
+            int diffs = two_body_operator.FindDifferences(*proj_it, *proj_jt, two_body_indirects);
+            int packed_diffs = two_body_operator.FindDifferences(packed[i], packed[j], packed_indirects);
+            EXPECT_EQ(diffs, packed_diffs);
+            if(abs(diffs) <= 2)
+            {
+                ASSERT_EQ(two_body_indirects.left.size(), packed_indirects.left.size());
+                for(unsigned int k = 0; k < two_body_indirects.left.size(); k++)
+                {   EXPECT_EQ(*two_body_indirects.left[k], *packed_indirects.left[k]);
+                    EXPECT_EQ(two_body_indirects.left[k]->IsHole(), packed_indirects.left[k]->IsHole());
+                }
+                for(int k = 0; k < abs(diffs); k++)
+                {   EXPECT_EQ(*two_body_indirects.right[k], *packed_indirects.right[k]);
+                    EXPECT_EQ(two_body_indirects.right[k]->IsHole(), packed_indirects.right[k]->IsHole());
+                }
+            }
+        }
+    }
+}
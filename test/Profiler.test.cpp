@@ -0,0 +1,86 @@
+#include "Universal/Profiler.h"
+#include "gtest/gtest.h"
+#include "Include.h"
+#include <filesystem>
+
+using namespace Ambit;
+
+TEST(ProfilerTester, Report)
+{
+    Profiler* profiler = Profiler::Instance();
+    profiler->Reset();
+
+    // Disabled timers and counters do nothing
+    profiler->Enable(false);
+    {   ProfileTimer timer("Disabled phase");
+    }
+
+    profiler->Enable();
+    for(int i = 0; i < 3; i++)
+    {   ProfileTimer timer("Test phase");
+    }
+    {   ProfileTimer timer("Stopped phase");
+        timer.Stop();
+    }
+    profiler->AddCount("Test counter", 5);
+    profiler->AddCount("Test counter", 7);
+
+    // Frequent counters add over threads and report with the named counters
+    ProfileCounter& frequent = profiler->Counter("Test frequent counter");
+    EXPECT_EQ(&frequent, &profiler->Counter("Test frequent counter"));
+    #pragma omp parallel for
+    for(int i = 0; i < 1000; i++)
+        frequent.Add();
+    frequent.Add(20);
+    EXPECT_EQ(1020u, frequent.Total());
+    EXPECT_LT(0., Profiler::PeakMemoryMB());
+    EXPECT_LT(0., Profiler::PhysicalMemoryMB());
+
+    std::filesystem::path filepath = std::filesystem::temp_directory_path() / "ProfilerTest.profile.json";
+    profiler->WriteReport(filepath.string());
+    profiler->Enable(false);
+    profiler->Reset();
+    EXPECT_EQ(0u, frequent.Total());
+
+    if(ProcessorRank == 0)
+    {
+        std::ifstream file(filepath);
+        std::stringstream contents;
+        contents << file.rdbuf();
+        std::string report = contents.str();
+
+        EXPECT_NE(std::string::npos, report.find("\"Test phase\": {\"calls\": " + itoa(3 * NumProcessors)));
+        EXPECT_NE(std::string::npos, report.find("\"Stopped phase\""));
+        EXPECT_EQ(std::string::npos, report.find("\"Disabled phase\""));
+        EXPECT_NE(std::string::npos, report.find("\"Test counter\": " + itoa(12 * NumProcessors)));
+        EXPECT_NE(std::string::npos, report.find("\"Test frequent counter\": " + itoa(1020 * NumProcessors)));
+        EXPECT_NE(std::string::npos, report.find("\"peak_memory_MB\""));
+
+        std::filesystem::remove(filepath);
+    }
+}
+
+TEST(ProfilerTester, GroupReport)
+{
+    Profiler* profiler = Profiler::Instance();
+    profiler->Reset();
+    profiler->Enable();
+    profiler->AddCount("Group counter", 3);
+
+    // Each process reports alone: the report holds only its own counts
+    Communicator alone = Communicator::World().Split(ProcessorRank);
+    std::filesystem::path filepath = std::filesystem::temp_directory_path() / ("ProfilerTest" + itoa(ProcessorRank) + ".profile.json");
+    profiler->WriteReport(filepath.string(), alone);
+    profiler->Enable(false);
+    profiler->Reset();
+
+    std::ifstream file(filepath);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::string report = contents.str();
+
+    EXPECT_NE(std::string::npos, report.find("\"processes\": 1,"));
+    EXPECT_NE(std::string::npos, report.find("\"Group counter\": 3"));
+
+    std::filesystem::remove(filepath);
+}
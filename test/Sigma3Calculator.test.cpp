@@ -0,0 +1,80 @@
+#include "MBPT/Sigma3Calculator.h"
+#include "gtest/gtest.h"
+#include "Include.h"
+#include "Basis/BasisGenerator.h"
+#include "Atom/MultirunOptions.h"
+
+using namespace Ambit;
+
+TEST(Sigma3CalculatorTester, Cache)
+{
+    pLattice lattice(new Lattice(1000, 1.e-6, 50.));
+
+    // LiI
+    std::string user_input_string = std::string() +
+        "NuclearRadius = 1.5\n" +
+        "NuclearThickness = 2.3\n" +
+        "Z = 3\n" +
+        "[HF]\n" +
+        "N = 2\n" +
+        "Configuration = '1s2'\n" +
+        "[Basis]\n" +
+        "--bspline-basis\n" +
+        "ValenceBasis = 3sp\n" +
+        "BSpline/Rmax = 50.0\n" +
+        "[MBPT]\n" +
+        "Basis = 8spd\n";
+
+    std::stringstream user_input_stream(user_input_string);
+    MultirunOptions userInput(user_input_stream, "//", "\n", ",");
+
+    BasisGenerator basis_generator(lattice, userInput);
+    basis_generator.GenerateHFCore();
+    pOrbitalManagerConst orbitals = basis_generator.GenerateBasis();
+
+    pHFOperator hf = basis_generator.GetClosedHFOperator();
+    pCoulombOperator coulomb(new CoulombOperator(lattice));
+    pHartreeY hartreeY(new HartreeY(hf->GetIntegrator(), coulomb));
+    pSlaterIntegrals integrals(new SlaterIntegralsFlatHash(orbitals, hartreeY));
+
+    Sigma3Calculator cached(orbitals, integrals);
+    cached.UpdateIntegrals();
+    EXPECT_LT(0., cached.CacheMemoryMB());
+
+    Sigma3Calculator uncached(orbitals, integrals);
+    uncached.SetCacheSize(0);
+    uncached.UpdateIntegrals();
+    EXPECT_EQ(0., uncached.CacheMemoryMB());
+
+    ElectronInfo s_up(2, -1, 1), s_down(2, -1, -1), p_up(2, 1, 1), p_down(2, 1, -1), s3(3, -1, 1), p3(3, -2, -1);
+
+    // Allowed and parity-forbidden elements
+    std::vector<std::array<const ElectronInfo*, 6>> elements = {
+        {{&s_up, &s_down, &s3, &s_up, &s_down, &s3}},
+        {{&s_up, &p_down, &s3, &p_up, &s_down, &s3}},
+        {{&s_up, &p_down, &p3, &s3, &s_down, &p_down}},
+        {{&s3, &s_up, &p_down, &s_down, &s3, &p_up}}};
+
+    bool nonzero = false;
+    for(const auto& e: elements)
+    {
+        double expected = uncached.GetMatrixElement(*e[0], *e[1], *e[2], *e[3], *e[4], *e[5]);
+        double value = cached.GetMatrixElement(*e[0], *e[1], *e[2], *e[3], *e[4], *e[5]);
+        EXPECT_NEAR(expected, value, 1.e-12 * fabs(expected));
+        nonzero = nonzero || (expected != 0.);
+
+        // Permuted pairs give the same cached element
+        EXPECT_EQ(value, cached.GetMatrixElement(*e[1], *e[0], *e[2], *e[4], *e[3], *e[5]));
+        EXPECT_EQ(value, cached.GetMatrixElement(*e[2], *e[1], *e[0], *e[5], *e[4], *e[3]));
+        EXPECT_EQ(value, cached.GetMatrixElement(*e[1], *e[2], *e[0], *e[4], *e[5], *e[3]));
+        EXPECT_NEAR(expected, uncached.GetMatrixElement(*e[1], *e[2], *e[0], *e[4], *e[5], *e[3]), 1.e-12 * fabs(expected));
+    }
+    EXPECT_TRUE(nonzero);
+
+    // Cleared cache gives the same elements
+    cached.ClearCache();
+    for(const auto& e: elements)
+        EXPECT_NEAR(uncached.GetMatrixElement(*e[0], *e[1], *e[2], *e[3], *e[4], *e[5]),
+                    cached.GetMatrixElement(*e[2], *e[0], *e[1], *e[5], *e[3], *e[4]),
+                    1.e-12 * fabs(uncached.GetMatrixElement(*e[0], *e[1], *e[2], *e[3], *e[4], *e[5])));
+}
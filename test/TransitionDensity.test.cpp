@@ -0,0 +1,129 @@
+#include "gtest/gtest.h"
+#include "Include.h"
+#include "Configuration/TransitionDensity.h"
+#include "Configuration/LevelMap.h"
+#include "ExternalField/EJOperator.h"
+#include "HartreeFock/Core.h"
+#include "Basis/BasisGenerator.h"
+#include "Atom/MultirunOptions.h"
+#include "MBPT/OneElectronIntegrals.h"
+#include "MBPT/SlaterIntegrals.h"
+#include "Configuration/HamiltonianMatrix.h"
+#include "Configuration/ConfigGenerator.h"
+#include "Configuration/GFactor.h"
+
+using namespace Ambit;
+
+TEST(TransitionDensityTester, HeTransitions)
+{
+    pLattice lattice(new Lattice(1000, 1.e-6, 50.));
+
+    std::string user_input_string = std::string() +
+        "NuclearRadius = 1.5\n" +
+        "NuclearThickness = 2.3\n" +
+        "Z = 2\n" +
+        "[HF]\n" +
+        "N = 0\n" +
+        "[Basis]\n" +
+        "--bspline-basis\n" +
+        "ValenceBasis = 8spd\n" +
+        "BSpline/Rmax = 50.0\n" +
+        "[CI]\n" +
+        "LeadingConfigurations = '1s2'\n" +
+        "ElectronExcitations = 2\n";
+
+    std::stringstream user_input_stream(user_input_string);
+    MultirunOptions userInput(user_input_stream, "//", "\n", ",");
+
+    // Get core and excited basis
+    BasisGenerator basis_generator(lattice, userInput);
+    basis_generator.GenerateHFCore();
+    pOrbitalManagerConst orbitals = basis_generator.GenerateBasis();
+
+    // Generate integrals
+    pHFOperator hf = basis_generator.GetClosedHFOperator();
+    pHFIntegrals hf_electron(new HFIntegrals(orbitals, hf));
+    hf_electron->CalculateOneElectronIntegrals(orbitals->valence, orbitals->valence);
+
+    pCoulombOperator coulomb(new CoulombOperator(lattice));
+    pHartreeY hartreeY(new HartreeY(hf->GetIntegrator(), coulomb));
+    pSlaterIntegrals integrals(new SlaterIntegralsFlatHash(orbitals, hartreeY));
+    integrals->CalculateTwoElectronIntegrals(orbitals->valence, orbitals->valence, orbitals->valence, orbitals->valence);
+    pTwoElectronCoulombOperator twobody_electron = std::make_shared<TwoElectronCoulombOperator>(integrals);
+
+    pAngularDataLibrary angular_library = std::make_shared<AngularDataLibrary>();
+    ConfigGenerator config_generator(orbitals, userInput);
+    auto allconfigs = config_generator.GenerateConfigurations();
+    pLevelStore levels = std::make_shared<LevelMap>(angular_library);
+
+    Symmetry even_sym(0, Parity::even);
+    pRelativisticConfigList relconfigs = config_generator.GenerateRelativisticConfigurations(allconfigs, even_sym, angular_library);
+    HamiltonianMatrix H_even(hf_electron, twobody_electron, relconfigs);
+    H_even.GenerateMatrix();
+    pHamiltonianID even_key = std::make_shared<HamiltonianID>(even_sym);
+    levels->Store(even_key, H_even.SolveMatrix(even_key, 3));
+
+    Symmetry odd_sym(2, Parity::odd);
+    relconfigs = config_generator.GenerateRelativisticConfigurations(allconfigs, odd_sym, angular_library);
+    HamiltonianMatrix H_odd(hf_electron, twobody_electron, relconfigs);
+    H_odd.GenerateMatrix();
+    pHamiltonianID odd_key = std::make_shared<HamiltonianID>(odd_sym);
+    levels->Store(odd_key, H_odd.SolveMatrix(odd_key, 3));
+
+    LevelVector even = levels->GetLevels(even_key);
+    LevelVector odd = levels->GetLevels(odd_key);
+
+    // E1 and M1 share the same rank one transition densities
+    pIntegrator integrator(new SimpsonsIntegrator(lattice));
+    pTimeDependentSpinorOperator E1(new EJOperator(1, integrator, TransitionGauge::Length));
+    E1->SetFrequency(even.levels[0]->GetEnergy() - odd.levels[1]->GetEnergy());
+    pTransitionIntegrals E1_integrals(new TransitionIntegrals(orbitals, E1));
+    E1_integrals->CalculateOneElectronIntegrals(orbitals->valence, orbitals->valence);
+    ManyBodyOperator<pTransitionIntegrals> E1_many_body(E1_integrals);
+
+    pTimeDependentSpinorOperator M1(new MJOperator(1, integrator));
+    M1->SetFrequency(odd.levels[1]->GetEnergy() - odd.levels[0]->GetEnergy());
+    pTransitionIntegrals M1_integrals(new TransitionIntegrals(orbitals, M1));
+    M1_integrals->CalculateOneElectronIntegrals(orbitals->valence, orbitals->valence);
+    ManyBodyOperator<pTransitionIntegrals> M1_many_body(M1_integrals);
+
+    pTransitionDensityConst even_odd = levels->GetTransitionDensity(even, odd, 1);
+    EXPECT_EQ(even_odd, levels->GetTransitionDensity(even, odd, 1));
+    EXPECT_EQ(3, even_odd->NumLeftLevels());
+    EXPECT_EQ(3, even_odd->NumRightLevels());
+
+    std::vector<double> expected = E1_many_body.GetMatrixElement(even, odd);
+    std::vector<double> values = even_odd->GetMatrixElement(*E1_integrals);
+    ASSERT_EQ(expected.size(), values.size());
+    for(unsigned int i = 0; i < expected.size(); i++)
+        EXPECT_NEAR(expected[i], values[i], 1.e-10 + 1.e-8 * fabs(expected[i]));
+
+    // M1 is forbidden between opposite parity states
+    values = even_odd->GetMatrixElement(*M1_integrals);
+    for(double value: values)
+        EXPECT_DOUBLE_EQ(0., value);
+
+    pTransitionDensityConst odd_odd = levels->GetTransitionDensity(odd, odd, 1);
+    expected = M1_many_body.GetMatrixElement(odd, odd);
+    values = odd_odd->GetMatrixElement(*M1_integrals);
+    ASSERT_EQ(expected.size(), values.size());
+    for(unsigned int i = 0; i < expected.size(); i++)
+        EXPECT_NEAR(expected[i], values[i], 1.e-10 + 1.e-8 * fabs(expected[i]));
+
+    // Diagonal density gives the same expectation values
+    TransitionDensity odd_diagonal(odd, 1);
+    EXPECT_TRUE(odd_diagonal.IsDiagonal());
+    EXPECT_EQ(3, odd_diagonal.NumSolutions());
+    values = odd_diagonal.GetMatrixElement(*M1_integrals);
+    for(unsigned int i = 0; i < values.size(); i++)
+        EXPECT_NEAR(expected[i * odd.levels.size() + i], values[i], 1.e-10 + 1.e-8 * fabs(values[i]));
+
+    // g-factors from diagonal density
+    pSzOperatorConst Sz = std::make_shared<SzOperator>(hf->GetIntegrator(), orbitals);
+    ManyBodyOperator<pSzOperatorConst> Sz_many_body(Sz);
+    expected = Sz_many_body.GetMatrixElement(odd);
+    values = odd_diagonal.GetMatrixElement(*Sz);
+    ASSERT_EQ(expected.size(), values.size());
+    for(unsigned int i = 0; i < expected.size(); i++)
+        EXPECT_NEAR(expected[i], values[i], 1.e-10 + 1.e-8 * fabs(expected[i]));
+}
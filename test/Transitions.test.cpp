@@ -0,0 +1,211 @@
+#include "ExternalField/EJOperator.h"
+#include "gtest/gtest.h"
+#include "Include.h"
+#include <filesystem>
+#include <fstream>
+
+using namespace Ambit;
+
+namespace
+{
+    /** EMCalculator with the internals of TransitionCalculator made public for testing. */
+    class TestEMCalculator: public EMCalculator
+    {
+    public:
+        using EMCalculator::EMCalculator;
+        using TransitionCalculator::FrequencyTransition;
+        using TransitionCalculator::CalculateByFrequency;
+        using TransitionCalculator::SetOperatorFrequency;
+        using TransitionCalculator::CalculateTransition;
+        using TransitionCalculator::CalculateAllLines;
+
+        pTransitionIntegrals GetIntegrals() const { return integrals; }
+        double GetScale() const { return scale; }
+    };
+
+    /** TransitionCalculator without operator or levels, for FrequencyGroups(). */
+    class GroupingCalculator: public TransitionCalculator
+    {
+    public:
+        GroupingCalculator(MultirunOptions& user_input): TransitionCalculator(user_input, nullptr, nullptr) {}
+        using TransitionCalculator::FrequencyGroups;
+
+    protected:
+        virtual void PrintHeader() const override {}
+        virtual void PrintTransition(const LevelID&, const LevelID&, double) const override {}
+    };
+
+    /** MgI in a small basis with levels of symmetries 0e and 2o (connected by E1). */
+    std::string MgInput(const std::filesystem::path& directory, const std::string& transition_options)
+    {
+        return std::string() +
+            "-c\n" +
+            "Z = 12\n" +
+            "AngularDataDirectory = " + (directory / "angular").string() + "\n" +
+            "[Lattice]\n" +
+            "NumPoints = 1000\n" +
+            "StartPoint = 1.e-6\n" +
+            "EndPoint = 50.\n" +
+            "[HF]\n" +
+            "N = 11\n" +
+            "Configuration = '1s2 2s2 2p6 : 3s1'\n" +
+            "[Basis]\n" +
+            "--bspline-basis\n" +
+            "ValenceBasis = 5spd\n" +
+            "FrozenCore = 2sp\n" +
+            "[CI]\n" +
+            "LeadingConfigurations = '3s2, 3s1 3p1'\n" +
+            "ElectronExcitations = 2\n" +
+            "NumSolutions = 3\n" +
+            "EvenParityTwoJ = '0'\n" +
+            "OddParityTwoJ = '2'\n" +
+            "[Transitions/E1]\n" +
+            transition_options;
+    }
+}
+
+TEST(TransitionsTester, FrequencyGroups)
+{
+    std::stringstream user_input_stream("FrequencyTolerance = 0.125\n");
+    MultirunOptions user_input(user_input_stream, "//", "\n", ",");
+    GroupingCalculator calculator(user_input);
+
+    // Groups extend to exactly the tolerance above their lowest frequency, but no further
+    std::vector<std::pair<double, double>> groups = calculator.FrequencyGroups({0.5, 0.375, 0.25, -0.125, 0.3751, 0.625, 0.});
+    ASSERT_EQ(4, groups.size());
+    EXPECT_EQ(std::make_pair(-0.125, 0.), groups[0]);
+    EXPECT_EQ(std::make_pair(0.25, 0.375), groups[1]);
+    EXPECT_EQ(std::make_pair(0.3751, 0.5), groups[2]);
+    EXPECT_EQ(std::make_pair(0.625, 0.625), groups[3]);
+
+    // Equal frequencies are always together
+    groups = calculator.FrequencyGroups({0.25, 0.25});
+    ASSERT_EQ(1, groups.size());
+    EXPECT_EQ(std::make_pair(0.25, 0.25), groups[0]);
+}
+
+TEST(TransitionsTester, InterpolateFrequency)
+{
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "TransitionsInterpolateTest";
+    std::filesystem::create_directories(directory / "angular");
+
+    // All lines in one group, interpolated between its ends
+    std::stringstream user_input_stream(MgInput(directory, "FrequencyTolerance = 10.\n--interpolate-frequency\n"));
+    MultirunOptions user_input(user_input_stream, "//", "\n", ",");
+
+    Atom atom(user_input, 12, (directory / "MgI").string());
+    atom.MakeBasis();
+    pLevelStore levels = atom.ChooseHamiltoniansAndRead();
+    std::vector<pHamiltonianID> keys(levels->begin(), levels->end());
+    ASSERT_EQ(2, keys.size());
+    atom.CalculateEnergies(keys);
+
+    user_input.set_prefix("Transitions/E1");
+    TestEMCalculator calculator(MultipolarityType::E, 1, user_input, atom);
+
+    LevelVector left_levels = levels->GetLevels(keys[0]);
+    LevelVector right_levels = levels->GetLevels(keys[1]);
+    pTransitionDensityConst density = std::make_shared<TransitionDensity>(left_levels, right_levels, 1);
+
+    std::vector<TestEMCalculator::FrequencyTransition> transitions;
+    for(unsigned int i = 0; i < left_levels.levels.size(); i++)
+        for(unsigned int j = 0; j < right_levels.levels.size(); j++)
+        {
+            TestEMCalculator::FrequencyTransition transition;
+            transition.frequency = left_levels.levels[i]->GetEnergy() - right_levels.levels[j]->GetEnergy();
+            transition.density = density;
+            transition.index = i * right_levels.levels.size() + j;
+            transition.id = std::make_pair(std::make_pair(keys[0], int(i)), std::make_pair(keys[1], int(j)));
+            transitions.push_back(transition);
+        }
+    ASSERT_EQ(9, transitions.size());
+
+    calculator.CalculateByFrequency(transitions);
+
+    // Sorted by frequency: at both ends of the group the interpolation is a direct solution
+    ASSERT_LT(transitions.front().frequency + 1.e-3, transitions.back().frequency);
+    for(const auto* transition: {&transitions.front(), &transitions.back()})
+    {
+        calculator.SetOperatorFrequency(transition->frequency);
+        double direct = density->GetMatrixElement(*calculator.GetIntegrals())[transition->index]/calculator.GetScale();
+        EXPECT_NEAR(direct, transition->value, 1.e-10 * mmax(1., fabs(direct)));
+    }
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST(TransitionsTester, AllLines)
+{
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "TransitionsAllLinesTest";
+    std::filesystem::create_directories(directory / "angular");
+
+    // RPA at each line's own frequency, as for single transitions
+    std::stringstream user_input_stream(MgInput(directory, "--rpa\n"));
+    MultirunOptions user_input(user_input_stream, "//", "\n", ",");
+
+    Atom atom(user_input, 12, (directory / "MgI").string());
+    atom.MakeBasis();
+    pLevelStore levels = atom.ChooseHamiltoniansAndRead();
+    std::vector<pHamiltonianID> keys(levels->begin(), levels->end());
+    ASSERT_EQ(2, keys.size());
+    atom.CalculateEnergies(keys);
+
+    user_input.set_prefix("Transitions/E1");
+    std::filesystem::path filepath = directory / "lines.csv";
+    {   TestEMCalculator calculator(MultipolarityType::E, 1, user_input, atom);
+        calculator.CalculateAllLines(filepath.string(), false);
+    }
+
+    // Line strengths S as printed for each transition calculated on its own
+    std::ostringstream output;
+    std::ostream* stored_outstream = outstream;
+    outstream = &output;
+    {   TestEMCalculator calculator(MultipolarityType::E, 1, user_input, atom);
+        LevelVector left_levels = levels->GetLevels(keys[0]);
+        LevelVector right_levels = levels->GetLevels(keys[1]);
+        for(unsigned int i = 0; i < left_levels.levels.size(); i++)
+            for(unsigned int j = 0; j < right_levels.levels.size(); j++)
+                calculator.CalculateTransition(std::make_pair(keys[0], int(i)), std::make_pair(keys[1], int(j)));
+    }
+    outstream = stored_outstream;
+
+    std::map<std::string, double> printed;
+    std::istringstream printed_lines(output.str());
+    std::string line;
+    while(std::getline(printed_lines, line))
+    {
+        std::size_t equals = line.find(" = ");
+        if(line.find(" -> ") != std::string::npos && equals != std::string::npos)
+        {   std::string names = line.substr(0, equals);
+            names.erase(0, names.find_first_not_of(' '));
+            names.replace(names.find(" -> "), 4, ",");
+            printed[names] = std::stod(line.substr(equals + 3));
+        }
+    }
+    ASSERT_EQ(9, printed.size());
+
+    // Every line in the file (after the header) matches the printed S
+    std::ifstream file(filepath);
+    ASSERT_TRUE(std::getline(file, line));
+    EXPECT_EQ("left,right,E_left,E_right,S,A,gf", line);
+
+    unsigned int num_lines = 0;
+    while(std::getline(file, line))
+    {
+        std::vector<std::string> fields;
+        std::istringstream line_stream(line);
+        std::string field;
+        while(std::getline(line_stream, field, ','))
+            fields.push_back(field);
+        ASSERT_EQ(7, fields.size());
+
+        auto it = printed.find(fields[0] + "," + fields[1]);
+        ASSERT_NE(printed.end(), it) << line;
+        double S = std::stod(fields[4]);
+        EXPECT_NEAR(it->second, S, 1.e-5 * mmax(1.e-8, fabs(S))) << line;
+        num_lines++;
+    }
+    EXPECT_EQ(printed.size(), num_lines);
+
+    std::filesystem::remove_all(directory);
+}
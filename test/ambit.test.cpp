@@ -4,6 +4,7 @@
 #include "Include.h"
 #include "Atom/OutStreams.h"
 #include "gitInfo.h"
+#include "Universal/Communicator.h"
 #include "Universal/Enums.h"
 #include "Atom/GetPot"
 #include <boost/math/special_functions/bessel.hpp>
@@ -48,6 +49,7 @@ int main(int argc, char* argv[])
         NumProcessors = 1;
         ProcessorRank = 0;
     #endif
+    SetProcessGroup(Communicator::World());
     
     OutStreams::InitialiseStreams();
     outstream = logstream;